@@ -0,0 +1,137 @@
+//------------------------------------------------------------------------------
+//       Filename: board.h
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Describes the hardware variants, see PCB/
+//------------------------------------------------------------------------------
+//       Notes : Select the variant with CONFIG_BOARD. Each one gives its
+//               component values and pins, everything the firmware derives
+//               from them is computed here at compile time, including the
+//               fixed-point reciprocals that keep the conversions free of
+//               divisions (the CH32V003 has no divide instruction).
+//               Preprocessor only, usb_config.h includes this from assembly.
+//------------------------------------------------------------------------------
+#pragma once
+
+//------------------------------------------------------------------------------
+// Module exported defines
+//------------------------------------------------------------------------------
+#define BOARD_MKI  (1)
+#define BOARD_MKII (2)
+
+#ifndef CONFIG_BOARD
+#define CONFIG_BOARD BOARD_MKII
+#endif
+
+#if CONFIG_BOARD == BOARD_MKI
+
+#define BOARD_NAME "MkI"
+
+// Output divider, R2 / R4, in 100 Ohm units
+#define BOARD_FEEDBACK_RF  (390)
+#define BOARD_FEEDBACK_RIN (100)
+
+// Shunt R5 and the op-amp feedback R7 / R6, in Ohms
+#define BOARD_SHUNT_MILLIOHMS (333)
+#define BOARD_OPA_RF          (2000)
+#define BOARD_OPA_RIN         (220)
+
+// Highest duty before the SRF1260 and B2100 run out of margin
+#define BOARD_MAX_DUTY (250)
+
+#elif CONFIG_BOARD == BOARD_MKII
+
+#define BOARD_NAME "MkII"
+
+// Output divider, R5 / R6, in 100 Ohm units
+#define BOARD_FEEDBACK_RF  (390)
+#define BOARD_FEEDBACK_RIN (100)
+
+// Shunt R9 and the op-amp feedback R7 / R8, in Ohms
+#define BOARD_SHUNT_MILLIOHMS (330)
+#define BOARD_OPA_RF          (2000)
+#define BOARD_OPA_RIN         (220)
+
+// Highest duty before the SRF1260 and SS34 run out of margin
+#define BOARD_MAX_DUTY (250)
+
+#else
+#error "Unknown CONFIG_BOARD, see board.h"
+#endif
+
+// Pins, the same on both boards
+// PWM_OUT  = PC0 = T1CH3
+// FEEDBACK = PD6 = A6
+// CURRENT  = PD4 = A7 (OPA output), PA2 is OPA+, PA1 is OPA-
+#define BOARD_PWM_PIN          (0) // GPIOC
+#define BOARD_FEEDBACK_PIN     (6) // GPIOD
+#define BOARD_CURRENT_PIN      (4) // GPIOD
+#define BOARD_OPA_NEG_PIN      (1) // GPIOA
+#define BOARD_OPA_POS_PIN      (2) // GPIOA
+#define BOARD_FEEDBACK_CHANNEL (6)
+#define BOARD_CURRENT_CHANNEL  (7)
+
+#define BOARD_USB_PORT    C
+#define BOARD_USB_PIN_DP  (4)
+#define BOARD_USB_PIN_DM  (3)
+#define BOARD_USB_PIN_DPU (2)
+
+//------------------------------------------------------------------------------
+// Derived constants
+//------------------------------------------------------------------------------
+#define BOARD_ADC_MAX       (1 << 10)
+#define BOARD_FEEDBACK_RT   (BOARD_FEEDBACK_RF + BOARD_FEEDBACK_RIN)
+#define BOARD_FEEDBACK_NORM (BOARD_FEEDBACK_RIN * BOARD_ADC_MAX)
+
+// Op-amp gain in Q4, 1 + Rf / Rin
+#define BOARD_OPA_GAIN_Q4 ((16 * (BOARD_OPA_RIN + BOARD_OPA_RF)) / BOARD_OPA_RIN)
+
+// Counts per mV in Q16 at 1mV of VDD, divided by VDD in mV at run time
+#define BOARD_COUNTS_PER_MV_SHIFT (16)
+#define BOARD_COUNTS_PER_MV_NUM                                                                                       \
+    ((uint32_t)(((uint64_t)BOARD_FEEDBACK_NORM << BOARD_COUNTS_PER_MV_SHIFT) / BOARD_FEEDBACK_RT))
+
+// mV per count in Q8 is VDD * Rt / (Rin * ADC_MAX), the divide is this
+// multiplier in Q19, good to VDD = 6.5V
+#define BOARD_MV_PER_COUNT_SHIFT (8)
+#define BOARD_MV_PER_COUNT_MUL_SHIFT (19)
+#define BOARD_MV_PER_COUNT_MUL                                                                                        \
+    ((uint32_t)((((uint64_t)BOARD_FEEDBACK_RT << (BOARD_MV_PER_COUNT_SHIFT + BOARD_MV_PER_COUNT_MUL_SHIFT)) +          \
+                 BOARD_FEEDBACK_NORM / 2) /                                                                           \
+                BOARD_FEEDBACK_NORM))
+
+// (Rin * ADC_MAX / 64) / Rt in Q11, for the power target, see
+// BoostPWM_SetPowerTarget()
+#define BOARD_POWER_SCALE_SHIFT (11)
+#define BOARD_POWER_SCALE                                                                                             \
+    ((uint32_t)((((uint64_t)(BOARD_FEEDBACK_NORM / 64) << BOARD_POWER_SCALE_SHIFT) + BOARD_FEEDBACK_RT / 2) /        \
+                BOARD_FEEDBACK_RT))
+
+// The firmware takes the current as 1mA per count and leaves the rest to the
+// current trim, this is the actual figure at VDD = 3.3V in Q16
+#define BOARD_MA_PER_COUNT_Q16                                                                                        \
+    ((uint32_t)(((uint64_t)3300 * 1000 * 16 << 16) / BOARD_ADC_MAX / (BOARD_SHUNT_MILLIOHMS * BOARD_OPA_GAIN_Q4)))
+
+#ifndef __ASSEMBLER__
+#include <stdint.h>
+
+// Checks of the derived constants against the exact values
+_Static_assert(BOARD_OPA_GAIN_Q4 == 161, "op-amp gain");
+_Static_assert((uint64_t)6500 * BOARD_MV_PER_COUNT_MUL <= UINT32_MAX, "mV per count multiplier overflows");
+_Static_assert((uint64_t)BOARD_MV_PER_COUNT_MUL * BOARD_FEEDBACK_NORM >
+                       ((uint64_t)BOARD_FEEDBACK_RT << (BOARD_MV_PER_COUNT_SHIFT + BOARD_MV_PER_COUNT_MUL_SHIFT)) -
+                           BOARD_FEEDBACK_NORM &&
+                   (uint64_t)BOARD_MV_PER_COUNT_MUL * BOARD_FEEDBACK_NORM <
+                       ((uint64_t)BOARD_FEEDBACK_RT << (BOARD_MV_PER_COUNT_SHIFT + BOARD_MV_PER_COUNT_MUL_SHIFT)) +
+                           BOARD_FEEDBACK_NORM,
+               "mV per count multiplier is not the rounded reciprocal");
+// The power target is below 2^19 before scaling for VDD over 1.8V
+_Static_assert((uint64_t)BOARD_POWER_SCALE * 0x80000 <= UINT32_MAX, "power scale overflows");
+_Static_assert(BOARD_MA_PER_COUNT_Q16 > 65536 * 90 / 100 && BOARD_MA_PER_COUNT_Q16 < 65536 * 110 / 100,
+               "current is not ~1mA per count, beyond what the trim corrects");
+#endif
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
@@ -5,42 +5,173 @@
 //------------------------------------------------------------------------------
 //       Purpose : Implements the Boost Converter API
 //------------------------------------------------------------------------------
-//       Notes : None
-//------------------------------------------------------------------------------
-//
-// PWM_OUT = PC0 = T1CH3
-// FEEDBACK = PD6 = A6
-// CURRENT = PD4 = A7
-//
+//       Notes : The pins and the analog front end are described in board.h
 //------------------------------------------------------------------------------
 // Module includes
 //------------------------------------------------------------------------------
+#include "board.h"
 #include "boost.h"
-#include "ch32v003fun.h"
+#include "charger.h"
+#include "fra.h"
+#include "hal.h"
 #include "log.h"
+#include "profile.h"
+#include "trace.h"
 
 //------------------------------------------------------------------------------
 // Module constant defines
 //------------------------------------------------------------------------------
 #define TAG "boost"
 
-// Feedback Resistors in 10 Ohm units
-#define Rf  390
-#define Rin 100
-#define Rt  (Rf + Rin)
-
 #define INTERNAL_VREF  1200
 #define ADC_RESOLUTION 10
 #define ADC_MAX        (1 << ADC_RESOLUTION)
 
 #define MIN_DUTY    0
-#define MAX_DUTY    250
+#define MAX_DUTY    BOARD_MAX_DUTY
 #define ADC_SAMPLES (3)
 
-// PID terms
-#define KP(eP) ((eP) >> 0)
-#define KD(eD) ((eD) >> 3)
-#define KI(eI) ((eI) >> 6)
+// TIM1 runs at HCLK / PWM_PRESCALER and triggers one control cycle per period
+#define PWM_PRESCALER   (2)
+#define PWM_PERIOD      (255 + 10 + 1)
+#define CONTROL_LOOP_HZ (FUNCONF_SYSTEM_CORE_CLOCK / (PWM_PRESCALER * PWM_PERIOD))
+#define MS_TO_SAMPLES(ms) ((ms) * (CONTROL_LOOP_HZ / 1000))
+#define SAMPLES_TO_US(n)  ((n) * 1000 / (CONTROL_LOOP_HZ / 1000))
+
+// The current is the amplified shunt voltage on the OPA output, ~1mA/LSB.
+// The reported current averages (1 << OVERSAMPLE_SHIFT) samples (~2.8ms) in
+// Q8, the switching ripple and noise dither the ADC so the average resolves
+// well below a count at low currents.
+#define ISENSE_CHANNEL   BOARD_CURRENT_CHANNEL
+#define VREF_CHANNEL     (8)
+#define OVERSAMPLE_SHIFT (8)
+
+static_assert(OVERSAMPLE_SHIFT == 8, "The oversampled sum is taken as Q8");
+
+// Injected sequence, the current channel alone or followed by VRef. Either
+// way the current ends up in IDATAR1.
+// NOTE: See note in 9.3.12 (ADC_ISQR) of TRM. The group numbers is actually 4-group numbers.
+#define ADC_ISQR(ich)      ((ich) << 15)
+#define ADC_ISQR_VREF(ich) ((VREF_CHANNEL << 15) | ((ich) << 10) | (1 << 20))
+
+// VRef is sampled every VREF_DIVIDER cycles and low-pass filtered in Q8, the
+// conversion factors are only rederived when it moves by over half a count
+#define VREF_DIVIDER           (16)
+#define VREF_SHIFT             (8)
+#define VREF_FILTER_SHIFT      (4)
+#define VREF_PUBLISH_THRESHOLD (1 << (VREF_SHIFT - 1))
+
+// Conversion factors, mV per count in Q8 and counts per mV in Q16, see board.h
+#define MV_PER_COUNT_SHIFT  BOARD_MV_PER_COUNT_SHIFT
+#define COUNTS_PER_MV_SHIFT BOARD_COUNTS_PER_MV_SHIFT
+#define COUNTS_PER_MV_NUM   BOARD_COUNTS_PER_MV_NUM
+
+// Per unit gain trims, 1 + trim / 2^16, correcting the divider and VRef
+// tolerance for the voltage and the shunt and op-amp gain for the current
+#define TRIM_SHIFT (16)
+#define TRIM_ONE   (1 << TRIM_SHIFT)
+
+// Current offset calibration window, in ADC samples (~90kHz)
+#define CALIBRATION_SETTLE  (32)
+#define CALIBRATION_SHIFT   (8)
+#define CALIBRATION_SAMPLES (CALIBRATION_SETTLE + (1 << CALIBRATION_SHIFT))
+
+// Background offset recalibration while the output is off. Only runs with
+// the output back at the idle voltage, as a charged output capacitor feeds
+// any load, and rejects averages that step or drift from the boot offset by
+// more than a sensor drift can, which is load current through the diode.
+#define RECAL_SETTLE     MS_TO_SAMPLES(5)
+#define RECAL_SHIFT      (10)
+#define RECAL_SAMPLES    (RECAL_SETTLE + (1 << RECAL_SHIFT))
+#define RECAL_MAX_STEP   (8)
+#define RECAL_MAX_DRIFT  (16)
+#define RECAL_IDLE_SHIFT (5) // Within 1/32 of the idle output voltage
+
+// Warm start is only used if the idle (zero duty) output voltage, which
+// follows the input voltage, is within 1/16th of the saved one
+#define WARM_START_INPUT_TOLERANCE(raw) ((raw) >> 4)
+// Largest voltage error, in ADC counts, for the loop to be considered settled
+#define WARM_START_MAX_ERROR (4)
+
+// Soft start, the voltage reference rises from the output voltage by this
+// many counts per control cycle (~5.7V/ms), after a start and on a raised
+// target, so the integrator can not wind up while the output capacitor charges
+#define SOFT_START_STEP (4)
+
+// PID terms, the shifts can be tuned at runtime
+#ifndef CONFIG_PID_KP_SHIFT
+#define CONFIG_PID_KP_SHIFT 0
+#endif
+#ifndef CONFIG_PID_KD_SHIFT
+#define CONFIG_PID_KD_SHIFT 0
+#endif
+#ifndef CONFIG_PID_KI_SHIFT
+#define CONFIG_PID_KI_SHIFT 6
+#endif
+static_assert(CONFIG_PID_KP_SHIFT <= BOOST_PID_KP_SHIFT_MAX, "CONFIG_PID_KP_SHIFT out of range");
+static_assert(CONFIG_PID_KD_SHIFT <= BOOST_PID_KD_SHIFT_MAX, "CONFIG_PID_KD_SHIFT out of range");
+static_assert(CONFIG_PID_KI_SHIFT >= BOOST_PID_KI_SHIFT_MIN && CONFIG_PID_KI_SHIFT <= BOOST_PID_KI_SHIFT_MAX,
+              "CONFIG_PID_KI_SHIFT out of range");
+
+#define KP(eP) ((eP) >> s_gains.kpShift)
+#define KD(eD) ((eD) >> s_gains.kdShift)
+#define KI(eI) ((eI) >> s_gains.kiShift)
+
+// The PID's current error, halved to share the voltage loop's gains. A mA
+// count is a far smaller step than a feedback count, into a low impedance
+// load, such as an LED string, the full error rings the CC loop.
+#define PID_CURRENT_ERROR(e) ((e) / 2)
+
+// Cascaded controller terms, outer loop gives mA per voltage count,
+// inner loop gives duty per mA. Tuned on the loadstep simulation, the inner
+// loop acts on the output current so the outer loop has to run every sample
+// with a high gain to hold the voltage on load steps, every 2nd or 4th
+// doubles the dip and fails CR regulation.
+#define CASCADE_KVP(eV)       ((eV) * 64)
+#define CASCADE_KVI_SHIFT     (3)
+#define CASCADE_KVI(eI)       ((eI) >> CASCADE_KVI_SHIFT)
+#define CASCADE_KIP(eI)       ((eI) >> 3)
+#define CASCADE_KII_SHIFT     (8)
+
+// Short circuit response
+#define FOLDBACK_SHIFT           (8)
+#define HICCUP_DEBOUNCE          (64)
+#define HICCUP_LIMIT_SHIFT       (2) // Current limiting within 1/4 of the limit
+#define HICCUP_MAX_BACKOFF_SHIFT (5)
+#define HICCUP_RECOVERY          MS_TO_SAMPLES(1000)
+
+// Averaged measurements wait for the error to stay within tolerance for
+// MEASURE_SETTLE samples, or for MEASURE_TIMEOUT, before averaging
+#define MEASURE_SETTLE            MS_TO_SAMPLES(1)
+#define MEASURE_TIMEOUT           MS_TO_SAMPLES(50)
+#define MEASURE_SHIFT             (8)
+#define MEASURE_MAX_ERROR         WARM_START_MAX_ERROR
+#define MEASURE_CURRENT_TOLERANCE (8)
+
+// Voltage step response, settled once within tolerance for STEP_HOLD, the
+// ripple is then taken over STEP_RIPPLE
+#define STEP_TOLERANCE WARM_START_MAX_ERROR
+#define STEP_HOLD      MS_TO_SAMPLES(1)
+#define STEP_TIMEOUT   MS_TO_SAMPLES(50)
+#define STEP_RIPPLE    MS_TO_SAMPLES(2)
+#define STEP_UNSETTLED (0xffff)
+
+// 1ms decimated measurements, averaged with a Q16 reciprocal multiply
+#define DECIMATE_SAMPLES    MS_TO_SAMPLES(1)
+#define DECIMATE_SHIFT      (16)
+#define DECIMATE_RECIPROCAL ((1 << DECIMATE_SHIFT) / DECIMATE_SAMPLES)
+
+// Source resistance fixed-point scale, mOhm * (1 << RESISTANCE_SHIFT) *
+// (Rin * ADC_MAX) / (1000 * Rt), divided by VDD in mV at run time
+#define RESISTANCE_SHIFT (12)
+#define RESISTANCE_SCALE (((1 << RESISTANCE_SHIFT) * BOARD_FEEDBACK_NORM) / (1000 * BOARD_FEEDBACK_RT))
+
+static_assert((uint64_t)CONFIG_RESISTANCE_LIMIT * RESISTANCE_SCALE <= UINT32_MAX,
+              "CONFIG_RESISTANCE_LIMIT overflows BoostPWM_SetSourceResistance()");
+
+#ifndef CONFIG_BOOST_CONTROLLER
+#define CONFIG_BOOST_CONTROLLER eBOOST_CONTROLLER_PID
+#endif
 
 #ifndef min
 #define min(a, b) (((a) < (b)) ? (a) : (b))
@@ -64,35 +195,152 @@
 //------------------------------------------------------------------------------
 // Module type definitions
 //------------------------------------------------------------------------------
+typedef struct
+{
+    uint32_t vddMillivolts;
+    uint32_t millivoltsPerCount;  // Q(MV_PER_COUNT_SHIFT)
+    uint32_t countsPerMillivolt;  // Q(COUNTS_PER_MV_SHIFT)
+} VoltageScale_t;
 
 //------------------------------------------------------------------------------
 // Module static variables
 //------------------------------------------------------------------------------
 static uint16_t s_feedbackVRaw = 0;
 static uint16_t s_feedbackIRaw = 0;
+static int s_current = 0;
+static volatile int32_t s_currentQ8 = 0; // Oversampled current, see OVERSAMPLE_SHIFT
 static int16_t s_currentOffset = 0;
 static uint16_t s_vref = 0;
+static bool s_vrefSampled = true;
+static uint8_t s_vrefCount = 0;
+static uint32_t s_vrefFiltered = 0;
+static volatile uint32_t s_vrefPublished = 0;
+
+// Conversion factors derived from the published VRef in the main loop, into
+// the set not in use, then swapped in by flipping the index
+static VoltageScale_t s_scales[2] = {0};
+static volatile uint8_t s_scaleIndex = 0;
+static uint32_t s_scaleVRef = 0;
+static volatile int16_t s_voltageTrim = 0;
+static volatile uint32_t s_milliampsPerCount = TRIM_ONE;
+static volatile uint32_t s_countsPerMilliamp = TRIM_ONE;
 static uint8_t s_pwmDuty = 0;
 static uint8_t s_ccMode = 0;
 static volatile uint32_t s_targetVRaw = 0;
 static volatile uint32_t s_targetIRaw = 0;
+static volatile uint32_t s_targetPRaw = 0;
+static volatile uint32_t s_resistanceRaw = 0;
+static volatile BoostMode_e s_mode = eBOOST_MODE_CV;
+
+// Short circuit response
+static volatile BoostFaultMode_e s_faultMode = eBOOST_FAULT_NONE;
+static volatile uint16_t s_faultKneeRaw = 0;
+static volatile uint16_t s_foldbackFloorRaw = 0;
+static volatile uint32_t s_foldbackSlope = 0;
+static volatile uint32_t s_hiccupRetry = 0;
+static uint32_t s_hiccupBackoff = 0;
+static volatile uint32_t s_hiccupTimer = 0;
+static uint32_t s_hiccupHealthy = 0;
+static uint16_t s_shortCount = 0;
+static volatile uint16_t s_faultCount = 0;
+static volatile uint16_t s_calibrationCount = 0;
+static uint16_t s_idleVRaw = 0;
+static int16_t s_bootOffset = 0;
+static uint16_t s_recalCount = 0;
+static uint32_t s_recalSum = 0;
+static volatile uint16_t s_recalibrations = 0;
+
+// Controller state
+static volatile BoostController_e s_controller = CONFIG_BOOST_CONTROLLER;
+static int s_error = 0;
+static int s_lastEP = 0;
+static int s_eI = 0;
+static int s_outerI = 0;
+static int s_innerI = 0;
+static uint16_t s_softStartVRaw = 0; // Ramping voltage reference, see SOFT_START_STEP
+static volatile BoostPidGains_t s_gains = {
+    .kpShift = CONFIG_PID_KP_SHIFT,
+    .kdShift = CONFIG_PID_KD_SHIFT,
+    .kiShift = CONFIG_PID_KI_SHIFT,
+};
+
+// Step response of the last voltage target change
+static volatile bool s_stepActive = false;
+static volatile bool s_stepComplete = false;
+static bool s_stepRising = false;
+static uint16_t s_stepSamples = 0;
+static uint16_t s_stepInBand = 0;
+static volatile uint16_t s_stepSettledAt = 0;
+static volatile uint16_t s_stepOvershoot = 0;
+static uint16_t s_stepRippleStart = 0;
+static volatile uint16_t s_stepRippleMin = 0;
+static volatile uint16_t s_stepRippleMax = 0;
+
+// Warm start operating point, applied once the calibration completes
+static volatile bool s_warmStartPending = false;
+static volatile bool s_warmStarted = false;
+static int s_warmStartEI = 0;
+static uint8_t s_warmStartDuty = 0;
+static uint16_t s_warmStartInputRaw = 0;
+
+// Output gate, the setpoints and PID state are kept while it is off
+static volatile bool s_outputEnabled = true;
+static volatile bool s_turnOnPending = false;
+static uint32_t s_turnOnStart = 0;
+static volatile uint32_t s_turnOnTicks = 0;
+
+// Averaged measurement, run from the control loop
+static volatile bool s_measureActive = false;
+static uint16_t s_measureSettled = 0;
+static uint16_t s_measureWait = 0;
+static uint16_t s_measureCount = 0;
+static uint32_t s_measureVSum = 0;
+static int32_t s_measureISum = 0;
+
+#if CONFIG_ENABLE_CHARGER
+// 1ms decimation
+static uint16_t s_decimateCount = 0;
+static uint32_t s_decimateVSum = 0;
+static int32_t s_decimateISum = 0;
+#endif
 
 //------------------------------------------------------------------------------
 // Module static function prototypes
 //------------------------------------------------------------------------------
+static void FilterVRef(void);
+static void UpdateScale(void);
 static int GetVRefMillivolts(void);
 static uint16_t GetVoltageMillivolts(void);
+static uint16_t RawToMillivolts(uint16_t raw);
 static uint16_t MillivoltsToADC(uint32_t millivolts);
-static uint16_t GetCurrentMilliamps(void);
+static uint32_t GetCurrentMilliampsQ8(void);
 static uint16_t MilliampsToADC(uint32_t milliamps);
+static uint16_t CountsToMilliamps(int counts);
 
 static void SetupOpAmp(void);
 static void SetupADC(void);
 
-static void BoostControllerPID(void);
+static void BoostControl(void);
+static int BoostControllerPID(void);
+static int BoostControllerCascade(void);
+static void ResetState(void);
+static int GetVoltageReference(int current);
+static int GetPowerError(int current);
+static int GetCurrentLimit(void);
+static bool HiccupCheck(void);
+static void UpdateFoldback(void);
 static void SetDuty(uint8_t duty);
 
-static void Calibrate(void);
+static void UpdateCurrent(void);
+static void CalibrateSample(void);
+static void RecalibrateSample(void);
+static void ApplyWarmStart(void);
+static void MeasureSample(void);
+static void DecimateSample(void);
+static void StepSample(void);
+#if CONFIG_ENABLE_TRACE
+static void SaveSeed(TraceSeed_t *seed);
+#endif
 
 //------------------------------------------------------------------------------
 // Module externally exported functions
@@ -108,13 +356,17 @@ void BoostPWM_Init(void)
 
     SetupADC();
 
+#if CONFIG_ENABLE_FRA
+    FRA_Init(CONTROL_LOOP_HZ);
+#endif
+
     RCC->APB2PCENR |= RCC_APB2Periph_TIM1 | RCC_APB2Periph_AFIO | RCC_APB2Periph_GPIOC;
 
     AFIO->PCFR1 |= GPIO_PartialRemap1_TIM1;
 
     // PC0 is T1CH3, 10MHz Output alt func, push-pull
-    GPIOC->CFGLR &= ~(0xf << (0 << 2));
-    GPIOC->CFGLR |= (GPIO_Speed_10MHz | GPIO_CNF_OUT_PP_AF) << (0 << 2);
+    GPIOC->CFGLR &= ~(0xf << (BOARD_PWM_PIN << 2));
+    GPIOC->CFGLR |= (GPIO_Speed_10MHz | GPIO_CNF_OUT_PP_AF) << (BOARD_PWM_PIN << 2);
 
     // Reset TIM1 to init all regs
     RCC->APB2PRSTR |= RCC_APB2Periph_TIM1;
@@ -124,10 +376,10 @@ void BoostPWM_Init(void)
     // SMCFGR: default clk input is CK_INT
 
     // Prescaler
-    TIM1->PSC = 0x0001;
+    TIM1->PSC = PWM_PRESCALER - 1;
 
     // Auto Reload - sets period
-    TIM1->ATRLR = 255 + 10;
+    TIM1->ATRLR = PWM_PERIOD - 1;
 
     // Reload immediately
     TIM1->SWEVGR |= TIM_UG;
@@ -152,19 +404,37 @@ void BoostPWM_Init(void)
     // Enable TIM1
     TIM1->CTLR1 |= TIM_CEN;
 
-    Calibrate();
+    // Wait for the first conversion so VRef is valid for target conversions.
+    // The current offset calibration then carries on in the ADC IRQ.
+    while (s_calibrationCount == 0)
+    {
+        HAL_Yield();
+    }
+    UpdateScale();
 
 #if 0
 
     LOGD(TAG, "VRef: (%d) %dmV", s_vref, GetVRefMillivolts());
     LOGD(TAG, "Vout: (%d) %dmV", s_feedbackRaw, GetVoltageMillivolts());
-    LOGD(TAG, "Current: (%d) %dmA", s_current, GetCurrentMilliamps());
+    LOGD(TAG, "Current: (%d) %dmA", s_current, GetCurrentMilliampsQ8() >> 8);
     LOGD(TAG, "Target: %d", s_targetADC);
     puts("");
     Delay_Ms(1000);
 #endif
 }
 
+/**
+ * @brief  Background work of the boost converter, call from the main loop
+ * @param  None
+ * @return None
+ * @note   Rederives the voltage conversion factors once the filtered VRef
+ *         has moved, so the divisions stay out of the ADC IRQ.
+ */
+void BoostPWM_Task(void)
+{
+    UpdateScale();
+}
+
 /**
  * @brief  Set the target voltage for the boost converter
  * @param millivolts - The target voltage in millivolts
@@ -172,7 +442,22 @@ void BoostPWM_Init(void)
  */
 void BoostPWM_SetVoltageTarget(uint32_t millivolts)
 {
-    s_targetVRaw = MillivoltsToADC(millivolts);
+    const uint16_t target = MillivoltsToADC(millivolts);
+    if (target == s_targetVRaw)
+    {
+        return;
+    }
+
+    // Follow the step response of the new target
+    s_stepActive = false;
+    s_stepRising = target > s_targetVRaw;
+    s_stepSamples = 0;
+    s_stepInBand = 0;
+    s_stepSettledAt = 0;
+    s_stepOvershoot = 0;
+    s_stepComplete = false;
+    s_targetVRaw = target;
+    s_stepActive = true;
 }
 
 /**
@@ -190,256 +475,1352 @@ void BoostPWM_SetCurrentLimit(uint32_t milliamps)
     {
         s_targetIRaw = 0;
     }
+
+    UpdateFoldback();
 }
 
 /**
- * @brief  Get the state of the boost converter
- * @param[out] state - The state of the boost converter
+ * @brief  Configure the short circuit response
+ * @param  config - the fault response mode and thresholds
  * @return None
+ * @note   Settings are re-applied on every command, only what changed is
+ *         written so a running response is not interrupted and the hiccup
+ *         backoff is only restarted by a new retry time. Leaving hiccup
+ *         while the output is held off retries on the next sample.
  */
-void BoostPWM_GetState(BoostState_t *state)
+void BoostPWM_SetFaultConfig(const BoostFaultConfig_t *config)
 {
-    *state = (BoostState_t){
-        .voltage = GetVoltageMillivolts(),
-        .current = GetCurrentMilliamps(),
-        .duty = s_pwmDuty,
-        .ccMode = s_ccMode,
-    };
+    const uint16_t kneeRaw = MillivoltsToADC(config->kneeMillivolts);
+    const uint16_t floorRaw = MilliampsToADC(config->floorMilliamps);
+    const uint32_t retry = MS_TO_SAMPLES(config->retryMs);
+    const BoostFaultMode_e mode = (config->mode < eBOOST_FAULT_COUNT && kneeRaw) ? config->mode : eBOOST_FAULT_NONE;
+
+    if (kneeRaw != s_faultKneeRaw || floorRaw != s_foldbackFloorRaw)
+    {
+        s_faultKneeRaw = kneeRaw;
+        s_foldbackFloorRaw = floorRaw;
+        UpdateFoldback();
+    }
+
+    if (retry != s_hiccupRetry)
+    {
+        s_hiccupRetry = retry;
+        s_hiccupBackoff = retry;
+    }
+
+    if (mode != s_faultMode)
+    {
+        s_faultMode = mode;
+        if (mode != eBOOST_FAULT_HICCUP && s_hiccupTimer)
+        {
+            s_hiccupTimer = 1;
+        }
+    }
 }
 
 /**
- * @brief  ADC1 IRQ Handler
+ * @brief  Get the number of times the hiccup protection tripped
  * @param  None
- * @return None
+ * @return The number of trips since boot
  */
-void ADC1_IRQHandler(void) __attribute__((section(".srodata"))) __attribute__((interrupt));
-void ADC1_IRQHandler(void)
+uint16_t BoostPWM_GetFaultCount(void)
 {
-    // Values come in reverse order.
-    s_vref = ADC1->IDATAR2;
-    s_feedbackIRaw = ADC1->IDATAR1;
-
-    s_feedbackVRaw = ADC1->RDATAR;
-    BoostControllerPID();
-
-    // Acknowledge pending interrupts.
-    ADC1->STATR = 0;
+    return s_faultCount;
 }
 
-//------------------------------------------------------------------------------
-// Module static functions
-//------------------------------------------------------------------------------
+/**
+ * @brief  Check if the output is held off by the hiccup protection
+ * @param  None
+ * @return true while the output is off waiting for a retry
+ */
+bool BoostPWM_IsFaulted(void)
+{
+    return s_hiccupTimer != 0;
+}
 
 /**
- * @brief  Get the VRef voltage in millivolts
+ * @brief  Check if the current sensor calibration has completed
  * @param  None
- * @return The VRef voltage in millivolts
+ * @return true once the controller is regulating
  */
-static int GetVRefMillivolts(void)
+bool BoostPWM_IsCalibrated(void)
 {
-    return ((INTERNAL_VREF * ADC_MAX) / s_vref);
+    return s_calibrationCount >= CALIBRATION_SAMPLES;
 }
 
 /**
- * @brief  Get the output voltage in millivolts
+ * @brief  Get the current sensor offset
  * @param  None
- * @return The output voltage in millivolts
+ * @return The current sensor offset in ADC counts
  */
-static uint16_t GetVoltageMillivolts(void)
+int16_t BoostPWM_GetCurrentOffset(void)
 {
-    const int vref = GetVRefMillivolts();
-    return (s_feedbackVRaw * vref * Rt) / (Rin * ADC_MAX);
+    return s_currentOffset;
 }
 
 /**
- * @brief  Convert millivolts to ADC target value
- * @param  millivolts: target voltage in millivolts
- * @return The ADC target value
+ * @brief  Capture the settled operating point for a later warm start
+ * @param[out] warmStart - the operating point
+ * @return true if the loop is settled in CV mode and the point is valid
  */
-static uint16_t MillivoltsToADC(uint32_t millivolts)
+bool BoostPWM_GetWarmStart(BoostWarmStart_t *warmStart)
 {
-    return (millivolts * ADC_MAX * Rin) / (Rt * GetVRefMillivolts());
+    const int error = (int)s_targetVRaw - s_feedbackVRaw;
+    const bool settled = BoostPWM_IsCalibrated() && s_targetVRaw && !s_ccMode &&
+                         error <= WARM_START_MAX_ERROR && error >= -WARM_START_MAX_ERROR;
+
+    *warmStart = (BoostWarmStart_t){
+        .integrator = s_eI,
+        .inputMillivolts = settled ? RawToMillivolts(s_idleVRaw) : 0,
+        .duty = s_pwmDuty,
+        .valid = settled,
+    };
+
+    return settled;
 }
 
 /**
- * @brief  Get the current in milliamps
- * @param  None
- * @return The output current in milliamps
+ * @brief  Seed the controller from a saved operating point
+ * @param  warmStart - the operating point, applied once calibration completes
+ * @return None
+ * @note   Must be called after BoostPWM_Init(), the point is ignored if the
+ *         input conditions measured during calibration do not match.
  */
-static uint16_t GetCurrentMilliamps(void)
+void BoostPWM_SetWarmStart(const BoostWarmStart_t *warmStart)
 {
-    const int current = (int)s_feedbackIRaw - s_currentOffset;
-    if (current < 0)
+    if (!warmStart->valid || BoostPWM_IsCalibrated())
     {
-        return 0;
+        return;
     }
-    return (uint16_t)current;
+
+    s_warmStartEI = warmStart->integrator;
+    s_warmStartDuty = warmStart->duty;
+    s_warmStartInputRaw = MillivoltsToADC(warmStart->inputMillivolts);
+    s_warmStartPending = true;
 }
 
 /**
- * @brief  Convert milliamps to ADC target value
- * @param  milliamps: target current in milliamps
- * @return The ADC target value
+ * @brief  Check if the controller was seeded from a saved operating point
+ * @param  None
+ * @return true if the warm start was applied
  */
-static uint16_t MilliampsToADC(uint32_t milliamps)
+bool BoostPWM_IsWarmStarted(void)
 {
-    return (uint16_t)(milliamps + s_currentOffset);
+    return s_warmStarted;
 }
 
 /**
- * @brief  Set up the ADC for the voltage and current feedback
- * @param  None
+ * @brief  Enable or disable the output
+ * @param  enabled - true to switch the output on
  * @return None
+ * @note   Disabling only gates the PWM, the targets, the PID integrator and
+ *         the calibration are kept so re-enabling settles quickly.
  */
-static void SetupADC(void)
+void BoostPWM_SetOutputEnabled(bool enabled)
 {
-    // Configure ADC.
-    RCC->APB2PCENR |= RCC_APB2Periph_GPIOD | RCC_APB2Periph_ADC1;
-
-    // PD6 is analog input ch 6
-    GPIOD->CFGLR &= ~(0xf << (6 << 2)); // CNF = 00: Analog, MODE = 00: Input
-    // PD4 is analog input ch 7
-    GPIOD->CFGLR &= ~(0xf << (4 << 2)); // CNF = 00: Analog, MODE = 00: Input
+    if (enabled == s_outputEnabled)
+    {
+        return;
+    }
 
-    // Reset the ADC to init all regs
-    RCC->APB2PRSTR |= RCC_APB2Periph_ADC1;
-    RCC->APB2PRSTR &= ~RCC_APB2Periph_ADC1;
+    if (enabled)
+    {
+        s_lastEP = 0;
+        s_turnOnStart = HAL_GetTicks();
+        s_turnOnPending = true;
+    }
+    s_outputEnabled = enabled;
+}
 
-    // ADCCLK = 12 MHz => RCC_ADCPRE divide by 4
-    RCC->CFGR0 &= ~RCC_ADCPRE;     // Clear out the bis in case they were set
-    RCC->CFGR0 |= RCC_ADCPRE_DIV4; // set it to 010xx for /4.
+/**
+ * @brief  Check if the output is enabled
+ * @param  None
+ * @return true if the output is enabled
+ */
+bool BoostPWM_IsOutputEnabled(void)
+{
+    return s_outputEnabled;
+}
 
-    ADC1->RSQR1 = 0; // 1 channels in sequence
-    ADC1->RSQR2 = 0;
-    // Set up 1st conversion on ch6
-    // 0-9 for 8 ext inputs and two internals
-    ADC1->RSQR3 = (6 << 0);
+/**
+ * @brief  Drop the PID state so the next enable starts from zero duty
+ * @param  None
+ * @return None
+ * @note   Only takes effect while the output is disabled.
+ */
+void BoostPWM_ResetController(void)
+{
+    if (s_outputEnabled)
+    {
+        return;
+    }
 
-    // Injection group is 8. NOTE: See note in 9.3.12 (ADC_ISQR) of TRM. The
-    //  group numbers is actually 4-group numbers.
-    ADC1->ISQR = (8 << 15) | (7 << 10); // ch8 as first conversion, ch7 as second
-    ADC1->ISQR |= (1 << 20);            // set number of conversions to 1
+    ResetState();
+}
 
-    // Sampling time for channels. Careful: This has PID tuning implications.
-    // Note that with 3 and 3,the full loop (and injection) runs at 138kHz.
-    ADC1->SAMPTR2 = (ADC_SAMPLES << (3 * 7)) | (ADC_SAMPLES << (3 * 8)) | (ADC_SAMPLES << (3 * 1));
-    // 0:7 => 3/9/15/30/43/57/73/241 cycles
-    // (4 == 43 cycles), (6 = 73 cycles)  Note these are alrady /2, so
-    // setting this to 73 cycles actually makes it wait 256 total cycles @ 48MHz.
+/**
+ * @brief  Select the control algorithm
+ * @param  controller - the controller to use
+ * @return None
+ * @note   The controller state is reset, so the output restarts from zero duty.
+ */
+void BoostPWM_SetController(BoostController_e controller)
+{
+    if (controller >= eBOOST_CONTROLLER_COUNT || controller == s_controller)
+    {
+        return;
+    }
 
-    // Turn on ADC and set rule group to sw trig
-    // 0 = Use TRGO event for Timer 1 to fire ADC rule.
-    ADC1->CTLR2 = ADC_ADON | ADC_JEXTTRIG | ADC_JEXTSEL | ADC_EXTTRIG;
+    const bool enabled = s_outputEnabled;
+    BoostPWM_SetOutputEnabled(false);
+    BoostPWM_ResetController();
+    s_controller = controller;
+    BoostPWM_SetOutputEnabled(enabled);
+}
 
-    // Reset calibration
-    ADC1->CTLR2 |= ADC_RSTCAL;
-    while (ADC1->CTLR2 & ADC_RSTCAL)
-        ;
+/**
+ * @brief  Get the selected control algorithm
+ * @param  None
+ * @return The controller in use
+ */
+BoostController_e BoostPWM_GetController(void)
+{
+    return s_controller;
+}
 
-    // Calibrate ADC
-    ADC1->CTLR2 |= ADC_CAL;
-    while (ADC1->CTLR2 & ADC_CAL)
-        ;
+/**
+ * @brief  Get the time from the last output enable to reaching regulation
+ * @param  None
+ * @return The turn-on time in SysTick counts, 0 if still settling
+ */
+uint32_t BoostPWM_GetTurnOnTime(void)
+{
+    return s_turnOnPending ? 0 : s_turnOnTicks;
+}
 
-    // enable the ADC Conversion Complete IRQ
-    NVIC_EnableIRQ(ADC_IRQn);
+/**
+ * @brief  Select the output regulation mode
+ * @param  mode - the output mode
+ * @return None
+ */
+void BoostPWM_SetMode(BoostMode_e mode)
+{
+    if (mode < eBOOST_MODE_COUNT)
+    {
+        s_mode = mode;
+    }
+}
 
-#if CONFIG_ENABLE_NESTED_INTERRUPTS
-    __set_INTSYSCR(__get_INTSYSCR() | 2); // Enable interrupt nesting.
+/**
+ * @brief  Get the output regulation mode
+ * @param  None
+ * @return The output mode
+ */
+BoostMode_e BoostPWM_GetMode(void)
+{
+    return s_mode;
+}
 
-    // Ref. 6.3 Vector Table of Interrupts and Exceptions
-    PFIC->IPRIOR[15] = 1 << 7; // Turn on preemption for ADC
-#endif
+/**
+ * @brief  Set the target power for constant power mode
+ * @param  milliwatts - The target power in milliwatts
+ * @return None
+ * @note   The target is stored as a V * I product in ADC counts, so the
+ *         controller only needs a multiplication.
+ */
+void BoostPWM_SetPowerTarget(uint32_t milliwatts)
+{
+    // mW * 1000 * (Rin * ADC_MAX) / (vref * Rt), split to stay within 32 bits
+    const uint32_t scaled = (milliwatts * 1000 * 64) / GetVRefMillivolts();
+    s_targetPRaw = (scaled * BOARD_POWER_SCALE) >> BOARD_POWER_SCALE_SHIFT;
+}
 
-    // ADC_JEOCIE: Enable the End-of-conversion interrupt.
-    // ADC_JDISCEN | ADC_JAUTO: Force injection after rule conversion.
-    // ADC_SCAN: Allow scanning.
-    ADC1->CTLR1 = ADC_JEOCIE | ADC_JDISCEN | ADC_SCAN | ADC_JAUTO;
+/**
+ * @brief  Set the source resistance for constant resistance mode
+ * @param  milliohms - The emulated source resistance in milliohms
+ * @return None
+ * @note   The output voltage drops by the resistance times the current.
+ *         Held to CONFIG_RESISTANCE_LIMIT, past it the scaling overflows.
+ */
+void BoostPWM_SetSourceResistance(uint32_t milliohms)
+{
+    milliohms = min(milliohms, CONFIG_RESISTANCE_LIMIT);
+    s_resistanceRaw = (milliohms * RESISTANCE_SCALE) / GetVRefMillivolts();
 }
 
 /**
- * @brief  Set up the Op-Amp for current sensing
- * @param  None
+ * @brief  Set the per unit gain trims
+ * @param  trim - the voltage and current gain corrections
  * @return None
+ * @note   A trim is (actual / reported - 1) * 2^16, measured against a
+ *         reference meter. Targets set before the call are not rescaled.
  */
-static void SetupOpAmp(void)
+void BoostPWM_SetTrim(const BoostTrim_t *trim)
 {
-    RCC->APB2PCENR = RCC_APB2Periph_GPIOD | RCC_APB2Periph_GPIOA;
+    // Called with every command, only a changed trim is worth the division.
+    // The control loop only reads s_milliampsPerCount, the reciprocal is for
+    // the targets set here in the main loop.
+    const uint32_t currentGain = TRIM_ONE + trim->current;
+    if (currentGain != s_milliampsPerCount)
+    {
+        s_countsPerMilliamp = ((1UL << 31) / currentGain) << 1;
+        s_milliampsPerCount = currentGain;
+    }
 
-    // Set the Op-Amp Input Positive and Negative to Floating
-    GPIOA->CFGLR &= ~(0xf << (1 << 2));
-    GPIOA->CFGLR &= ~(0xf << (2 << 2));
-    GPIOA->CFGLR |= (GPIO_Speed_In | GPIO_CNF_IN_ANALOG) << (1 << 2);
-    GPIOA->CFGLR |= (GPIO_Speed_In | GPIO_CNF_IN_ANALOG) << (2 << 2);
+    // Rederive the voltage conversion factors now, for the targets set next
+    if (trim->voltage != s_voltageTrim)
+    {
+        s_voltageTrim = trim->voltage;
+        s_scaleVRef = 0;
+        UpdateScale();
+    }
+}
 
-    // Set the Default Op-Amp pins to OPP0 and OPN0, then Enable the Op-Amp
-    EXTEN->EXTEN_CTR &= ~(EXTEN_OPA_NSEL | EXTEN_OPA_PSEL);
-    EXTEN->EXTEN_CTR |= EXTEN_OPA_EN;
+/**
+ * @brief  Get the current sensor calibration state
+ * @param[out] calibration - the calibration state
+ * @return None
+ */
+void BoostPWM_GetCalibration(BoostCalibration_t *calibration)
+{
+    const int16_t offset = s_currentOffset;
+    *calibration = (BoostCalibration_t){
+        .currentOffset = offset,
+        .offsetDrift = offset - s_bootOffset,
+        .recalibrations = s_recalibrations,
+    };
 }
 
 /**
- * @brief  Boost controller PID algorithm
+ * @brief  Start an averaged measurement of the output
  * @param  None
  * @return None
- * @note   eP = P error, eI = I error, eD = D error
+ * @note   The measurement only progresses while the output is regulating
  */
-static INLINE void BoostControllerPID(void)
+void BoostPWM_StartMeasurement(void)
 {
-    static int lastEP = 0;
-    static int eI = 0;
+    s_measureActive = false;
+    s_measureSettled = 0;
+    s_measureWait = 0;
+    s_measureCount = 0;
+    s_measureVSum = 0;
+    s_measureISum = 0;
+    s_measureActive = true;
+}
 
-    // Skip if the target is 0
-    if (s_targetVRaw == 0 || s_targetIRaw == 0)
+/**
+ * @brief  Get the result of the last averaged measurement
+ * @param[out] measurement - the averaged output voltage and current
+ * @return true if the measurement is complete
+ */
+bool BoostPWM_GetMeasurement(BoostMeasurement_t *measurement)
+{
+    if (s_measureActive)
     {
-        // Reset the algorithm
-        lastEP = 0;
-        eI = 0;
-        SetDuty(0);
-        return;
+        return false;
     }
 
-    // Calculate the voltage and current errors
-    const int ePv = s_targetVRaw - s_feedbackVRaw;
-    const int ePi = s_targetIRaw - s_feedbackIRaw;
-    s_ccMode = (ePv < ePi) ? 0 : 1;
+    const int32_t current = s_measureISum >> MEASURE_SHIFT;
+    *measurement = (BoostMeasurement_t){
+        .millivolts = RawToMillivolts(s_measureVSum >> MEASURE_SHIFT),
+        .milliamps = CountsToMilliamps(current),
+        .settled = s_measureWait < MEASURE_TIMEOUT,
+    };
+    return true;
+}
 
-    // Picking the smallest error gives current or voltage limiting
-    const int eP = min(ePv, ePi);
-    const int eD = eP - lastEP;
-    eI += eP;
+/**
+ * @brief  Set the PID gains
+ * @param  gains - the right shift applied to each term
+ * @return None
+ * @note   Each shift is clamped to the BOOST_PID_* range, see
+ *         BoostPWM_GetPidGains() for the ones in use.
+ */
+void BoostPWM_SetPidGains(const BoostPidGains_t *gains)
+{
+    s_gains = (BoostPidGains_t){
+        .kpShift = min(gains->kpShift, BOOST_PID_KP_SHIFT_MAX),
+        .kdShift = min(gains->kdShift, BOOST_PID_KD_SHIFT_MAX),
+        .kiShift = min(max(gains->kiShift, BOOST_PID_KI_SHIFT_MIN), BOOST_PID_KI_SHIFT_MAX),
+    };
+}
 
-    int duty = KP(eP) + KD(eD) + KI(eI);
+/**
+ * @brief  Get the PID gains
+ * @param[out] gains - the right shift applied to each term
+ * @return None
+ */
+void BoostPWM_GetPidGains(BoostPidGains_t *gains)
+{
+    *gains = s_gains;
+}
 
-    // Limit the duty cycle for safety
-    duty = max(duty, MIN_DUTY);
-    duty = min(duty, MAX_DUTY);
+/**
+ * @brief  Get the response to the last voltage target change
+ * @param[out] response - settling time, overshoot and ripple
+ * @return None
+ */
+void BoostPWM_GetStepResponse(BoostStepResponse_t *response)
+{
+    const uint16_t settledAt = s_stepSettledAt;
+    *response = (BoostStepResponse_t){
+        .settlingUs = (settledAt && settledAt < STEP_TIMEOUT) ? SAMPLES_TO_US(settledAt) : STEP_UNSETTLED,
+        .overshootMillivolts = RawToMillivolts(s_stepOvershoot),
+        .rippleMillivolts = RawToMillivolts(s_stepRippleMax - s_stepRippleMin),
+        .complete = s_stepComplete,
+    };
+}
 
-    SetDuty(duty);
+/**
+ * @brief  Get the state of the boost converter
+ * @param[out] state - The state of the boost converter
+ * @return None
+ */
+void BoostPWM_GetState(BoostState_t *state)
+{
+    const uint32_t current = GetCurrentMilliampsQ8();
+    *state = (BoostState_t){
+        .voltage = GetVoltageMillivolts(),
+        .current = current >> 8,
+        .duty = s_pwmDuty,
+        .ccMode = s_ccMode,
+        .currentFraction = current & 0xFF,
+    };
 }
 
+#if CONFIG_HOST_BUILD
 /**
- * @brief  Set PWM duty cycle for the boost converter
- * @param  None
+ * @brief  Load the control loop's state a device trace started from
+ * @param  seed - the state, see TraceSeed_t
  * @return None
+ * @note   For the host replay, in place of the interrupt that preceded the
+ *         first record. The offset calibration counts as done and the
+ *         output as on, as they were when the trace was taken.
  */
-static INLINE void SetDuty(uint8_t duty)
+void BoostPWM_Seed(const TraceSeed_t *seed)
 {
-    TIM1->CH3CVR = s_pwmDuty = duty;
+    s_eI = seed->integrator;
+    s_lastEP = seed->lastError;
+    s_outerI = seed->outerIntegrator;
+    s_innerI = seed->innerIntegrator;
+    s_targetVRaw = seed->targetVRaw;
+    s_targetIRaw = seed->targetIRaw;
+    s_targetPRaw = seed->targetPRaw;
+    s_resistanceRaw = seed->resistanceRaw;
+    s_softStartVRaw = seed->softStartVRaw;
+    s_currentOffset = seed->currentOffset;
+    s_controller = seed->controller;
+    s_mode = seed->mode;
+    s_gains = (BoostPidGains_t){
+        .kpShift = seed->kpShift,
+        .kdShift = seed->kdShift,
+        .kiShift = seed->kiShift,
+    };
+
+    s_faultMode = seed->faultMode;
+    s_faultKneeRaw = seed->faultKneeRaw;
+    s_foldbackFloorRaw = seed->foldbackFloorRaw;
+    s_foldbackSlope = seed->foldbackSlope;
+    s_hiccupRetry = seed->hiccupRetry;
+    s_hiccupTimer = seed->hiccupTimer;
+    s_hiccupBackoff = seed->hiccupBackoff;
+    s_hiccupHealthy = seed->hiccupHealthy;
+    s_shortCount = seed->shortCount;
+
+    s_calibrationCount = CALIBRATION_SAMPLES;
+    s_warmStartPending = false;
+    s_outputEnabled = true;
+    s_turnOnPending = false;
+
+    s_vref = seed->vref;
+    s_vrefFiltered = seed->vrefFiltered;
+    s_vrefPublished = seed->vrefPublished;
+    s_vrefCount = seed->vrefCount;
+    s_vrefSampled = seed->vrefSampled;
+    HAL_ADC_SetInjectedSequence(s_vrefSampled ? ADC_ISQR_VREF(ISENSE_CHANNEL) : ADC_ISQR(ISENSE_CHANNEL));
+    SetDuty(seed->duty);
 }
+#endif
 
 /**
- * @brief  Calibrate the current sensor
+ * @brief  ADC1 IRQ Handler
  * @param  None
  * @return None
  */
-static void Calibrate(void)
+void ADC1_IRQHandler(void) __attribute__((section(".srodata"))) __attribute__((interrupt));
+void ADC1_IRQHandler(void)
 {
-    // Calibrate the current sensor
-    s_targetVRaw = 0;
-    Delay_Ms(100);
-    s_currentOffset = s_feedbackIRaw;
+    PROFILE_START(start);
+
+#if CONFIG_ENABLE_TRACE
+    // Before the readings go into the VRef filter
+    TraceSeed_t *seed = Trace_GetSeed();
+    if (seed)
+    {
+        SaveSeed(seed);
+    }
+#endif
+
+    // Values come in reverse order.
+    if (s_vrefSampled)
+    {
+        s_vref = HAL_ADC_GetInjected2();
+        FilterVRef();
+    }
+    s_feedbackIRaw = HAL_ADC_GetInjected1();
+
+    s_feedbackVRaw = HAL_ADC_GetRegular();
+
+    TRACE_RECORD(s_feedbackVRaw, s_feedbackIRaw, s_vref, s_vrefSampled);
+
+    UpdateCurrent();
+
+    if (s_calibrationCount < CALIBRATION_SAMPLES)
+    {
+        CalibrateSample();
+    }
+    else
+    {
+        BoostControl();
+    }
+
+    // Set up the next injected sequence, with VRef only every VREF_DIVIDER
+    // cycles
+    s_vrefSampled = (++s_vrefCount & (VREF_DIVIDER - 1)) == 0;
+    HAL_ADC_SetInjectedSequence(s_vrefSampled ? ADC_ISQR_VREF(ISENSE_CHANNEL) : ADC_ISQR(ISENSE_CHANNEL));
+
+    // Acknowledge pending interrupts.
+    HAL_ADC_ClearStatus();
+
+    PROFILE_STOP(ePROFILE_ADC_ISR, start);
+}
+
+//------------------------------------------------------------------------------
+// Module static functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  Low-pass filter the VRef samples and publish significant changes
+ * @param  None
+ * @return None
+ */
+static INLINE void FilterVRef(void)
+{
+    const uint32_t sample = (uint32_t)s_vref << VREF_SHIFT;
+    if (s_vrefFiltered == 0)
+    {
+        s_vrefFiltered = s_vrefPublished = sample;
+        return;
+    }
+
+    s_vrefFiltered += ((int)sample - (int)s_vrefFiltered) >> VREF_FILTER_SHIFT;
+
+    const int delta = (int)s_vrefFiltered - (int)s_vrefPublished;
+    if (delta > VREF_PUBLISH_THRESHOLD || delta < -VREF_PUBLISH_THRESHOLD)
+    {
+        s_vrefPublished = s_vrefFiltered;
+    }
+}
+
+/**
+ * @brief  Rederive the conversion factors if the published VRef moved
+ * @param  None
+ * @return None
+ * @note   Main context only. The factors are written to the set not in use
+ *         and swapped in with a single store, so the ADC IRQ always converts
+ *         with a complete set and never divides.
+ */
+static void UpdateScale(void)
+{
+    const uint32_t vref = s_vrefPublished;
+    if (vref == s_scaleVRef || vref == 0)
+    {
+        return;
+    }
+    s_scaleVRef = vref;
+
+    const uint8_t next = s_scaleIndex ^ 1;
+    VoltageScale_t *scale = &s_scales[next];
+    scale->vddMillivolts = ((INTERNAL_VREF * ADC_MAX) << VREF_SHIFT) / vref;
+
+    const uint32_t voltageGain = TRIM_ONE + s_voltageTrim;
+    const uint32_t millivoltsPerCount = (scale->vddMillivolts * BOARD_MV_PER_COUNT_MUL) >> BOARD_MV_PER_COUNT_MUL_SHIFT;
+    scale->millivoltsPerCount = (millivoltsPerCount * voltageGain) >> TRIM_SHIFT;
+    scale->countsPerMillivolt = ((COUNTS_PER_MV_NUM / scale->vddMillivolts) << TRIM_SHIFT) / voltageGain;
+
+    s_scaleIndex = next;
+}
+
+/**
+ * @brief  Get the VRef voltage in millivolts
+ * @param  None
+ * @return The VRef voltage in millivolts
+ */
+static int GetVRefMillivolts(void)
+{
+    return s_scales[s_scaleIndex].vddMillivolts;
+}
+
+/**
+ * @brief  Get the output voltage in millivolts
+ * @param  None
+ * @return The output voltage in millivolts
+ */
+static uint16_t GetVoltageMillivolts(void)
+{
+    return RawToMillivolts(s_feedbackVRaw);
+}
+
+/**
+ * @brief  Convert an ADC feedback value to millivolts
+ * @param  raw: feedback value in ADC counts
+ * @return The output voltage in millivolts
+ */
+static uint16_t RawToMillivolts(uint16_t raw)
+{
+    return (raw * s_scales[s_scaleIndex].millivoltsPerCount) >> MV_PER_COUNT_SHIFT;
+}
+
+/**
+ * @brief  Convert millivolts to ADC target value
+ * @param  millivolts: target voltage in millivolts
+ * @return The ADC target value
+ */
+static uint16_t MillivoltsToADC(uint32_t millivolts)
+{
+    return (millivolts * s_scales[s_scaleIndex].countsPerMillivolt) >> COUNTS_PER_MV_SHIFT;
+}
+
+/**
+ * @brief  Get the oversampled current in milliamps
+ * @param  None
+ * @return The output current in milliamps, Q8
+ * @note   Split in whole and fractional counts so neither product overflows.
+ */
+static uint32_t GetCurrentMilliampsQ8(void)
+{
+    const int32_t q8 = s_currentQ8;
+    if (q8 < 0)
+    {
+        return 0;
+    }
+
+    const uint32_t scale = s_milliampsPerCount;
+    return (((uint32_t)q8 >> 8) * scale >> (TRIM_SHIFT - 8)) + (((uint32_t)q8 & 0xFF) * scale >> TRIM_SHIFT);
+}
+
+/**
+ * @brief  Convert offset corrected current counts to milliamps
+ * @param  counts: current in ADC counts, ~1mA each
+ * @return The current in milliamps
+ */
+static uint16_t CountsToMilliamps(int counts)
+{
+    if (counts < 0)
+    {
+        return 0;
+    }
+    return (counts * s_milliampsPerCount) >> TRIM_SHIFT;
+}
+
+/**
+ * @brief  Convert milliamps to ADC target value
+ * @param  milliamps: target current in milliamps
+ * @return The ADC target value
+ */
+static uint16_t MilliampsToADC(uint32_t milliamps)
+{
+    // NOTE: The offset is applied in the controller, so the limit stays valid
+    // while the offset is still being calibrated.
+    return (milliamps * s_countsPerMilliamp) >> TRIM_SHIFT;
+}
+
+/**
+ * @brief  Set up the ADC for the voltage and current feedback
+ * @param  None
+ * @return None
+ */
+static void SetupADC(void)
+{
+    // Configure ADC.
+    RCC->APB2PCENR |= RCC_APB2Periph_GPIOD | RCC_APB2Periph_ADC1;
+
+    // PD6 is analog input ch 6
+    GPIOD->CFGLR &= ~(0xf << (BOARD_FEEDBACK_PIN << 2)); // CNF = 00: Analog, MODE = 00: Input
+    // PD4 is analog input ch 7
+    GPIOD->CFGLR &= ~(0xf << (BOARD_CURRENT_PIN << 2)); // CNF = 00: Analog, MODE = 00: Input
+
+    // Reset the ADC to init all regs
+    RCC->APB2PRSTR |= RCC_APB2Periph_ADC1;
+    RCC->APB2PRSTR &= ~RCC_APB2Periph_ADC1;
+
+    // ADCCLK = 12 MHz => RCC_ADCPRE divide by 4
+    RCC->CFGR0 &= ~RCC_ADCPRE;     // Clear out the bis in case they were set
+    RCC->CFGR0 |= RCC_ADCPRE_DIV4; // set it to 010xx for /4.
+
+    ADC1->RSQR1 = 0; // 1 channels in sequence
+    ADC1->RSQR2 = 0;
+    // Set up 1st conversion on ch6
+    // 0-9 for 8 ext inputs and two internals
+    ADC1->RSQR3 = (BOARD_FEEDBACK_CHANNEL << 0);
+
+    // Injection group is 8, preceded by the current channel
+    ADC1->ISQR = ADC_ISQR_VREF(ISENSE_CHANNEL);
+
+    // Sampling time for channels. Careful: This has PID tuning implications.
+    // Note that with 3 and 3,the full loop (and injection) runs at 138kHz.
+    ADC1->SAMPTR2 = (ADC_SAMPLES << (3 * ISENSE_CHANNEL)) | (ADC_SAMPLES << (3 * VREF_CHANNEL)) | (ADC_SAMPLES << (3 * 1));
+    // 0:7 => 3/9/15/30/43/57/73/241 cycles
+    // (4 == 43 cycles), (6 = 73 cycles)  Note these are alrady /2, so
+    // setting this to 73 cycles actually makes it wait 256 total cycles @ 48MHz.
+
+    // Turn on ADC and set rule group to sw trig
+    // 0 = Use TRGO event for Timer 1 to fire ADC rule.
+    ADC1->CTLR2 = ADC_ADON | ADC_JEXTTRIG | ADC_JEXTSEL | ADC_EXTTRIG;
+
+    HAL_ADC_Calibrate();
+
+    // enable the ADC Conversion Complete IRQ
+    NVIC_EnableIRQ(ADC_IRQn);
+
+#if CONFIG_ENABLE_NESTED_INTERRUPTS
+    __set_INTSYSCR(__get_INTSYSCR() | 2); // Enable interrupt nesting.
+
+    // Ref. 6.3 Vector Table of Interrupts and Exceptions
+    PFIC->IPRIOR[15] = 1 << 7; // Turn on preemption for ADC
+#endif
+
+    // ADC_JEOCIE: Enable the End-of-conversion interrupt.
+    // ADC_JDISCEN | ADC_JAUTO: Force injection after rule conversion.
+    // ADC_SCAN: Allow scanning.
+    ADC1->CTLR1 = ADC_JEOCIE | ADC_JDISCEN | ADC_SCAN | ADC_JAUTO;
+}
+
+/**
+ * @brief  Set up the Op-Amp for current sensing
+ * @param  None
+ * @return None
+ */
+static void SetupOpAmp(void)
+{
+    RCC->APB2PCENR = RCC_APB2Periph_GPIOD | RCC_APB2Periph_GPIOA;
+
+    // Set the Op-Amp Input Positive and Negative to Floating
+    GPIOA->CFGLR &= ~(0xf << (BOARD_OPA_NEG_PIN << 2));
+    GPIOA->CFGLR &= ~(0xf << (BOARD_OPA_POS_PIN << 2));
+    GPIOA->CFGLR |= (GPIO_Speed_In | GPIO_CNF_IN_ANALOG) << (BOARD_OPA_NEG_PIN << 2);
+    GPIOA->CFGLR |= (GPIO_Speed_In | GPIO_CNF_IN_ANALOG) << (BOARD_OPA_POS_PIN << 2);
+
+    // Set the Default Op-Amp pins to OPP0 and OPN0, then Enable the Op-Amp
+    EXTEN->EXTEN_CTR &= ~(EXTEN_OPA_NSEL | EXTEN_OPA_PSEL);
+    EXTEN->EXTEN_CTR |= EXTEN_OPA_EN;
+}
+
+/**
+ * @brief  Run the selected controller and update the PWM duty cycle
+ * @param  None
+ * @return None
+ */
+static INLINE void BoostControl(void)
+{
+    // Gate the output but keep the controller state warm
+    if (!s_outputEnabled)
+    {
+        s_softStartVRaw = s_feedbackVRaw;
+        SetDuty(0);
+        RecalibrateSample();
+        return;
+    }
+
+    // Skip if the target is 0
+    if (s_targetVRaw == 0 || s_targetIRaw == 0)
+    {
+        ResetState();
+        SetDuty(0);
+        RecalibrateSample();
+        return;
+    }
+
+    s_softStartVRaw = min(s_softStartVRaw + SOFT_START_STEP, (int)s_targetVRaw);
+
+    s_recalCount = 0;
+
+    // A hiccup retry still pending when the mode changed runs out first
+    if ((s_faultMode == eBOOST_FAULT_HICCUP || s_hiccupTimer) && HiccupCheck())
+    {
+        SetDuty(0);
+        return;
+    }
+
+    PROFILE_START(start);
+    int duty;
+    if (s_controller == eBOOST_CONTROLLER_CASCADE)
+    {
+        duty = BoostControllerCascade();
+    }
+    else
+    {
+        duty = BoostControllerPID();
+    }
+    PROFILE_STOP(ePROFILE_CONTROLLER, start);
+
+    // Leaving the current limit ramps back up from the output voltage, as a
+    // soft start does, rather than from the integral held at the limit
+    if (s_ccMode)
+    {
+        s_softStartVRaw = s_feedbackVRaw;
+    }
+
+    if (s_turnOnPending && s_error <= WARM_START_MAX_ERROR)
+    {
+        s_turnOnTicks = HAL_GetTicks() - s_turnOnStart;
+        s_turnOnPending = false;
+    }
+
+    // Limit the duty cycle for safety
+    duty = max(duty, MIN_DUTY);
+    duty = min(duty, MAX_DUTY);
+
+#if CONFIG_ENABLE_FRA
+    // The perturbation goes on top of the limited output, so limit it again
+    duty = FRA_Inject(duty);
+    duty = max(duty, MIN_DUTY);
+    duty = min(duty, MAX_DUTY);
+#endif
+
+    SetDuty(duty);
+
+    MeasureSample();
+    DecimateSample();
+    StepSample();
+}
+
+/**
+ * @brief  Accumulate a sample of the averaged measurement
+ * @param  None
+ * @return None
+ * @note   Settling is detected from the active loop's error, in CC that is the
+ *         current error, so the wait is only as long as the step needs.
+ */
+static INLINE void MeasureSample(void)
+{
+    if (!s_measureActive)
+    {
+        return;
+    }
+
+    if (s_measureSettled < MEASURE_SETTLE)
+    {
+        const int eI = GetCurrentLimit() - s_current;
+        const bool settled = (s_error <= MEASURE_MAX_ERROR && s_error >= -MEASURE_MAX_ERROR) ||
+                             (s_ccMode && eI <= MEASURE_CURRENT_TOLERANCE && eI >= -MEASURE_CURRENT_TOLERANCE);
+
+        if (settled || s_measureWait >= MEASURE_TIMEOUT)
+        {
+            s_measureSettled++;
+        }
+        else
+        {
+            s_measureSettled = 0;
+            s_measureWait++;
+        }
+        return;
+    }
+
+    s_measureVSum += s_feedbackVRaw;
+    s_measureISum += s_current;
+
+    if (++s_measureCount == (1 << MEASURE_SHIFT))
+    {
+        s_measureActive = false;
+    }
+}
+
+#if CONFIG_ENABLE_TRACE
+/**
+ * @brief  Take the control loop's state for a trace, see BoostPWM_Seed()
+ * @param[out] seed - the state before this interrupt's control step
+ * @return None
+ * @note   Once per trace, from the ADC IRQ
+ */
+static void SaveSeed(TraceSeed_t *seed)
+{
+    *seed = (TraceSeed_t){
+        .integrator = s_eI,
+        .lastError = s_lastEP,
+        .outerIntegrator = s_outerI,
+        .innerIntegrator = s_innerI,
+        .targetPRaw = s_targetPRaw,
+        .resistanceRaw = s_resistanceRaw,
+        .foldbackSlope = s_foldbackSlope,
+        .hiccupRetry = s_hiccupRetry,
+        .hiccupTimer = s_hiccupTimer,
+        .hiccupBackoff = s_hiccupBackoff,
+        .hiccupHealthy = s_hiccupHealthy,
+        .vrefFiltered = s_vrefFiltered,
+        .vrefPublished = s_vrefPublished,
+        .targetVRaw = s_targetVRaw,
+        .targetIRaw = s_targetIRaw,
+        .softStartVRaw = s_softStartVRaw,
+        .faultKneeRaw = s_faultKneeRaw,
+        .foldbackFloorRaw = s_foldbackFloorRaw,
+        .shortCount = s_shortCount,
+        .currentOffset = s_currentOffset,
+        .vref = s_vref,
+        .duty = s_pwmDuty,
+        .controller = s_controller,
+        .mode = s_mode,
+        .faultMode = s_faultMode,
+        .vrefCount = s_vrefCount,
+        .vrefSampled = s_vrefSampled,
+        .kpShift = s_gains.kpShift,
+        .kdShift = s_gains.kdShift,
+        .kiShift = s_gains.kiShift,
+    };
+}
+#endif
+
+/**
+ * @brief  Follow the step response to a voltage target change
+ * @param  None
+ * @return None
+ */
+static INLINE void StepSample(void)
+{
+    if (!s_stepActive)
+    {
+        return;
+    }
+
+    const uint16_t vRaw = s_feedbackVRaw;
+    const int error = (int)vRaw - (int)s_targetVRaw;
+    s_stepSamples++;
+
+    // Settling, track the overshoot until the output stays within tolerance
+    if (s_stepSettledAt == 0)
+    {
+        const int overshoot = s_stepRising ? error : -error;
+        if (overshoot > (int)s_stepOvershoot)
+        {
+            s_stepOvershoot = overshoot;
+        }
+
+        if (error <= STEP_TOLERANCE && error >= -STEP_TOLERANCE)
+        {
+            if (s_stepInBand == 0)
+            {
+                s_stepInBand = s_stepSamples;
+            }
+        }
+        else
+        {
+            s_stepInBand = 0;
+        }
+
+        const bool settled = s_stepInBand && (s_stepSamples - s_stepInBand) >= STEP_HOLD;
+        if (settled || s_stepSamples >= STEP_TIMEOUT)
+        {
+            s_stepSettledAt = settled ? s_stepInBand : STEP_TIMEOUT;
+            s_stepRippleStart = s_stepSamples;
+            s_stepRippleMin = vRaw;
+            s_stepRippleMax = vRaw;
+        }
+        return;
+    }
+
+    // Settled, measure the ripple
+    s_stepRippleMin = min(s_stepRippleMin, vRaw);
+    s_stepRippleMax = max(s_stepRippleMax, vRaw);
+    if (s_stepSamples - s_stepRippleStart >= STEP_RIPPLE)
+    {
+        s_stepActive = false;
+        s_stepComplete = true;
+    }
+}
+
+/**
+ * @brief  Decimate the output measurements to 1ms averages for the charger
+ * @param  None
+ * @return None
+ */
+static INLINE void DecimateSample(void)
+{
+#if CONFIG_ENABLE_CHARGER
+    s_decimateVSum += s_feedbackVRaw;
+    s_decimateISum += s_current;
+
+    if (++s_decimateCount < DECIMATE_SAMPLES)
+    {
+        return;
+    }
+
+    const uint16_t vRaw = (s_decimateVSum * DECIMATE_RECIPROCAL) >> DECIMATE_SHIFT;
+    const int32_t current = (s_decimateISum * DECIMATE_RECIPROCAL) >> DECIMATE_SHIFT;
+    s_decimateCount = 0;
+    s_decimateVSum = 0;
+    s_decimateISum = 0;
+
+    Charger_Tick(RawToMillivolts(vRaw), CountsToMilliamps(current), s_ccMode);
+#endif
+}
+
+/**
+ * @brief  Boost controller PID algorithm
+ * @param  None
+ * @return The new duty cycle, unclamped
+ * @note   eP = P error, eI = I error, eD = D error
+ */
+static INLINE int BoostControllerPID(void)
+{
+    const int current = s_current;
+
+    // Calculate the voltage and current errors
+    const int ePv = GetVoltageReference(current) - s_feedbackVRaw;
+    int ePi = GetCurrentLimit() - current;
+    if (s_mode == eBOOST_MODE_CP)
+    {
+        ePi = min(ePi, GetPowerError(current));
+    }
+    ePi = PID_CURRENT_ERROR(ePi);
+    s_ccMode = (ePv < ePi) ? 0 : 1;
+
+    // Picking the smallest error gives current or voltage limiting
+    const int eP = min(ePv, ePi);
+    const int eD = eP - s_lastEP;
+    s_lastEP = eP;
+    s_eI += eP;
+    s_error = eP;
+
+    return KP(eP) + KD(eD) + KI(s_eI);
+}
+
+/**
+ * @brief  Cascaded controller, outer voltage PI loop feeding an inner current PI loop
+ * @param  None
+ * @return The new duty cycle, unclamped
+ * @note   Both loops run every sample. The outer loop's current reference
+ *         is clamped to the current limit, so the CC/CV crossover is smooth
+ *         and current transients are limited directly.
+ */
+static INLINE int BoostControllerCascade(void)
+{
+    // Outer voltage loop
+    const int current = s_current;
+    int iMax = GetCurrentLimit();
+    if (s_mode == eBOOST_MODE_CP)
+    {
+        // Current that would deliver the target power at this voltage
+        iMax = min(iMax, max(current + GetPowerError(current), 0));
+    }
+    const int eV = GetVoltageReference(current) - s_feedbackVRaw;
+    s_error = eV;
+
+    int iRef = CASCADE_KVP(eV) + CASCADE_KVI(s_outerI);
+
+    // Clamp to the current limit, only integrating when not saturated
+    if (iRef >= iMax)
+    {
+        iRef = iMax;
+        s_ccMode = 1;
+        if (eV < 0) s_outerI += eV;
+    }
+    else if (iRef <= 0)
+    {
+        iRef = 0;
+        s_ccMode = 0;
+        if (eV > 0) s_outerI += eV;
+    }
+    else
+    {
+        s_ccMode = 0;
+        s_outerI += eV;
+    }
+    // Inner current loop
+    const int eI = iRef - s_current;
+    s_innerI += eI;
+    s_innerI = max(s_innerI, 0);
+    s_innerI = min(s_innerI, MAX_DUTY << CASCADE_KII_SHIFT);
+
+    return CASCADE_KIP(eI) + (s_innerI >> CASCADE_KII_SHIFT);
+}
+
+/**
+ * @brief  Get the voltage reference for the selected output mode
+ * @param  current - the output current in ADC counts
+ * @return The voltage reference in ADC counts
+ * @note   In CR mode the target drops by the source resistance times the
+ *         current, costing a single multiplication per control cycle. The
+ *         soft start limits the result, as it follows the output voltage
+ *         while current limiting.
+ */
+static INLINE int GetVoltageReference(int current)
+{
+    int target = s_targetVRaw;
+    if (s_mode == eBOOST_MODE_CR && current > 0)
+    {
+        const int drop = (current * s_resistanceRaw) >> RESISTANCE_SHIFT;
+        target = max(target - drop, 0);
+    }
+
+    return min(target, (int)s_softStartVRaw);
+}
+
+/**
+ * @brief  Get the power error as an equivalent current error
+ * @param  current - the output current in ADC counts
+ * @return (P - V * I) / V in current ADC counts
+ * @note   The division by V is approximated by a shift of log2(V), the
+ *         integrator removes the residual gain error so the power is exact.
+ */
+static INLINE int GetPowerError(int current)
+{
+    const int v = s_feedbackVRaw;
+    const int eP = (int)s_targetPRaw - v * current;
+
+    int shift = 4;
+    if (v >= 512) shift = 9;
+    else if (v >= 256) shift = 8;
+    else if (v >= 128) shift = 7;
+    else if (v >= 64) shift = 6;
+    else if (v >= 32) shift = 5;
+
+    return eP >> shift;
+}
+
+/**
+ * @brief  Get the current limit, folded back when the output collapses
+ * @param  None
+ * @return The current limit in ADC counts
+ * @note   Below the knee voltage the limit falls linearly to the floor at 0V.
+ */
+static INLINE int GetCurrentLimit(void)
+{
+    if (s_faultMode != eBOOST_FAULT_FOLDBACK || s_feedbackVRaw >= s_faultKneeRaw)
+    {
+        return s_targetIRaw;
+    }
+
+    const int limit = s_foldbackFloorRaw + ((s_feedbackVRaw * s_foldbackSlope) >> FOLDBACK_SHIFT);
+    return min(limit, (int)s_targetIRaw);
+}
+
+/**
+ * @brief  Hiccup short circuit protection
+ * @param  None
+ * @return true if the output must be kept off
+ * @note   A short is a collapsed output while current limiting. The output is
+ *         then switched off and retried, doubling the off time on every trip.
+ *         Current limiting is taken from the current rather than s_ccMode,
+ *         the PID flips that on the current ripple once the voltage reference
+ *         tracks the output in CC, and the debounce would never complete.
+ */
+static INLINE bool HiccupCheck(void)
+{
+    if (s_hiccupTimer)
+    {
+        if (--s_hiccupTimer)
+        {
+            return true;
+        }
+
+        // Retry from a clean soft start
+        ResetState();
+        s_hiccupHealthy = 0;
+        return false;
+    }
+
+    const int limit = s_targetIRaw;
+    if (s_feedbackVRaw < s_faultKneeRaw && s_current >= limit - (limit >> HICCUP_LIMIT_SHIFT))
+    {
+        s_hiccupHealthy = 0;
+        if (++s_shortCount < HICCUP_DEBOUNCE)
+        {
+            return false;
+        }
+
+        s_shortCount = 0;
+        s_faultCount++;
+        s_hiccupTimer = s_hiccupBackoff;
+        s_hiccupBackoff = min(s_hiccupBackoff << 1, s_hiccupRetry << HICCUP_MAX_BACKOFF_SHIFT);
+        return true;
+    }
+
+    s_shortCount = 0;
+    if (s_hiccupHealthy < HICCUP_RECOVERY && ++s_hiccupHealthy == HICCUP_RECOVERY)
+    {
+        s_hiccupBackoff = s_hiccupRetry;
+    }
+    return false;
+}
+
+/**
+ * @brief  Recalculate the foldback slope from the limit, floor and knee
+ * @param  None
+ * @return None
+ */
+static void UpdateFoldback(void)
+{
+    const int range = (int)s_targetIRaw - s_foldbackFloorRaw;
+    if (range <= 0 || s_faultKneeRaw == 0)
+    {
+        s_foldbackSlope = 0;
+        return;
+    }
+
+    s_foldbackSlope = (range << FOLDBACK_SHIFT) / s_faultKneeRaw;
+}
+
+/**
+ * @brief  Reset the state of all the controllers
+ * @param  None
+ * @return None
+ */
+static INLINE void ResetState(void)
+{
+    s_lastEP = 0;
+    s_eI = 0;
+    s_outerI = 0;
+    s_innerI = 0;
+    s_softStartVRaw = s_feedbackVRaw;
+}
+
+/**
+ * @brief  Set PWM duty cycle for the boost converter
+ * @param  None
+ * @return None
+ */
+static INLINE void SetDuty(uint8_t duty)
+{
+    HAL_PWM_SetCompare(s_pwmDuty = duty);
+}
+
+/**
+ * @brief  Offset correct the current sample and oversample it
+ * @param  None
+ * @return None
+ * @note   The sum of (1 << OVERSAMPLE_SHIFT) samples is the average in Q8,
+ *         it is published with a single store. The sum is signed, so the
+ *         noise around zero current averages out rather than rectifying.
+ */
+static INLINE void UpdateCurrent(void)
+{
+    static int32_t sum = 0;
+    static uint16_t count = 0;
+
+    s_current = (int)s_feedbackIRaw - s_currentOffset;
+
+    sum += s_current;
+    if (++count == (1 << OVERSAMPLE_SHIFT))
+    {
+        s_currentQ8 = sum;
+        sum = 0;
+        count = 0;
+    }
+}
+
+/**
+ * @brief  Accumulate one current sensor calibration sample
+ * @param  None
+ * @return None
+ * @note   Runs from the ADC IRQ with the output off, the first few samples
+ *         are dropped to let the op-amp and ADC settle. The idle output
+ *         voltage is averaged alongside as a measure of the input voltage.
+ */
+static INLINE void CalibrateSample(void)
+{
+    static uint32_t sumI = 0;
+    static uint32_t sumV = 0;
+
+    const uint16_t count = ++s_calibrationCount;
+    if (count <= CALIBRATION_SETTLE)
+    {
+        return;
+    }
+
+    sumI += s_feedbackIRaw;
+    sumV += s_feedbackVRaw;
+
+    if (count == CALIBRATION_SAMPLES)
+    {
+        s_currentOffset = s_bootOffset = sumI >> CALIBRATION_SHIFT;
+        s_idleVRaw = sumV >> CALIBRATION_SHIFT;
+        s_softStartVRaw = s_idleVRaw;
+        ApplyWarmStart();
+    }
+}
+
+/**
+ * @brief  Track the current sensor offset drift while the output is off
+ * @param  None
+ * @return None
+ * @note   Averages (1 << RECAL_SHIFT) samples once the inductor current has
+ *         decayed and the output is back at its idle voltage, and swaps in
+ *         the new offset with a single store. A load drawing less than
+ *         RECAL_MAX_STEP counts through the diode can not be told from drift.
+ */
+static INLINE void RecalibrateSample(void)
+{
+    const int idle = s_idleVRaw;
+    const int delta = (int)s_feedbackVRaw - idle;
+    if (delta > (idle >> RECAL_IDLE_SHIFT) || delta < -(idle >> RECAL_IDLE_SHIFT))
+    {
+        s_recalCount = 0;
+        return;
+    }
+
+    const uint16_t count = ++s_recalCount;
+    if (count <= RECAL_SETTLE)
+    {
+        s_recalSum = 0;
+        return;
+    }
+
+    s_recalSum += s_feedbackIRaw;
+    if (count < RECAL_SAMPLES)
+    {
+        return;
+    }
+
+    // Keep tracking for as long as the output stays off
+    s_recalCount = RECAL_SETTLE;
+    const int offset = s_recalSum >> RECAL_SHIFT;
+    s_recalSum = 0;
+
+    const int step = offset - s_currentOffset;
+    const int drift = offset - s_bootOffset;
+    if (step > RECAL_MAX_STEP || step < -RECAL_MAX_STEP || drift > RECAL_MAX_DRIFT || drift < -RECAL_MAX_DRIFT)
+    {
+        return;
+    }
+
+    s_currentOffset = offset;
+    s_recalibrations++;
+}
+
+/**
+ * @brief  Seed the PID integrator from the saved operating point
+ * @param  None
+ * @return None
+ * @note   Falls back to the normal soft start if the input voltage moved.
+ */
+static INLINE void ApplyWarmStart(void)
+{
+    if (!s_warmStartPending)
+    {
+        return;
+    }
+    s_warmStartPending = false;
+
+    const int delta = (int)s_idleVRaw - s_warmStartInputRaw;
+    const int tolerance = WARM_START_INPUT_TOLERANCE(s_warmStartInputRaw);
+    if (delta > tolerance || delta < -tolerance)
+    {
+        return;
+    }
 
-    LOGD(TAG, "Current offset: %d", s_currentOffset);
+    s_eI = s_warmStartEI;
+    s_innerI = s_warmStartDuty << CASCADE_KII_SHIFT;
+    s_warmStarted = true;
 }
 
 //------------------------------------------------------------------------------
@@ -17,13 +17,23 @@ extern "C" {
 // Module includes
 //------------------------------------------------------------------------------
 #include "funconfig.h"
+#include "trace.h"
 #include <assert.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 //------------------------------------------------------------------------------
 // Module exported defines
 //------------------------------------------------------------------------------
 
+// The PID shifts BoostPWM_SetPidGains() accepts, main_sim tune checks that
+// every set in the range settles. A stronger integral oscillates. The error
+// moves a few counts per sample, so the derivative is gone past a shift of 3.
+#define BOOST_PID_KP_SHIFT_MAX (4)
+#define BOOST_PID_KD_SHIFT_MAX (3)
+#define BOOST_PID_KI_SHIFT_MIN (6)
+#define BOOST_PID_KI_SHIFT_MAX (9)
+
 //------------------------------------------------------------------------------
 // Module exported type definitions
 //------------------------------------------------------------------------------
@@ -33,17 +43,127 @@ typedef struct __attribute__((packed))
     uint16_t current;
     uint8_t duty;
     uint8_t ccMode;
+    uint8_t currentFraction; // Current below 1mA, in 1/256mA
 } BoostState_t;
 
 static_assert(sizeof(BoostState_t) <= BOOST_REPORT_SIZE, "BoostState_t too big, adjust BOOST_REPORT_SIZE in usb_config.h");
 
+typedef struct __attribute__((packed))
+{
+    int16_t currentOffset;   // Current sensor offset in ADC counts
+    int16_t offsetDrift;     // Offset change since the boot calibration
+    uint16_t recalibrations; // Number of background recalibrations
+} BoostCalibration_t;
+
+typedef struct
+{
+    int16_t voltage; // Output voltage gain correction, in 2^-16 units
+    int16_t current; // Output current gain correction, in 2^-16 units
+} BoostTrim_t;
+
+static_assert(sizeof(BoostCalibration_t) <= BOOST_REPORT_SIZE, "BoostCalibration_t too big, adjust BOOST_REPORT_SIZE in usb_config.h");
+
+typedef enum
+{
+    eBOOST_CONTROLLER_PID = 0,
+    eBOOST_CONTROLLER_CASCADE,
+    eBOOST_CONTROLLER_COUNT,
+} BoostController_e;
+
+typedef enum
+{
+    eBOOST_MODE_CV = 0, // Constant voltage with current limit
+    eBOOST_MODE_CP,     // Constant power, capped by the voltage and current limits
+    eBOOST_MODE_CR,     // Constant voltage behind a source resistance
+    eBOOST_MODE_COUNT,
+} BoostMode_e;
+
+typedef enum
+{
+    eBOOST_FAULT_NONE = 0, // Hold the current limit
+    eBOOST_FAULT_FOLDBACK, // Lower the current limit as the output collapses
+    eBOOST_FAULT_HICCUP,   // Switch off and retry with exponential back-off
+    eBOOST_FAULT_COUNT,
+} BoostFaultMode_e;
+
+typedef struct
+{
+    uint16_t kneeMillivolts; // Output voltage below which the output is considered shorted
+    uint16_t floorMilliamps; // Foldback current limit at 0V
+    uint16_t retryMs;        // Initial hiccup off time, doubles on every trip
+    uint8_t mode;            // BoostFaultMode_e
+    uint8_t reserved;
+} BoostFaultConfig_t;
+
+typedef struct
+{
+    int32_t integrator;       // PID integrator at the settled point
+    uint16_t inputMillivolts; // Output voltage at zero duty, follows the input
+    uint8_t duty;             // Settled duty cycle
+    uint8_t valid;
+} BoostWarmStart_t;
+
+typedef struct
+{
+    uint16_t millivolts;
+    uint16_t milliamps;
+    bool settled; // false if the loop did not settle before the timeout
+} BoostMeasurement_t;
+
+typedef struct
+{
+    uint8_t kpShift; // Each term is its error shifted right by this amount
+    uint8_t kdShift;
+    uint8_t kiShift;
+    uint8_t reserved;
+} BoostPidGains_t;
+
+typedef struct __attribute__((packed))
+{
+    uint16_t settlingUs; // 0xffff if it did not settle
+    uint16_t overshootMillivolts;
+    uint16_t rippleMillivolts; // Peak to peak once settled
+    uint8_t complete;
+} BoostStepResponse_t;
+
+static_assert(sizeof(BoostStepResponse_t) <= BOOST_REPORT_SIZE, "BoostStepResponse_t too big, adjust BOOST_REPORT_SIZE in usb_config.h");
+
 //------------------------------------------------------------------------------
 // Module exported functions
 //------------------------------------------------------------------------------
 void BoostPWM_Init(void);
+void BoostPWM_Task(void);
 void BoostPWM_SetVoltageTarget(uint32_t millivolts);
 void BoostPWM_SetCurrentLimit(uint32_t milliamps);
 void BoostPWM_GetState(BoostState_t *state);
+bool BoostPWM_IsCalibrated(void);
+int16_t BoostPWM_GetCurrentOffset(void);
+bool BoostPWM_GetWarmStart(BoostWarmStart_t *warmStart);
+void BoostPWM_SetWarmStart(const BoostWarmStart_t *warmStart);
+bool BoostPWM_IsWarmStarted(void);
+void BoostPWM_SetOutputEnabled(bool enabled);
+bool BoostPWM_IsOutputEnabled(void);
+void BoostPWM_ResetController(void);
+uint32_t BoostPWM_GetTurnOnTime(void);
+void BoostPWM_SetController(BoostController_e controller);
+BoostController_e BoostPWM_GetController(void);
+void BoostPWM_SetMode(BoostMode_e mode);
+BoostMode_e BoostPWM_GetMode(void);
+void BoostPWM_SetPowerTarget(uint32_t milliwatts);
+void BoostPWM_SetSourceResistance(uint32_t milliohms);
+void BoostPWM_SetFaultConfig(const BoostFaultConfig_t *config);
+uint16_t BoostPWM_GetFaultCount(void);
+bool BoostPWM_IsFaulted(void);
+void BoostPWM_GetCalibration(BoostCalibration_t *calibration);
+void BoostPWM_SetTrim(const BoostTrim_t *trim);
+void BoostPWM_StartMeasurement(void);
+bool BoostPWM_GetMeasurement(BoostMeasurement_t *measurement);
+void BoostPWM_SetPidGains(const BoostPidGains_t *gains);
+void BoostPWM_GetPidGains(BoostPidGains_t *gains);
+void BoostPWM_GetStepResponse(BoostStepResponse_t *response);
+#if CONFIG_HOST_BUILD
+void BoostPWM_Seed(const TraceSeed_t *seed);
+#endif
 
 //------------------------------------------------------------------------------
 // Module exported variables
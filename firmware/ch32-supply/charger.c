@@ -0,0 +1,283 @@
+//------------------------------------------------------------------------------
+//       Filename: charger.c
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Implements the Battery Charger API
+//------------------------------------------------------------------------------
+//       Notes : The supply's own CC/CV regulation does the charging, this
+//               module only follows the phase and ends the charge. The
+//               termination rules run from the control loop on the 1ms
+//               decimated measurements, so they do not depend on the main
+//               loop or the host being responsive.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#include "charger.h"
+#include "boost.h"
+#include "log.h"
+
+#if CONFIG_ENABLE_CHARGER
+
+//------------------------------------------------------------------------------
+// Module constant defines
+//------------------------------------------------------------------------------
+#define TAG "charger"
+
+#define MS_PER_MINUTE (60UL * 1000)
+
+// Phase changes and taper termination must hold for this long
+#define CHARGER_DEBOUNCE_MS (1000)
+
+// -dV detection, the voltage is low-pass filtered over ~256ms and the check
+// is held off while the pack voltage settles after connecting the charge
+#define CHARGER_FILTER_SHIFT     (8)
+#define CHARGER_DELTA_V_BLANKING (5 * MS_PER_MINUTE)
+
+//------------------------------------------------------------------------------
+// External variables
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// External functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module type definitions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module static variables
+//------------------------------------------------------------------------------
+static ChargerConfig_t s_config = {0};
+static uint32_t s_timeoutMs = 0;
+
+// Shared with the control loop
+static volatile ChargerState_e s_state = eCHARGER_STATE_IDLE;
+static volatile ChargerEnd_e s_reason = eCHARGER_END_NONE;
+static volatile uint32_t s_elapsedMs = 0;
+static volatile uint16_t s_peakMillivolts = 0;
+static uint32_t s_filtered = 0;
+static uint16_t s_debounce = 0;
+
+static ChargerState_e s_lastState = eCHARGER_STATE_IDLE;
+
+//------------------------------------------------------------------------------
+// Module static function prototypes
+//------------------------------------------------------------------------------
+static void End(ChargerState_e state, ChargerEnd_e reason);
+
+//------------------------------------------------------------------------------
+// Module externally exported functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  Set the charge profile
+ * @param  config - the charge profile
+ * @return None
+ * @note   Takes effect on the next Charger_Start()
+ */
+void Charger_SetConfig(const ChargerConfig_t *config)
+{
+    s_config = *config;
+}
+
+/**
+ * @brief  Start charging with the configured profile
+ * @param  None
+ * @return true if the charge was started
+ * @note   The caller is expected to restore its setpoints once Charger_Task()
+ *         reports the end of the charge.
+ */
+bool Charger_Start(void)
+{
+    if (s_config.voltageMillivolts == 0 || s_config.currentMilliamps == 0)
+    {
+        LOGE(TAG, "Invalid profile: %dmV, %dmA", s_config.voltageMillivolts, s_config.currentMilliamps);
+        return false;
+    }
+
+    s_state = eCHARGER_STATE_IDLE;
+    s_timeoutMs = s_config.timeoutMinutes * MS_PER_MINUTE;
+    s_reason = eCHARGER_END_NONE;
+    s_elapsedMs = 0;
+    s_peakMillivolts = 0;
+    s_filtered = 0;
+    s_debounce = 0;
+
+    BoostPWM_SetMode(eBOOST_MODE_CV);
+    BoostPWM_SetVoltageTarget(s_config.voltageMillivolts);
+    BoostPWM_SetCurrentLimit(s_config.currentMilliamps);
+    BoostPWM_SetOutputEnabled(true);
+
+    s_state = eCHARGER_STATE_CC;
+    return true;
+}
+
+/**
+ * @brief  Stop charging and turn the output off
+ * @param  None
+ * @return None
+ */
+void Charger_Stop(void)
+{
+    if (Charger_IsRunning())
+    {
+        End(eCHARGER_STATE_ABORTED, eCHARGER_END_STOPPED);
+    }
+}
+
+/**
+ * @brief  Follow the charge, called from the main loop
+ * @param  None
+ * @return true if the charge ended since the last call
+ */
+bool Charger_Task(void)
+{
+    if (Charger_IsRunning() && !BoostPWM_IsOutputEnabled())
+    {
+        End(eCHARGER_STATE_ABORTED, eCHARGER_END_STOPPED);
+    }
+
+    const ChargerState_e state = s_state;
+    if (state == s_lastState)
+    {
+        return false;
+    }
+
+    const bool wasRunning = s_lastState == eCHARGER_STATE_CC || s_lastState == eCHARGER_STATE_CV;
+    s_lastState = state;
+
+    switch (state)
+    {
+        case eCHARGER_STATE_CC:
+            LOGI(TAG, "CC: %dmA up to %dmV", s_config.currentMilliamps, s_config.voltageMillivolts);
+            break;
+        case eCHARGER_STATE_CV:
+            LOGI(TAG, "CV after %ds", s_elapsedMs / 1000);
+            break;
+        case eCHARGER_STATE_DONE:
+        case eCHARGER_STATE_ABORTED:
+            LOGI(TAG, "Ended after %ds, reason: %d, peak: %dmV", s_elapsedMs / 1000, s_reason, s_peakMillivolts);
+            break;
+        default:
+            break;
+    }
+
+    return wasRunning && !Charger_IsRunning();
+}
+
+/**
+ * @brief  Check if a charge is in progress
+ * @param  None
+ * @return true if charging
+ */
+bool Charger_IsRunning(void)
+{
+    const ChargerState_e state = s_state;
+    return state == eCHARGER_STATE_CC || state == eCHARGER_STATE_CV;
+}
+
+/**
+ * @brief  Get the charge status
+ * @param[out] status - the charge status
+ * @return None
+ */
+void Charger_GetStatus(ChargerStatus_t *status)
+{
+    *status = (ChargerStatus_t){
+        .state = s_state,
+        .reason = s_reason,
+        .elapsedSeconds = s_elapsedMs / 1000,
+        .peakMillivolts = s_peakMillivolts,
+    };
+}
+
+/**
+ * @brief  Apply the termination rules, called from the control loop every 1ms
+ * @param  millivolts - the 1ms average output voltage
+ * @param  milliamps - the 1ms average output current
+ * @param  ccMode - true if the supply is current limiting
+ * @return None
+ */
+void Charger_Tick(uint16_t millivolts, uint16_t milliamps, bool ccMode)
+{
+    const ChargerState_e state = s_state;
+    if (state != eCHARGER_STATE_CC && state != eCHARGER_STATE_CV)
+    {
+        return;
+    }
+
+    const uint32_t elapsed = ++s_elapsedMs;
+
+    const uint32_t sample = (uint32_t)millivolts << CHARGER_FILTER_SHIFT;
+    if (s_filtered == 0)
+    {
+        s_filtered = sample;
+    }
+    s_filtered += ((int)sample - (int)s_filtered) >> CHARGER_FILTER_SHIFT;
+    const uint16_t filtered = s_filtered >> CHARGER_FILTER_SHIFT;
+
+    if (state == eCHARGER_STATE_CC)
+    {
+        if (filtered > s_peakMillivolts)
+        {
+            s_peakMillivolts = filtered;
+        }
+
+        if (s_config.deltaMillivolts && elapsed > CHARGER_DELTA_V_BLANKING &&
+            s_peakMillivolts - filtered >= s_config.deltaMillivolts)
+        {
+            End(eCHARGER_STATE_DONE, eCHARGER_END_DELTA_V);
+            return;
+        }
+
+        // The supply leaves current limiting once the pack reaches the CV voltage
+        s_debounce = ccMode ? 0 : s_debounce + 1;
+        if (s_debounce >= CHARGER_DEBOUNCE_MS)
+        {
+            s_debounce = 0;
+            s_state = eCHARGER_STATE_CV;
+        }
+    }
+    else
+    {
+        const bool tapered = s_config.terminationMilliamps && milliamps < s_config.terminationMilliamps;
+        s_debounce = tapered ? s_debounce + 1 : 0;
+        if (s_debounce >= CHARGER_DEBOUNCE_MS)
+        {
+            End(eCHARGER_STATE_DONE, eCHARGER_END_TAPER);
+            return;
+        }
+    }
+
+    if (s_timeoutMs && elapsed >= s_timeoutMs)
+    {
+        End(eCHARGER_STATE_DONE, eCHARGER_END_TIMER);
+    }
+}
+
+//------------------------------------------------------------------------------
+// Module static functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  End the charge and turn the output off
+ * @param  state - the final state
+ * @param  reason - why the charge ended
+ * @return None
+ */
+static void End(ChargerState_e state, ChargerEnd_e reason)
+{
+    BoostPWM_SetOutputEnabled(false);
+    s_reason = reason;
+    s_state = state;
+}
+
+#endif // CONFIG_ENABLE_CHARGER
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
@@ -0,0 +1,90 @@
+//------------------------------------------------------------------------------
+//       Filename: charger.h
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Defines the Battery Charger API
+//------------------------------------------------------------------------------
+//       Notes : None
+//------------------------------------------------------------------------------
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#include "funconfig.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+//------------------------------------------------------------------------------
+// Module exported defines
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module exported type definitions
+//------------------------------------------------------------------------------
+typedef enum
+{
+    eCHARGER_STATE_IDLE = 0,
+    eCHARGER_STATE_CC,
+    eCHARGER_STATE_CV,
+    eCHARGER_STATE_DONE,
+    eCHARGER_STATE_ABORTED,
+} ChargerState_e;
+
+typedef enum
+{
+    eCHARGER_END_NONE = 0,
+    eCHARGER_END_TAPER,   // CV current fell below the termination current
+    eCHARGER_END_DELTA_V, // Voltage dropped from its peak while in CC (NiMH)
+    eCHARGER_END_TIMER,   // Safety timer expired
+    eCHARGER_END_STOPPED, // Stopped by the user or the output was turned off
+} ChargerEnd_e;
+
+typedef struct
+{
+    uint16_t voltageMillivolts;    // CV voltage, the pack's full charge voltage
+    uint16_t currentMilliamps;     // CC current
+    uint16_t terminationMilliamps; // End the CV phase below this current, 0 to disable
+    uint16_t timeoutMinutes;       // Safety timer, 0 to disable
+    uint16_t deltaMillivolts;      // End the CC phase on this drop from the peak, 0 to disable
+    uint16_t reserved;
+} ChargerConfig_t;
+
+typedef struct __attribute__((packed))
+{
+    uint8_t state;  // ChargerState_e
+    uint8_t reason; // ChargerEnd_e
+    uint16_t elapsedSeconds;
+    uint16_t peakMillivolts;
+} ChargerStatus_t;
+
+static_assert(sizeof(ChargerStatus_t) <= BOOST_REPORT_SIZE, "ChargerStatus_t too big, adjust BOOST_REPORT_SIZE in usb_config.h");
+
+//------------------------------------------------------------------------------
+// Module exported functions
+//------------------------------------------------------------------------------
+void Charger_SetConfig(const ChargerConfig_t *config);
+bool Charger_Start(void);
+void Charger_Stop(void);
+bool Charger_Task(void);
+bool Charger_IsRunning(void);
+void Charger_GetStatus(ChargerStatus_t *status);
+void Charger_Tick(uint16_t millivolts, uint16_t milliamps, bool ccMode);
+
+//------------------------------------------------------------------------------
+// Module exported variables
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+#ifdef __cplusplus
+}
+#endif
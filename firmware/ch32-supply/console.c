@@ -0,0 +1,200 @@
+//------------------------------------------------------------------------------
+//       Filename: console.c
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Implements the debugger console API
+//------------------------------------------------------------------------------
+//       Notes : Everything runs in the main loop, input arrives from
+//               poll_input() in Console_Task(), so the buffers need no
+//               locking. The indices run free and are masked on access.
+//               On the host stdout is routed through Console_Write().
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#include "console.h"
+#include "hal.h"
+#include <stdbool.h>
+
+//------------------------------------------------------------------------------
+// Module constant defines
+//------------------------------------------------------------------------------
+#define RX_MASK (CONFIG_CONSOLE_RX_SIZE - 1)
+#define TX_MASK (CONFIG_CONSOLE_TX_SIZE - 1)
+
+_Static_assert((CONFIG_CONSOLE_RX_SIZE & RX_MASK) == 0, "RX size must be a power of two");
+_Static_assert((CONFIG_CONSOLE_TX_SIZE & TX_MASK) == 0, "TX size must be a power of two");
+_Static_assert(CONFIG_CONSOLE_RX_SIZE <= 256, "RX indices are 8 bit");
+_Static_assert(sizeof(CONSOLE_DROPPED_MARK) - 1 < CONFIG_CONSOLE_TX_SIZE, "The mark must fit in the buffer");
+
+//------------------------------------------------------------------------------
+// External variables
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// External functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module type definitions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module static variables
+//------------------------------------------------------------------------------
+static uint8_t s_rx[CONFIG_CONSOLE_RX_SIZE];
+static uint8_t s_rxHead = 0;
+static uint8_t s_rxTail = 0;
+
+static uint8_t s_tx[CONFIG_CONSOLE_TX_SIZE];
+static uint16_t s_txHead = 0;
+static uint16_t s_txTail = 0;
+static bool s_txDropped = false;
+
+//------------------------------------------------------------------------------
+// Module static function prototypes
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module externally exported functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  Move console bytes over the debugger link, call once per main loop
+ * @param  None
+ * @return None
+ * @note   At most one frame goes out per call, the debugger reads it back
+ *         in its own time and the next call finds the link busy until then
+ */
+void Console_Task(void)
+{
+    HAL_Console_Poll();
+
+    if (!HAL_Console_TxReady())
+    {
+        return;
+    }
+
+    uint8_t frame[HAL_CONSOLE_FRAME_SIZE];
+    uint32_t size = 0;
+    while (size < sizeof(frame) && s_txTail != s_txHead)
+    {
+        frame[size++] = s_tx[s_txTail++ & TX_MASK];
+    }
+    HAL_Console_Send(frame, size);
+}
+
+/**
+ * @brief  Debugger input handler
+ * @param  numbytes - the number of bytes received
+ * @param  data - the data (8 bytes)
+ * @return None
+ * @note   Bytes that do not fit are dropped
+ */
+void handle_debug_input(int numbytes, uint8_t *data)
+{
+    for (int i = 0; i < numbytes; i++)
+    {
+        if ((uint8_t)(s_rxHead - s_rxTail) == CONFIG_CONSOLE_RX_SIZE)
+        {
+            break;
+        }
+        s_rx[s_rxHead++ & RX_MASK] = data[i];
+    }
+}
+
+/**
+ * @brief  Get the next character from the debugger
+ * @param  None
+ * @return the next character or -1 if no character is available
+ */
+int Console_Read(void)
+{
+    if (s_rxTail == s_rxHead)
+    {
+        return -1;
+    }
+    return s_rx[s_rxTail++ & RX_MASK];
+}
+
+/**
+ * @brief  Copy bytes into the output buffer
+ * @param  buf - the bytes
+ * @param  size - the number of bytes
+ * @return the number of bytes queued, the rest are dropped
+ * @note   Never waits. After a drop nothing is queued until there is room
+ *         for CONSOLE_DROPPED_MARK, which goes first.
+ */
+int Console_Write(const char *buf, int size)
+{
+    static const char mark[] = CONSOLE_DROPPED_MARK;
+    if (s_txDropped)
+    {
+        if (Console_TxFree() < sizeof(mark) - 1 + (uint32_t)(size > 0))
+        {
+            return 0;
+        }
+        s_txDropped = false;
+        for (uint32_t i = 0; i < sizeof(mark) - 1; i++)
+        {
+            s_tx[s_txHead++ & TX_MASK] = mark[i];
+        }
+    }
+
+    int queued = 0;
+    while (queued < size && Console_TxFree())
+    {
+        s_tx[s_txHead++ & TX_MASK] = buf[queued++];
+    }
+    s_txDropped = queued < size;
+    return queued;
+}
+
+/**
+ * @brief  Room left in the output buffer
+ * @param  None
+ * @return the bytes that can be written without a drop
+ */
+uint32_t Console_TxFree(void)
+{
+    return CONFIG_CONSOLE_TX_SIZE - (uint16_t)(s_txHead - s_txTail);
+}
+
+#if !CONFIG_HOST_BUILD
+
+/**
+ * @brief  Queue a character for the debugger
+ * @param  c - the character
+ * @return the character
+ */
+int putchar(int c)
+{
+    const char ch = (char)c;
+    Console_Write(&ch, 1);
+    return c;
+}
+
+/**
+ * @brief  Queue printf() output for the debugger, replaces ch32v003fun's
+ * @param  fd - unused
+ * @param  buf - the bytes
+ * @param  size - the number of bytes
+ * @return size, whether or not it all fitted
+ */
+int _write(int fd, const char *buf, int size)
+{
+    Console_Write(buf, size);
+    return size;
+}
+
+#endif // !CONFIG_HOST_BUILD
+
+//------------------------------------------------------------------------------
+// Module static functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
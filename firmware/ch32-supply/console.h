@@ -0,0 +1,69 @@
+//------------------------------------------------------------------------------
+//       Filename: console.h
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Defines the debugger console API
+//------------------------------------------------------------------------------
+//       Notes : Console_Read() and putchar() (and printf() through _write())
+//               go to ring buffers. Console_Task() moves the bytes over the
+//               debug link, one frame per main loop iteration, so the console
+//               does not change the loop timing. Writing never waits, output
+//               that does not fit is dropped and the next output that does
+//               starts with CONSOLE_DROPPED_MARK to show the gap. Check
+//               Console_TxFree() before a burst, see the lines logged when
+//               the debugger attaches in main.c.
+//               On the host stdout goes through Console_Write() too, see
+//               host/host.c.
+//------------------------------------------------------------------------------
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#include <stdint.h>
+
+//------------------------------------------------------------------------------
+// Module exported defines
+//------------------------------------------------------------------------------
+
+// Must be powers of two
+#ifndef CONFIG_CONSOLE_RX_SIZE
+#define CONFIG_CONSOLE_RX_SIZE (8)
+#endif
+
+// Long enough for one line of a burst, main.c paces them, see LOG_LINE_SIZE
+#ifndef CONFIG_CONSOLE_TX_SIZE
+#define CONFIG_CONSOLE_TX_SIZE (128)
+#endif
+
+// Written ahead of the output that follows a drop
+#define CONSOLE_DROPPED_MARK "\r\n[...]\r\n"
+
+//------------------------------------------------------------------------------
+// Module exported type definitions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module exported functions
+//------------------------------------------------------------------------------
+void Console_Task(void);
+int Console_Read(void);
+int Console_Write(const char *buf, int size);
+uint32_t Console_TxFree(void);
+
+//------------------------------------------------------------------------------
+// Module exported variables
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,399 @@
+//------------------------------------------------------------------------------
+//       Filename: fra.c
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Implements the Frequency Response Analyser API
+//------------------------------------------------------------------------------
+//       Notes : The loop gain is measured by adding a sine to the controller
+//               output (u) and correlating both u and the perturbed duty (v)
+//               against the injected sine, a single bin DFT per frequency.
+//               T(jw) = -U/V, no ADC samples are needed since both signals
+//               are known exactly in the control loop.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#include "fra.h"
+#include "log.h"
+#include "timebase.h"
+
+#if CONFIG_ENABLE_FRA
+
+//------------------------------------------------------------------------------
+// Module constant defines
+//------------------------------------------------------------------------------
+#define TAG "fra"
+
+// 64 entry sine table in Q7, indexed by the top bits of the phase
+#define SINE_BITS    (6)
+#define SINE_SHIFT   (32 - SINE_BITS)
+#define SINE_QUARTER (1 << (SINE_BITS - 2))
+#define SINE_MASK    ((1 << SINE_BITS) - 1)
+#define SINE_Q       (7)
+
+// Each point settles for a few periods and then integrates whole periods
+// for at least FRA_MIN_SAMPLES, which keeps the accumulators within 31 bits
+#define FRA_SETTLE_PERIODS (4)
+#define FRA_MIN_SETTLE     (1024)
+#define FRA_MIN_SAMPLES    (8192)
+
+// The slowest point (50Hz) takes ~200ms. A point still running after this
+// long means the loop stopped regulating, with a zero target or a hiccup,
+// and is no longer calling FRA_Inject(), so the sweep is aborted
+#define FRA_POINT_TIMEOUT_MS (1000)
+
+// Results are saturated to this Q6 gain
+#define GAIN_SHIFT (6)
+#define GAIN_MAX   (0xffff)
+
+// Headroom for the CORDIC, which grows the magnitude by ~1.65
+#define CORDIC_LIMIT      (1 << 28)
+#define CORDIC_ITERATIONS (14)
+#define DEGREES_180       (18000)
+
+//------------------------------------------------------------------------------
+// External variables
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// External functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module type definitions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module static variables
+//------------------------------------------------------------------------------
+static const int8_t s_sine[1 << SINE_BITS] = {
+    0, 12, 25, 37, 49, 60, 71, 81, 90, 98, 106, 112, 117, 122, 125, 126,
+    127, 126, 125, 122, 117, 112, 106, 98, 90, 81, 71, 60, 49, 37, 25, 12,
+    0, -12, -25, -37, -49, -60, -71, -81, -90, -98, -106, -112, -117, -122, -125, -126,
+    -127, -126, -125, -122, -117, -112, -106, -98, -90, -81, -71, -60, -49, -37, -25, -12};
+
+// atan(2^-i) in 0.01 degrees
+static const int16_t s_atan[CORDIC_ITERATIONS] = {
+    4500, 2657, 1404, 713, 358, 179, 90, 45, 22, 11, 6, 3, 1, 1};
+
+// Roughly logarithmic sweep, from well below to well above the crossover
+static const uint16_t s_frequencies[FRA_POINTS] = {
+    50, 75, 100, 150, 200, 300, 500, 750,
+    1000, 1500, 2000, 3000, 5000, 7500, 10000, 15000};
+
+static uint32_t s_sampleHz = 0;
+static FraReport_t s_report = {0};
+static uint32_t s_pointStartMs = 0;
+
+// Shared with the control loop
+static volatile bool s_active = false;
+static volatile bool s_pointReady = false;
+static uint32_t s_phase = 0;
+static uint32_t s_phaseInc = 0;
+static int s_amplitude = FRA_DEFAULT_AMPLITUDE;
+static uint32_t s_settle = 0;
+static uint32_t s_remaining = 0;
+static int s_dc = 0;
+static int32_t s_uRe = 0;
+static int32_t s_uIm = 0;
+static int32_t s_vRe = 0;
+static int32_t s_vIm = 0;
+
+//------------------------------------------------------------------------------
+// Module static function prototypes
+//------------------------------------------------------------------------------
+static void StartPoint(uint16_t frequency);
+static void FinishPoint(FraPoint_t *point);
+static int Cordic(int32_t *x, int32_t *y);
+
+//------------------------------------------------------------------------------
+// Module externally exported functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  Initialise the analyser
+ * @param  sampleHz - the control loop rate
+ * @return None
+ */
+void FRA_Init(uint32_t sampleHz)
+{
+    s_sampleHz = sampleHz;
+}
+
+/**
+ * @brief  Start a sweep, the output must be on and regulating
+ * @param  amplitude - perturbation amplitude in duty counts, 0 for the default
+ * @return None
+ */
+void FRA_Start(uint8_t amplitude)
+{
+    s_active = false;
+    s_pointReady = false;
+    s_amplitude = amplitude ? amplitude : FRA_DEFAULT_AMPLITUDE;
+    s_report.count = 0;
+    s_report.state = eFRA_STATE_RUNNING;
+    LOGI(TAG, "Sweep started, amplitude: %d", s_amplitude);
+}
+
+/**
+ * @brief  Abort a running sweep, the points measured so far are kept
+ * @param  None
+ * @return None
+ */
+void FRA_Stop(void)
+{
+    s_active = false;
+    if (s_report.state == eFRA_STATE_RUNNING)
+    {
+        s_report.state = eFRA_STATE_ABORTED;
+        LOGW(TAG, "Sweep aborted after %d points", s_report.count);
+    }
+}
+
+/**
+ * @brief  Advance the sweep, called from the main loop
+ * @param  None
+ * @return None
+ */
+void FRA_Task(void)
+{
+    if (s_report.state != eFRA_STATE_RUNNING)
+    {
+        return;
+    }
+
+    if (s_active)
+    {
+        if (Timebase_Millis() - s_pointStartMs > FRA_POINT_TIMEOUT_MS)
+        {
+            LOGW(TAG, "%dHz timed out", s_report.points[s_report.count].frequency);
+            FRA_Stop();
+        }
+        return;
+    }
+
+    if (s_pointReady)
+    {
+        s_pointReady = false;
+        FraPoint_t *point = &s_report.points[s_report.count];
+        FinishPoint(point);
+        LOGI(TAG, "%5dHz: Gain: %d/64, Phase: %d/100deg", point->frequency, point->gain, point->phase);
+        s_report.count++;
+    }
+
+    if (s_report.count >= FRA_POINTS)
+    {
+        s_report.state = eFRA_STATE_DONE;
+        LOGI(TAG, "Sweep done");
+        return;
+    }
+
+    StartPoint(s_frequencies[s_report.count]);
+}
+
+/**
+ * @brief  Check if a sweep is in progress
+ * @param  None
+ * @return true if running
+ */
+bool FRA_IsRunning(void)
+{
+    return s_report.state == eFRA_STATE_RUNNING;
+}
+
+/**
+ * @brief  Get the sweep results
+ * @param  None
+ * @return pointer to the report
+ */
+const FraReport_t *FRA_GetReport(void)
+{
+    return &s_report;
+}
+
+/**
+ * @brief  Perturb the duty cycle and correlate, called from the control loop
+ * @param  duty - the controller output
+ * @return the perturbed duty cycle
+ */
+int FRA_Inject(int duty)
+{
+    if (!s_active)
+    {
+        return duty;
+    }
+
+    s_phase += s_phaseInc;
+    const uint32_t index = s_phase >> SINE_SHIFT;
+    const int sine = s_sine[index];
+    const int cosine = s_sine[(index + SINE_QUARTER) & SINE_MASK];
+    const int perturbed = duty + ((sine * s_amplitude) >> SINE_Q);
+
+    if (s_settle)
+    {
+        if (--s_settle == 0)
+        {
+            s_dc = duty;
+        }
+        return perturbed;
+    }
+
+    // Remove the operating point so leakage from it does not swamp the bin
+    const int u = duty - s_dc;
+    const int v = perturbed - s_dc;
+    s_uRe += u * sine;
+    s_uIm += u * cosine;
+    s_vRe += v * sine;
+    s_vIm += v * cosine;
+
+    if (--s_remaining == 0)
+    {
+        s_active = false;
+        s_pointReady = true;
+    }
+
+    return perturbed;
+}
+
+//------------------------------------------------------------------------------
+// Module static functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  Set up the control loop for the next frequency
+ * @param  frequency - the frequency in Hz
+ * @return None
+ */
+static void StartPoint(uint16_t frequency)
+{
+    // phaseInc = f * 2^32 / fs, in two steps to stay within 32 bits
+    const uint32_t scaled = (uint32_t)frequency << 16;
+    const uint32_t remainder = scaled % s_sampleHz;
+    const uint32_t phaseInc = ((scaled / s_sampleHz) << 16) + (((remainder << 15) / s_sampleHz) << 1);
+
+    // Integrate over whole periods
+    const uint32_t periods = ((uint32_t)FRA_MIN_SAMPLES * frequency + s_sampleHz - 1) / s_sampleHz;
+    const uint32_t samples = (periods * s_sampleHz) / frequency;
+    const uint32_t settle = (FRA_SETTLE_PERIODS * s_sampleHz) / frequency;
+
+    s_report.points[s_report.count].frequency = frequency;
+
+    s_phase = 0;
+    s_phaseInc = phaseInc;
+    s_settle = settle > FRA_MIN_SETTLE ? settle : FRA_MIN_SETTLE;
+    s_remaining = samples;
+    s_uRe = 0;
+    s_uIm = 0;
+    s_vRe = 0;
+    s_vIm = 0;
+    s_pointStartMs = Timebase_Millis();
+    s_active = true;
+}
+
+/**
+ * @brief  Convert the accumulated bins to a loop gain point
+ * @param[out]  point - the point to fill in, frequency already set
+ * @return None
+ */
+static void FinishPoint(FraPoint_t *point)
+{
+    int32_t uRe = s_uRe;
+    int32_t uIm = s_uIm;
+    int32_t vRe = s_vRe;
+    int32_t vIm = s_vIm;
+
+    // Scale all bins together so the ratio is kept
+    int32_t largest = 0;
+    const int32_t bins[] = {uRe, uIm, vRe, vIm};
+    for (unsigned i = 0; i < sizeof(bins) / sizeof(bins[0]); i++)
+    {
+        const int32_t magnitude = bins[i] < 0 ? -bins[i] : bins[i];
+        largest = magnitude > largest ? magnitude : largest;
+    }
+    while (largest >= CORDIC_LIMIT)
+    {
+        largest >>= 1;
+        uRe >>= 1;
+        uIm >>= 1;
+        vRe >>= 1;
+        vIm >>= 1;
+    }
+
+    // Both magnitudes carry the same CORDIC gain, which cancels in the ratio
+    const int uPhase = Cordic(&uRe, &uIm);
+    const int vPhase = Cordic(&vRe, &vIm);
+
+    uint32_t uMagnitude = uRe;
+    uint32_t vMagnitude = vRe;
+    while (uMagnitude >= (1u << (31 - GAIN_SHIFT)))
+    {
+        uMagnitude >>= 1;
+        vMagnitude >>= 1;
+    }
+
+    uint32_t gain = GAIN_MAX;
+    if (vMagnitude != 0)
+    {
+        gain = (uMagnitude << GAIN_SHIFT) / vMagnitude;
+        gain = gain < GAIN_MAX ? gain : GAIN_MAX;
+    }
+
+    // T = -U/V
+    int phase = uPhase - vPhase + DEGREES_180;
+    while (phase > DEGREES_180)
+    {
+        phase -= 2 * DEGREES_180;
+    }
+    while (phase <= -DEGREES_180)
+    {
+        phase += 2 * DEGREES_180;
+    }
+
+    point->gain = gain;
+    point->phase = phase;
+}
+
+/**
+ * @brief  CORDIC vectoring, rotates the vector onto the positive x axis
+ * @param[in,out]  x - real part, the scaled magnitude on return
+ * @param[in,out]  y - imaginary part, ~0 on return
+ * @return the angle of the vector in 0.01 degrees
+ */
+static int Cordic(int32_t *x, int32_t *y)
+{
+    int angle = 0;
+    if (*x < 0)
+    {
+        *x = -*x;
+        *y = -*y;
+        angle = DEGREES_180;
+    }
+
+    for (int i = 0; i < CORDIC_ITERATIONS; i++)
+    {
+        const int32_t dx = *y >> i;
+        const int32_t dy = *x >> i;
+        if (*y > 0)
+        {
+            *x += dx;
+            *y -= dy;
+            angle += s_atan[i];
+        }
+        else
+        {
+            *x -= dx;
+            *y += dy;
+            angle -= s_atan[i];
+        }
+    }
+
+    return angle;
+}
+
+#endif // CONFIG_ENABLE_FRA
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
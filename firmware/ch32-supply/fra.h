@@ -0,0 +1,82 @@
+//------------------------------------------------------------------------------
+//       Filename: fra.h
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Defines the Frequency Response Analyser API
+//------------------------------------------------------------------------------
+//       Notes : None
+//------------------------------------------------------------------------------
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#include "funconfig.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+//------------------------------------------------------------------------------
+// Module exported defines
+//------------------------------------------------------------------------------
+// Number of frequencies in a sweep
+#define FRA_POINTS (16)
+
+// Default perturbation amplitude, in duty counts
+#define FRA_DEFAULT_AMPLITUDE (4)
+
+//------------------------------------------------------------------------------
+// Module exported type definitions
+//------------------------------------------------------------------------------
+typedef enum
+{
+    eFRA_STATE_IDLE = 0,
+    eFRA_STATE_RUNNING,
+    eFRA_STATE_DONE,
+    eFRA_STATE_ABORTED,
+} FraState_e;
+
+typedef struct __attribute__((packed))
+{
+    uint16_t frequency; // Hz
+    uint16_t gain;      // Loop gain magnitude, Q6
+    int16_t phase;      // Loop gain phase, 0.01 degrees
+} FraPoint_t;
+
+typedef struct __attribute__((packed))
+{
+    uint8_t state;
+    uint8_t count;
+    FraPoint_t points[FRA_POINTS];
+} FraReport_t;
+
+// The HID report count in usb_config.h is a single byte
+static_assert(sizeof(FraReport_t) < 256, "FraReport_t too big for its HID report");
+
+//------------------------------------------------------------------------------
+// Module exported functions
+//------------------------------------------------------------------------------
+void FRA_Init(uint32_t sampleHz);
+void FRA_Start(uint8_t amplitude);
+void FRA_Stop(void);
+void FRA_Task(void);
+bool FRA_IsRunning(void);
+const FraReport_t *FRA_GetReport(void);
+int FRA_Inject(int duty);
+
+//------------------------------------------------------------------------------
+// Module exported variables
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+#ifdef __cplusplus
+}
+#endif
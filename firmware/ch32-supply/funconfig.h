@@ -4,8 +4,49 @@
 // Must be a multiple of 8
 #define BOOST_REPORT_SIZE (8)
 
+// HID feature report IDs
+#define BOOST_REPORT_ID_STATE       0xaa
+#define BOOST_REPORT_ID_HISTORY     0xab
+#define BOOST_REPORT_ID_CALIBRATION 0xac
+#define BOOST_REPORT_ID_FRA         0xad
+#define BOOST_REPORT_ID_SWEEP       0xae
+#define BOOST_REPORT_ID_CHARGER     0xaf
+#define BOOST_REPORT_ID_PROFILE     0xb0
+#define BOOST_REPORT_ID_STEP        0xb1
+#define BOOST_REPORT_ID_TRACE       0xb2
+#define BOOST_REPORT_ID_CONFIG      0xb3
+#define BOOST_REPORT_ID_STATS       0xb4
+
 #define CONFIG_DEBUG_ENABLE_LOGS 1
 
+// Output limits, every setpoint taken from the host is held to these
+#define CONFIG_VOLTAGE_LIMIT    15000 // mV
+#define CONFIG_CURRENT_LIMIT    1000  // mA
+#define CONFIG_POWER_LIMIT      15000 // mW
+#define CONFIG_RESISTANCE_LIMIT 65535 // mOhm, the CR mode source resistance
+
+// Cycle counts of the hot paths, costs a few cycles per profiled scope
+#define CONFIG_ENABLE_PROFILE 0
+
+// One shot capture of the raw ADC readings, for replay on the host, the
+// simulations build it in to check the replay
+#ifndef CONFIG_ENABLE_TRACE
+#define CONFIG_ENABLE_TRACE 0
+#endif
+
+// Loop gain sweep (Bode plot), also sizes the 0xAD report in usb_config.h
+#define CONFIG_ENABLE_FRA 1
+
+// Static voltage or current sweep, the 0xAE report
+#ifndef CONFIG_ENABLE_SWEEP
+#define CONFIG_ENABLE_SWEEP 1
+#endif
+
+// CC/CV battery charger, the 0xAF report
+#ifndef CONFIG_ENABLE_CHARGER
+#define CONFIG_ENABLE_CHARGER 1
+#endif
+
 // Though this should be on by default we can extra force it on.
 #define FUNCONF_USE_DEBUGPRINTF 1
 // #define FUNCONF_DEBUGPRINTF_TIMEOUT (1 << 31) // Wait for a very very long time.
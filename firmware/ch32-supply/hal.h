@@ -0,0 +1,290 @@
+//------------------------------------------------------------------------------
+//       Filename: hal.h
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Peripheral access layer
+//------------------------------------------------------------------------------
+//       Notes : Every run time peripheral access goes through here. On the
+//               MCU each function inlines to the same register access the
+//               modules used to make directly. With CONFIG_HOST_BUILD the
+//               registers are plain memory provided by the host backend
+//               (host/), which also runs the timer, the ADC and the flash,
+//               so the whole firmware runs as a Linux process.
+//               One time peripheral set up stays in the drivers, it only
+//               writes registers, which the host backend provides as well.
+//------------------------------------------------------------------------------
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#include "funconfig.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef CONFIG_HOST_BUILD
+#define CONFIG_HOST_BUILD (0)
+#endif
+
+#if CONFIG_HOST_BUILD
+#include "host.h"
+#else
+#include "ch32v003fun.h"
+#include "ch32v003_flash.h"
+#endif
+
+//------------------------------------------------------------------------------
+// Module exported defines
+//------------------------------------------------------------------------------
+#define HAL_INLINE static inline __attribute__((always_inline))
+
+#define HAL_IWDG_KEY_ENABLE (0xCCCC)
+#define HAL_IWDG_KEY_ACCESS (0x5555)
+#define HAL_IWDG_KEY_FEED   (0xAAAA)
+
+// Console bytes per debugger data register write
+#define HAL_CONSOLE_FRAME_SIZE (7)
+
+//------------------------------------------------------------------------------
+// Module exported type definitions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module exported functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  Get the free running core cycle counter
+ * @param  None
+ * @return SysTick counter, in HCLK cycles
+ */
+HAL_INLINE uint32_t HAL_GetTicks(void)
+{
+    return SysTick->CNT;
+}
+
+/**
+ * @brief  Let the peripherals run, called once per main loop iteration
+ * @param  None
+ * @return None
+ * @note   Nothing to do on the MCU, the host backend advances simulated time
+ */
+HAL_INLINE void HAL_Yield(void)
+{
+#if CONFIG_HOST_BUILD
+    Host_Advance(CONFIG_HOST_LOOP_CYCLES);
+#endif
+}
+
+/**
+ * @brief  Start SysTick free running from HCLK, with no interrupt
+ * @param  None
+ * @return None
+ */
+HAL_INLINE void HAL_SysTick_Start(void)
+{
+    SysTick->CTLR = 0;
+    SysTick->CNT = 0;
+    SysTick->CTLR = SYSTICK_CTLR_STE | SYSTICK_CTLR_STCLK;
+}
+
+/**
+ * @brief  Set the PWM compare value, the duty cycle in timer counts
+ * @param  compare - the compare value
+ * @return None
+ */
+HAL_INLINE void HAL_PWM_SetCompare(uint8_t compare)
+{
+    TIM1->CH3CVR = compare;
+}
+
+/**
+ * @brief  Get the regular (voltage feedback) conversion
+ * @param  None
+ * @return ADC counts
+ */
+HAL_INLINE uint16_t HAL_ADC_GetRegular(void)
+{
+    return ADC1->RDATAR;
+}
+
+/**
+ * @brief  Get the first injected conversion
+ * @param  None
+ * @return ADC counts
+ * @note   Injected results come in reverse order, with VRef in the sequence
+ *         this is the current sense channel that preceded it.
+ */
+HAL_INLINE uint16_t HAL_ADC_GetInjected1(void)
+{
+    return ADC1->IDATAR1;
+}
+
+/**
+ * @brief  Get the second injected conversion
+ * @param  None
+ * @return ADC counts
+ */
+HAL_INLINE uint16_t HAL_ADC_GetInjected2(void)
+{
+    return ADC1->IDATAR2;
+}
+
+/**
+ * @brief  Set the injected sequence for the next trigger
+ * @param  isqr - the ISQR register value
+ * @return None
+ */
+HAL_INLINE void HAL_ADC_SetInjectedSequence(uint32_t isqr)
+{
+    ADC1->ISQR = isqr;
+}
+
+/**
+ * @brief  Acknowledge the pending ADC interrupts
+ * @param  None
+ * @return None
+ */
+HAL_INLINE void HAL_ADC_ClearStatus(void)
+{
+    ADC1->STATR = 0;
+}
+
+/**
+ * @brief  Reset and run the ADC self calibration
+ * @param  None
+ * @return None
+ * @note   The host ADC has no offset, its calibration finishes immediately
+ */
+HAL_INLINE void HAL_ADC_Calibrate(void)
+{
+#if CONFIG_HOST_BUILD
+    ADC1->CTLR2 &= ~(ADC_RSTCAL | ADC_CAL);
+#else
+    ADC1->CTLR2 |= ADC_RSTCAL;
+    while (ADC1->CTLR2 & ADC_RSTCAL)
+        ;
+
+    ADC1->CTLR2 |= ADC_CAL;
+    while (ADC1->CTLR2 & ADC_CAL)
+        ;
+#endif
+}
+
+/**
+ * @brief  Start the independent watchdog
+ * @param  reload - the value to reload the counter with
+ * @param  prescaler - the prescaler to use
+ * @return None
+ */
+HAL_INLINE void HAL_WDT_Init(uint16_t reload, uint8_t prescaler)
+{
+    IWDG->CTLR = HAL_IWDG_KEY_ACCESS;
+    IWDG->PSCR = prescaler;
+
+    IWDG->CTLR = HAL_IWDG_KEY_ACCESS;
+    IWDG->RLDR = reload & 0xfff;
+
+    IWDG->CTLR = HAL_IWDG_KEY_ENABLE;
+}
+
+/**
+ * @brief  Feed the watchdog
+ * @param  None
+ * @return None
+ */
+HAL_INLINE void HAL_WDT_Feed(void)
+{
+    IWDG->CTLR = HAL_IWDG_KEY_FEED;
+}
+
+/**
+ * @brief  Take any console input the debugger has left, never waits
+ * @param  None
+ * @return None
+ * @note   The input arrives through handle_debug_input()
+ */
+HAL_INLINE void HAL_Console_Poll(void)
+{
+    poll_input();
+}
+
+/**
+ * @brief  Check whether the debugger has read the last output frame
+ * @param  None
+ * @return true if HAL_Console_Send() can be called
+ */
+HAL_INLINE bool HAL_Console_TxReady(void)
+{
+#if CONFIG_HOST_BUILD
+    return Host_ConsoleReady();
+#else
+    return !(*DMDATA0 & 0x80);
+#endif
+}
+
+/**
+ * @brief  Hand one frame of console output to the debugger
+ * @param  data - the bytes to send
+ * @param  size - the number of bytes, up to HAL_CONSOLE_FRAME_SIZE
+ * @return None
+ * @note   An empty frame sends a NUL on the MCU, the debugger only sends
+ *         input when it reads output, so an idle console still has to talk
+ */
+HAL_INLINE void HAL_Console_Send(const uint8_t *data, uint32_t size)
+{
+#if CONFIG_HOST_BUILD
+    Host_ConsoleSend(data, size);
+#else
+    // Same framing as ch32v003fun's _write(): the length plus the first three
+    // bytes in DMDATA0, the other four in DMDATA1
+    uint8_t frame[8] = {0};
+    for (uint32_t i = 0; i < size; i++)
+    {
+        frame[i + 1] = data[i];
+    }
+    frame[0] = 0x80 | ((size ? size : 1) + 4);
+    *DMDATA1 = frame[4] | frame[5] << 8 | frame[6] << 16 | (uint32_t)frame[7] << 24;
+    *DMDATA0 = frame[0] | frame[1] << 8 | frame[2] << 16 | (uint32_t)frame[3] << 24;
+#endif
+}
+
+#if CONFIG_HOST_BUILD
+
+// The host flash is a RAM image of the NVS page, addressed by offset
+HAL_INLINE void HAL_Flash_Init(void) {}
+HAL_INLINE uint32_t HAL_Flash_Address(uint16_t offset) { return offset; }
+HAL_INLINE void HAL_Flash_Unlock(void) { Host_FlashUnlock(true); }
+HAL_INLINE void HAL_Flash_Lock(void) { Host_FlashUnlock(false); }
+HAL_INLINE void HAL_Flash_ErasePage(uint32_t address) { Host_FlashErase(address); }
+HAL_INLINE void HAL_Flash_Program16(uint32_t address, uint16_t value) { Host_FlashProgram(address, value); }
+HAL_INLINE uint8_t HAL_Flash_Read8(uint32_t address) { return Host_FlashRead(address); }
+
+#else
+
+HAL_INLINE void HAL_Flash_Init(void) { flash_set_latency(); }
+HAL_INLINE uint32_t HAL_Flash_Address(uint16_t offset) { return flash_calculate_runtime_address(offset); }
+HAL_INLINE void HAL_Flash_Unlock(void) { flash_unlock(); }
+HAL_INLINE void HAL_Flash_Lock(void) { flash_lock(); }
+HAL_INLINE void HAL_Flash_ErasePage(uint32_t address) { flash_erase_page(address); }
+HAL_INLINE void HAL_Flash_Program16(uint32_t address, uint16_t value) { flash_program_16(address, value); }
+HAL_INLINE uint8_t HAL_Flash_Read8(uint32_t address) { return flash_read_8_bits(address); }
+
+#endif // CONFIG_HOST_BUILD
+
+//------------------------------------------------------------------------------
+// Module exported variables
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,117 @@
+//------------------------------------------------------------------------------
+//       Filename: history.c
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Implements the telemetry history API
+//------------------------------------------------------------------------------
+//       Notes : The report is double buffered. Each sample packs the next
+//               report and then publishes it, so the USB interrupt always
+//               copies out a whole report, never one being rewritten. A
+//               transfer takes a few ms, well inside the sample period.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#include "history.h"
+#include "timebase.h"
+
+#if CONFIG_ENABLE_HISTORY
+
+//------------------------------------------------------------------------------
+// Module constant defines
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// External variables
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// External functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module type definitions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module static variables
+//------------------------------------------------------------------------------
+static TelemetrySample_t s_samples[CONFIG_HISTORY_DEPTH] = {0};
+static uint8_t s_count = 0;
+static uint32_t s_lastMillis = 0;
+static uint16_t s_sequence = 0;
+
+static HistoryReport_t s_reports[2] = {0};
+static volatile uint8_t s_published = 0;
+
+//------------------------------------------------------------------------------
+// Module static function prototypes
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module externally exported functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  Take a sample once per period, called from the main loop
+ * @param  state - the latest state
+ * @return None
+ */
+void History_Task(const BoostState_t *state)
+{
+    const uint32_t now = Timebase_Millis();
+    const uint32_t elapsed = now - s_lastMillis;
+    if (s_count && elapsed < CONFIG_HISTORY_PERIOD_MS)
+    {
+        return;
+    }
+
+    // Drop the oldest sample once full
+    if (s_count == CONFIG_HISTORY_DEPTH)
+    {
+        for (uint8_t i = 1; i < s_count; i++)
+        {
+            s_samples[i - 1] = s_samples[i];
+        }
+        s_count--;
+    }
+
+    s_samples[s_count++] = (TelemetrySample_t){
+        .voltage = state->voltage,
+        .current = state->current | (state->ccMode ? TELEMETRY_CC_MODE : 0),
+        .elapsedMs = elapsed > UINT8_MAX ? UINT8_MAX : elapsed,
+        .duty = state->duty,
+    };
+    s_lastMillis = now;
+
+    HistoryReport_t *next = &s_reports[!s_published];
+    next->count = Telemetry_Encode(s_samples, s_count, CONFIG_HISTORY_PERIOD_MS, next->data, sizeof(next->data),
+                                   &next->size);
+    next->sequence = s_sequence++;
+    next->millis = now;
+    next->periodMs = CONFIG_HISTORY_PERIOD_MS;
+
+    s_published = !s_published;
+}
+
+/**
+ * @brief  Get the history report
+ * @param  None
+ * @return the report last published
+ */
+const HistoryReport_t *History_GetReport(void)
+{
+    return &s_reports[s_published];
+}
+
+//------------------------------------------------------------------------------
+// Module static functions
+//------------------------------------------------------------------------------
+
+#endif // CONFIG_ENABLE_HISTORY
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
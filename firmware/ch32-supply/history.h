@@ -0,0 +1,84 @@
+//------------------------------------------------------------------------------
+//       Filename: history.h
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Defines the telemetry history API
+//------------------------------------------------------------------------------
+//       Notes : Keeps the most recent state samples in the form of the 0xAB
+//               feature report, so one control transfer returns a block of
+//               them instead of one 0xAA transfer per sample. The samples are
+//               packed by telemetry.c, as many of the newest as fit. Reads
+//               have no side effects, the host tells new samples from ones it
+//               already has by their sequence numbers, and a jump in them
+//               means it polled too slowly and missed some.
+//------------------------------------------------------------------------------
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#include "boost.h"
+#include "funconfig.h"
+#include "telemetry.h"
+#include <stdint.h>
+
+//------------------------------------------------------------------------------
+// Module exported defines
+//------------------------------------------------------------------------------
+#ifndef CONFIG_ENABLE_HISTORY
+#define CONFIG_ENABLE_HISTORY (1)
+#endif
+
+#ifndef CONFIG_HISTORY_PERIOD_MS
+#define CONFIG_HISTORY_PERIOD_MS (10)
+#endif
+
+// Samples kept, 160ms at the default period, three times the web UI's poll.
+// A steady but noisy output would pack ~30 into a report, but every sample
+// costs 6 bytes of RAM here whether it is sent or not.
+#ifndef CONFIG_HISTORY_DEPTH
+#define CONFIG_HISTORY_DEPTH (16)
+#endif
+
+#define HISTORY_REPORT_SIZE (63)
+#define HISTORY_DATA_SIZE   (HISTORY_REPORT_SIZE - 9)
+
+//------------------------------------------------------------------------------
+// Module exported type definitions
+//------------------------------------------------------------------------------
+typedef struct __attribute__((packed))
+{
+    uint16_t sequence; // Of the newest sample, counts every sample taken
+    uint8_t count;     // Samples packed, oldest first
+    uint32_t millis;   // Timebase_Millis() of the newest sample
+    uint8_t periodMs;  // CONFIG_HISTORY_PERIOD_MS
+    uint8_t size;      // Bytes of data used
+    uint8_t data[HISTORY_DATA_SIZE];
+} HistoryReport_t;
+
+static_assert(sizeof(HistoryReport_t) == HISTORY_REPORT_SIZE, "HistoryReport_t must fill the 0xAB report");
+static_assert(CONFIG_HISTORY_PERIOD_MS <= UINT8_MAX, "The period is sent as a byte");
+static_assert(CONFIG_HISTORY_DEPTH <= UINT8_MAX, "Sample counts are bytes");
+
+//------------------------------------------------------------------------------
+// Module exported functions
+//------------------------------------------------------------------------------
+void History_Task(const BoostState_t *state);
+const HistoryReport_t *History_GetReport(void);
+
+//------------------------------------------------------------------------------
+// Module exported variables
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+#ifdef __cplusplus
+}
+#endif
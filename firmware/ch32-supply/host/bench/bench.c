@@ -0,0 +1,775 @@
+//------------------------------------------------------------------------------
+//       Filename: bench.c
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Micro-benchmarks of the firmware hot paths on the host
+//------------------------------------------------------------------------------
+//       Notes : Usage: main_bench [-o results.json] [-b baseline.json]
+//                                 [-t threshold]
+//               Each benchmark is timed over BENCH_RUNS runs of enough
+//               operations to last BENCH_RUN_NS. The median run is the result
+//               and the spread of the runs its noise. With a baseline, any
+//               benchmark whose fastest run is slower than the baseline's by
+//               more than the threshold (10% by default) is a regression and
+//               the exit status is 1. The fastest run is the least disturbed
+//               by the rest of the machine.
+//               Host timings only compare host builds, the cycle counts of
+//               the image come from iss/iss_main.c or CONFIG_ENABLE_PROFILE.
+//               Before timing anything the telemetry packing is round tripped
+//               on random blocks, a mismatch exits with status 1.
+//               The history is filled from the model first, and after the
+//               benchmarks the cost per sample of polling 0xAA is compared
+//               with reading blocks from 0xAB: the USB transactions and bytes
+//               on the bus, the firmware's time to serve them and the host's
+//               to decode them.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#include "bench.h"
+#include "boost.h"
+#include "hal.h"
+#include "history.h"
+#include "log.h"
+#include "nvs.h"
+#include "rv003usb.h"
+#include "telemetry.h"
+#include "timebase.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_HAVE_TSC (1)
+#else
+#define BENCH_HAVE_TSC (0)
+#endif
+
+//------------------------------------------------------------------------------
+// Module constant defines
+//------------------------------------------------------------------------------
+#define BENCH_RUNS   (15)
+#define BENCH_RUN_NS (5000000)
+
+#define BENCH_DEFAULT_THRESHOLD (0.10)
+
+#define BENCH_MAX_NAME (32)
+
+#define TELEMETRY_CHECK_BLOCKS (100000)
+#define TELEMETRY_MAX_SAMPLES  (64)
+
+// A control read: setup, the data in 8 byte packets, status
+#define USB_PACKET_SIZE          (8)
+#define USB_TRANSACTIONS(length) (2 + ((length) + USB_PACKET_SIZE - 1) / USB_PACKET_SIZE)
+#define USB_BYTES(length)        (USB_PACKET_SIZE + (length))
+
+#define array_size(x) (sizeof(x) / sizeof(x[0]))
+
+//------------------------------------------------------------------------------
+// External variables
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// External functions
+//------------------------------------------------------------------------------
+extern void ADC1_IRQHandler(void);
+
+//------------------------------------------------------------------------------
+// Module type definitions
+//------------------------------------------------------------------------------
+typedef void (*BenchFunction_t)(uint32_t ops);
+
+typedef struct
+{
+    const char *name;
+    BenchFunction_t function;
+} Bench_t;
+
+typedef struct
+{
+    double nsPerOp;
+    double minNsPerOp;
+    double stddevNs;
+    double cyclesPerOp;
+    uint32_t ops;
+} BenchResult_t;
+
+//------------------------------------------------------------------------------
+// Module static variables
+//------------------------------------------------------------------------------
+static volatile uint32_t s_sink = 0;
+static uint32_t s_random = 0x2545f491;
+
+//------------------------------------------------------------------------------
+// Module static function prototypes
+//------------------------------------------------------------------------------
+static void BenchControllerPID(uint32_t ops);
+static void BenchRawToMillivolts(uint32_t ops);
+static void BenchMillivoltsToADC(uint32_t ops);
+static void BenchCountsToMilliamps(uint32_t ops);
+static void BenchMilliampsToADC(uint32_t ops);
+static void BenchGetState(uint32_t ops);
+static void BenchAdcIsr(uint32_t ops);
+static void BenchNvsLoad(uint32_t ops);
+static void BenchNvsSave(uint32_t ops);
+static void BenchLog(uint32_t ops);
+static void BenchHidGetReport(uint32_t ops);
+static void BenchHidCommand(uint32_t ops);
+static void BenchHidReadState(uint32_t ops);
+static void BenchHidReadHistory(uint32_t ops);
+static void BenchTelemetryEncode(uint32_t ops);
+static void BenchTelemetryDecode(uint32_t ops);
+
+static void Run(const Bench_t *bench, BenchResult_t *result);
+static uint64_t Now(void);
+static uint64_t Cycles(void);
+static int CompareDoubles(const void *a, const void *b);
+static bool LoadBaseline(const char *path, const char *name, double *minNsPerOp);
+static uint32_t ReadReport(uint8_t reportId, uint8_t *buffer);
+static bool CheckTelemetry(void);
+static void FillHistory(void);
+static const BenchResult_t *FindResult(const BenchResult_t *results, const char *name);
+static void CompareTransfers(const BenchResult_t *results);
+static void RandomSamples(TelemetrySample_t *samples, uint8_t count);
+static uint32_t Random(void);
+
+static const Bench_t s_benches[] = {
+    {"controller_pid", BenchControllerPID},
+    {"raw_to_millivolts", BenchRawToMillivolts},
+    {"millivolts_to_adc", BenchMillivoltsToADC},
+    {"counts_to_milliamps", BenchCountsToMilliamps},
+    {"milliamps_to_adc", BenchMilliampsToADC},
+    {"get_state", BenchGetState},
+    {"adc_isr", BenchAdcIsr},
+    {"nvs_load", BenchNvsLoad},
+    {"nvs_save", BenchNvsSave},
+    {"log", BenchLog},
+    {"hid_get_report", BenchHidGetReport},
+    {"hid_command", BenchHidCommand},
+    {"hid_read_state", BenchHidReadState},
+    {"hid_read_history", BenchHidReadHistory},
+    {"telemetry_encode", BenchTelemetryEncode},
+    {"telemetry_decode", BenchTelemetryDecode},
+};
+
+//------------------------------------------------------------------------------
+// Module externally exported functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  Run the benchmarks
+ * @param  argc - argument count
+ * @param  argv - see the notes at the top
+ * @return 0, or 1 on a regression against the baseline
+ */
+int main(int argc, char **argv)
+{
+    const char *resultsPath = NULL;
+    const char *baselinePath = NULL;
+    double threshold = BENCH_DEFAULT_THRESHOLD;
+
+    int option;
+    while ((option = getopt(argc, argv, "o:b:t:")) != -1)
+    {
+        switch (option)
+        {
+            case 'o':
+                resultsPath = optarg;
+                break;
+            case 'b':
+                baselinePath = optarg;
+                break;
+            case 't':
+                threshold = atof(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-o results.json] [-b baseline.json] [-t threshold]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    // The firmware's own output would drown the results, and the log benchmark
+    // should not be measuring a terminal. SystemInit() would read a piped
+    // stdin to its end, and routes stdout through the console, which must not
+    // wait for a debugger to read it.
+    if (!freopen("/dev/null", "r", stdin) || !freopen("/dev/null", "w", stdout))
+    {
+        perror("/dev/null");
+        return 2;
+    }
+    setenv("HOST_DEBUGGER", "0", 1);
+    SystemInit();
+
+    Timebase_Init();
+    LOG_Init(eLOG_LEVEL_NONE, Timebase_Micros);
+    NVS_Init();
+    BoostPWM_Init();
+    BoostPWM_SetVoltageTarget(9000);
+    BoostPWM_SetCurrentLimit(1000);
+
+    // Let the calibration finish and the loop settle on the model
+    Delay_Ms(100);
+    FillHistory();
+
+    if (!CheckTelemetry())
+    {
+        return 1;
+    }
+
+    FILE *results = resultsPath ? fopen(resultsPath, "w") : NULL;
+    if (resultsPath && !results)
+    {
+        perror(resultsPath);
+        return 2;
+    }
+    if (results)
+    {
+        fprintf(results, "{\n  \"unit\": \"ns\",\n  \"cycles\": \"%s\",\n  \"benchmarks\": [\n",
+                BENCH_HAVE_TSC ? "tsc" : "none");
+    }
+
+    bool regressed = false;
+    BenchResult_t measured[array_size(s_benches)];
+    fprintf(stderr, "%-20s %10s %10s %10s %10s %10s\n", "benchmark", "ns/op", "min", "stddev", "cycles/op",
+            "baseline");
+    for (size_t i = 0; i < array_size(s_benches); i++)
+    {
+        BenchResult_t result;
+        Run(&s_benches[i], &result);
+        measured[i] = result;
+
+        fprintf(stderr, "%-20s %10.2f %10.2f %10.2f %10.1f", s_benches[i].name, result.nsPerOp, result.minNsPerOp,
+                result.stddevNs, result.cyclesPerOp);
+
+        double baseline;
+        if (baselinePath && LoadBaseline(baselinePath, s_benches[i].name, &baseline) && baseline > 0)
+        {
+            const double change = result.minNsPerOp / baseline - 1;
+            const bool regression = change > threshold;
+            regressed |= regression;
+            fprintf(stderr, " %+9.1f%%%s", change * 100, regression ? "  REGRESSION" : "");
+        }
+        fprintf(stderr, "\n");
+
+        if (results)
+        {
+            fprintf(results,
+                    "    {\"name\": \"%s\", \"ns_per_op\": %.3f, \"min_ns_per_op\": %.3f, \"stddev_ns\": %.3f, "
+                    "\"cycles_per_op\": %.1f, \"ops\": %u}%s\n",
+                    s_benches[i].name, result.nsPerOp, result.minNsPerOp, result.stddevNs, result.cyclesPerOp,
+                    result.ops, i + 1 < array_size(s_benches) ? "," : "");
+        }
+    }
+
+    if (results)
+    {
+        fprintf(results, "  ]\n}\n");
+        fclose(results);
+    }
+
+    CompareTransfers(measured);
+
+    return regressed ? 1 : 0;
+}
+
+//------------------------------------------------------------------------------
+// Module static functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  One PID step per op, the feedback sweeps across the target
+ */
+static void BenchControllerPID(uint32_t ops)
+{
+    for (uint32_t i = 0; i < ops; i++)
+    {
+        s_sink += Bench_ControllerPID(280 + (i & 63));
+    }
+}
+
+static void BenchRawToMillivolts(uint32_t ops)
+{
+    for (uint32_t i = 0; i < ops; i++)
+    {
+        s_sink += Bench_RawToMillivolts(i & 1023);
+    }
+}
+
+static void BenchMillivoltsToADC(uint32_t ops)
+{
+    for (uint32_t i = 0; i < ops; i++)
+    {
+        s_sink += Bench_MillivoltsToADC(i & 16383);
+    }
+}
+
+static void BenchCountsToMilliamps(uint32_t ops)
+{
+    for (uint32_t i = 0; i < ops; i++)
+    {
+        s_sink += Bench_CountsToMilliamps(i & 1023);
+    }
+}
+
+static void BenchMilliampsToADC(uint32_t ops)
+{
+    for (uint32_t i = 0; i < ops; i++)
+    {
+        s_sink += Bench_MilliampsToADC(i & 1023);
+    }
+}
+
+static void BenchGetState(uint32_t ops)
+{
+    BoostState_t state;
+    for (uint32_t i = 0; i < ops; i++)
+    {
+        BoostPWM_GetState(&state);
+        s_sink += state.voltage;
+    }
+}
+
+/**
+ * @brief  The whole control loop interrupt, on the readings left by the
+ *         last simulated conversion
+ */
+static void BenchAdcIsr(uint32_t ops)
+{
+    for (uint32_t i = 0; i < ops; i++)
+    {
+        ADC1_IRQHandler();
+    }
+    s_sink += TIM1->CH3CVR;
+}
+
+static void BenchNvsLoad(uint32_t ops)
+{
+    uint8_t data[32];
+    for (uint32_t i = 0; i < ops; i++)
+    {
+        NVS_Load(data, 0, sizeof(data));
+        s_sink += data[i & 31];
+    }
+}
+
+static void BenchNvsSave(uint32_t ops)
+{
+    uint8_t data[32] = {0};
+    for (uint32_t i = 0; i < ops; i++)
+    {
+        data[0] = i;
+        NVS_Save(data, sizeof(data));
+    }
+}
+
+/**
+ * @brief  One formatted line per op, into /dev/null
+ */
+static void BenchLog(uint32_t ops)
+{
+    LOG_Init(eLOG_LEVEL_DEBUG, Timebase_Micros);
+    for (uint32_t i = 0; i < ops; i++)
+    {
+        LOGI("bench", "Vout: %dmV, Iout: %dmA", 9000 + (i & 7), 100);
+    }
+    LOG_Init(eLOG_LEVEL_NONE, Timebase_Micros);
+}
+
+static void BenchHidGetReport(uint32_t ops)
+{
+    struct usb_endpoint endpoint = {0};
+    for (uint32_t i = 0; i < ops; i++)
+    {
+        usb_handle_hid_get_report_start(&endpoint, BOOST_REPORT_SIZE, BOOST_REPORT_ID_STATE);
+        s_sink += endpoint.max_len;
+    }
+}
+
+/**
+ * @brief  A set current command per op, from the set report request on,
+ *         parsing only, the main loop that applies it does not run
+ */
+static void BenchHidCommand(uint32_t ops)
+{
+    struct usb_endpoint endpoint = {0};
+    uint8_t data[BOOST_REPORT_SIZE] = {BOOST_REPORT_ID_STATE, 2, 0xe8, 0x03, 0, 0};
+    for (uint32_t i = 0; i < ops; i++)
+    {
+        usb_handle_hid_set_report_start(&endpoint, BOOST_REPORT_SIZE, BOOST_REPORT_ID_STATE);
+        usb_handle_user_data(&endpoint, 0, data, sizeof(data), NULL);
+    }
+    s_sink += endpoint.count;
+}
+
+/**
+ * @brief  A whole 0xAA transfer per op, one sample
+ */
+static void BenchHidReadState(uint32_t ops)
+{
+    uint8_t buffer[64];
+    for (uint32_t i = 0; i < ops; i++)
+    {
+        s_sink += ReadReport(BOOST_REPORT_ID_STATE, buffer);
+    }
+}
+
+/**
+ * @brief  A whole 0xAB transfer per op, of the history FillHistory() took
+ */
+static void BenchHidReadHistory(uint32_t ops)
+{
+    uint8_t buffer[64];
+    for (uint32_t i = 0; i < ops; i++)
+    {
+        s_sink += ReadReport(BOOST_REPORT_ID_HISTORY, buffer);
+    }
+}
+
+/**
+ * @brief  Pack a block of 32 samples of a steady, noisy output per op
+ */
+static void BenchTelemetryEncode(uint32_t ops)
+{
+    TelemetrySample_t samples[32];
+    for (uint8_t i = 0; i < 32; i++)
+    {
+        samples[i] = (TelemetrySample_t){
+            .voltage = 9000 + (Random() % 7) * 16 - 48,
+            .current = 100 + Random() % 3,
+            .elapsedMs = 10,
+            .duty = 120 + Random() % 8,
+        };
+    }
+
+    uint8_t buffer[HISTORY_DATA_SIZE];
+    uint8_t size;
+    for (uint32_t i = 0; i < ops; i++)
+    {
+        s_sink += Telemetry_Encode(samples, 32, 10, buffer, sizeof(buffer), &size);
+    }
+}
+
+/**
+ * @brief  Unpack the 0xAB report per op, the host's side of a transfer
+ */
+static void BenchTelemetryDecode(uint32_t ops)
+{
+    const HistoryReport_t *report = History_GetReport();
+    TelemetrySample_t samples[CONFIG_HISTORY_DEPTH];
+    for (uint32_t i = 0; i < ops; i++)
+    {
+        s_sink += Telemetry_Decode(report->data, report->size, report->count, report->periodMs, samples);
+    }
+}
+
+/**
+ * @brief  Time a benchmark
+ * @param  bench - the benchmark
+ * @param[out] result - the median, minimum and spread per op
+ * @return None
+ */
+static void Run(const Bench_t *bench, BenchResult_t *result)
+{
+    // Size the runs, doubling from one op until a run is long enough to time
+    uint32_t ops = 1;
+    while (true)
+    {
+        const uint64_t start = Now();
+        bench->function(ops);
+        if (Now() - start >= BENCH_RUN_NS / 4 || ops >= (1u << 30))
+        {
+            break;
+        }
+        ops <<= 1;
+    }
+    ops <<= 2;
+
+    double nsPerOp[BENCH_RUNS];
+    double cyclesPerOp[BENCH_RUNS];
+    double mean = 0;
+    for (int run = 0; run < BENCH_RUNS; run++)
+    {
+        const uint64_t start = Now();
+        const uint64_t startCycles = Cycles();
+        bench->function(ops);
+        cyclesPerOp[run] = (double)(Cycles() - startCycles) / ops;
+        nsPerOp[run] = (double)(Now() - start) / ops;
+        mean += nsPerOp[run] / BENCH_RUNS;
+    }
+
+    double variance = 0;
+    for (int run = 0; run < BENCH_RUNS; run++)
+    {
+        variance += (nsPerOp[run] - mean) * (nsPerOp[run] - mean) / (BENCH_RUNS - 1);
+    }
+
+    qsort(nsPerOp, BENCH_RUNS, sizeof(nsPerOp[0]), CompareDoubles);
+    qsort(cyclesPerOp, BENCH_RUNS, sizeof(cyclesPerOp[0]), CompareDoubles);
+
+    *result = (BenchResult_t){
+        .nsPerOp = nsPerOp[BENCH_RUNS / 2],
+        .minNsPerOp = nsPerOp[0],
+        .stddevNs = sqrt(variance),
+        .cyclesPerOp = cyclesPerOp[BENCH_RUNS / 2],
+        .ops = ops,
+    };
+}
+
+/**
+ * @brief  Get the wall clock
+ * @param  None
+ * @return nanoseconds
+ */
+static uint64_t Now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * @brief  Get the host cycle counter, where there is one
+ * @param  None
+ * @return the time stamp counter, 0 without one
+ */
+static uint64_t Cycles(void)
+{
+#if BENCH_HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/**
+ * @brief  qsort() comparison for doubles
+ */
+static int CompareDoubles(const void *a, const void *b)
+{
+    const double x = *(const double *)a;
+    const double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief  Find a benchmark in a results file written by this program
+ * @param  path - the results file
+ * @param  name - the benchmark
+ * @param[out] minNsPerOp - its fastest run
+ * @return false if the file or the benchmark is missing
+ */
+static bool LoadBaseline(const char *path, const char *name, double *minNsPerOp)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+    {
+        return false;
+    }
+
+    bool found = false;
+    char line[256];
+    while (!found && fgets(line, sizeof(line), file))
+    {
+        char lineName[BENCH_MAX_NAME + 1];
+        double nsPerOp;
+        found = sscanf(line, " {\"name\": \"%32[^\"]\", \"ns_per_op\": %lf, \"min_ns_per_op\": %lf", lineName,
+                       &nsPerOp, minNsPerOp) == 3 &&
+                strcmp(lineName, name) == 0;
+    }
+
+    fclose(file);
+    return found;
+}
+
+/**
+ * @brief  Copy a feature report out the way the USB driver does, in 8 byte
+ *         packets from the buffer the handler points at
+ * @param  reportId - the report
+ * @param[out] buffer - the report, at least 64 bytes
+ * @return the report length
+ */
+static uint32_t ReadReport(uint8_t reportId, uint8_t *buffer)
+{
+    struct usb_endpoint endpoint = {0};
+    usb_handle_hid_get_report_start(&endpoint, 64, reportId);
+    for (uint32_t offset = 0; offset < endpoint.max_len; offset += 8)
+    {
+        const uint32_t size = endpoint.max_len - offset < 8 ? endpoint.max_len - offset : 8;
+        memcpy(buffer + offset, endpoint.opaque + offset, size);
+    }
+    return endpoint.max_len;
+}
+
+/**
+ * @brief  Take a full history of the output on the model, as the main loop
+ *         would
+ * @param  None
+ * @return None
+ */
+static void FillHistory(void)
+{
+    for (uint32_t ms = 0; ms < CONFIG_HISTORY_DEPTH * CONFIG_HISTORY_PERIOD_MS; ms++)
+    {
+        BoostState_t state;
+        BoostPWM_GetState(&state);
+        History_Task(&state);
+        Delay_Ms(1);
+    }
+}
+
+/**
+ * @brief  Look up a benchmark's result
+ * @param  results - the results, in the order of s_benches
+ * @param  name - the benchmark
+ * @return the result
+ */
+static const BenchResult_t *FindResult(const BenchResult_t *results, const char *name)
+{
+    for (size_t i = 0; i < array_size(s_benches); i++)
+    {
+        if (!strcmp(s_benches[i].name, name))
+        {
+            return &results[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief  Print the cost per sample of 0xAA polling and 0xAB blocks
+ * @param  results - the results, in the order of s_benches
+ * @return None
+ * @note   On a low speed bus the transactions are what limits the rate, the
+ *         host schedules a few per 1ms frame at best. Host timings only
+ *         compare with each other, as above.
+ */
+static void CompareTransfers(const BenchResult_t *results)
+{
+    uint8_t buffer[64];
+    const uint32_t stateLength = ReadReport(BOOST_REPORT_ID_STATE, buffer);
+    const uint32_t historyLength = ReadReport(BOOST_REPORT_ID_HISTORY, buffer);
+    const uint32_t samples = History_GetReport()->count;
+    if (!samples)
+    {
+        fprintf(stderr, "transfers: the history is empty\n");
+        return;
+    }
+
+    const double stateNs = FindResult(results, "hid_read_state")->minNsPerOp;
+    const double historyNs = FindResult(results, "hid_read_history")->minNsPerOp;
+    const double decodeNs = FindResult(results, "telemetry_decode")->minNsPerOp;
+
+    fprintf(stderr, "\n%-20s %10s %10s %10s %10s %10s\n", "per sample", "samples", "usb xacts", "usb bytes",
+            "device ns", "host ns");
+    fprintf(stderr, "%-20s %10u %10.2f %10.2f %10.2f %10.2f\n", "0xAA poll", 1u, (double)USB_TRANSACTIONS(stateLength),
+            (double)USB_BYTES(stateLength), stateNs, 0.0);
+    fprintf(stderr, "%-20s %10u %10.2f %10.2f %10.2f %10.2f\n", "0xAB block", samples,
+            (double)USB_TRANSACTIONS(historyLength) / samples, (double)USB_BYTES(historyLength) / samples,
+            historyNs / samples, decodeNs / samples);
+}
+
+/**
+ * @brief  Round trip the telemetry packing on random blocks and capacities,
+ *         and feed the decoder random bytes, which it must reject or decode
+ *         without reading past the block
+ * @param  None
+ * @return true if every block came back as it went in
+ */
+static bool CheckTelemetry(void)
+{
+    TelemetrySample_t samples[TELEMETRY_MAX_SAMPLES];
+    TelemetrySample_t decoded[TELEMETRY_MAX_SAMPLES];
+    uint8_t buffer[UINT8_MAX];
+
+    for (uint32_t block = 0; block < TELEMETRY_CHECK_BLOCKS; block++)
+    {
+        const uint8_t count = 1 + Random() % TELEMETRY_MAX_SAMPLES;
+        const uint8_t capacity = Random() % 2 ? HISTORY_DATA_SIZE : Random() % sizeof(buffer);
+        const uint8_t period = Random() % 2 ? 10 : Random();
+        RandomSamples(samples, count);
+
+        uint8_t size;
+        const uint8_t packed = Telemetry_Encode(samples, count, period, buffer, capacity, &size);
+        const TelemetrySample_t *expected = &samples[count - packed];
+        bool ok = size <= capacity && packed <= count && (packed > 0) == (capacity >= TELEMETRY_KEYFRAME_SIZE);
+        ok = ok && Telemetry_Decode(buffer, size, packed, period, decoded) == packed;
+        for (uint8_t i = 0; ok && i < packed; i++)
+        {
+            ok = decoded[i].voltage == expected[i].voltage && decoded[i].current == expected[i].current &&
+                 decoded[i].duty == expected[i].duty && (i == 0 || decoded[i].elapsedMs == expected[i].elapsedMs);
+        }
+
+        // One more sample must not have fitted
+        if (ok && packed && packed < count)
+        {
+            uint8_t unlimited[UINT8_MAX];
+            uint8_t larger;
+            const uint8_t fitted = Telemetry_Encode(expected - 1, packed + 1, period, unlimited, sizeof(unlimited), &larger);
+            ok = fitted <= packed || larger > capacity;
+        }
+
+        if (!ok)
+        {
+            fprintf(stderr, "telemetry round trip failed, block %u: %u samples, capacity %u, period %u\n", block,
+                    count, capacity, period);
+            return false;
+        }
+
+        for (uint8_t i = 0; i < capacity; i++)
+        {
+            buffer[i] = Random();
+        }
+        s_sink += Telemetry_Decode(buffer, capacity, count, period, decoded);
+    }
+
+    fprintf(stderr, "telemetry round trip: %u blocks ok\n", TELEMETRY_CHECK_BLOCKS);
+    return true;
+}
+
+/**
+ * @brief  Random samples, from small steps to full range jumps
+ * @param[out] samples - the samples
+ * @param  count - the number of samples
+ * @return None
+ */
+static void RandomSamples(TelemetrySample_t *samples, uint8_t count)
+{
+    const uint32_t step = 1u << (Random() % 17);
+    TelemetrySample_t sample = {
+        .voltage = Random(),
+        .current = Random(),
+        .elapsedMs = Random(),
+        .duty = Random(),
+    };
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        sample.voltage += Random() % step - step / 2;
+        sample.current += Random() % step - step / 2;
+        sample.duty += Random() % step - step / 2;
+        sample.elapsedMs = Random() % 4 ? sample.elapsedMs : Random();
+        samples[i] = sample;
+    }
+}
+
+/**
+ * @brief  xorshift, fixed seed so failures repeat
+ * @param  None
+ * @return 32 random bits
+ */
+static uint32_t Random(void)
+{
+    s_random ^= s_random << 13;
+    s_random ^= s_random >> 17;
+    s_random ^= s_random << 5;
+    return s_random;
+}
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
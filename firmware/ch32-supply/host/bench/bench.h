@@ -0,0 +1,49 @@
+//------------------------------------------------------------------------------
+//       Filename: bench.h
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Defines the entry points the benchmarks reach into
+//------------------------------------------------------------------------------
+//       Notes : The controller and the conversions are static in boost.c,
+//               bench_boost.c includes it and exposes them here.
+//------------------------------------------------------------------------------
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#include <stdint.h>
+
+//------------------------------------------------------------------------------
+// Module exported defines
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module exported type definitions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module exported functions
+//------------------------------------------------------------------------------
+int Bench_ControllerPID(uint16_t vRaw);
+uint16_t Bench_RawToMillivolts(uint16_t raw);
+uint16_t Bench_MillivoltsToADC(uint32_t millivolts);
+uint16_t Bench_CountsToMilliamps(int counts);
+uint16_t Bench_MilliampsToADC(uint32_t milliamps);
+
+//------------------------------------------------------------------------------
+// Module exported variables
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+#ifdef __cplusplus
+}
+#endif
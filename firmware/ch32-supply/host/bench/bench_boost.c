@@ -0,0 +1,70 @@
+//------------------------------------------------------------------------------
+//       Filename: bench_boost.c
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Exposes the static hot paths of boost.c to the benchmarks
+//------------------------------------------------------------------------------
+//       Notes : Built in place of boost.c, so the code measured is the code
+//               that ships.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#include "boost.c"
+#include "bench.h"
+
+//------------------------------------------------------------------------------
+// Module externally exported functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  Run one PID step on a voltage reading
+ * @param  vRaw - the voltage feedback, in ADC counts
+ * @return the unclamped duty
+ * @note   The integrator is cleared each step, a benchmark would otherwise
+ *         wind it up without bound.
+ */
+int Bench_ControllerPID(uint16_t vRaw)
+{
+    s_feedbackVRaw = vRaw;
+    s_eI = 0;
+    return BoostControllerPID();
+}
+
+/**
+ * @brief  See RawToMillivolts()
+ */
+uint16_t Bench_RawToMillivolts(uint16_t raw)
+{
+    return RawToMillivolts(raw);
+}
+
+/**
+ * @brief  See MillivoltsToADC()
+ */
+uint16_t Bench_MillivoltsToADC(uint32_t millivolts)
+{
+    return MillivoltsToADC(millivolts);
+}
+
+/**
+ * @brief  See CountsToMilliamps()
+ */
+uint16_t Bench_CountsToMilliamps(int counts)
+{
+    return CountsToMilliamps(counts);
+}
+
+/**
+ * @brief  See MilliampsToADC()
+ */
+uint16_t Bench_MilliampsToADC(uint32_t milliamps)
+{
+    return MilliampsToADC(milliamps);
+}
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
@@ -0,0 +1,21 @@
+//------------------------------------------------------------------------------
+//       Filename: bench_main.c
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Builds main.c into the benchmarks for its HID handlers
+//------------------------------------------------------------------------------
+//       Notes : The benchmarks bring their own main(), the firmware's is
+//               renamed and never called.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#define main Firmware_Main
+#include "main.c"
+#undef main
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
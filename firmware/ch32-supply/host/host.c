@@ -0,0 +1,1024 @@
+//------------------------------------------------------------------------------
+//       Filename: host.c
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Implements the host backend of the peripheral access layer
+//------------------------------------------------------------------------------
+//       Notes : Environment variables:
+//                 HOST_RUN_MS     - exit after this much simulated time
+//                 HOST_NVS_FILE   - keeps the settings page between runs
+//                 HOST_ADC_RECORD - writes the ADC readings, the console
+//                                   input and the HID writes to a trace file
+//                 HOST_ADC_REPLAY - reads them back from a trace file in
+//                                   place of the plant and stdin, exits at
+//                                   its end. A device trace is booted on
+//                                   its first readings, then the control
+//                                   loop takes the state it was captured
+//                                   with before the first record.
+//                 HOST_DUTY_LOG   - writes the compare value the control loop
+//                                   left after every ADC interrupt, one per line
+//                 HOST_DEBUGGER   - 0 runs as if no debugger were attached
+//               The debug console reads stdin. A pipe or a file is read to
+//               its end before boot and handed over a byte per poll, so the
+//               input lands on the same main loop iterations every run. A
+//               terminal is read as typed. stdout goes through the console's
+//               output buffer, and out a frame at a time at the rate a
+//               debugger would read them, HOST_CONSOLE_FRAME_CYCLES.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#define _GNU_SOURCE // fopencookie()
+
+#include "boost.h"
+#include "console.h"
+#include "hal.h"
+#include "host.h"
+#include "rv003usb.h"
+#include "trace.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+//------------------------------------------------------------------------------
+// Module constant defines
+//------------------------------------------------------------------------------
+#define CYCLES_PER_MS (FUNCONF_SYSTEM_CORE_CLOCK / 1000)
+
+#define HOST_FLASH_SIZE (64)
+
+#define HOST_INPUT_CHUNK (256)
+
+// A debugger reading the link back to back, a frame per 100us
+#define HOST_CONSOLE_FRAME_CYCLES (CYCLES_PER_MS / 10)
+
+// Injected sequence fields, see ADC_ISQR() in boost.c
+#define ISQR_LENGTH(isqr) (((isqr) >> 20) & 0x3)
+#define ISQR_JSQ3(isqr)   (((isqr) >> 10) & 0x1f)
+#define ISQR_JSQ4(isqr)   (((isqr) >> 15) & 0x1f)
+
+//------------------------------------------------------------------------------
+// External variables
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// External functions
+//------------------------------------------------------------------------------
+extern void ADC1_IRQHandler(void);
+
+//------------------------------------------------------------------------------
+// Module type definitions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module static variables
+//------------------------------------------------------------------------------
+// The register blocks, see host.h
+RCC_TypeDef g_hostRcc;
+AFIO_TypeDef g_hostAfio;
+GPIO_TypeDef g_hostGpio[3];
+TIM_TypeDef g_hostTim1;
+ADC_TypeDef g_hostAdc1;
+EXTEN_TypeDef g_hostExten;
+SysTick_Type g_hostSysTick;
+IWDG_TypeDef g_hostIwdg;
+PFIC_Type g_hostPfic;
+
+static uint64_t s_cycles = 0;
+static uint64_t s_nextTrigger = 0;
+static uint64_t s_runCycles = 0;
+static bool s_adcIrqEnabled = false;
+static uint32_t s_intsyscr = 0;
+static HostHook_t s_hook = NULL;
+
+static FILE *s_recordFile = NULL;
+static FILE *s_replayFile = NULL;
+static FILE *s_dutyFile = NULL;
+static bool s_debugger = true;
+static uint32_t s_replayCount = 0;
+static uint32_t s_replayNext = 0;
+static bool s_replayPeeked = false;
+static TraceSeed_t s_replaySeed = {0};
+static bool s_replaySeedPending = false;
+
+static uint8_t s_flash[HOST_FLASH_SIZE];
+static bool s_flashUnlocked = false;
+static const char *s_flashFile = NULL;
+
+// Console input read up front, NULL when stdin is a terminal
+static uint8_t *s_input = NULL;
+static size_t s_inputSize = 0;
+static size_t s_inputRead = 0;
+static int s_stdinFlags = -1;
+
+// The real stdout, stdout itself feeds the console's output buffer
+static FILE *s_console = NULL;
+static uint64_t s_consoleReadyAt = 0;
+static bool s_consoleDrain = false;
+
+//------------------------------------------------------------------------------
+// Module static function prototypes
+//------------------------------------------------------------------------------
+static uint32_t PwmPeriod(void);
+static void TriggerADC(void);
+static bool ReplayRecord(bool vrefSampled);
+static bool BootRecord(void);
+static void LoadRecord(uint32_t record);
+static bool ReplayEvent(int type);
+static void RecordSample(bool vrefSampled);
+static void RecordEvent(TraceEvent_e type, const uint8_t *data, uint32_t length);
+static bool PeekRecord(uint32_t *record);
+static void HidWrite(const uint8_t *report, uint32_t length);
+static FILE *OpenTrace(const char *name, bool write);
+static bool ReadWord(FILE *file, uint32_t *word);
+static bool ReadBytes(FILE *file, uint8_t *data, uint32_t length);
+static void WriteWord(FILE *file, uint32_t word);
+static void SaveFlash(void);
+static void ReadInput(void);
+static void RestoreStdin(void);
+static void RouteStdout(void);
+static ssize_t ConsoleWrite(void *cookie, const char *buf, size_t size);
+static void FlushConsole(void);
+
+//------------------------------------------------------------------------------
+// Module externally exported functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  Set up the host, stands in for the clock set up
+ * @param  None
+ * @return None
+ */
+void SystemInit(void)
+{
+    const char *runMs = getenv("HOST_RUN_MS");
+    if (runMs)
+    {
+        s_runCycles = strtoull(runMs, NULL, 0) * CYCLES_PER_MS;
+    }
+
+    // Erased flash, unless a previous run left its settings
+    memset(s_flash, 0xff, sizeof(s_flash));
+    s_flashFile = getenv("HOST_NVS_FILE");
+    if (s_flashFile)
+    {
+        FILE *file = fopen(s_flashFile, "rb");
+        if (file)
+        {
+            (void)!fread(s_flash, 1, sizeof(s_flash), file);
+            fclose(file);
+        }
+    }
+
+    s_recordFile = OpenTrace(getenv("HOST_ADC_RECORD"), true);
+    s_replayFile = OpenTrace(getenv("HOST_ADC_REPLAY"), false);
+
+    const char *dutyLog = getenv("HOST_DUTY_LOG");
+    if (dutyLog)
+    {
+        s_dutyFile = fopen(dutyLog, "w");
+    }
+
+    const char *debugger = getenv("HOST_DEBUGGER");
+    if (debugger)
+    {
+        s_debugger = atoi(debugger) != 0;
+    }
+
+    // A replay takes its input from the trace
+    if (!s_replayFile)
+    {
+        ReadInput();
+    }
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    RouteStdout();
+
+    Plant_Init();
+}
+
+/**
+ * @brief  Run the simulated peripherals
+ * @param  cycles - core cycles to advance by
+ * @return None
+ * @note   Interrupts are taken at the cycle they would fire on the MCU,
+ *         they never preempt each other or the main loop mid statement.
+ */
+void Host_Advance(uint32_t cycles)
+{
+    const uint64_t end = s_cycles + cycles;
+
+    while (true)
+    {
+        uint64_t next = end;
+
+        const bool pwmRunning = (TIM1->CTLR1 & TIM_CEN) != 0;
+        if (pwmRunning)
+        {
+            if (s_nextTrigger <= s_cycles)
+            {
+                s_nextTrigger = s_cycles + PwmPeriod();
+            }
+            next = s_nextTrigger < next ? s_nextTrigger : next;
+        }
+
+        SysTick->CNT += (uint32_t)(next - s_cycles);
+        s_cycles = next;
+
+        if (s_runCycles && s_cycles >= s_runCycles)
+        {
+            exit(0);
+        }
+
+        if (pwmRunning && s_cycles == s_nextTrigger)
+        {
+            TriggerADC();
+            s_nextTrigger = s_cycles + PwmPeriod();
+
+            if (s_hook)
+            {
+                s_hook(s_cycles);
+            }
+        }
+
+        if (s_cycles >= end)
+        {
+            return;
+        }
+    }
+}
+
+/**
+ * @brief  Get the simulated time
+ * @param  None
+ * @return core cycles since SystemInit()
+ */
+uint64_t Host_GetCycles(void)
+{
+    return s_cycles;
+}
+
+/**
+ * @brief  Watch and drive the run from outside the firmware, see host/sim
+ * @param  hook - called after every ADC interrupt, NULL for none
+ * @return None
+ * @note   The hook runs where the firmware waited, like an interrupt would.
+ */
+void Host_SetHook(HostHook_t hook)
+{
+    s_hook = hook;
+}
+
+/**
+ * @brief  Get how far a replay has got
+ * @param  None
+ * @return the trace records the firmware has been given
+ */
+uint32_t Host_GetReplayCount(void)
+{
+    return s_replayCount;
+}
+
+/**
+ * @brief  Write a feature report the way the USB driver delivers it
+ * @param  report - the report, starting with its ID
+ * @param  length - the report length
+ * @return None
+ * @note   On the MCU this is the USB interrupt, it runs where the firmware
+ *         waited. Recorded in the trace, if there is one.
+ */
+void Host_HidWrite(const uint8_t *report, uint32_t length)
+{
+    RecordEvent(eTRACE_EVENT_HID, report, length);
+    HidWrite(report, length);
+}
+
+/**
+ * @brief  Check whether the debugger has read the last console frame
+ * @param  None
+ * @return true once HOST_CONSOLE_FRAME_CYCLES have passed since it was sent
+ */
+bool Host_ConsoleReady(void)
+{
+    return s_consoleDrain || s_cycles >= s_consoleReadyAt;
+}
+
+/**
+ * @brief  Pass a console frame to the real stdout
+ * @param  data - the bytes
+ * @param  size - the number of bytes
+ * @return None
+ */
+void Host_ConsoleSend(const uint8_t *data, uint32_t size)
+{
+    fwrite(data, 1, size, s_console ? s_console : stdout);
+    s_consoleReadyAt = s_cycles + HOST_CONSOLE_FRAME_CYCLES;
+}
+
+/**
+ * @brief  Lock or unlock the flash, locking writes the page back to the file
+ * @param  unlocked - true to allow erasing and programming
+ * @return None
+ */
+void Host_FlashUnlock(bool unlocked)
+{
+    s_flashUnlocked = unlocked;
+    if (!unlocked)
+    {
+        SaveFlash();
+    }
+}
+
+/**
+ * @brief  Erase the settings page
+ * @param  address - offset in the page
+ * @return None
+ */
+void Host_FlashErase(uint32_t address)
+{
+    if (s_flashUnlocked && address < HOST_FLASH_SIZE)
+    {
+        memset(s_flash, 0xff, sizeof(s_flash));
+    }
+}
+
+/**
+ * @brief  Program a half word
+ * @param  address - offset in the page
+ * @param  value - the half word
+ * @return None
+ */
+void Host_FlashProgram(uint32_t address, uint16_t value)
+{
+    // Programming can only clear bits, like the real thing
+    if (s_flashUnlocked && address + 1 < HOST_FLASH_SIZE)
+    {
+        s_flash[address] &= value & 0xff;
+        s_flash[address + 1] &= value >> 8;
+    }
+}
+
+/**
+ * @brief  Read a byte
+ * @param  address - offset in the page
+ * @return the byte
+ */
+uint8_t Host_FlashRead(uint32_t address)
+{
+    return address < HOST_FLASH_SIZE ? s_flash[address] : 0xff;
+}
+
+/**
+ * @brief  Busy waits only let simulated time pass
+ * @param  ms - the delay in milliseconds
+ * @return None
+ */
+void Delay_Ms(uint32_t ms)
+{
+    Host_Advance(ms * CYCLES_PER_MS);
+}
+
+/**
+ * @brief  Busy waits only let simulated time pass
+ * @param  us - the delay in microseconds
+ * @return None
+ */
+void Delay_Us(uint32_t us)
+{
+    Host_Advance(us * (CYCLES_PER_MS / 1000));
+}
+
+/**
+ * @brief  Enable an interrupt, only the ADC is simulated
+ * @param  irq - the interrupt number
+ * @return None
+ */
+void NVIC_EnableIRQ(int irq)
+{
+    s_adcIrqEnabled |= irq == ADC_IRQn;
+}
+
+/**
+ * @brief  Disable an interrupt
+ * @param  irq - the interrupt number
+ * @return None
+ */
+void NVIC_DisableIRQ(int irq)
+{
+    s_adcIrqEnabled &= irq != ADC_IRQn;
+}
+
+/**
+ * @brief  Interrupt nesting has no effect, interrupts are taken one at a time
+ */
+uint32_t __get_INTSYSCR(void)
+{
+    return s_intsyscr;
+}
+
+/**
+ * @brief  Interrupt nesting has no effect, interrupts are taken one at a time
+ */
+void __set_INTSYSCR(uint32_t value)
+{
+    s_intsyscr = value;
+}
+
+/**
+ * @brief  The console is stdin, so the debugger is attached unless told not
+ * @param  None
+ * @return 1 if attached
+ */
+int DidDebuggerAttach(void)
+{
+    return s_debugger;
+}
+
+/**
+ * @brief  Pass a byte from stdin to the console, if there is one
+ * @param  None
+ * @return None
+ */
+void poll_input(void)
+{
+    uint8_t data[8] = {0};
+    if (s_replayFile)
+    {
+        ReplayEvent(eTRACE_EVENT_CONSOLE);
+    }
+    else if (s_input)
+    {
+        if (s_inputRead < s_inputSize)
+        {
+            data[0] = s_input[s_inputRead++];
+            handle_debug_input(1, data);
+            RecordEvent(eTRACE_EVENT_CONSOLE, data, 1);
+        }
+    }
+    else if (read(STDIN_FILENO, data, 1) == 1)
+    {
+        handle_debug_input(1, data);
+        RecordEvent(eTRACE_EVENT_CONSOLE, data, 1);
+    }
+}
+
+/**
+ * @brief  There is no bus on the host, requests go to the handlers directly
+ */
+void usb_setup(void)
+{
+}
+
+/**
+ * @brief  Nothing polls the IN endpoints on the host
+ */
+void usb_send_data(const void *data, uint32_t length, uint32_t poly_function, uint32_t token)
+{
+}
+
+/**
+ * @brief  Nothing polls the IN endpoints on the host
+ */
+void usb_send_empty(uint32_t token)
+{
+}
+
+//------------------------------------------------------------------------------
+// Module static functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  Get the PWM period from the timer registers
+ * @param  None
+ * @return core cycles per PWM period
+ */
+static uint32_t PwmPeriod(void)
+{
+    return (TIM1->PSC + 1) * (TIM1->ATRLR + 1);
+}
+
+/**
+ * @brief  Convert the configured sequences and take the ADC interrupt
+ * @param  None
+ * @return None
+ * @note   TRGO fires on the timer update, the regular conversion and the
+ *         injected sequence follow it.
+ */
+static void TriggerADC(void)
+{
+    HostAdcSample_t sample;
+    if (!s_replayFile)
+    {
+        Plant_Step(TIM1->CH3CVR, PwmPeriod(), &sample);
+    }
+
+    if (!(ADC1->CTLR2 & ADC_ADON))
+    {
+        return;
+    }
+
+    // A device trace starts mid run. Until the offset calibration is done
+    // the firmware sees its first readings, then the loop's state is loaded
+    // in place of the interrupt before the first record.
+    bool booting = false;
+    if (s_replaySeedPending)
+    {
+        booting = !BoostPWM_IsCalibrated();
+        if (!booting)
+        {
+            BoostPWM_Seed(&s_replaySeed);
+            s_replaySeedPending = false;
+        }
+    }
+
+    const uint32_t isqr = ADC1->ISQR;
+    const bool vrefSampled = ISQR_LENGTH(isqr) == 1;
+
+    if (booting)
+    {
+        if (!BootRecord())
+        {
+            fprintf(stderr, "replay: no records\n");
+            exit(0);
+        }
+    }
+    else if (s_replayFile)
+    {
+        if (!ReplayRecord(vrefSampled))
+        {
+            fprintf(stderr, "replay: %u records\n", s_replayCount);
+            exit(0);
+        }
+    }
+    else
+    {
+        ADC1->RDATAR = sample.channel[(ADC1->RSQR3 & 0x1f) % HOST_ADC_CHANNELS];
+        if (vrefSampled)
+        {
+            ADC1->IDATAR1 = sample.channel[ISQR_JSQ3(isqr) % HOST_ADC_CHANNELS];
+            ADC1->IDATAR2 = sample.channel[ISQR_JSQ4(isqr) % HOST_ADC_CHANNELS];
+        }
+        else
+        {
+            ADC1->IDATAR1 = sample.channel[ISQR_JSQ4(isqr) % HOST_ADC_CHANNELS];
+        }
+    }
+
+    if (s_recordFile)
+    {
+        RecordSample(vrefSampled);
+    }
+
+    ADC1->STATR |= ADC_JEOC;
+
+    if (s_adcIrqEnabled && (ADC1->CTLR1 & ADC_JEOCIE))
+    {
+        ADC1_IRQHandler();
+    }
+
+    // Where the hooks that wrote them ran
+    if (s_replayFile)
+    {
+        while (ReplayEvent(eTRACE_EVENT_HID))
+        {
+        }
+    }
+
+    // A device trace's duty log starts with its first record
+    if (s_dutyFile && !booting)
+    {
+        fprintf(s_dutyFile, "%u\n", (unsigned)TIM1->CH3CVR);
+    }
+}
+
+/**
+ * @brief  Write a feature report the way the USB driver delivers it
+ * @param  report - the report, starting with its ID
+ * @param  length - the report length
+ * @return None
+ * @note   The set report request, then the data stage in 8 byte packets
+ */
+static void HidWrite(const uint8_t *report, uint32_t length)
+{
+    struct usb_endpoint endpoint = {0};
+    usb_handle_hid_set_report_start(&endpoint, length, report[0]);
+
+    const uint32_t size = endpoint.max_len < length ? endpoint.max_len : length;
+    for (uint32_t offset = 0; offset < size; offset += 8)
+    {
+        uint8_t packet[8];
+        const uint32_t packetSize = size - offset < 8 ? size - offset : 8;
+        memcpy(packet, report + offset, packetSize);
+        usb_handle_user_data(&endpoint, 0, packet, packetSize, NULL);
+    }
+}
+
+/**
+ * @brief  Load the next trace record into the result registers
+ * @param  vrefSampled - whether the firmware asked for VRef this time
+ * @return false at the end of the trace
+ * @note   A trace captured on a device starts at an arbitrary point of the
+ *         VRef schedule. When the schedules disagree IDATAR2 keeps the last
+ *         VRef, as the real register would.
+ */
+static bool ReplayRecord(bool vrefSampled)
+{
+    // Events the firmware did not take where it did when recording, it has
+    // diverged, but they still go in before the interrupt they preceded
+    while (ReplayEvent(-1))
+    {
+    }
+
+    uint32_t record;
+    if (!PeekRecord(&record))
+    {
+        return false;
+    }
+    s_replayPeeked = false;
+    s_replayCount++;
+    LoadRecord(record);
+
+    static bool warned = false;
+    if (!warned && vrefSampled != ((record & TRACE_VREF_SAMPLED) != 0))
+    {
+        warned = true;
+        fprintf(stderr, "replay: VRef schedule differs from the trace at record %u\n", s_replayCount);
+    }
+    return true;
+}
+
+/**
+ * @brief  Load the first trace record without taking it, while a device
+ *         trace boots
+ * @param  None
+ * @return false if the trace has no records
+ */
+static bool BootRecord(void)
+{
+    uint32_t record;
+    if (!PeekRecord(&record) || (record & TRACE_EVENT))
+    {
+        return false;
+    }
+    LoadRecord(record);
+
+    // Init waits for a VRef reading
+    if (!(record & TRACE_VREF_SAMPLED))
+    {
+        ADC1->IDATAR2 = s_replaySeed.vref;
+    }
+    return true;
+}
+
+/**
+ * @brief  Put a record's readings in the result registers
+ * @param  record - the record
+ * @return None
+ */
+static void LoadRecord(uint32_t record)
+{
+    ADC1->RDATAR = (record >> TRACE_VOLTAGE_SHIFT) & TRACE_READING_MASK;
+    ADC1->IDATAR1 = (record >> TRACE_CURRENT_SHIFT) & TRACE_READING_MASK;
+    if (record & TRACE_VREF_SAMPLED)
+    {
+        ADC1->IDATAR2 = (record >> TRACE_VREF_SHIFT) & TRACE_READING_MASK;
+    }
+}
+
+/**
+ * @brief  Deliver the next trace record if it is an event
+ * @param  type - the TraceEvent_e to take, -1 for any
+ * @return true if an event was delivered
+ */
+static bool ReplayEvent(int type)
+{
+    uint32_t record;
+    if (!PeekRecord(&record) || !(record & TRACE_EVENT))
+    {
+        return false;
+    }
+
+    const int recordType = (record >> TRACE_EVENT_TYPE_SHIFT) & TRACE_EVENT_TYPE_MASK;
+    if (type >= 0 && recordType != type)
+    {
+        return false;
+    }
+    s_replayPeeked = false;
+
+    uint8_t data[TRACE_EVENT_LENGTH_MASK + 1] = {0};
+    const uint32_t length = record & TRACE_EVENT_LENGTH_MASK;
+    for (uint32_t offset = 0; offset < length; offset += 4)
+    {
+        uint32_t word = 0;
+        if (!ReadWord(s_replayFile, &word))
+        {
+            return false;
+        }
+        for (uint32_t i = 0; i < 4; i++)
+        {
+            data[offset + i] = word >> (i * 8);
+        }
+    }
+
+    switch (recordType)
+    {
+        case eTRACE_EVENT_CONSOLE:
+            handle_debug_input(length, data);
+            break;
+        case eTRACE_EVENT_HID:
+            HidWrite(data, length);
+            break;
+        default:
+            fprintf(stderr, "replay: unknown event %d skipped\n", recordType);
+            break;
+    }
+    return true;
+}
+
+/**
+ * @brief  Append the readings the firmware is about to see to the trace
+ * @param  vrefSampled - whether VRef is part of this conversion
+ * @return None
+ */
+static void RecordSample(bool vrefSampled)
+{
+    WriteWord(s_recordFile, Trace_Pack(ADC1->RDATAR, ADC1->IDATAR1, ADC1->IDATAR2, vrefSampled));
+}
+
+/**
+ * @brief  Append an input the firmware took to the trace, if recording
+ * @param  type - the event type
+ * @param  data - its bytes
+ * @param  length - the byte count, longer is cut at TRACE_EVENT_LENGTH_MASK
+ * @return None
+ */
+static void RecordEvent(TraceEvent_e type, const uint8_t *data, uint32_t length)
+{
+    if (!s_recordFile)
+    {
+        return;
+    }
+
+    length = length < TRACE_EVENT_LENGTH_MASK ? length : TRACE_EVENT_LENGTH_MASK;
+    WriteWord(s_recordFile, Trace_PackEvent(type, length));
+    for (uint32_t offset = 0; offset < length; offset += 4)
+    {
+        uint32_t word = 0;
+        for (uint32_t i = 0; i < 4 && offset + i < length; i++)
+        {
+            word |= (uint32_t)data[offset + i] << (i * 8);
+        }
+        WriteWord(s_recordFile, word);
+    }
+}
+
+/**
+ * @brief  Look at the next trace record without taking it
+ * @param[out] record - the record
+ * @return false at the end of the trace
+ * @note   Clear s_replayPeeked to take it
+ */
+static bool PeekRecord(uint32_t *record)
+{
+    if (!s_replayPeeked)
+    {
+        s_replayPeeked = ReadWord(s_replayFile, &s_replayNext);
+    }
+    *record = s_replayNext;
+    return s_replayPeeked;
+}
+
+/**
+ * @brief  Open a trace file and check or write its header
+ * @param  name - the path, NULL for none
+ * @param  write - true to record, false to replay
+ * @return the file, NULL if there is none
+ */
+static FILE *OpenTrace(const char *name, bool write)
+{
+    if (!name)
+    {
+        return NULL;
+    }
+
+    FILE *file = fopen(name, write ? "wb" : "rb");
+    if (!file)
+    {
+        perror(name);
+        exit(1);
+    }
+
+    // A host trace starts at boot, it has no controller state
+    if (write)
+    {
+        WriteWord(file, TRACE_FILE_MAGIC);
+        WriteWord(file, TRACE_FILE_VERSION);
+        WriteWord(file, 0);
+        return file;
+    }
+
+    uint32_t magic = 0;
+    uint32_t version = 0;
+    // Version 1 is version 2 without events, version 2 is version 3 without the state
+    if (!ReadWord(file, &magic) || !ReadWord(file, &version) || magic != TRACE_FILE_MAGIC || version < 1 ||
+        version > TRACE_FILE_VERSION)
+    {
+        fprintf(stderr, "%s: not a version 1 to %d trace\n", name, TRACE_FILE_VERSION);
+        exit(1);
+    }
+
+    uint32_t seedLength = 0;
+    if (version >= 3 && !ReadWord(file, &seedLength))
+    {
+        fprintf(stderr, "%s: truncated\n", name);
+        exit(1);
+    }
+    if (seedLength)
+    {
+        if (seedLength != sizeof(s_replaySeed) || !ReadBytes(file, (uint8_t *)&s_replaySeed, seedLength))
+        {
+            fprintf(stderr, "%s: controller state of %u bytes, expected %u\n", name, seedLength,
+                    (unsigned)sizeof(s_replaySeed));
+            exit(1);
+        }
+        s_replaySeedPending = true;
+    }
+    return file;
+}
+
+/**
+ * @brief  Read a little endian word
+ * @param  file - the trace
+ * @param[out] word - the word
+ * @return false at the end of the file
+ */
+static bool ReadWord(FILE *file, uint32_t *word)
+{
+    uint8_t bytes[4];
+    if (fread(bytes, 1, sizeof(bytes), file) != sizeof(bytes))
+    {
+        return false;
+    }
+    *word = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+    return true;
+}
+
+/**
+ * @brief  Read bytes packed 4 to a little endian word, low byte first
+ * @param  file - the trace
+ * @param[out] data - the bytes
+ * @param  length - the byte count, the last word is padded
+ * @return false at the end of the file
+ */
+static bool ReadBytes(FILE *file, uint8_t *data, uint32_t length)
+{
+    for (uint32_t offset = 0; offset < length; offset += 4)
+    {
+        uint32_t word;
+        if (!ReadWord(file, &word))
+        {
+            return false;
+        }
+        for (uint32_t i = 0; i < 4 && offset + i < length; i++)
+        {
+            data[offset + i] = word >> (i * 8);
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief  Write a little endian word
+ * @param  file - the trace
+ * @param  word - the word
+ * @return None
+ */
+static void WriteWord(FILE *file, uint32_t word)
+{
+    const uint8_t bytes[4] = {word, word >> 8, word >> 16, word >> 24};
+    fwrite(bytes, 1, sizeof(bytes), file);
+}
+
+/**
+ * @brief  Read all of stdin unless it is a terminal, which is made non
+ *         blocking instead
+ * @param  None
+ * @return None
+ * @note   A pipe only delivers what its writer got to before each read, so
+ *         reading it while running would tie the input to the wall clock.
+ */
+static void ReadInput(void)
+{
+    if (isatty(STDIN_FILENO))
+    {
+        s_stdinFlags = fcntl(STDIN_FILENO, F_GETFL);
+        fcntl(STDIN_FILENO, F_SETFL, s_stdinFlags | O_NONBLOCK);
+        // The terminal is shared with the shell
+        atexit(RestoreStdin);
+        return;
+    }
+
+    size_t capacity = HOST_INPUT_CHUNK;
+    s_input = malloc(capacity);
+    while (s_input)
+    {
+        const ssize_t count = read(STDIN_FILENO, s_input + s_inputSize, capacity - s_inputSize);
+        if (count <= 0)
+        {
+            break;
+        }
+
+        s_inputSize += count;
+        if (s_inputSize == capacity)
+        {
+            capacity *= 2;
+            s_input = realloc(s_input, capacity);
+        }
+    }
+}
+
+/**
+ * @brief  Put the terminal back as it was
+ * @param  None
+ * @return None
+ */
+static void RestoreStdin(void)
+{
+    fcntl(STDIN_FILENO, F_SETFL, s_stdinFlags);
+}
+
+/**
+ * @brief  Make stdout a stream into Console_Write(), so the firmware's
+ *         output takes the path it does on the MCU
+ * @param  None
+ * @return None
+ */
+static void RouteStdout(void)
+{
+    FILE *console = fopencookie(NULL, "w", (cookie_io_functions_t){.write = ConsoleWrite});
+    if (!console)
+    {
+        return;
+    }
+
+    // Each printf() reaches the buffer as it returns, as through _write()
+    setvbuf(console, NULL, _IONBF, 0);
+    s_console = stdout;
+    stdout = console;
+    atexit(FlushConsole);
+}
+
+/**
+ * @brief  stdout's write function
+ * @param  cookie - unused
+ * @param  buf - the bytes
+ * @param  size - the number of bytes
+ * @return size, whether or not it all fitted, like _write()
+ */
+static ssize_t ConsoleWrite(void *cookie, const char *buf, size_t size)
+{
+    Console_Write(buf, size);
+    return size;
+}
+
+/**
+ * @brief  Send what is left in the console's buffer at exit
+ * @param  None
+ * @return None
+ */
+static void FlushConsole(void)
+{
+    fflush(stdout);
+    s_consoleDrain = true;
+    for (uint32_t i = 0; i <= CONFIG_CONSOLE_TX_SIZE / HAL_CONSOLE_FRAME_SIZE; i++)
+    {
+        Console_Task();
+    }
+    fflush(s_console);
+}
+
+/**
+ * @brief  Write the settings page back to the file
+ * @param  None
+ * @return None
+ */
+static void SaveFlash(void)
+{
+    if (!s_flashFile)
+    {
+        return;
+    }
+
+    FILE *file = fopen(s_flashFile, "wb");
+    if (file)
+    {
+        fwrite(s_flash, 1, sizeof(s_flash), file);
+        fclose(file);
+    }
+}
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
@@ -0,0 +1,270 @@
+//------------------------------------------------------------------------------
+//       Filename: host.h
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Defines the host backend of the peripheral access layer
+//------------------------------------------------------------------------------
+//       Notes : Stands in for ch32v003fun.h in the host build. The register
+//               blocks the firmware touches are plain memory with the same
+//               names and bits, the backend reads them back to decide when
+//               the timer and the ADC would fire, and keeps SysTick counting.
+//               Time only moves when the firmware waits, in Delay_Ms(),
+//               and once per main loop iteration, so a run is deterministic.
+//------------------------------------------------------------------------------
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#include "funconfig.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+//------------------------------------------------------------------------------
+// Module exported defines
+//------------------------------------------------------------------------------
+#ifndef FUNCONF_SYSTEM_CORE_CLOCK
+#define FUNCONF_SYSTEM_CORE_CLOCK 48000000
+#endif
+
+// Simulated time of one main loop iteration
+#ifndef CONFIG_HOST_LOOP_CYCLES
+#define CONFIG_HOST_LOOP_CYCLES (FUNCONF_SYSTEM_CORE_CLOCK / 20000)
+#endif
+
+// Interrupt handlers are plain functions on the host
+#define interrupt
+
+#define RCC_APB2Periph_AFIO  (0x00000001)
+#define RCC_APB2Periph_GPIOA (0x00000004)
+#define RCC_APB2Periph_GPIOC (0x00000010)
+#define RCC_APB2Periph_GPIOD (0x00000020)
+#define RCC_APB2Periph_ADC1  (0x00000200)
+#define RCC_APB2Periph_TIM1  (0x00000800)
+#define RCC_ADCPRE           (0x0000F800)
+#define RCC_ADCPRE_DIV4      (0x00004000)
+
+#define GPIO_PartialRemap1_TIM1 (0x00160040)
+#define GPIO_Speed_In           (0)
+#define GPIO_Speed_10MHz        (1)
+#define GPIO_CNF_IN_ANALOG      (0)
+#define GPIO_CNF_OUT_PP_AF      (8)
+
+#define TIM_CEN    (0x0001)
+#define TIM_UG     (0x0001)
+#define TIM_OC3M_1 (0x0020)
+#define TIM_OC3M_2 (0x0040)
+#define TIM_MMS_1  (0x0020)
+#define TIM_CC3E   (0x0100)
+#define TIM_CC3NP  (0x0800)
+#define TIM_MOE    (0x8000)
+
+#define ADC_JEOC     (0x00000004)
+#define ADC_JEOCIE   (0x00000080)
+#define ADC_SCAN     (0x00000100)
+#define ADC_JAUTO    (0x00000400)
+#define ADC_JDISCEN  (0x00001000)
+#define ADC_ADON     (0x00000001)
+#define ADC_CAL      (0x00000004)
+#define ADC_RSTCAL   (0x00000008)
+#define ADC_JEXTSEL  (0x00007000)
+#define ADC_JEXTTRIG (0x00008000)
+#define ADC_EXTTRIG  (0x00100000)
+
+#define EXTEN_OPA_EN   (0x00010000)
+#define EXTEN_OPA_NSEL (0x00020000)
+#define EXTEN_OPA_PSEL (0x00040000)
+
+#define SYSTICK_CTLR_STE   (1 << 0)
+#define SYSTICK_CTLR_STIE  (1 << 1)
+#define SYSTICK_CTLR_STCLK (1 << 2)
+#define SYSTICK_CTLR_STRE  (1 << 3)
+
+#define IWDG_Prescaler_128 (0x05)
+
+#define ADC_IRQn     (29)
+
+#define RCC     (&g_hostRcc)
+#define AFIO    (&g_hostAfio)
+#define GPIOA   (&g_hostGpio[0])
+#define GPIOC   (&g_hostGpio[1])
+#define GPIOD   (&g_hostGpio[2])
+#define TIM1    (&g_hostTim1)
+#define ADC1    (&g_hostAdc1)
+#define EXTEN   (&g_hostExten)
+#define SysTick (&g_hostSysTick)
+#define IWDG    (&g_hostIwdg)
+#define PFIC    (&g_hostPfic)
+
+//------------------------------------------------------------------------------
+// Module exported type definitions
+//------------------------------------------------------------------------------
+typedef volatile uint32_t HostReg_t;
+
+typedef struct
+{
+    HostReg_t CTLR, CFGR0, INTR, APB2PRSTR, APB1PRSTR, AHBPCENR, APB2PCENR, APB1PCENR, RSTSCKR;
+} RCC_TypeDef;
+
+typedef struct
+{
+    HostReg_t ECR, PCFR1, EXTICR;
+} AFIO_TypeDef;
+
+typedef struct
+{
+    HostReg_t CFGLR, CFGHR, INDR, OUTDR, BSHR, BCR, LCKR;
+} GPIO_TypeDef;
+
+typedef struct
+{
+    HostReg_t CTLR1, CTLR2, SMCFGR, DMAINTENR, INTFR, SWEVGR, CHCTLR1, CHCTLR2, CCER, CNT, PSC, ATRLR, RPTCR;
+    HostReg_t CH1CVR, CH2CVR, CH3CVR, CH4CVR, BDTR, DMACFGR, DMAADR;
+} TIM_TypeDef;
+
+typedef struct
+{
+    HostReg_t STATR, CTLR1, CTLR2, SAMPTR1, SAMPTR2, IOFR1, IOFR2, IOFR3, IOFR4, WDHTR, WDLTR;
+    HostReg_t RSQR1, RSQR2, RSQR3, ISQR, IDATAR1, IDATAR2, IDATAR3, IDATAR4, RDATAR, DLYR;
+} ADC_TypeDef;
+
+typedef struct
+{
+    HostReg_t EXTEN_CTR;
+} EXTEN_TypeDef;
+
+typedef struct
+{
+    HostReg_t CTLR, SR, CNT, RESERVED0, CMP, RESERVED1;
+} SysTick_Type;
+
+typedef struct
+{
+    HostReg_t CTLR, PSCR, RLDR, STATR;
+} IWDG_TypeDef;
+
+typedef struct
+{
+    HostReg_t IPRIOR[256];
+} PFIC_Type;
+
+// One conversion of every ADC channel, in counts
+#define HOST_ADC_CHANNELS (10)
+typedef struct
+{
+    uint16_t channel[HOST_ADC_CHANNELS];
+} HostAdcSample_t;
+
+// Called after every ADC interrupt with the simulated time, in core cycles
+typedef void (*HostHook_t)(uint64_t cycles);
+
+// The model's operating conditions, see Plant_Configure()
+typedef struct
+{
+    double vin;  // Input voltage, V
+    double load; // Output load, Ohms, 0 for open circuit
+
+    // Component errors, 0 for the values in board.h
+    double rfError;   // Feedback divider top resistor, relative
+    double rinError;  // Feedback divider bottom resistor, relative
+    double vrefError; // Internal reference, relative
+    double offsetMv;  // Current amplifier input offset, mV
+} PlantConfig_t;
+
+// A battery across the output, in parallel with the load. The open circuit
+// voltage rises linearly with the charge, as a capacitor behind a resistance.
+typedef struct
+{
+    double emf;         // Open circuit voltage, V
+    double resistance;  // Internal resistance, Ohms
+    double capacitance; // Charge per volt of open circuit voltage, F
+} PlantBattery_t;
+
+// A string of like diodes across the output, e.g. LEDs, in parallel with the
+// load. Each follows the Shockley equation, the string has a series
+// resistance, so I = Is * (exp((V - I * R) / (count * n * Vt)) - 1).
+typedef struct
+{
+    uint32_t count;     // Diodes in series, 0 for none
+    double saturation;  // Is, A
+    double ideality;    // n
+    double resistance;  // The string's series resistance, Ohms
+} PlantDiode_t;
+
+// What a meter on the model would read
+typedef struct
+{
+    double vOut;       // Output voltage, V
+    double iL;         // Inductor current, A
+    double iLoad;      // Output current, into the load and the battery, A
+    double energyIn;   // Drawn from the input since Plant_Init(), J
+    double energyLoss; // Dissipated in the inductor and the diode, J
+    double vBattery;   // Battery open circuit voltage, V, 0 without one
+} PlantState_t;
+
+//------------------------------------------------------------------------------
+// Module exported functions
+//------------------------------------------------------------------------------
+void Host_Advance(uint32_t cycles);
+uint64_t Host_GetCycles(void);
+void Host_SetHook(HostHook_t hook);
+uint32_t Host_GetReplayCount(void);
+void Host_HidWrite(const uint8_t *report, uint32_t length);
+bool Host_ConsoleReady(void);
+void Host_ConsoleSend(const uint8_t *data, uint32_t size);
+
+void Host_FlashUnlock(bool unlocked);
+void Host_FlashErase(uint32_t address);
+void Host_FlashProgram(uint32_t address, uint16_t value);
+uint8_t Host_FlashRead(uint32_t address);
+
+// The converter and its analog front end, stepped once per PWM period
+void Plant_Configure(const PlantConfig_t *config);
+void Plant_SetLoad(double ohms);
+void Plant_SetBattery(const PlantBattery_t *battery);
+void Plant_SetDiode(const PlantDiode_t *diode);
+double Plant_GetDiodeCurrent(double volts);
+void Plant_Init(void);
+void Plant_Step(uint32_t compare, uint32_t period, HostAdcSample_t *sample);
+void Plant_GetState(PlantState_t *state);
+void Plant_GetResponse(double frequency, double *re, double *im);
+
+// ch32v003fun stand-ins
+void SystemInit(void);
+void Delay_Ms(uint32_t ms);
+void Delay_Us(uint32_t us);
+void NVIC_EnableIRQ(int irq);
+void NVIC_DisableIRQ(int irq);
+uint32_t __get_INTSYSCR(void);
+void __set_INTSYSCR(uint32_t value);
+int DidDebuggerAttach(void);
+void poll_input(void);
+void handle_debug_input(int numbytes, uint8_t *data);
+
+//------------------------------------------------------------------------------
+// Module exported variables
+//------------------------------------------------------------------------------
+extern RCC_TypeDef g_hostRcc;
+extern AFIO_TypeDef g_hostAfio;
+extern GPIO_TypeDef g_hostGpio[3];
+extern TIM_TypeDef g_hostTim1;
+extern ADC_TypeDef g_hostAdc1;
+extern EXTEN_TypeDef g_hostExten;
+extern SysTick_Type g_hostSysTick;
+extern IWDG_TypeDef g_hostIwdg;
+extern PFIC_Type g_hostPfic;
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+#ifdef __cplusplus
+}
+#endif
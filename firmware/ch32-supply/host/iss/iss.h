@@ -0,0 +1,121 @@
+//------------------------------------------------------------------------------
+//       Filename: iss.h
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Defines the instruction set simulator's core and bus
+//------------------------------------------------------------------------------
+//       Notes : A CH32V003 as far as main.elf can tell: an RV32EC core with
+//               Zicsr, 16K of flash behind the wait states FLASH->ACTLR asks
+//               for, 2K of RAM, and register models of RCC, FLASH, TIM1,
+//               ADC1, SysTick, the interrupt controller and the debugger's
+//               data registers. Everything else is plain memory.
+//               The cycle counts below are the model, not the datasheet,
+//               which gives none. They are close enough to compare two
+//               builds, check absolute figures against CONFIG_ENABLE_PROFILE
+//               on a board before relying on them.
+//------------------------------------------------------------------------------
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#include <stdbool.h>
+#include <stdint.h>
+
+//------------------------------------------------------------------------------
+// Module exported defines
+//------------------------------------------------------------------------------
+#define ISS_CORE_CLOCK (48000000)
+
+// Memory map, code runs from the flash alias at 0
+#define ISS_FLASH_ALIAS (0x00000000)
+#define ISS_FLASH_BASE  (0x08000000)
+#define ISS_FLASH_SIZE  (16 * 1024)
+#define ISS_FLASH_PAGE  (64)
+#define ISS_RAM_BASE    (0x20000000)
+#define ISS_RAM_SIZE    (2 * 1024)
+
+#define ISS_IRQ_COUNT   (32)
+#define ISS_IRQ_SYSTICK (12)
+#define ISS_IRQ_ADC1    (29)
+#define ISS_IRQ_NONE    (-1)
+
+// Cycles per instruction, the QingKe V2 pipeline has two stages
+#define ISS_CYCLES_INSTRUCTION (1) // Any instruction, fetched without waits
+#define ISS_CYCLES_LOAD        (1) // A load's data phase
+#define ISS_CYCLES_TAKEN       (1) // A taken branch or jump refills the fetch
+#define ISS_CYCLES_IRQ_ENTRY   (4) // Saving the context and reading the vector
+#define ISS_CYCLES_MRET        (2) // Restoring it, then the refill
+
+//------------------------------------------------------------------------------
+// Module exported type definitions
+//------------------------------------------------------------------------------
+typedef enum
+{
+    eISS_STEP_NONE = 0,
+    eISS_STEP_CALL,  // A jump that links, to cpu->pc
+    eISS_STEP_IRQ,   // An interrupt taken, to cpu->pc
+    eISS_STEP_MRET,  // The return from one
+    eISS_STEP_WAIT,  // wfi, the cycles went by asleep
+    eISS_STEP_BREAK, // ebreak
+    eISS_STEP_FAULT, // See cpu->fault
+} IssStep_e;
+
+typedef struct
+{
+    uint32_t x[16];
+    uint32_t pc;
+    uint64_t cycles;
+    uint64_t instructions;
+
+    uint32_t mstatus;
+    uint32_t mtvec;
+    uint32_t mepc;
+    uint32_t mcause;
+    uint32_t mscratch;
+    uint32_t intsyscr;
+
+    // The hardware prologue's copy of the caller saved registers
+    uint32_t shadow[16];
+    bool shadowed;
+    int irq; // Being served, ISS_IRQ_NONE in thread mode
+
+    uint32_t fetched; // Flash word in the fetch buffer, ~0 for none
+    const char *fault;
+} IssCpu_t;
+
+//------------------------------------------------------------------------------
+// Module exported functions
+//------------------------------------------------------------------------------
+void IssCpu_Reset(IssCpu_t *cpu);
+IssStep_e IssCpu_Step(IssCpu_t *cpu);
+
+bool IssBus_Init(const char *tracePath, const uint16_t *readings, bool debugger);
+bool IssBus_Load(uint32_t address, const uint8_t *data, uint32_t size);
+bool IssBus_Read(uint32_t address, uint32_t size, uint32_t *value);
+bool IssBus_Write(uint32_t address, uint32_t size, uint32_t value);
+uint32_t IssBus_WaitStates(uint32_t address);
+void IssBus_Advance(uint64_t cycles);
+uint64_t IssBus_NextEvent(void);
+int IssBus_PendingIrq(void);
+void IssBus_TakeIrq(int irq);
+bool IssBus_Done(void);
+void IssBus_Flush(void);
+void IssBus_Report(void);
+
+//------------------------------------------------------------------------------
+// Module exported variables
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+#ifdef __cplusplus
+}
+#endif
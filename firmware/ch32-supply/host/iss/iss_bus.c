@@ -0,0 +1,1086 @@
+//------------------------------------------------------------------------------
+//       Filename: iss_bus.c
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Implements the simulator's memory map and peripherals
+//------------------------------------------------------------------------------
+//       Notes : Registers are plain memory but for the bits main.elf waits
+//               on or takes its timing from:
+//                 RCC    - the ready bits follow the enables, SWS follows SW,
+//                          APB2PRSTR clears TIM1 and ADC1
+//                 FLASH  - ACTLR sets the wait states, the key sequence
+//                          unlocks, page erase and half word programming
+//                          change the image, nothing is ever busy
+//                 TIM1   - counts up from HCLK through PSC, each update is
+//                          TRGO when CTLR2 selects it
+//                 ADC1   - TRGO starts the regular group, JAUTO the injected
+//                          one after it. A channel takes its sample time plus
+//                          11 ADC clocks, ADCPRE's top two bits set the clock.
+//                          The results come from the trace, or the fixed
+//                          readings, in the order host/host.c loads them.
+//                          CAL and RSTCAL finish at once.
+//                 SysTick, the interrupt controller (enable, pending, the
+//                          reset key) and the debugger's DMDATA0 and DMDATA1.
+//               The debugger reads the link every ISS_DEBUGGER_POLL_CYCLES
+//               like minichlink, prints the output frames on stdout and
+//               answers with the console input from the trace. HID reports
+//               in the trace cannot be delivered, the USB stack is bit
+//               banged, so they are counted and skipped.
+//               Interrupts are levels: ADC1 while a flag it enables is set,
+//               SysTick while CNTIF is, and any set through IPSR.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#include "iss.h"
+#include "trace.h"
+#include <stdio.h>
+#include <string.h>
+
+//------------------------------------------------------------------------------
+// Module constant defines
+//------------------------------------------------------------------------------
+#define INFO_BASE (0x1ffff000) // System flash, ESIG and the option bytes
+#define INFO_SIZE (0x900)
+#define ESIG_FLACAP (0x1ffff7e0)
+
+#define PERIPH_BASE (0x40000000)
+#define PERIPH_SIZE (0x24000)
+#define CORE_BASE   (0xe0000000)
+#define CORE_SIZE   (0x10000)
+
+#define RCC_BASE       (0x40021000)
+#define RCC_CTLR       (RCC_BASE + 0x00)
+#define RCC_CFGR0      (RCC_BASE + 0x04)
+#define RCC_APB2PRSTR  (RCC_BASE + 0x0c)
+#define RCC_HSION      (1u << 0)
+#define RCC_HSEON      (1u << 16)
+#define RCC_PLLON      (1u << 24)
+#define RCC_READY      (RCC_HSION | RCC_HSEON | RCC_PLLON) // Each ready bit is the next one up
+#define RCC_RST_ADC1   (1u << 9)
+#define RCC_RST_TIM1   (1u << 11)
+
+#define FLASH_BASE_R  (0x40022000)
+#define FLASH_ACTLR   (FLASH_BASE_R + 0x00)
+#define FLASH_KEYR    (FLASH_BASE_R + 0x04)
+#define FLASH_STATR   (FLASH_BASE_R + 0x0c)
+#define FLASH_CTLR    (FLASH_BASE_R + 0x10)
+#define FLASH_ADDR    (FLASH_BASE_R + 0x14)
+#define FLASH_KEY1    (0x45670123)
+#define FLASH_KEY2    (0xcdef89ab)
+#define FLASH_PG      (1u << 0)
+#define FLASH_PER     (1u << 1)
+#define FLASH_STRT    (1u << 6)
+#define FLASH_LOCK    (1u << 7)
+#define FLASH_EOP     (1u << 5)
+#define FLASH_LATENCY (0x3)
+
+#define TIM1_BASE    (0x40012c00)
+#define TIM1_CTLR1   (TIM1_BASE + 0x00)
+#define TIM1_CTLR2   (TIM1_BASE + 0x04)
+#define TIM1_INTFR   (TIM1_BASE + 0x10)
+#define TIM1_SWEVGR  (TIM1_BASE + 0x14)
+#define TIM1_CNT     (TIM1_BASE + 0x24)
+#define TIM1_PSC     (TIM1_BASE + 0x28)
+#define TIM1_ATRLR   (TIM1_BASE + 0x2c)
+#define TIM1_SIZE    (0x50)
+#define TIM_CEN      (1u << 0)
+#define TIM_UG       (1u << 0)
+#define TIM_UIF      (1u << 0)
+#define TIM_MMS(r)   (((r) >> 4) & 0x7)
+#define TIM_MMS_UPDATE (2)
+
+#define ADC1_BASE     (0x40012400)
+#define ADC1_STATR    (ADC1_BASE + 0x00)
+#define ADC1_CTLR1    (ADC1_BASE + 0x04)
+#define ADC1_CTLR2    (ADC1_BASE + 0x08)
+#define ADC1_SAMPTR1  (ADC1_BASE + 0x0c)
+#define ADC1_SAMPTR2  (ADC1_BASE + 0x10)
+#define ADC1_RSQR1    (ADC1_BASE + 0x2c)
+#define ADC1_RSQR2    (ADC1_BASE + 0x30)
+#define ADC1_RSQR3    (ADC1_BASE + 0x34)
+#define ADC1_ISQR     (ADC1_BASE + 0x38)
+#define ADC1_IDATAR1  (ADC1_BASE + 0x3c)
+#define ADC1_IDATAR2  (ADC1_BASE + 0x40)
+#define ADC1_RDATAR   (ADC1_BASE + 0x4c)
+#define ADC1_SIZE     (0x50)
+#define ADC_AWD       (1u << 0)
+#define ADC_EOC       (1u << 1)
+#define ADC_JEOC      (1u << 2)
+#define ADC_JSTRT     (1u << 3)
+#define ADC_STRT      (1u << 4)
+#define ADC_EOCIE     (1u << 5)
+#define ADC_AWDIE     (1u << 6)
+#define ADC_JEOCIE    (1u << 7)
+#define ADC_SCAN      (1u << 8)
+#define ADC_JAUTO     (1u << 10)
+#define ADC_ADON      (1u << 0)
+#define ADC_CAL       (1u << 2)
+#define ADC_RSTCAL    (1u << 3)
+#define ADC_EXTSEL(r) (((r) >> 17) & 0x7)
+#define ADC_EXTTRIG   (1u << 20)
+#define ADC_JSWSTART  (1u << 21)
+#define ADC_SWSTART   (1u << 22)
+#define ADC_CONVERSION_CLOCKS (11)
+
+#define PFIC_BASE  (0xe000e000)
+#define PFIC_ISR   (PFIC_BASE + 0x000)
+#define PFIC_IPR   (PFIC_BASE + 0x020)
+#define PFIC_CFGR  (PFIC_BASE + 0x048)
+#define PFIC_IENR  (PFIC_BASE + 0x100)
+#define PFIC_IRER  (PFIC_BASE + 0x180)
+#define PFIC_IPSR  (PFIC_BASE + 0x200)
+#define PFIC_IPRR  (PFIC_BASE + 0x280)
+#define PFIC_KEY3  (0xbeef)
+#define PFIC_RESET (1u << 7)
+
+#define SYSTICK_BASE  (0xe000f000)
+#define SYSTICK_CTLR  (SYSTICK_BASE + 0x00)
+#define SYSTICK_SR    (SYSTICK_BASE + 0x04)
+#define SYSTICK_CNT   (SYSTICK_BASE + 0x08)
+#define SYSTICK_CMP   (SYSTICK_BASE + 0x10)
+#define SYSTICK_STE   (1u << 0)
+#define SYSTICK_STIE  (1u << 1)
+#define SYSTICK_STCLK (1u << 2)
+#define SYSTICK_STRE  (1u << 3)
+#define SYSTICK_CNTIF (1u << 0)
+
+#define DMDATA0  (0xe00000f4)
+#define DMDATA1  (0xe00000f8)
+#define SENTINEL (0xe00000fc) // Cleared by a debugger, see DidDebuggerAttach()
+
+// A debugger reading the link back to back, a frame per 100us, as on the host
+#define ISS_DEBUGGER_POLL_CYCLES (ISS_CORE_CLOCK / 10000)
+
+// How long wfi sleeps with nothing scheduled
+#define ISS_IDLE_CYCLES (ISS_CORE_CLOCK / 1000)
+
+#define ISS_INPUT_SIZE (256)
+
+#define NO_EVENT (UINT64_MAX)
+
+//------------------------------------------------------------------------------
+// Module type definitions
+//------------------------------------------------------------------------------
+typedef enum
+{
+    eEVENT_NONE = 0,
+    eEVENT_TIMER,
+    eEVENT_ADC,
+    eEVENT_SYSTICK,
+    eEVENT_DEBUGGER,
+} Event_e;
+
+//------------------------------------------------------------------------------
+// Module static variables
+//------------------------------------------------------------------------------
+static uint8_t s_flash[ISS_FLASH_SIZE];
+static uint8_t s_ram[ISS_RAM_SIZE];
+static uint8_t s_info[INFO_SIZE];
+static uint8_t s_periph[PERIPH_SIZE];
+static uint8_t s_core[CORE_SIZE];
+
+static uint64_t s_now = 0;
+static bool s_done = false;
+
+static uint32_t s_flashKeys = 0;
+
+static uint64_t s_timerStart = 0; // Where CNT was last 0
+static uint64_t s_timerUpdate = NO_EVENT;
+
+static uint64_t s_adcDone = NO_EVENT;
+static bool s_adcInjected = false;
+
+static uint64_t s_tickStart = 0; // Where CNT was last s_tickBase
+static uint32_t s_tickBase = 0;
+
+static uint64_t s_irqEnabled = 0;
+static uint64_t s_irqPending = 0; // Through IPSR
+
+static bool s_debugger = false;
+static uint64_t s_debuggerPoll = NO_EVENT;
+static uint8_t s_input[ISS_INPUT_SIZE];
+static uint32_t s_inputHead = 0;
+static uint32_t s_inputTail = 0;
+
+static FILE *s_trace = NULL;
+static const uint16_t *s_readings = NULL;
+
+static uint32_t s_conversions = 0;
+static uint32_t s_overruns = 0;
+static uint32_t s_hidSkipped = 0;
+static uint32_t s_inputDropped = 0;
+static uint32_t s_vrefMismatches = 0;
+
+//------------------------------------------------------------------------------
+// Module static function prototypes
+//------------------------------------------------------------------------------
+static uint8_t *Map(uint32_t address, uint32_t size);
+static uint32_t Reg(uint32_t address);
+static void SetReg(uint32_t address, uint32_t value);
+static void Refresh(uint32_t address);
+static void Written(uint32_t address, uint32_t old, uint32_t value);
+static bool ProgramFlash(uint32_t address, uint32_t size, uint32_t value);
+static Event_e NextEvent(uint64_t *at);
+static uint32_t TimerPeriod(void);
+static uint32_t TimerCount(void);
+static void TimerUpdate(uint64_t at);
+static void AdcStart(bool regular, bool injected);
+static void AdcComplete(void);
+static uint32_t AdcChannelCycles(uint32_t channel);
+static bool NextReadings(bool vrefSampled, uint32_t *record);
+static uint32_t TickDivider(uint32_t ctlr);
+static uint32_t TickCount(uint32_t ctlr);
+static uint64_t TickMatch(void);
+static void DebuggerPoll(void);
+static bool ReadWord(uint32_t *word);
+
+//------------------------------------------------------------------------------
+// Module externally exported functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  Reset the part with erased flash
+ * @param  tracePath - the ADC trace to feed, NULL for fixed readings
+ * @param  readings - voltage, current and VRef counts when there is no trace
+ * @param  debugger - whether a debugger reads the console
+ * @return false if the trace cannot be read
+ */
+bool IssBus_Init(const char *tracePath, const uint16_t *readings, bool debugger)
+{
+    memset(s_flash, 0xff, sizeof(s_flash));
+    memset(s_info, 0xff, sizeof(s_info));
+    SetReg(ESIG_FLACAP & ~3u, 0xffff0000 | (ISS_FLASH_SIZE / 1024));
+    SetReg(RCC_CTLR, RCC_HSION | (RCC_HSION << 1));
+    SetReg(FLASH_CTLR, FLASH_LOCK);
+
+    s_readings = readings;
+    s_debugger = debugger;
+    s_debuggerPoll = debugger ? ISS_DEBUGGER_POLL_CYCLES : NO_EVENT;
+    if (!tracePath)
+    {
+        return true;
+    }
+
+    s_trace = fopen(tracePath, "rb");
+    if (!s_trace)
+    {
+        perror(tracePath);
+        return false;
+    }
+
+    uint32_t magic = 0;
+    uint32_t version = 0;
+    if (!ReadWord(&magic) || !ReadWord(&version) || magic != TRACE_FILE_MAGIC || version < 1 ||
+        version > TRACE_FILE_VERSION)
+    {
+        fprintf(stderr, "%s: not a version 1 to %d trace\n", tracePath, TRACE_FILE_VERSION);
+        return false;
+    }
+
+    // The controller state has no place to go in an unmodified image, a
+    // device trace runs from boot like a host one
+    uint32_t seedLength = 0;
+    if (version >= 3 && !ReadWord(&seedLength))
+    {
+        fprintf(stderr, "%s: truncated\n", tracePath);
+        return false;
+    }
+    if (seedLength)
+    {
+        fprintf(stderr, "%s: a device trace, its controller state is ignored\n", tracePath);
+    }
+    for (uint32_t offset = 0; offset < seedLength; offset += 4)
+    {
+        uint32_t word;
+        if (!ReadWord(&word))
+        {
+            fprintf(stderr, "%s: truncated\n", tracePath);
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief  Put part of the image in flash, or RAM
+ * @param  address - its load address
+ * @param  data - the bytes
+ * @param  size - the byte count
+ * @return false if it does not fit the memory map
+ */
+bool IssBus_Load(uint32_t address, const uint8_t *data, uint32_t size)
+{
+    uint8_t *target = Map(address, size);
+    const bool flash = target >= s_flash && target < s_flash + sizeof(s_flash);
+    const bool ram = target >= s_ram && target < s_ram + sizeof(s_ram);
+    if (!flash && !ram)
+    {
+        return false;
+    }
+    memcpy(target, data, size);
+    return true;
+}
+
+/**
+ * @brief  Read from the memory map
+ * @param  address - the first byte
+ * @param  size - 1, 2 or 4 bytes
+ * @param[out] value - the value, zero extended
+ * @return false outside the memory map
+ */
+bool IssBus_Read(uint32_t address, uint32_t size, uint32_t *value)
+{
+    uint8_t *bytes = Map(address, size);
+    if (!bytes)
+    {
+        return false;
+    }
+
+    if (address >= PERIPH_BASE)
+    {
+        Refresh(address & ~3u);
+    }
+
+    *value = 0;
+    memcpy(value, bytes, size);
+    return true;
+}
+
+/**
+ * @brief  Write to the memory map
+ * @param  address - the first byte
+ * @param  size - 1, 2 or 4 bytes
+ * @param  value - the value, its low bytes for a narrow write
+ * @return false outside the memory map, or to flash it is not programming
+ */
+bool IssBus_Write(uint32_t address, uint32_t size, uint32_t value)
+{
+    uint8_t *bytes = Map(address, size);
+    if (!bytes)
+    {
+        return false;
+    }
+
+    if (address < PERIPH_BASE)
+    {
+        if (bytes >= s_ram && bytes < s_ram + sizeof(s_ram))
+        {
+            memcpy(bytes, &value, size);
+            return true;
+        }
+        return ProgramFlash(address, size, value);
+    }
+
+    const uint32_t reg = address & ~3u;
+    Refresh(reg);
+    const uint32_t old = Reg(reg);
+    memcpy(bytes, &value, size);
+    Written(reg, old, Reg(reg));
+    return true;
+}
+
+/**
+ * @brief  The wait states a read from an address takes
+ * @param  address - the address
+ * @return FLASH->ACTLR's latency for flash, 0 elsewhere
+ */
+uint32_t IssBus_WaitStates(uint32_t address)
+{
+    const bool flash = address - ISS_FLASH_ALIAS < ISS_FLASH_SIZE || address - ISS_FLASH_BASE < ISS_FLASH_SIZE ||
+                       address - INFO_BASE < INFO_SIZE;
+    return flash ? Reg(FLASH_ACTLR) & FLASH_LATENCY : 0;
+}
+
+/**
+ * @brief  Run the peripherals up to a time
+ * @param  cycles - the core's cycle count
+ * @return None
+ */
+void IssBus_Advance(uint64_t cycles)
+{
+    uint64_t at;
+    Event_e event;
+    while ((event = NextEvent(&at)) != eEVENT_NONE && at <= cycles)
+    {
+        s_now = at;
+        switch (event)
+        {
+            case eEVENT_TIMER:
+                TimerUpdate(at);
+                break;
+            case eEVENT_ADC:
+                AdcComplete();
+                break;
+            case eEVENT_SYSTICK:
+                SetReg(SYSTICK_SR, Reg(SYSTICK_SR) | SYSTICK_CNTIF);
+                if (Reg(SYSTICK_CTLR) & SYSTICK_STRE)
+                {
+                    s_tickBase = 0;
+                }
+                else
+                {
+                    s_tickBase = Reg(SYSTICK_CMP) + 1;
+                }
+                s_tickStart = at + TickDivider(Reg(SYSTICK_CTLR));
+                break;
+            case eEVENT_DEBUGGER:
+                DebuggerPoll();
+                s_debuggerPoll += ISS_DEBUGGER_POLL_CYCLES;
+                break;
+            case eEVENT_NONE:
+                break;
+        }
+    }
+    s_now = cycles;
+}
+
+/**
+ * @brief  When the next thing that could raise an interrupt happens
+ * @param  None
+ * @return the cycle, at most ISS_IDLE_CYCLES away
+ */
+uint64_t IssBus_NextEvent(void)
+{
+    uint64_t at;
+    const bool scheduled = NextEvent(&at) != eEVENT_NONE;
+    return scheduled && at < s_now + ISS_IDLE_CYCLES ? at : s_now + ISS_IDLE_CYCLES;
+}
+
+/**
+ * @brief  The interrupt the core should take
+ * @param  None
+ * @return the lowest pending and enabled one, ISS_IRQ_NONE if none
+ */
+int IssBus_PendingIrq(void)
+{
+    uint64_t pending = s_irqPending;
+
+    const uint32_t statr = Reg(ADC1_STATR);
+    const uint32_t ctlr1 = Reg(ADC1_CTLR1);
+    if (((statr & ADC_EOC) && (ctlr1 & ADC_EOCIE)) || ((statr & ADC_JEOC) && (ctlr1 & ADC_JEOCIE)) ||
+        ((statr & ADC_AWD) && (ctlr1 & ADC_AWDIE)))
+    {
+        pending |= 1ull << ISS_IRQ_ADC1;
+    }
+    if ((Reg(SYSTICK_SR) & SYSTICK_CNTIF) && (Reg(SYSTICK_CTLR) & SYSTICK_STIE))
+    {
+        pending |= 1ull << ISS_IRQ_SYSTICK;
+    }
+
+    pending &= s_irqEnabled;
+    return pending ? __builtin_ctzll(pending) : ISS_IRQ_NONE;
+}
+
+/**
+ * @brief  Clear a pending bit set through IPSR as its interrupt is taken
+ * @param  irq - the interrupt
+ * @return None
+ */
+void IssBus_TakeIrq(int irq)
+{
+    s_irqPending &= ~(1ull << irq);
+}
+
+/**
+ * @brief  Whether the run is over: the trace ran out or the part reset
+ * @param  None
+ * @return true to stop
+ */
+bool IssBus_Done(void)
+{
+    return s_done;
+}
+
+/**
+ * @brief  Print the console output the debugger has not polled yet
+ * @param  None
+ * @return None
+ */
+void IssBus_Flush(void)
+{
+    if (s_debugger && (Reg(DMDATA0) & 0x80))
+    {
+        DebuggerPoll();
+    }
+}
+
+/**
+ * @brief  Print what the peripherals saw
+ * @param  None
+ * @return None
+ */
+void IssBus_Report(void)
+{
+    fprintf(stderr, "conversions %u, overruns %u\n", s_conversions, s_overruns);
+    if (s_vrefMismatches)
+    {
+        fprintf(stderr, "VRef schedule differs from the trace on %u records\n", s_vrefMismatches);
+    }
+    if (s_hidSkipped)
+    {
+        fprintf(stderr, "%u HID reports in the trace skipped\n", s_hidSkipped);
+    }
+    if (s_inputDropped)
+    {
+        fprintf(stderr, "%u console bytes dropped, the debugger was not reading\n", s_inputDropped);
+    }
+}
+
+//------------------------------------------------------------------------------
+// Module static functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  Find the backing bytes of an access
+ * @param  address - the first byte
+ * @param  size - the byte count
+ * @return the bytes, NULL outside the memory map
+ */
+static uint8_t *Map(uint32_t address, uint32_t size)
+{
+    if (address - ISS_FLASH_ALIAS + size <= ISS_FLASH_SIZE)
+    {
+        return s_flash + address - ISS_FLASH_ALIAS;
+    }
+    if (address - ISS_FLASH_BASE + size <= ISS_FLASH_SIZE)
+    {
+        return s_flash + address - ISS_FLASH_BASE;
+    }
+    if (address - ISS_RAM_BASE + size <= ISS_RAM_SIZE)
+    {
+        return s_ram + address - ISS_RAM_BASE;
+    }
+    if (address - INFO_BASE + size <= INFO_SIZE)
+    {
+        return s_info + address - INFO_BASE;
+    }
+    if (address - PERIPH_BASE + size <= PERIPH_SIZE)
+    {
+        return s_periph + address - PERIPH_BASE;
+    }
+    if (address - CORE_BASE + size <= CORE_SIZE)
+    {
+        return s_core + address - CORE_BASE;
+    }
+    return NULL;
+}
+
+/**
+ * @brief  Read a register's backing word
+ * @param  address - the register
+ * @return its value
+ */
+static uint32_t Reg(uint32_t address)
+{
+    uint32_t value;
+    memcpy(&value, Map(address, 4), 4);
+    return value;
+}
+
+/**
+ * @brief  Set a register's backing word
+ * @param  address - the register
+ * @param  value - its value
+ * @return None
+ */
+static void SetReg(uint32_t address, uint32_t value)
+{
+    memcpy(Map(address, 4), &value, 4);
+}
+
+/**
+ * @brief  Bring a register that changes by itself up to date before a read
+ * @param  address - the register
+ * @return None
+ */
+static void Refresh(uint32_t address)
+{
+    switch (address)
+    {
+        case TIM1_CNT:
+            SetReg(TIM1_CNT, TimerCount());
+            break;
+        case SYSTICK_CNT:
+            SetReg(SYSTICK_CNT, TickCount(Reg(SYSTICK_CTLR)));
+            break;
+        case PFIC_ISR:
+        case PFIC_ISR + 4:
+            SetReg(address, s_irqEnabled >> (address == PFIC_ISR ? 0 : 32));
+            break;
+        case PFIC_IPR:
+        case PFIC_IPR + 4:
+            SetReg(address, s_irqPending >> (address == PFIC_IPR ? 0 : 32));
+            break;
+    }
+}
+
+/**
+ * @brief  Act on a register write
+ * @param  address - the register
+ * @param  old - its value before
+ * @param  value - its value now
+ * @return None
+ */
+static void Written(uint32_t address, uint32_t old, uint32_t value)
+{
+    switch (address)
+    {
+        case RCC_CTLR:
+            SetReg(RCC_CTLR, (value & ~(RCC_READY << 1)) | ((value & RCC_READY) << 1));
+            break;
+        case RCC_CFGR0:
+            SetReg(RCC_CFGR0, (value & ~0xcu) | ((value & 0x3) << 2));
+            break;
+        case RCC_APB2PRSTR:
+            if (value & RCC_RST_TIM1)
+            {
+                memset(Map(TIM1_BASE, TIM1_SIZE), 0, TIM1_SIZE);
+                s_timerUpdate = NO_EVENT;
+            }
+            if (value & RCC_RST_ADC1)
+            {
+                memset(Map(ADC1_BASE, ADC1_SIZE), 0, ADC1_SIZE);
+                s_adcDone = NO_EVENT;
+            }
+            break;
+
+        case FLASH_KEYR:
+            s_flashKeys = value == FLASH_KEY1 ? 1 : s_flashKeys == 1 && value == FLASH_KEY2 ? 2 : 0;
+            if (s_flashKeys == 2)
+            {
+                SetReg(FLASH_CTLR, Reg(FLASH_CTLR) & ~FLASH_LOCK);
+            }
+            break;
+        case FLASH_CTLR:
+            // Locked until the keys, and only the lock can be written then
+            if (old & FLASH_LOCK)
+            {
+                SetReg(FLASH_CTLR, old);
+            }
+            else if ((value & FLASH_STRT) && (value & FLASH_PER))
+            {
+                const uint32_t page = Reg(FLASH_ADDR) & (ISS_FLASH_SIZE - ISS_FLASH_PAGE);
+                memset(s_flash + page, 0xff, ISS_FLASH_PAGE);
+                SetReg(FLASH_CTLR, value & ~FLASH_STRT);
+                SetReg(FLASH_STATR, Reg(FLASH_STATR) | FLASH_EOP);
+            }
+            break;
+
+        case TIM1_CTLR1:
+            if ((value & TIM_CEN) && !(old & TIM_CEN))
+            {
+                s_timerStart = s_now - (uint64_t)(Reg(TIM1_CNT) & 0xffff) * ((Reg(TIM1_PSC) & 0xffff) + 1);
+                s_timerUpdate = s_timerStart + TimerPeriod();
+            }
+            else if (!(value & TIM_CEN) && (old & TIM_CEN))
+            {
+                s_timerUpdate = NO_EVENT;
+            }
+            break;
+        case TIM1_CNT:
+        case TIM1_PSC:
+        case TIM1_ATRLR:
+            if (Reg(TIM1_CTLR1) & TIM_CEN)
+            {
+                s_timerStart = s_now - (uint64_t)(Reg(TIM1_CNT) & 0xffff) * ((Reg(TIM1_PSC) & 0xffff) + 1);
+                s_timerUpdate = s_timerStart + TimerPeriod();
+            }
+            break;
+        case TIM1_SWEVGR:
+            if (value & TIM_UG)
+            {
+                SetReg(TIM1_SWEVGR, value & ~TIM_UG);
+                SetReg(TIM1_CNT, 0);
+                TimerUpdate(s_now);
+                s_timerStart = s_now;
+                s_timerUpdate = Reg(TIM1_CTLR1) & TIM_CEN ? s_now + TimerPeriod() : NO_EVENT;
+            }
+            break;
+
+        case ADC1_CTLR2:
+            SetReg(ADC1_CTLR2, value & ~(ADC_CAL | ADC_RSTCAL | ADC_SWSTART | ADC_JSWSTART));
+            if ((value & (ADC_SWSTART | ADC_JSWSTART)) && (value & ADC_ADON))
+            {
+                AdcStart(value & ADC_SWSTART, (value & ADC_JSWSTART) || (Reg(ADC1_CTLR1) & ADC_JAUTO));
+            }
+            break;
+
+        case SYSTICK_CTLR:
+            s_tickBase = TickCount(old);
+            s_tickStart = s_now;
+            break;
+        case SYSTICK_CNT:
+            s_tickBase = value;
+            s_tickStart = s_now;
+            break;
+
+        case PFIC_CFGR:
+            if ((value >> 16) == PFIC_KEY3 && (value & PFIC_RESET))
+            {
+                fprintf(stderr, "system reset requested\n");
+                s_done = true;
+            }
+            break;
+        case PFIC_IENR:
+        case PFIC_IENR + 4:
+            s_irqEnabled |= (uint64_t)value << (address == PFIC_IENR ? 0 : 32);
+            break;
+        case PFIC_IRER:
+        case PFIC_IRER + 4:
+            s_irqEnabled &= ~((uint64_t)value << (address == PFIC_IRER ? 0 : 32));
+            break;
+        case PFIC_IPSR:
+        case PFIC_IPSR + 4:
+            s_irqPending |= (uint64_t)value << (address == PFIC_IPSR ? 0 : 32);
+            break;
+        case PFIC_IPRR:
+        case PFIC_IPRR + 4:
+            s_irqPending &= ~((uint64_t)value << (address == PFIC_IPRR ? 0 : 32));
+            break;
+    }
+}
+
+/**
+ * @brief  Write to flash, which only programming can
+ * @param  address - the half word
+ * @param  size - must be 2
+ * @param  value - the half word
+ * @return false if the flash is not being programmed
+ */
+static bool ProgramFlash(uint32_t address, uint32_t size, uint32_t value)
+{
+    const uint32_t ctlr = Reg(FLASH_CTLR);
+    if (size != 2 || (ctlr & FLASH_LOCK) || !(ctlr & FLASH_PG) || !Map(address, size) || address >= INFO_BASE)
+    {
+        return false;
+    }
+
+    const uint32_t offset = address & (ISS_FLASH_SIZE - 1);
+    s_flash[offset] = value;
+    s_flash[offset + 1] = value >> 8;
+    SetReg(FLASH_STATR, Reg(FLASH_STATR) | FLASH_EOP);
+    return true;
+}
+
+/**
+ * @brief  Find the next scheduled peripheral event
+ * @param[out] at - its cycle
+ * @return the event, eEVENT_NONE if nothing is scheduled
+ */
+static Event_e NextEvent(uint64_t *at)
+{
+    Event_e event = eEVENT_NONE;
+    *at = NO_EVENT;
+
+    const uint64_t times[] = {
+        [eEVENT_TIMER] = s_timerUpdate,
+        [eEVENT_ADC] = s_adcDone,
+        [eEVENT_SYSTICK] = TickMatch(),
+        [eEVENT_DEBUGGER] = s_debuggerPoll,
+    };
+    for (uint32_t i = eEVENT_TIMER; i <= eEVENT_DEBUGGER; i++)
+    {
+        if (times[i] < *at)
+        {
+            *at = times[i];
+            event = (Event_e)i;
+        }
+    }
+    return event;
+}
+
+/**
+ * @brief  HCLK cycles between two TIM1 updates
+ * @param  None
+ * @return the period
+ */
+static uint32_t TimerPeriod(void)
+{
+    return ((Reg(TIM1_PSC) & 0xffff) + 1) * ((Reg(TIM1_ATRLR) & 0xffff) + 1);
+}
+
+/**
+ * @brief  TIM1's counter now
+ * @param  None
+ * @return CNT
+ */
+static uint32_t TimerCount(void)
+{
+    if (!(Reg(TIM1_CTLR1) & TIM_CEN))
+    {
+        return Reg(TIM1_CNT) & 0xffff;
+    }
+    return (s_now - s_timerStart) / ((Reg(TIM1_PSC) & 0xffff) + 1) % ((Reg(TIM1_ATRLR) & 0xffff) + 1);
+}
+
+/**
+ * @brief  A TIM1 update: the flag, TRGO, and the next one
+ * @param  at - its cycle
+ * @return None
+ */
+static void TimerUpdate(uint64_t at)
+{
+    SetReg(TIM1_INTFR, Reg(TIM1_INTFR) | TIM_UIF);
+    if (s_timerUpdate == at)
+    {
+        s_timerStart = at;
+        s_timerUpdate = at + TimerPeriod();
+    }
+
+    const uint32_t ctlr2 = Reg(ADC1_CTLR2);
+    if (TIM_MMS(Reg(TIM1_CTLR2)) == TIM_MMS_UPDATE && (ctlr2 & ADC_ADON) && (ctlr2 & ADC_EXTTRIG))
+    {
+        static bool warned = false;
+        if (ADC_EXTSEL(ctlr2) != 0 && !warned)
+        {
+            warned = true;
+            fprintf(stderr, "ADC1 EXTSEL %u is not modelled, TRGO starts it anyway\n", ADC_EXTSEL(ctlr2));
+        }
+        AdcStart(true, Reg(ADC1_CTLR1) & ADC_JAUTO);
+    }
+}
+
+/**
+ * @brief  Start converting, unless a conversion is running
+ * @param  regular - convert the regular group
+ * @param  injected - convert the injected group, after it
+ * @return None
+ */
+static void AdcStart(bool regular, bool injected)
+{
+    if (s_adcDone != NO_EVENT)
+    {
+        s_overruns++;
+        return;
+    }
+
+    uint32_t cycles = 0;
+    if (regular)
+    {
+        const uint32_t rsqr[3] = {Reg(ADC1_RSQR3), Reg(ADC1_RSQR2), Reg(ADC1_RSQR1)};
+        const uint32_t length = Reg(ADC1_CTLR1) & ADC_SCAN ? ((rsqr[2] >> 20) & 0xf) + 1 : 1;
+        for (uint32_t i = 0; i < length; i++)
+        {
+            cycles += AdcChannelCycles((rsqr[i / 6] >> (5 * (i % 6))) & 0x1f);
+        }
+    }
+    if (injected)
+    {
+        // The last JL + 1 of the four, see ADC_ISQR() in boost.c
+        const uint32_t isqr = Reg(ADC1_ISQR);
+        const uint32_t length = ((isqr >> 20) & 0x3) + 1;
+        for (uint32_t i = 4 - length; i < 4; i++)
+        {
+            cycles += AdcChannelCycles((isqr >> (5 * i)) & 0x1f);
+        }
+    }
+
+    SetReg(ADC1_STATR, Reg(ADC1_STATR) | (regular ? ADC_STRT : 0) | (injected ? ADC_JSTRT : 0));
+    s_adcInjected = injected;
+    s_adcDone = s_now + cycles;
+}
+
+/**
+ * @brief  End a conversion with the next readings
+ * @param  None
+ * @return None
+ * @note   Without readings left the run is over and the flags stay clear
+ */
+static void AdcComplete(void)
+{
+    s_adcDone = NO_EVENT;
+
+    const bool vrefSampled = ((Reg(ADC1_ISQR) >> 20) & 0x3) == 1;
+    uint32_t record;
+    if (!NextReadings(vrefSampled, &record))
+    {
+        s_done = true;
+        return;
+    }
+    s_conversions++;
+
+    SetReg(ADC1_RDATAR, (record >> TRACE_VOLTAGE_SHIFT) & TRACE_READING_MASK);
+    SetReg(ADC1_IDATAR1, (record >> TRACE_CURRENT_SHIFT) & TRACE_READING_MASK);
+    if (record & TRACE_VREF_SAMPLED)
+    {
+        SetReg(ADC1_IDATAR2, (record >> TRACE_VREF_SHIFT) & TRACE_READING_MASK);
+    }
+    SetReg(ADC1_STATR, Reg(ADC1_STATR) | ADC_EOC | (s_adcInjected ? ADC_JEOC : 0));
+}
+
+/**
+ * @brief  HCLK cycles to convert one channel
+ * @param  channel - the channel
+ * @return its sample time plus the conversion, in ADCCLK cycles times ADCPRE
+ */
+static uint32_t AdcChannelCycles(uint32_t channel)
+{
+    static const uint16_t samples[8] = {3, 9, 15, 30, 43, 57, 73, 241};
+    const uint32_t samptr = channel < 10 ? Reg(ADC1_SAMPTR2) >> (3 * channel) : Reg(ADC1_SAMPTR1) >> (3 * (channel - 10));
+    const uint32_t divider = 2 * (((Reg(RCC_CFGR0) >> 14) & 0x3) + 1);
+    return (samples[samptr & 0x7] + ADC_CONVERSION_CLOCKS) * divider;
+}
+
+/**
+ * @brief  The next conversion's readings, as a trace record
+ * @param  vrefSampled - whether the firmware asked for VRef this time
+ * @param[out] record - the readings
+ * @return false at the end of the trace
+ * @note   The console input before it goes to the debugger
+ */
+static bool NextReadings(bool vrefSampled, uint32_t *record)
+{
+    if (!s_trace)
+    {
+        *record = Trace_Pack(s_readings[0], s_readings[1], s_readings[2], vrefSampled);
+        return true;
+    }
+
+    while (ReadWord(record))
+    {
+        if (!(*record & TRACE_EVENT))
+        {
+            if (vrefSampled != ((*record & TRACE_VREF_SAMPLED) != 0))
+            {
+                s_vrefMismatches++;
+            }
+            return true;
+        }
+
+        const uint32_t type = (*record >> TRACE_EVENT_TYPE_SHIFT) & TRACE_EVENT_TYPE_MASK;
+        const uint32_t length = *record & TRACE_EVENT_LENGTH_MASK;
+        for (uint32_t offset = 0; offset < length; offset += 4)
+        {
+            uint32_t word;
+            if (!ReadWord(&word))
+            {
+                return false;
+            }
+            for (uint32_t i = 0; i < 4 && offset + i < length && type == eTRACE_EVENT_CONSOLE; i++)
+            {
+                if ((s_inputTail + 1) % ISS_INPUT_SIZE == s_inputHead || !s_debugger)
+                {
+                    s_inputDropped++;
+                    continue;
+                }
+                s_input[s_inputTail] = word >> (i * 8);
+                s_inputTail = (s_inputTail + 1) % ISS_INPUT_SIZE;
+            }
+        }
+        s_hidSkipped += type == eTRACE_EVENT_HID;
+    }
+    return false;
+}
+
+/**
+ * @brief  HCLK cycles per SysTick count
+ * @param  ctlr - SysTick's CTLR
+ * @return 1 on HCLK, 8 on HCLK / 8
+ */
+static uint32_t TickDivider(uint32_t ctlr)
+{
+    return ctlr & SYSTICK_STCLK ? 1 : 8;
+}
+
+/**
+ * @brief  SysTick's counter now
+ * @param  ctlr - the CTLR it has been counting with
+ * @return CNT
+ */
+static uint32_t TickCount(uint32_t ctlr)
+{
+    if (!(ctlr & SYSTICK_STE) || s_now < s_tickStart)
+    {
+        return ctlr & SYSTICK_STE ? s_tickBase : Reg(SYSTICK_CNT);
+    }
+    return s_tickBase + (uint32_t)((s_now - s_tickStart) / TickDivider(ctlr));
+}
+
+/**
+ * @brief  When SysTick next reaches CMP, only while it could act on it
+ * @param  None
+ * @return the cycle, NO_EVENT if never
+ */
+static uint64_t TickMatch(void)
+{
+    const uint32_t ctlr = Reg(SYSTICK_CTLR);
+    if (!(ctlr & SYSTICK_STE) || !(ctlr & (SYSTICK_STIE | SYSTICK_STRE)) || s_now < s_tickStart)
+    {
+        return NO_EVENT;
+    }
+
+    const uint32_t divider = TickDivider(ctlr);
+    const uint64_t elapsed = (s_now - s_tickStart) / divider;
+    const uint32_t remaining = Reg(SYSTICK_CMP) - (s_tickBase + (uint32_t)elapsed);
+    return s_tickStart + (elapsed + remaining) * divider;
+}
+
+/**
+ * @brief  Read the link as minichlink does: take an output frame and answer
+ *         it with input, or send input once the last was taken
+ * @param  None
+ * @return None
+ */
+static void DebuggerPoll(void)
+{
+    SetReg(SENTINEL, 0);
+
+    const uint32_t data0 = Reg(DMDATA0);
+    const uint32_t data1 = Reg(DMDATA1);
+    const uint32_t length = data0 & 0x7f;
+    if (data0 & 0x80)
+    {
+        const uint8_t frame[7] = {data0 >> 8, data0 >> 16, data0 >> 24, data1, data1 >> 8, data1 >> 16, data1 >> 24};
+        for (uint32_t i = 0; i + 4 < length && i < sizeof(frame); i++)
+        {
+            // An idle console sends a NUL to be asked for input
+            if (frame[i])
+            {
+                putchar(frame[i]);
+            }
+        }
+    }
+    else if (length > 4)
+    {
+        // The firmware has not taken the last input yet
+        return;
+    }
+
+    uint8_t frame[7] = {0};
+    uint32_t count = 0;
+    while (count < sizeof(frame) && s_inputHead != s_inputTail)
+    {
+        frame[count++] = s_input[s_inputHead];
+        s_inputHead = (s_inputHead + 1) % ISS_INPUT_SIZE;
+    }
+    if (!count && !(data0 & 0x80))
+    {
+        return;
+    }
+
+    SetReg(DMDATA1, frame[3] | frame[4] << 8 | frame[5] << 16 | (uint32_t)frame[6] << 24);
+    SetReg(DMDATA0, count ? (count + 4) | frame[0] << 8 | frame[1] << 16 | (uint32_t)frame[2] << 24 : 0);
+}
+
+/**
+ * @brief  Read a little endian word from the trace
+ * @param[out] word - the word
+ * @return false at the end of the file
+ */
+static bool ReadWord(uint32_t *word)
+{
+    uint8_t bytes[4];
+    if (fread(bytes, 1, sizeof(bytes), s_trace) != sizeof(bytes))
+    {
+        return false;
+    }
+    *word = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+    return true;
+}
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
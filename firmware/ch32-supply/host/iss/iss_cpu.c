@@ -0,0 +1,862 @@
+//------------------------------------------------------------------------------
+//       Filename: iss_cpu.c
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Implements the simulator's RV32EC core
+//------------------------------------------------------------------------------
+//       Notes : Compressed instructions are decoded into the same form as
+//               the full ones and share their execution. An instruction the
+//               part would trap on, or an access outside the memory map,
+//               stops the run with a fault instead: the firmware has no
+//               exception handler worth simulating.
+//               Interrupts are taken one at a time, between instructions.
+//               With the hardware prologue on (INTSYSCR bit 0) the caller
+//               saved registers are copied on entry and put back by mret,
+//               at no cost beyond ISS_CYCLES_IRQ_ENTRY.
+//               Flash fetches 32 bits at a time. Each word new to the fetch
+//               buffer waits the flash latency, taken jumps empty it.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#include "iss.h"
+#include <stdio.h>
+#include <string.h>
+
+//------------------------------------------------------------------------------
+// Module constant defines
+//------------------------------------------------------------------------------
+#define MSTATUS_MIE  (1u << 3)
+#define MSTATUS_MPIE (1u << 7)
+#define MSTATUS_MPP  (3u << 11)
+
+#define INTSYSCR_HPE (1u << 0)
+
+#define CSR_MSTATUS  (0x300)
+#define CSR_MISA     (0x301)
+#define CSR_MTVEC    (0x305)
+#define CSR_MSCRATCH (0x340)
+#define CSR_MEPC     (0x341)
+#define CSR_MCAUSE   (0x342)
+#define CSR_MTVAL    (0x343)
+#define CSR_GINTENR  (0x800) // MIE and MPIE on their own
+#define CSR_INTSYSCR (0x804)
+
+// RV32 E and C, XLEN 32
+#define MISA_VALUE ((1u << 30) | (1u << 4) | (1u << 2))
+
+#define NO_FETCH (0xffffffff)
+
+// The registers the hardware prologue saves: ra, t0 to t2, a0 to a5
+#define HPE_SAVED ((1u << 1) | (7u << 5) | (0x3fu << 10))
+
+#define BITS(value, high, low) (((value) >> (low)) & ((1u << ((high) - (low) + 1)) - 1))
+#define SIGN(value, bits)      ((int32_t)((uint32_t)(value) << (32 - (bits))) >> (32 - (bits)))
+
+//------------------------------------------------------------------------------
+// Module type definitions
+//------------------------------------------------------------------------------
+typedef enum
+{
+    eOP_ILLEGAL = 0,
+    eOP_LUI,
+    eOP_AUIPC,
+    eOP_JAL,
+    eOP_JALR,
+    eOP_BRANCH, // funct3 as encoded
+    eOP_LOAD,   // funct3 as encoded
+    eOP_STORE,  // funct3 as encoded
+    eOP_ALU,    // Alu_e, rs2 or the immediate
+    eOP_FENCE,
+    eOP_CSR, // funct3 as encoded, the CSR in imm
+    eOP_ECALL,
+    eOP_EBREAK,
+    eOP_MRET,
+    eOP_WFI,
+} Op_e;
+
+typedef enum
+{
+    eALU_ADD = 0,
+    eALU_SUB,
+    eALU_SLL,
+    eALU_SLT,
+    eALU_SLTU,
+    eALU_XOR,
+    eALU_SRL,
+    eALU_SRA,
+    eALU_OR,
+    eALU_AND,
+} Alu_e;
+
+typedef struct
+{
+    Op_e op;
+    uint8_t funct;
+    bool immediate; // eOP_ALU with imm for rs2
+    uint8_t rd;
+    uint8_t rs1;
+    uint8_t rs2;
+    int32_t imm;
+    uint8_t length;
+} Insn_t;
+
+//------------------------------------------------------------------------------
+// Module static variables
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module static function prototypes
+//------------------------------------------------------------------------------
+static bool Fetch(IssCpu_t *cpu, uint32_t *word);
+static bool FetchHalf(IssCpu_t *cpu, uint32_t address, uint32_t *half);
+static Insn_t Decode(uint32_t word);
+static Insn_t DecodeCompressed(uint32_t half);
+static Insn_t Alu(Alu_e alu, bool immediate, uint32_t rd, uint32_t rs1, uint32_t rs2, int32_t imm);
+static Insn_t Memory(Op_e op, uint8_t funct, uint32_t rd, uint32_t rs1, uint32_t rs2, int32_t imm);
+static IssStep_e Execute(IssCpu_t *cpu, const Insn_t *insn);
+static uint32_t AluResult(Alu_e alu, uint32_t a, uint32_t b);
+static bool Csr(IssCpu_t *cpu, uint32_t csr, uint32_t funct, uint32_t operand, uint32_t *old);
+static IssStep_e TakeIrq(IssCpu_t *cpu, int irq);
+static IssStep_e Mret(IssCpu_t *cpu);
+static IssStep_e Fault(IssCpu_t *cpu, const char *fault);
+
+//------------------------------------------------------------------------------
+// Module externally exported functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  Put the core in its reset state, fetching from 0
+ * @param  cpu - the core
+ * @return None
+ */
+void IssCpu_Reset(IssCpu_t *cpu)
+{
+    memset(cpu, 0, sizeof(*cpu));
+    cpu->mstatus = MSTATUS_MPP;
+    cpu->irq = ISS_IRQ_NONE;
+    cpu->fetched = NO_FETCH;
+}
+
+/**
+ * @brief  Take a pending interrupt, or run one instruction
+ * @param  cpu - the core
+ * @return what the step did, cpu->cycles has its cost
+ */
+IssStep_e IssCpu_Step(IssCpu_t *cpu)
+{
+    IssStep_e step = eISS_STEP_NONE;
+    const int irq = IssBus_PendingIrq();
+    if (irq != ISS_IRQ_NONE && cpu->irq == ISS_IRQ_NONE && (cpu->mstatus & MSTATUS_MIE))
+    {
+        step = TakeIrq(cpu, irq);
+    }
+    else
+    {
+        uint32_t word;
+        if (!Fetch(cpu, &word))
+        {
+            return Fault(cpu, "instruction fetch outside flash and RAM");
+        }
+
+        const Insn_t insn = (word & 3) == 3 ? Decode(word) : DecodeCompressed(word & 0xffff);
+        if (insn.op == eOP_ILLEGAL)
+        {
+            return Fault(cpu, "illegal instruction, the core is RV32EC with Zicsr");
+        }
+
+        cpu->cycles += ISS_CYCLES_INSTRUCTION;
+        cpu->instructions++;
+        step = Execute(cpu, &insn);
+    }
+
+    IssBus_Advance(cpu->cycles);
+    return step;
+}
+
+//------------------------------------------------------------------------------
+// Module static functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  Fetch the instruction at pc, with the flash waits
+ * @param  cpu - the core
+ * @param[out] word - the instruction, a compressed one in the low half
+ * @return false outside flash and RAM
+ */
+static bool Fetch(IssCpu_t *cpu, uint32_t *word)
+{
+    uint32_t low;
+    uint32_t high = 0;
+    if ((cpu->pc & 1) || !FetchHalf(cpu, cpu->pc, &low))
+    {
+        return false;
+    }
+    if ((low & 3) == 3 && !FetchHalf(cpu, cpu->pc + 2, &high))
+    {
+        return false;
+    }
+    *word = low | high << 16;
+    return true;
+}
+
+/**
+ * @brief  Fetch 16 bits of an instruction
+ * @param  cpu - the core
+ * @param  address - the half word
+ * @param[out] half - its value
+ * @return false outside flash and RAM
+ */
+static bool FetchHalf(IssCpu_t *cpu, uint32_t address, uint32_t *half)
+{
+    const bool flash = address - ISS_FLASH_ALIAS < ISS_FLASH_SIZE || address - ISS_FLASH_BASE < ISS_FLASH_SIZE;
+    const bool ram = address - ISS_RAM_BASE < ISS_RAM_SIZE;
+    if (!flash && !ram)
+    {
+        return false;
+    }
+
+    if (flash && (address & ~3u) != cpu->fetched)
+    {
+        cpu->fetched = address & ~3u;
+        cpu->cycles += IssBus_WaitStates(address);
+    }
+    return IssBus_Read(address, 2, half);
+}
+
+/**
+ * @brief  Decode a 32 bit instruction
+ * @param  word - the instruction
+ * @return the decoded instruction, eOP_ILLEGAL for any not in RV32E
+ */
+static Insn_t Decode(uint32_t word)
+{
+    static const Alu_e aluOps[8] = {eALU_ADD, eALU_SLL, eALU_SLT, eALU_SLTU, eALU_XOR, eALU_SRL, eALU_OR, eALU_AND};
+
+    const uint32_t rd = BITS(word, 11, 7);
+    const uint32_t rs1 = BITS(word, 19, 15);
+    const uint32_t rs2 = BITS(word, 24, 20);
+    const uint32_t funct3 = BITS(word, 14, 12);
+    const uint32_t funct7 = BITS(word, 31, 25);
+    const int32_t immI = SIGN(word >> 20, 12);
+    const int32_t immS = SIGN((funct7 << 5) | rd, 12);
+    const int32_t immB = SIGN((BITS(word, 31, 31) << 12) | (BITS(word, 7, 7) << 11) | (BITS(word, 30, 25) << 5) |
+                                  (BITS(word, 11, 8) << 1),
+                              13);
+    const int32_t immJ = SIGN((BITS(word, 31, 31) << 20) | (BITS(word, 19, 12) << 12) | (BITS(word, 20, 20) << 11) |
+                                  (BITS(word, 30, 21) << 1),
+                              21);
+
+    Insn_t insn = {.op = eOP_ILLEGAL};
+    switch (word & 0x7f)
+    {
+        case 0x37:
+            insn = (Insn_t){.op = eOP_LUI, .rd = rd, .imm = (int32_t)(word & 0xfffff000)};
+            break;
+        case 0x17:
+            insn = (Insn_t){.op = eOP_AUIPC, .rd = rd, .imm = (int32_t)(word & 0xfffff000)};
+            break;
+        case 0x6f:
+            insn = (Insn_t){.op = eOP_JAL, .rd = rd, .imm = immJ};
+            break;
+        case 0x67:
+            if (funct3 == 0)
+            {
+                insn = (Insn_t){.op = eOP_JALR, .rd = rd, .rs1 = rs1, .imm = immI};
+            }
+            break;
+        case 0x63:
+            if (funct3 != 2 && funct3 != 3)
+            {
+                insn = (Insn_t){.op = eOP_BRANCH, .funct = funct3, .rs1 = rs1, .rs2 = rs2, .imm = immB};
+            }
+            break;
+        case 0x03:
+            if (funct3 != 3 && funct3 < 6)
+            {
+                insn = Memory(eOP_LOAD, funct3, rd, rs1, 0, immI);
+            }
+            break;
+        case 0x23:
+            if (funct3 < 3)
+            {
+                insn = Memory(eOP_STORE, funct3, 0, rs1, rs2, immS);
+            }
+            break;
+        case 0x13:
+            if (funct3 == 1 && funct7 == 0)
+            {
+                insn = Alu(eALU_SLL, true, rd, rs1, 0, rs2);
+            }
+            else if (funct3 == 5 && (funct7 == 0 || funct7 == 0x20))
+            {
+                insn = Alu(funct7 ? eALU_SRA : eALU_SRL, true, rd, rs1, 0, rs2);
+            }
+            else if (funct3 != 1 && funct3 != 5)
+            {
+                insn = Alu(aluOps[funct3], true, rd, rs1, 0, immI);
+            }
+            break;
+        case 0x33:
+            // No M extension on the part
+            if (funct7 == 0)
+            {
+                insn = Alu(aluOps[funct3], false, rd, rs1, rs2, 0);
+            }
+            else if (funct7 == 0x20 && (funct3 == 0 || funct3 == 5))
+            {
+                insn = Alu(funct3 ? eALU_SRA : eALU_SUB, false, rd, rs1, rs2, 0);
+            }
+            break;
+        case 0x0f:
+            insn = (Insn_t){.op = eOP_FENCE};
+            break;
+        case 0x73:
+            if (funct3 == 0 && rd == 0 && rs1 == 0)
+            {
+                switch (word >> 20)
+                {
+                    case 0x000:
+                        insn.op = eOP_ECALL;
+                        break;
+                    case 0x001:
+                        insn.op = eOP_EBREAK;
+                        break;
+                    case 0x302:
+                        insn.op = eOP_MRET;
+                        break;
+                    case 0x105:
+                        insn.op = eOP_WFI;
+                        break;
+                }
+            }
+            else if (funct3 != 0 && funct3 != 4)
+            {
+                insn = (Insn_t){.op = eOP_CSR, .funct = funct3, .rd = rd, .rs1 = rs1, .imm = word >> 20};
+            }
+            break;
+    }
+
+    // RV32E has 16 registers, a CSR immediate is not one
+    const bool csrImmediate = insn.op == eOP_CSR && funct3 >= 5;
+    if (insn.rd >= 16 || (insn.rs1 >= 16 && !csrImmediate) || insn.rs2 >= 16)
+    {
+        insn.op = eOP_ILLEGAL;
+    }
+    insn.length = 4;
+    return insn;
+}
+
+/**
+ * @brief  Decode a compressed instruction
+ * @param  half - the instruction
+ * @return the decoded instruction, eOP_ILLEGAL for any not in RV32EC
+ */
+static Insn_t DecodeCompressed(uint32_t half)
+{
+    // The 3 bit register fields name x8 to x15
+    const uint32_t rdFull = BITS(half, 11, 7);
+    const uint32_t rs2Full = BITS(half, 6, 2);
+    const uint32_t rdShort = 8 + BITS(half, 4, 2);
+    const uint32_t rs1Short = 8 + BITS(half, 9, 7);
+    const int32_t imm6 = SIGN((BITS(half, 12, 12) << 5) | BITS(half, 6, 2), 6);
+    const uint32_t shamt = BITS(half, 6, 2);
+    const uint32_t uimmW = (BITS(half, 12, 10) << 3) | (BITS(half, 6, 6) << 2) | (BITS(half, 5, 5) << 6);
+    const int32_t immJ = SIGN((BITS(half, 12, 12) << 11) | (BITS(half, 11, 11) << 4) | (BITS(half, 10, 9) << 8) |
+                                  (BITS(half, 8, 8) << 10) | (BITS(half, 7, 7) << 6) | (BITS(half, 6, 6) << 7) |
+                                  (BITS(half, 5, 3) << 1) | (BITS(half, 2, 2) << 5),
+                              12);
+    const int32_t immB = SIGN((BITS(half, 12, 12) << 8) | (BITS(half, 11, 10) << 3) | (BITS(half, 6, 5) << 6) |
+                                  (BITS(half, 4, 3) << 1) | (BITS(half, 2, 2) << 5),
+                              9);
+
+    Insn_t insn = {.op = eOP_ILLEGAL};
+    switch ((BITS(half, 1, 0) << 3) | BITS(half, 15, 13))
+    {
+        case 000: // c.addi4spn
+        {
+            const uint32_t imm = (BITS(half, 12, 11) << 4) | (BITS(half, 10, 7) << 6) | (BITS(half, 6, 6) << 2) |
+                                 (BITS(half, 5, 5) << 3);
+            if (imm)
+            {
+                insn = Alu(eALU_ADD, true, rdShort, 2, 0, imm);
+            }
+            break;
+        }
+        case 002: // c.lw
+            insn = Memory(eOP_LOAD, 2, rdShort, rs1Short, 0, uimmW);
+            break;
+        case 006: // c.sw
+            insn = Memory(eOP_STORE, 2, 0, rs1Short, rdShort, uimmW);
+            break;
+
+        case 010: // c.addi, c.nop
+            insn = Alu(eALU_ADD, true, rdFull, rdFull, 0, imm6);
+            break;
+        case 011: // c.jal
+            insn = (Insn_t){.op = eOP_JAL, .rd = 1, .imm = immJ};
+            break;
+        case 012: // c.li
+            insn = Alu(eALU_ADD, true, rdFull, 0, 0, imm6);
+            break;
+        case 013: // c.addi16sp, c.lui
+            if (rdFull == 2)
+            {
+                const int32_t imm = SIGN((BITS(half, 12, 12) << 9) | (BITS(half, 6, 6) << 4) | (BITS(half, 5, 5) << 6) |
+                                             (BITS(half, 4, 3) << 7) | (BITS(half, 2, 2) << 5),
+                                         10);
+                if (imm)
+                {
+                    insn = Alu(eALU_ADD, true, 2, 2, 0, imm);
+                }
+            }
+            else if (imm6)
+            {
+                insn = (Insn_t){.op = eOP_LUI, .rd = rdFull, .imm = (int32_t)((uint32_t)imm6 << 12)};
+            }
+            break;
+        case 014: // c.srli, c.srai, c.andi, c.sub, c.xor, c.or, c.and
+            switch (BITS(half, 11, 10))
+            {
+                case 0:
+                case 1:
+                    if (!BITS(half, 12, 12))
+                    {
+                        insn = Alu(BITS(half, 10, 10) ? eALU_SRA : eALU_SRL, true, rs1Short, rs1Short, 0, shamt);
+                    }
+                    break;
+                case 2:
+                    insn = Alu(eALU_AND, true, rs1Short, rs1Short, 0, imm6);
+                    break;
+                case 3:
+                    if (!BITS(half, 12, 12))
+                    {
+                        static const Alu_e ops[4] = {eALU_SUB, eALU_XOR, eALU_OR, eALU_AND};
+                        insn = Alu(ops[BITS(half, 6, 5)], false, rs1Short, rs1Short, rdShort, 0);
+                    }
+                    break;
+            }
+            break;
+        case 015: // c.j
+            insn = (Insn_t){.op = eOP_JAL, .rd = 0, .imm = immJ};
+            break;
+        case 016: // c.beqz
+        case 017: // c.bnez
+            insn = (Insn_t){.op = eOP_BRANCH, .funct = BITS(half, 13, 13), .rs1 = rs1Short, .imm = immB};
+            break;
+
+        case 020: // c.slli
+            if (!BITS(half, 12, 12))
+            {
+                insn = Alu(eALU_SLL, true, rdFull, rdFull, 0, shamt);
+            }
+            break;
+        case 022: // c.lwsp
+            if (rdFull)
+            {
+                const uint32_t imm = (BITS(half, 12, 12) << 5) | (BITS(half, 6, 4) << 2) | (BITS(half, 3, 2) << 6);
+                insn = Memory(eOP_LOAD, 2, rdFull, 2, 0, imm);
+            }
+            break;
+        case 024: // c.jr, c.mv, c.ebreak, c.jalr, c.add
+            if (!BITS(half, 12, 12))
+            {
+                if (rs2Full)
+                {
+                    insn = Alu(eALU_ADD, false, rdFull, 0, rs2Full, 0);
+                }
+                else if (rdFull)
+                {
+                    insn = (Insn_t){.op = eOP_JALR, .rd = 0, .rs1 = rdFull};
+                }
+            }
+            else if (rs2Full)
+            {
+                insn = Alu(eALU_ADD, false, rdFull, rdFull, rs2Full, 0);
+            }
+            else if (rdFull)
+            {
+                insn = (Insn_t){.op = eOP_JALR, .rd = 1, .rs1 = rdFull};
+            }
+            else
+            {
+                insn.op = eOP_EBREAK;
+            }
+            break;
+        case 026: // c.swsp
+        {
+            const uint32_t imm = (BITS(half, 12, 9) << 2) | (BITS(half, 8, 7) << 6);
+            insn = Memory(eOP_STORE, 2, 0, 2, rs2Full, imm);
+            break;
+        }
+    }
+
+    if (insn.rd >= 16 || insn.rs1 >= 16 || insn.rs2 >= 16)
+    {
+        insn.op = eOP_ILLEGAL;
+    }
+    insn.length = 2;
+    return insn;
+}
+
+/**
+ * @brief  Make an arithmetic instruction
+ * @param  alu - the operation
+ * @param  immediate - imm in place of rs2
+ * @param  rd, rs1, rs2, imm - its operands
+ * @return the instruction
+ */
+static Insn_t Alu(Alu_e alu, bool immediate, uint32_t rd, uint32_t rs1, uint32_t rs2, int32_t imm)
+{
+    return (Insn_t){.op = eOP_ALU, .funct = alu, .immediate = immediate, .rd = rd, .rs1 = rs1, .rs2 = rs2, .imm = imm};
+}
+
+/**
+ * @brief  Make a load or a store
+ * @param  op - eOP_LOAD or eOP_STORE
+ * @param  funct - the width and sign, funct3 as encoded
+ * @param  rd, rs1, rs2, imm - its operands
+ * @return the instruction
+ */
+static Insn_t Memory(Op_e op, uint8_t funct, uint32_t rd, uint32_t rs1, uint32_t rs2, int32_t imm)
+{
+    return (Insn_t){.op = op, .funct = funct, .rd = rd, .rs1 = rs1, .rs2 = rs2, .imm = imm};
+}
+
+/**
+ * @brief  Run a decoded instruction
+ * @param  cpu - the core
+ * @param  insn - the instruction at pc
+ * @return what the step did
+ */
+static IssStep_e Execute(IssCpu_t *cpu, const Insn_t *insn)
+{
+    const uint32_t rs1 = cpu->x[insn->rs1];
+    const uint32_t rs2 = cpu->x[insn->rs2];
+    uint32_t next = cpu->pc + insn->length;
+    uint32_t result = 0;
+    bool writes = true;
+    IssStep_e step = eISS_STEP_NONE;
+
+    switch (insn->op)
+    {
+        case eOP_LUI:
+            result = insn->imm;
+            break;
+        case eOP_AUIPC:
+            result = cpu->pc + insn->imm;
+            break;
+        case eOP_JAL:
+        case eOP_JALR:
+            result = next;
+            next = insn->op == eOP_JAL ? cpu->pc + insn->imm : (rs1 + insn->imm) & ~1u;
+            cpu->cycles += ISS_CYCLES_TAKEN;
+            cpu->fetched = NO_FETCH;
+            step = insn->rd == 1 ? eISS_STEP_CALL : eISS_STEP_NONE;
+            break;
+        case eOP_BRANCH:
+        {
+            bool taken = false;
+            switch (insn->funct)
+            {
+                case 0:
+                    taken = rs1 == rs2;
+                    break;
+                case 1:
+                    taken = rs1 != rs2;
+                    break;
+                case 4:
+                    taken = (int32_t)rs1 < (int32_t)rs2;
+                    break;
+                case 5:
+                    taken = (int32_t)rs1 >= (int32_t)rs2;
+                    break;
+                case 6:
+                    taken = rs1 < rs2;
+                    break;
+                case 7:
+                    taken = rs1 >= rs2;
+                    break;
+            }
+            if (taken)
+            {
+                next = cpu->pc + insn->imm;
+                cpu->cycles += ISS_CYCLES_TAKEN;
+                cpu->fetched = NO_FETCH;
+            }
+            writes = false;
+            break;
+        }
+        case eOP_LOAD:
+        {
+            const uint32_t address = rs1 + insn->imm;
+            const uint32_t size = 1u << (insn->funct & 3);
+            if ((address & (size - 1)) || !IssBus_Read(address, size, &result))
+            {
+                return Fault(cpu, "load outside the memory map or misaligned");
+            }
+            if (insn->funct < 4)
+            {
+                result = size == 4 ? result : (uint32_t)SIGN(result, size * 8);
+            }
+            cpu->cycles += ISS_CYCLES_LOAD + IssBus_WaitStates(address);
+            break;
+        }
+        case eOP_STORE:
+        {
+            const uint32_t address = rs1 + insn->imm;
+            const uint32_t size = 1u << insn->funct;
+            if ((address & (size - 1)) || !IssBus_Write(address, size, rs2))
+            {
+                return Fault(cpu, "store outside the memory map or misaligned");
+            }
+            writes = false;
+            break;
+        }
+        case eOP_ALU:
+            result = AluResult((Alu_e)insn->funct, rs1, insn->immediate ? (uint32_t)insn->imm : rs2);
+            break;
+        case eOP_FENCE:
+            writes = false;
+            break;
+        case eOP_CSR:
+        {
+            const uint32_t operand = insn->funct >= 5 ? insn->rs1 : rs1;
+            if (!Csr(cpu, insn->imm & 0xfff, insn->funct, operand, &result))
+            {
+                return Fault(cpu, "CSR the simulator does not model");
+            }
+            break;
+        }
+        case eOP_ECALL:
+            return Fault(cpu, "ecall");
+        case eOP_EBREAK:
+            return eISS_STEP_BREAK;
+        case eOP_MRET:
+            return Mret(cpu);
+        case eOP_WFI:
+        {
+            // Asleep until the next event that could raise an interrupt
+            const uint64_t wake = IssBus_NextEvent();
+            if (IssBus_PendingIrq() == ISS_IRQ_NONE && wake > cpu->cycles)
+            {
+                cpu->cycles = wake;
+            }
+            writes = false;
+            step = eISS_STEP_WAIT;
+            break;
+        }
+        case eOP_ILLEGAL:
+            return Fault(cpu, "illegal instruction");
+    }
+
+    if (writes && insn->rd)
+    {
+        cpu->x[insn->rd] = result;
+    }
+    cpu->pc = next;
+    return step;
+}
+
+/**
+ * @brief  Compute an arithmetic instruction's result
+ * @param  alu - the operation
+ * @param  a - rs1
+ * @param  b - rs2 or the immediate
+ * @return the result
+ */
+static uint32_t AluResult(Alu_e alu, uint32_t a, uint32_t b)
+{
+    switch (alu)
+    {
+        case eALU_ADD:
+            return a + b;
+        case eALU_SUB:
+            return a - b;
+        case eALU_SLL:
+            return a << (b & 31);
+        case eALU_SLT:
+            return (int32_t)a < (int32_t)b;
+        case eALU_SLTU:
+            return a < b;
+        case eALU_XOR:
+            return a ^ b;
+        case eALU_SRL:
+            return a >> (b & 31);
+        case eALU_SRA:
+            return (uint32_t)((int32_t)a >> (b & 31));
+        case eALU_OR:
+            return a | b;
+        case eALU_AND:
+            return a & b;
+    }
+    return 0;
+}
+
+/**
+ * @brief  Read and update a CSR
+ * @param  cpu - the core
+ * @param  csr - the CSR number
+ * @param  funct - funct3, write, set or clear, from a register or not
+ * @param  operand - the value to write, set or clear
+ * @param[out] old - its value before
+ * @return false for a CSR that is not modelled
+ */
+static bool Csr(IssCpu_t *cpu, uint32_t csr, uint32_t funct, uint32_t operand, uint32_t *old)
+{
+    uint32_t *reg = NULL;
+    uint32_t value = 0;
+    switch (csr)
+    {
+        case CSR_MSTATUS:
+            reg = &cpu->mstatus;
+            break;
+        case CSR_MTVEC:
+            reg = &cpu->mtvec;
+            break;
+        case CSR_MSCRATCH:
+            reg = &cpu->mscratch;
+            break;
+        case CSR_MEPC:
+            reg = &cpu->mepc;
+            break;
+        case CSR_MCAUSE:
+            reg = &cpu->mcause;
+            break;
+        case CSR_INTSYSCR:
+            reg = &cpu->intsyscr;
+            break;
+        case CSR_GINTENR:
+            value = cpu->mstatus & (MSTATUS_MIE | MSTATUS_MPIE);
+            break;
+        case CSR_MISA:
+            value = MISA_VALUE;
+            break;
+        case CSR_MTVAL:
+            break;
+        default:
+            return false;
+    }
+
+    *old = reg ? *reg : value;
+    uint32_t next = *old;
+    switch (funct & 3)
+    {
+        case 1:
+            next = operand;
+            break;
+        case 2:
+            next |= operand;
+            break;
+        case 3:
+            next &= ~operand;
+            break;
+    }
+
+    if (reg)
+    {
+        *reg = next;
+    }
+    else if (csr == CSR_GINTENR)
+    {
+        cpu->mstatus = (cpu->mstatus & ~(MSTATUS_MIE | MSTATUS_MPIE)) | (next & (MSTATUS_MIE | MSTATUS_MPIE));
+    }
+    return true;
+}
+
+/**
+ * @brief  Enter an interrupt through the vector table
+ * @param  cpu - the core
+ * @param  irq - the interrupt
+ * @return eISS_STEP_IRQ, or a fault if the vector is unreadable
+ * @note   mtvec mode 3 holds handler addresses, mode 1 jump instructions
+ */
+static IssStep_e TakeIrq(IssCpu_t *cpu, int irq)
+{
+    cpu->mepc = cpu->pc;
+    cpu->mcause = 0x80000000u | irq;
+    cpu->mstatus = (cpu->mstatus & ~MSTATUS_MPIE) | ((cpu->mstatus & MSTATUS_MIE) ? MSTATUS_MPIE : 0);
+    cpu->mstatus &= ~MSTATUS_MIE;
+    cpu->shadowed = cpu->intsyscr & INTSYSCR_HPE;
+    if (cpu->shadowed)
+    {
+        memcpy(cpu->shadow, cpu->x, sizeof(cpu->shadow));
+    }
+    cpu->irq = irq;
+    cpu->cycles += ISS_CYCLES_IRQ_ENTRY;
+    IssBus_TakeIrq(irq);
+    cpu->fetched = NO_FETCH;
+
+    const uint32_t base = cpu->mtvec & ~3u;
+    switch (cpu->mtvec & 3)
+    {
+        case 0:
+            cpu->pc = base;
+            break;
+        case 1:
+            cpu->pc = base + 4 * irq;
+            break;
+        default:
+        {
+            const uint32_t entry = base + 4 * irq;
+            uint32_t vector;
+            if (!IssBus_Read(entry, 4, &vector))
+            {
+                return Fault(cpu, "vector table outside the memory map");
+            }
+            cpu->cycles += IssBus_WaitStates(entry);
+            cpu->pc = vector & ~1u;
+            break;
+        }
+    }
+    return eISS_STEP_IRQ;
+}
+
+/**
+ * @brief  Return from an interrupt, or from the startup code to main()
+ * @param  cpu - the core
+ * @return eISS_STEP_MRET if it ended an interrupt
+ */
+static IssStep_e Mret(IssCpu_t *cpu)
+{
+    cpu->mstatus = (cpu->mstatus & ~MSTATUS_MIE) | ((cpu->mstatus & MSTATUS_MPIE) ? MSTATUS_MIE : 0);
+    cpu->mstatus |= MSTATUS_MPIE;
+    cpu->pc = cpu->mepc;
+    cpu->cycles += ISS_CYCLES_MRET;
+    cpu->fetched = NO_FETCH;
+
+    if (cpu->irq == ISS_IRQ_NONE)
+    {
+        return eISS_STEP_NONE;
+    }
+    if (cpu->shadowed)
+    {
+        for (uint32_t i = 0; i < 16; i++)
+        {
+            if (HPE_SAVED & (1u << i))
+            {
+                cpu->x[i] = cpu->shadow[i];
+            }
+        }
+    }
+    cpu->irq = ISS_IRQ_NONE;
+    return eISS_STEP_MRET;
+}
+
+/**
+ * @brief  Stop the run where the part would have trapped
+ * @param  cpu - the core
+ * @param  fault - what went wrong
+ * @return eISS_STEP_FAULT, pc still at the instruction
+ */
+static IssStep_e Fault(IssCpu_t *cpu, const char *fault)
+{
+    cpu->fault = fault;
+    return eISS_STEP_FAULT;
+}
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
@@ -0,0 +1,620 @@
+//------------------------------------------------------------------------------
+//       Filename: iss_main.c
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Cycle counts of the unmodified firmware image, per function
+//               and per interrupt, on the instruction set simulator
+//------------------------------------------------------------------------------
+//       Notes : Usage: main_iss [-r trace] [-a v,i,vref] [-m ms] [-n]
+//                               [-f functions] [-o results.json]
+//                               [-b baseline.json] [-t threshold] main.elf
+//               main.elf boots from reset as on the part, see iss.h for what
+//               is modelled. Its ADC readings come from a trace (-r), as the
+//               host records them with HOST_ADC_RECORD, and the run ends
+//               with it. Console input in the trace reaches the firmware
+//               through the debugger. Without a trace every conversion reads
+//               the raw counts given with -a, for -m ms (1000 by default).
+//               -n runs with no debugger attached.
+//               Each cycle goes to the function whose code took it, by the
+//               image's symbols, and each interrupt's cycles from its entry
+//               to its mret go to it. With a baseline, an interrupt whose
+//               average or worst case, or a function whose cycles per call,
+//               grew by more than the threshold (5% by default) is a
+//               regression and the exit status is 1. The simulator is
+//               deterministic, the threshold only allows for small changes.
+//               A fault, an instruction or access the part would trap on,
+//               exits with status 3 and the core's registers.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#include "iss.h"
+#include <elf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+//------------------------------------------------------------------------------
+// Module constant defines
+//------------------------------------------------------------------------------
+#define ISS_DEFAULT_THRESHOLD (0.05)
+#define ISS_DEFAULT_RUN_MS    (1000)
+#define ISS_DEFAULT_FUNCTIONS (20)
+
+#define ISS_MAX_NAME (63)
+
+#define CYCLES_PER_MS (ISS_CORE_CLOCK / 1000)
+
+// Owner slots, one per half word of flash and then of RAM
+#define SLOTS ((ISS_FLASH_SIZE + ISS_RAM_SIZE) / 2)
+
+//------------------------------------------------------------------------------
+// Module type definitions
+//------------------------------------------------------------------------------
+typedef struct
+{
+    const char *name;
+    uint32_t address;
+    uint32_t size;
+    uint64_t cycles; // Its own, not its callees'
+    uint64_t calls;
+} Function_t;
+
+typedef struct
+{
+    uint32_t handler; // Function_t index
+    uint64_t count;
+    uint64_t cycles;
+    uint64_t min;
+    uint64_t max;
+} Isr_t;
+
+//------------------------------------------------------------------------------
+// Module static variables
+//------------------------------------------------------------------------------
+static uint8_t *s_image = NULL;
+static Function_t *s_functions = NULL;
+static uint32_t s_functionCount = 0;
+static uint16_t s_owner[SLOTS]; // 0 for code in no function
+
+static Isr_t s_isrs[ISS_IRQ_COUNT];
+static uint64_t s_isrStart = 0;
+static uint64_t s_idleCycles = 0;
+
+//------------------------------------------------------------------------------
+// Module static function prototypes
+//------------------------------------------------------------------------------
+static bool LoadElf(const char *path);
+static void AddFunction(const char *name, uint32_t address, uint32_t size);
+static uint32_t Owner(uint32_t address);
+static void Account(const IssCpu_t *cpu, IssStep_e step, uint32_t pc, int irq, uint64_t spent);
+static void PrintFault(const IssCpu_t *cpu);
+static bool Report(const IssCpu_t *cpu, uint32_t functions, const char *resultsPath, const char *baselinePath,
+                   double threshold);
+static const char *IsrName(int irq, char *name, size_t size);
+static bool Regressed(double value, double baseline, double threshold);
+static bool LoadBaseline(const char *path, const char *key, const char *name, double *first, double *second);
+static int CompareCycles(const void *a, const void *b);
+
+//------------------------------------------------------------------------------
+// Module externally exported functions
+//------------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    const char *tracePath = NULL;
+    const char *resultsPath = NULL;
+    const char *baselinePath = NULL;
+    double threshold = ISS_DEFAULT_THRESHOLD;
+    uint32_t runMs = 0;
+    uint32_t functions = ISS_DEFAULT_FUNCTIONS;
+    bool debugger = true;
+    uint16_t readings[3] = {0};
+    bool fixed = false;
+
+    int option;
+    while ((option = getopt(argc, argv, "r:a:m:nf:o:b:t:")) != -1)
+    {
+        unsigned voltage, current, vref;
+        switch (option)
+        {
+            case 'r':
+                tracePath = optarg;
+                break;
+            case 'a':
+                fixed = sscanf(optarg, "%u,%u,%u", &voltage, &current, &vref) == 3;
+                readings[0] = voltage;
+                readings[1] = current;
+                readings[2] = vref;
+                if (!fixed)
+                {
+                    fprintf(stderr, "-a takes the raw voltage, current and VRef counts, e.g. 512,20,465\n");
+                    return 2;
+                }
+                break;
+            case 'm':
+                runMs = atoi(optarg);
+                break;
+            case 'n':
+                debugger = false;
+                break;
+            case 'f':
+                functions = atoi(optarg);
+                break;
+            case 'o':
+                resultsPath = optarg;
+                break;
+            case 'b':
+                baselinePath = optarg;
+                break;
+            case 't':
+                threshold = atof(optarg);
+                break;
+            default:
+                optind = argc;
+                break;
+        }
+    }
+
+    if (optind != argc - 1 || (tracePath && fixed))
+    {
+        fprintf(stderr,
+                "usage: %s [-r trace | -a v,i,vref] [-m ms] [-n] [-f functions] [-o results.json] "
+                "[-b baseline.json] [-t threshold] main.elf\n",
+                argv[0]);
+        return 2;
+    }
+
+    if (!IssBus_Init(tracePath, readings, debugger) || !LoadElf(argv[optind]))
+    {
+        return 2;
+    }
+
+    const uint64_t limit = (uint64_t)(runMs ? runMs : tracePath ? UINT32_MAX : ISS_DEFAULT_RUN_MS) * CYCLES_PER_MS;
+
+    IssCpu_t cpu;
+    IssCpu_Reset(&cpu);
+    bool stopped = false;
+    while (!stopped && !IssBus_Done() && cpu.cycles < limit)
+    {
+        const uint32_t pc = cpu.pc;
+        const int irq = cpu.irq;
+        const uint64_t before = cpu.cycles;
+        const IssStep_e step = IssCpu_Step(&cpu);
+        if (step == eISS_STEP_FAULT)
+        {
+            PrintFault(&cpu);
+            return 3;
+        }
+        stopped = step == eISS_STEP_BREAK;
+        Account(&cpu, step, pc, irq, cpu.cycles - before);
+    }
+    IssBus_Flush();
+    fflush(stdout);
+    if (stopped)
+    {
+        fprintf(stderr, "ebreak at %08x in %s\n", cpu.pc, s_functions[Owner(cpu.pc)].name);
+    }
+
+    return Report(&cpu, functions, resultsPath, baselinePath, threshold) ? 1 : 0;
+}
+
+//------------------------------------------------------------------------------
+// Module static functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  Load an image's segments at their load addresses, and its
+ *         function symbols
+ * @param  path - the ELF file
+ * @return false if it is not an RV32 image that fits the part
+ */
+static bool LoadElf(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+    {
+        perror(path);
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    const long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    s_image = malloc(size > 0 ? size : 1);
+    const bool read = s_image && size > 0 && fread(s_image, size, 1, file) == 1;
+    fclose(file);
+
+    const Elf32_Ehdr *header = (const Elf32_Ehdr *)s_image;
+    if (!read || (size_t)size < sizeof(*header) || memcmp(header->e_ident, ELFMAG, SELFMAG) ||
+        header->e_ident[EI_CLASS] != ELFCLASS32 || header->e_ident[EI_DATA] != ELFDATA2LSB ||
+        header->e_machine != EM_RISCV || header->e_phoff + (uint64_t)header->e_phnum * sizeof(Elf32_Phdr) > (size_t)size ||
+        header->e_shoff + (uint64_t)header->e_shnum * sizeof(Elf32_Shdr) > (size_t)size)
+    {
+        fprintf(stderr, "%s: not an RV32 little endian ELF\n", path);
+        return false;
+    }
+
+    // .data is loaded in flash, the startup code copies it
+    const Elf32_Phdr *segments = (const Elf32_Phdr *)(s_image + header->e_phoff);
+    for (uint32_t i = 0; i < header->e_phnum; i++)
+    {
+        const Elf32_Phdr *segment = &segments[i];
+        if (segment->p_type != PT_LOAD || !segment->p_filesz)
+        {
+            continue;
+        }
+        if (segment->p_offset + (uint64_t)segment->p_filesz > (size_t)size ||
+            !IssBus_Load(segment->p_paddr, s_image + segment->p_offset, segment->p_filesz))
+        {
+            fprintf(stderr, "%s: segment at %08x of %u bytes is outside flash and RAM\n", path, segment->p_paddr,
+                    segment->p_filesz);
+            return false;
+        }
+    }
+
+    AddFunction("(no symbol)", 0, 0);
+    const Elf32_Shdr *sections = (const Elf32_Shdr *)(s_image + header->e_shoff);
+    for (uint32_t i = 0; i < header->e_shnum; i++)
+    {
+        const Elf32_Shdr *symtab = &sections[i];
+        if (symtab->sh_type != SHT_SYMTAB || symtab->sh_link >= header->e_shnum)
+        {
+            continue;
+        }
+        const Elf32_Shdr *strtab = &sections[symtab->sh_link];
+        if (symtab->sh_offset + (uint64_t)symtab->sh_size > (size_t)size ||
+            strtab->sh_offset + (uint64_t)strtab->sh_size > (size_t)size || !strtab->sh_size ||
+            s_image[strtab->sh_offset + strtab->sh_size - 1])
+        {
+            continue;
+        }
+
+        const Elf32_Sym *symbols = (const Elf32_Sym *)(s_image + symtab->sh_offset);
+        for (uint32_t s = 0; s < symtab->sh_size / sizeof(Elf32_Sym); s++)
+        {
+            if (ELF32_ST_TYPE(symbols[s].st_info) == STT_FUNC && symbols[s].st_size &&
+                symbols[s].st_name < strtab->sh_size)
+            {
+                AddFunction((const char *)s_image + strtab->sh_offset + symbols[s].st_name, symbols[s].st_value,
+                            symbols[s].st_size);
+            }
+        }
+    }
+
+    if (s_functionCount == 1)
+    {
+        fprintf(stderr, "%s: no function symbols, the cycles are counted as a whole\n", path);
+    }
+    return true;
+}
+
+/**
+ * @brief  Add a function and claim its code
+ * @param  name - its symbol
+ * @param  address - its first byte, a RAM function's run address
+ * @param  size - its size in bytes
+ * @return None
+ */
+static void AddFunction(const char *name, uint32_t address, uint32_t size)
+{
+    Function_t *functions = realloc(s_functions, (s_functionCount + 1) * sizeof(Function_t));
+    if (!functions || s_functionCount > UINT16_MAX)
+    {
+        return;
+    }
+    s_functions = functions;
+    s_functions[s_functionCount] = (Function_t){.name = name, .address = address, .size = size};
+
+    for (uint32_t offset = 0; offset < size; offset += 2)
+    {
+        const uint32_t at = address + offset;
+        uint32_t slot = SLOTS;
+        if (at - ISS_FLASH_ALIAS < ISS_FLASH_SIZE || at - ISS_FLASH_BASE < ISS_FLASH_SIZE)
+        {
+            slot = (at % ISS_FLASH_SIZE) / 2;
+        }
+        else if (at - ISS_RAM_BASE < ISS_RAM_SIZE)
+        {
+            slot = (ISS_FLASH_SIZE + at - ISS_RAM_BASE) / 2;
+        }
+        if (slot < SLOTS)
+        {
+            s_owner[slot] = s_functionCount;
+        }
+    }
+    s_functionCount++;
+}
+
+/**
+ * @brief  Find the function an address is in
+ * @param  address - a code address
+ * @return its index, 0 for none
+ */
+static uint32_t Owner(uint32_t address)
+{
+    if (address - ISS_FLASH_ALIAS < ISS_FLASH_SIZE || address - ISS_FLASH_BASE < ISS_FLASH_SIZE)
+    {
+        return s_owner[(address % ISS_FLASH_SIZE) / 2];
+    }
+    if (address - ISS_RAM_BASE < ISS_RAM_SIZE)
+    {
+        return s_owner[(ISS_FLASH_SIZE + address - ISS_RAM_BASE) / 2];
+    }
+    return 0;
+}
+
+/**
+ * @brief  Charge a step's cycles to its function, and to its interrupt
+ * @param  cpu - the core, after the step
+ * @param  step - what the step did
+ * @param  pc - the instruction it ran
+ * @param  irq - the interrupt it ran in, before the step
+ * @param  spent - its cycles
+ * @return None
+ */
+static void Account(const IssCpu_t *cpu, IssStep_e step, uint32_t pc, int irq, uint64_t spent)
+{
+    switch (step)
+    {
+        case eISS_STEP_IRQ:
+        {
+            // The entry is the handler's
+            Isr_t *isr = &s_isrs[cpu->irq];
+            isr->handler = Owner(cpu->pc);
+            s_functions[isr->handler].cycles += spent;
+            s_isrStart = cpu->cycles - spent;
+            return;
+        }
+        case eISS_STEP_MRET:
+        {
+            Isr_t *isr = &s_isrs[irq];
+            const uint64_t cycles = cpu->cycles - s_isrStart;
+            isr->min = isr->count && isr->min < cycles ? isr->min : cycles;
+            isr->max = isr->max > cycles ? isr->max : cycles;
+            isr->cycles += cycles;
+            isr->count++;
+            break;
+        }
+        case eISS_STEP_WAIT:
+            s_idleCycles += spent - ISS_CYCLES_INSTRUCTION;
+            spent = ISS_CYCLES_INSTRUCTION;
+            break;
+        case eISS_STEP_CALL:
+            s_functions[Owner(cpu->pc)].calls++;
+            break;
+        default:
+            break;
+    }
+    s_functions[Owner(pc)].cycles += spent;
+}
+
+/**
+ * @brief  Print where and why the core stopped
+ * @param  cpu - the core
+ * @return None
+ */
+static void PrintFault(const IssCpu_t *cpu)
+{
+    static const char *const names[16] = {"zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2",
+                                          "s0",   "s1", "a0", "a1", "a2", "a3", "a4", "a5"};
+
+    const Function_t *function = &s_functions[Owner(cpu->pc)];
+    fprintf(stderr, "fault at %08x, %s+0x%x, after %llu cycles: %s\n", cpu->pc, function->name,
+            cpu->pc - function->address, (unsigned long long)cpu->cycles, cpu->fault);
+    for (uint32_t i = 0; i < 16; i++)
+    {
+        fprintf(stderr, "  %-4s %08x%s", names[i], cpu->x[i], i % 4 == 3 ? "\n" : "");
+    }
+    fprintf(stderr, "  mstatus %08x mepc %08x mcause %08x\n", cpu->mstatus, cpu->mepc, cpu->mcause);
+}
+
+/**
+ * @brief  Print the interrupts and the busiest functions, write the results
+ *         and compare them with the baseline
+ * @param  cpu - the core at the end of the run
+ * @param  functions - how many functions to print
+ * @param  resultsPath - the results file, NULL for none
+ * @param  baselinePath - a results file from an earlier run, NULL for none
+ * @param  threshold - the growth that is a regression
+ * @return true if anything regressed
+ */
+static bool Report(const IssCpu_t *cpu, uint32_t functions, const char *resultsPath, const char *baselinePath,
+                   double threshold)
+{
+    const double total = cpu->cycles ? (double)cpu->cycles : 1;
+    fprintf(stderr, "%.1f ms, %llu cycles, %llu instructions, %.1f%% asleep\n", cpu->cycles / (double)CYCLES_PER_MS,
+            (unsigned long long)cpu->cycles, (unsigned long long)cpu->instructions, 100 * s_idleCycles / total);
+    IssBus_Report();
+
+    FILE *results = resultsPath ? fopen(resultsPath, "w") : NULL;
+    if (resultsPath && !results)
+    {
+        perror(resultsPath);
+    }
+    if (results)
+    {
+        fprintf(results, "{\n  \"unit\": \"cycles\",\n  \"cycles\": %llu,\n  \"interrupts\": [\n",
+                (unsigned long long)cpu->cycles);
+    }
+
+    bool regressed = false;
+    fprintf(stderr, "\n%-24s %8s %8s %8s %8s %7s %10s\n", "interrupt", "count", "min", "avg", "max", "load",
+            "baseline");
+    uint32_t written = 0;
+    for (int irq = 0; irq < ISS_IRQ_COUNT; irq++)
+    {
+        const Isr_t *isr = &s_isrs[irq];
+        if (!isr->count)
+        {
+            continue;
+        }
+
+        char name[ISS_MAX_NAME + 1];
+        IsrName(irq, name, sizeof(name));
+        const double average = (double)isr->cycles / isr->count;
+        fprintf(stderr, "%-24s %8llu %8llu %8.1f %8llu %6.1f%%", name, (unsigned long long)isr->count,
+                (unsigned long long)isr->min, average, (unsigned long long)isr->max, 100 * isr->cycles / total);
+
+        double baseAverage, baseMax;
+        if (baselinePath && LoadBaseline(baselinePath, "interrupt", name, &baseAverage, &baseMax))
+        {
+            const bool regression =
+                Regressed(average, baseAverage, threshold) || Regressed(isr->max, baseMax, threshold);
+            regressed |= regression;
+            fprintf(stderr, " %+9.1f%%%s", 100 * (average / baseAverage - 1), regression ? "  REGRESSION" : "");
+        }
+        fprintf(stderr, "\n");
+
+        if (results)
+        {
+            fprintf(results, "%s    {\"interrupt\": \"%s\", \"avg\": %.1f, \"max\": %llu, \"min\": %llu, \"count\": %llu}",
+                    written++ ? ",\n" : "", name, average, (unsigned long long)isr->max, (unsigned long long)isr->min,
+                    (unsigned long long)isr->count);
+        }
+    }
+
+    // Busiest first
+    uint32_t *order = malloc(s_functionCount * sizeof(uint32_t));
+    for (uint32_t i = 0; order && i < s_functionCount; i++)
+    {
+        order[i] = i;
+    }
+    if (order)
+    {
+        qsort(order, s_functionCount, sizeof(uint32_t), CompareCycles);
+    }
+
+    if (results)
+    {
+        fprintf(results, "\n  ],\n  \"functions\": [\n");
+    }
+    fprintf(stderr, "\n%-24s %8s %10s %7s %9s %10s\n", "function", "calls", "cycles", "share", "per call",
+            "baseline");
+    written = 0;
+    for (uint32_t i = 0; order && i < s_functionCount; i++)
+    {
+        const Function_t *function = &s_functions[order[i]];
+        if (!function->cycles)
+        {
+            break;
+        }
+
+        const double perCall = function->calls ? (double)function->cycles / function->calls : 0;
+        double basePerCall, baseCycles;
+        const bool compared = function->calls && baselinePath &&
+                              LoadBaseline(baselinePath, "function", function->name, &basePerCall, &baseCycles) &&
+                              basePerCall > 0;
+        const bool regression = compared && Regressed(perCall, basePerCall, threshold);
+        regressed |= regression;
+
+        if (i < functions || regression)
+        {
+            fprintf(stderr, "%-24.24s %8llu %10llu %6.1f%% %9.1f", function->name, (unsigned long long)function->calls,
+                    (unsigned long long)function->cycles, 100 * function->cycles / total, perCall);
+            if (compared)
+            {
+                fprintf(stderr, " %+9.1f%%%s", 100 * (perCall / basePerCall - 1), regression ? "  REGRESSION" : "");
+            }
+            fprintf(stderr, "\n");
+        }
+
+        if (results)
+        {
+            fprintf(results, "%s    {\"function\": \"%s\", \"per_call\": %.1f, \"cycles\": %llu, \"calls\": %llu}",
+                    written++ ? ",\n" : "", function->name, perCall, (unsigned long long)function->cycles,
+                    (unsigned long long)function->calls);
+        }
+    }
+    free(order);
+
+    if (results)
+    {
+        fprintf(results, "\n  ]\n}\n");
+        fclose(results);
+    }
+    return regressed;
+}
+
+/**
+ * @brief  Name an interrupt after its handler
+ * @param  irq - the interrupt
+ * @param[out] name - the name
+ * @param  size - its size
+ * @return name
+ */
+static const char *IsrName(int irq, char *name, size_t size)
+{
+    const uint32_t handler = s_isrs[irq].handler;
+    if (handler)
+    {
+        snprintf(name, size, "%s", s_functions[handler].name);
+    }
+    else
+    {
+        snprintf(name, size, "irq%d", irq);
+    }
+    return name;
+}
+
+/**
+ * @brief  Whether a count grew past the threshold
+ * @param  value - this run's
+ * @param  baseline - the baseline's
+ * @param  threshold - the growth allowed, as a fraction
+ * @return true for a regression
+ */
+static bool Regressed(double value, double baseline, double threshold)
+{
+    return baseline > 0 && value / baseline - 1 > threshold;
+}
+
+/**
+ * @brief  Find an interrupt or a function in a results file written by this
+ *         program
+ * @param  path - the results file
+ * @param  key - "interrupt" or "function"
+ * @param  name - its name
+ * @param[out] first - an interrupt's average or a function's cycles per call
+ * @param[out] second - an interrupt's worst case or a function's cycles
+ * @return false if the file or the entry is missing
+ */
+static bool LoadBaseline(const char *path, const char *key, const char *name, double *first, double *second)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+    {
+        return false;
+    }
+
+    char format[64];
+    snprintf(format, sizeof(format), " {\"%s\": \"%%%d[^\"]\", \"%%*[a-z_]\": %%lf, \"%%*[a-z_]\": %%lf", key,
+             ISS_MAX_NAME);
+
+    bool found = false;
+    char line[256];
+    while (!found && fgets(line, sizeof(line), file))
+    {
+        char lineName[ISS_MAX_NAME + 1];
+        found = sscanf(line, format, lineName, first, second) == 3 && strcmp(lineName, name) == 0;
+    }
+
+    fclose(file);
+    return found;
+}
+
+/**
+ * @brief  Order function indexes by their cycles, most first
+ */
+static int CompareCycles(const void *a, const void *b)
+{
+    const uint64_t cyclesA = s_functions[*(const uint32_t *)a].cycles;
+    const uint64_t cyclesB = s_functions[*(const uint32_t *)b].cycles;
+    return (cyclesA < cyclesB) - (cyclesA > cyclesB);
+}
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
@@ -0,0 +1,393 @@
+//------------------------------------------------------------------------------
+//       Filename: plant.c
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Simulated boost converter for the host build
+//------------------------------------------------------------------------------
+//       Notes : An averaged model of a non-synchronous boost from USB into a
+//               resistive load, optionally a battery and a diode string, sampled the way the
+//               board's analog front end presents it to the ADC. Environment
+//               variables:
+//                 HOST_VIN_MV    - input voltage, 5000 by default
+//                 HOST_LOAD_OHMS - output load, open circuit by default
+//               which override Plant_Configure(). The ADC noise is pseudo
+//               random with a fixed seed, so runs repeat exactly. The
+//               divider, the reference and the current amplifier's offset
+//               take the errors in the configuration, for tolerance runs.
+//               Plant_GetResponse() linearises the same difference equations
+//               about the last step, the reference the loop gain
+//               measurements are checked against.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#include "board.h"
+#include "host.h"
+#include <complex.h>
+#include <math.h>
+#include <stdlib.h>
+
+//------------------------------------------------------------------------------
+// Module constant defines
+//------------------------------------------------------------------------------
+
+// As on the board, see board.h
+#define Rf                     (BOARD_FEEDBACK_RF * 100.0)
+#define Rin                    (BOARD_FEEDBACK_RIN * 100.0)
+#define VDD                    (3.3)
+#define VREF                   (1.2)
+#define ADC_MAX                BOARD_ADC_MAX
+#define VOLTAGE_CHANNEL        BOARD_FEEDBACK_CHANNEL
+#define CURRENT_CHANNEL        BOARD_CURRENT_CHANNEL
+#define VREF_CHANNEL           (8)
+
+// Shunt amplifier, 1mA per count plus its offset
+#define COUNTS_PER_AMP   (1000.0)
+#define CURRENT_OFFSET   (12)
+#define OPA_GAIN         ((double)(BOARD_OPA_RF + BOARD_OPA_RIN) / BOARD_OPA_RIN)
+
+#define INDUCTANCE  (22e-6)
+#define CAPACITANCE (100e-6)
+#define DCR         (0.15)
+#define DIODE_DROP  (0.35)
+#define SUBSTEPS    (4)
+
+// Thermal voltage at 27C, and when the diode string's current is solved
+#define THERMAL_VOLTAGE  (0.02585)
+#define DIODE_TOLERANCE  (1e-9) // A
+#define DIODE_ITERATIONS (100)
+
+//------------------------------------------------------------------------------
+// External variables
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// External functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module type definitions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module static variables
+//------------------------------------------------------------------------------
+static PlantConfig_t s_config = {
+    .vin = 5.0,
+    .load = 0,
+};
+static double s_iL = 0;
+static double s_iLoad = 0;
+static double s_vOut = 0;
+static double s_energyIn = 0;
+static double s_energyLoss = 0;
+static PlantBattery_t s_battery = {0};
+static PlantDiode_t s_diode = {0};
+static double s_iDiode = 0;
+static double s_duty = 0;
+static uint32_t s_period = 1;
+static uint32_t s_noise = 0x12345678;
+
+// The components as built, see Plant_Init()
+static double s_rf = Rf;
+static double s_rin = Rin;
+static double s_vref = VREF;
+static double s_currentOffset = CURRENT_OFFSET;
+
+//------------------------------------------------------------------------------
+// Module static function prototypes
+//------------------------------------------------------------------------------
+static uint16_t ToCounts(double value);
+static int Noise(void);
+static double SolveDiode(double volts, double current);
+
+//------------------------------------------------------------------------------
+// Module externally exported functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  Set the operating conditions, before SystemInit()
+ * @param  config - the input voltage and the load
+ * @return None
+ */
+void Plant_Configure(const PlantConfig_t *config)
+{
+    s_config = *config;
+}
+
+/**
+ * @brief  Change the load while running, for load steps
+ * @param  ohms - the new load, 0 for open circuit
+ * @return None
+ */
+void Plant_SetLoad(double ohms)
+{
+    s_config.load = ohms;
+}
+
+/**
+ * @brief  Connect a battery across the output while running, for charging
+ * @param  battery - its state and size, NULL to disconnect it
+ * @return None
+ */
+void Plant_SetBattery(const PlantBattery_t *battery)
+{
+    s_battery = battery ? *battery : (PlantBattery_t){0};
+}
+
+/**
+ * @brief  Connect a diode string across the output while running, for I-V
+ *         curves
+ * @param  diode - the string, NULL to disconnect it
+ * @return None
+ */
+void Plant_SetDiode(const PlantDiode_t *diode)
+{
+    s_diode = diode ? *diode : (PlantDiode_t){0};
+    s_iDiode = 0;
+}
+
+/**
+ * @brief  Get the diode string's current at a voltage, the reference its
+ *         measured curve is checked against
+ * @param  volts - across the string
+ * @return A, 0 without a string
+ */
+double Plant_GetDiodeCurrent(double volts)
+{
+    return SolveDiode(volts, 0);
+}
+
+/**
+ * @brief  Set up the model from the configuration and the environment
+ * @param  None
+ * @return None
+ */
+void Plant_Init(void)
+{
+    const char *vin = getenv("HOST_VIN_MV");
+    if (vin)
+    {
+        s_config.vin = atof(vin) / 1000;
+    }
+
+    const char *load = getenv("HOST_LOAD_OHMS");
+    if (load)
+    {
+        s_config.load = atof(load);
+    }
+
+    s_rf = Rf * (1 + s_config.rfError);
+    s_rin = Rin * (1 + s_config.rinError);
+    s_vref = VREF * (1 + s_config.vrefError);
+    s_currentOffset = CURRENT_OFFSET + s_config.offsetMv / 1000 * OPA_GAIN / VDD * ADC_MAX;
+
+    s_vOut = s_config.vin - DIODE_DROP;
+}
+
+/**
+ * @brief  Advance the model by one PWM period and sample it
+ * @param  compare - the PWM compare value
+ * @param  period - the PWM period, in core cycles
+ * @param[out]  sample - the ADC channels
+ * @return None
+ */
+void Plant_Step(uint32_t compare, uint32_t period, HostAdcSample_t *sample)
+{
+    const double d = (double)compare * (TIM1->PSC + 1) / period;
+    const double dt = (double)period / FUNCONF_SYSTEM_CORE_CLOCK / SUBSTEPS;
+    s_duty = d;
+    s_period = period;
+
+    double iLoad = 0;
+    for (int i = 0; i < SUBSTEPS; i++)
+    {
+        iLoad = s_config.load > 0 ? s_vOut / s_config.load : 0;
+
+        // A battery above the output discharges into it, nothing stops it
+        if (s_battery.resistance > 0)
+        {
+            const double iBattery = (s_vOut - s_battery.emf) / s_battery.resistance;
+            s_battery.emf += iBattery / s_battery.capacitance * dt;
+            iLoad += iBattery;
+        }
+
+        if (s_diode.count)
+        {
+            s_iDiode = SolveDiode(s_vOut, s_iDiode);
+            iLoad += s_iDiode;
+        }
+
+        // The diode blocks reverse inductor current
+        const double vSwitch = (1 - d) * (s_vOut + DIODE_DROP);
+        s_iL += (s_config.vin - s_iL * DCR - vSwitch) / INDUCTANCE * dt;
+        s_iL = s_iL > 0 ? s_iL : 0;
+
+        // The switch is taken as ideal, the losses are the DCR and the diode
+        s_energyIn += s_config.vin * s_iL * dt;
+        s_energyLoss += (s_iL * s_iL * DCR + (1 - d) * s_iL * DIODE_DROP) * dt;
+
+        // The divider is the only load when open circuit
+        const double iOut = iLoad + s_vOut / (s_rf + s_rin);
+        s_vOut += ((1 - d) * s_iL - iOut) / CAPACITANCE * dt;
+        s_vOut = s_vOut > 0 ? s_vOut : 0;
+    }
+    s_iLoad = iLoad;
+
+    *sample = (HostAdcSample_t){0};
+    sample->channel[VOLTAGE_CHANNEL] = ToCounts(s_vOut * s_rin / (s_rf + s_rin) / VDD * ADC_MAX + Noise());
+    sample->channel[CURRENT_CHANNEL] = ToCounts(iLoad * COUNTS_PER_AMP + s_currentOffset + Noise());
+    sample->channel[VREF_CHANNEL] = ToCounts(s_vref / VDD * ADC_MAX + Noise());
+}
+
+/**
+ * @brief  Get the model's state, as of the last step
+ * @param[out] state - the output voltage and the currents
+ * @return None
+ */
+void Plant_GetState(PlantState_t *state)
+{
+    *state = (PlantState_t){
+        .vOut = s_vOut,
+        .iL = s_iL,
+        .iLoad = s_iLoad,
+        .energyIn = s_energyIn,
+        .energyLoss = s_energyLoss,
+        .vBattery = s_battery.emf,
+    };
+}
+
+/**
+ * @brief  Get the small signal response from the PWM compare value to the
+ *         voltage feedback reading, linearised about the last step
+ * @param  frequency - Hz, below half the step rate
+ * @param[out] re - ADC counts per compare count, the real part
+ * @param[out] im - the imaginary part
+ * @return None
+ * @note   The Euler substeps of Plant_Step() are linearised one at a time
+ *         and chained over a step. A compare value written in one step is
+ *         first used in the next, and the reading is taken at its end, so
+ *         the response carries that step's delay as the firmware sees it.
+ *         Assumes continuous conduction, the inductor current stays above 0.
+ */
+void Plant_GetResponse(double frequency, double *re, double *im)
+{
+    const double dt = (double)s_period / FUNCONF_SYSTEM_CORE_CLOCK / SUBSTEPS;
+    const double a = dt / INDUCTANCE;
+    const double c = dt / CAPACITANCE;
+    const double off = 1 - s_duty;
+    double conductance = 1 / (s_rf + s_rin);
+    conductance += s_config.load > 0 ? 1 / s_config.load : 0;
+    conductance += s_battery.resistance > 0 ? 1 / s_battery.resistance : 0;
+    if (s_diode.count)
+    {
+        // The string's small signal resistance, the diodes' slope plus its own
+        const double emission = s_diode.count * s_diode.ideality * THERMAL_VOLTAGE;
+        conductance += 1 / (emission / (s_iDiode + s_diode.saturation) + s_diode.resistance);
+    }
+
+    // One substep, the state is (iL, vOut) and the input the duty
+    const double m[2][2] = {
+        {1 - a * DCR, -a * off},
+        {c * off * (1 - a * DCR), 1 - c * conductance - c * a * off * off},
+    };
+    const double b[2] = {a * (s_vOut + DIODE_DROP), c * off * a * (s_vOut + DIODE_DROP) - c * s_iL};
+
+    // A = M^SUBSTEPS, B = (M^(SUBSTEPS-1) + ... + I) b
+    double A[2][2] = {{1, 0}, {0, 1}};
+    double B[2] = {0, 0};
+    for (int i = 0; i < SUBSTEPS; i++)
+    {
+        const double next[2][2] = {
+            {m[0][0] * A[0][0] + m[0][1] * A[1][0], m[0][0] * A[0][1] + m[0][1] * A[1][1]},
+            {m[1][0] * A[0][0] + m[1][1] * A[1][0], m[1][0] * A[0][1] + m[1][1] * A[1][1]},
+        };
+        const double nextB[2] = {m[0][0] * B[0] + m[0][1] * B[1] + b[0], m[1][0] * B[0] + m[1][1] * B[1] + b[1]};
+        A[0][0] = next[0][0];
+        A[0][1] = next[0][1];
+        A[1][0] = next[1][0];
+        A[1][1] = next[1][1];
+        B[0] = nextB[0];
+        B[1] = nextB[1];
+    }
+
+    // vOut = [0 1] (zI - A)^-1 B, in counts per compare count
+    const double complex z = cexp(I * 2 * M_PI * frequency * s_period / FUNCONF_SYSTEM_CORE_CLOCK);
+    const double complex det = (z - A[0][0]) * (z - A[1][1]) - A[0][1] * A[1][0];
+    const double complex vOut = (A[1][0] * B[0] + (z - A[0][0]) * B[1]) / det;
+    const double complex counts = vOut * s_rin / (s_rf + s_rin) / VDD * ADC_MAX * (TIM1->PSC + 1) / s_period;
+
+    *re = creal(counts);
+    *im = cimag(counts);
+}
+
+//------------------------------------------------------------------------------
+// Module static functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  Quantise to the ADC range
+ * @param  value - the ideal reading in counts
+ * @return ADC counts
+ */
+static uint16_t ToCounts(double value)
+{
+    if (value <= 0)
+    {
+        return 0;
+    }
+    return value >= ADC_MAX - 1 ? ADC_MAX - 1 : (uint16_t)(value + 0.5);
+}
+
+/**
+ * @brief  Solve the diode string's current, Newton's method on
+ *         f(I) = I - Is * (exp((V - I * R) / (count * n * Vt)) - 1)
+ * @param  volts - across the string
+ * @param  current - the first guess, A
+ * @return A
+ * @note   f is increasing and concave in I, so the steps approach the root
+ *         from below after the first, without overshooting into the
+ *         exponential. Far below the root each step gains at most
+ *         count * n * Vt / R, from the last step's current it takes one or
+ *         two.
+ */
+static double SolveDiode(double volts, double current)
+{
+    if (!s_diode.count)
+    {
+        return 0;
+    }
+
+    const double emission = s_diode.count * s_diode.ideality * THERMAL_VOLTAGE;
+    for (int i = 0; i < DIODE_ITERATIONS; i++)
+    {
+        const double forward = s_diode.saturation * exp((volts - current * s_diode.resistance) / emission);
+        const double f = current - (forward - s_diode.saturation);
+        const double step = f / (1 + forward * s_diode.resistance / emission);
+        current -= step;
+        if (fabs(step) < DIODE_TOLERANCE)
+        {
+            break;
+        }
+    }
+    return current;
+}
+
+/**
+ * @brief  One count of noise, xorshift
+ * @param  None
+ * @return -1, 0 or 1
+ */
+static int Noise(void)
+{
+    s_noise ^= s_noise << 13;
+    s_noise ^= s_noise >> 17;
+    s_noise ^= s_noise << 5;
+    return (int)(s_noise % 3) - 1;
+}
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
@@ -0,0 +1,77 @@
+//------------------------------------------------------------------------------
+//       Filename: rv003usb.h
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Host stand-in for the rv003usb driver
+//------------------------------------------------------------------------------
+//       Notes : Only the types and calls the firmware uses. The endpoint
+//               layout differs from the driver's, which sizes it for RV32.
+//------------------------------------------------------------------------------
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#include "funconfig.h"
+#include "usb_config.h"
+#include <stdint.h>
+
+//------------------------------------------------------------------------------
+// Module exported defines
+//------------------------------------------------------------------------------
+#define LogUEvent(a, b, c, d)
+
+//------------------------------------------------------------------------------
+// Module exported type definitions
+//------------------------------------------------------------------------------
+struct usb_endpoint
+{
+    uint32_t count;
+    uint32_t toggle_in;
+    uint32_t toggle_out;
+    uint32_t custom;
+    uint32_t max_len;
+    uint8_t *opaque;
+};
+
+struct rv003usb_internal
+{
+    uint32_t current_endpoint;
+    uint32_t my_address;
+    uint32_t setup_request;
+    struct usb_endpoint eps[ENDPOINTS];
+};
+
+struct usb_urb
+{
+    uint16_t wRequestTypeLSBRequestMSB;
+    uint32_t lValueLSBIndexMSB;
+    uint16_t wLength;
+} __attribute__((packed));
+
+//------------------------------------------------------------------------------
+// Module exported functions
+//------------------------------------------------------------------------------
+void usb_setup(void);
+void usb_send_data(const void *data, uint32_t length, uint32_t poly_function, uint32_t token);
+void usb_send_empty(uint32_t token);
+
+// Implemented by the firmware
+void usb_handle_user_in_request(struct usb_endpoint *e, uint8_t *scratchpad, int endp, uint32_t sendtok, struct rv003usb_internal *ist);
+void usb_handle_hid_set_report_start(struct usb_endpoint *e, int reqLen, uint32_t lValueLSBIndexMSB);
+void usb_handle_hid_get_report_start(struct usb_endpoint *e, int reqLen, uint32_t lValueLSBIndexMSB);
+void usb_handle_other_control_message(struct usb_endpoint *e, struct usb_urb *s, struct rv003usb_internal *ist);
+void usb_handle_user_data(struct usb_endpoint *e, int current_endpoint, uint8_t *data, int len, struct rv003usb_internal *ist);
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+#ifdef __cplusplus
+}
+#endif
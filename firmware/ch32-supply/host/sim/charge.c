@@ -0,0 +1,237 @@
+//------------------------------------------------------------------------------
+//       Filename: charge.c
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Charges a battery on the model with each controller
+//------------------------------------------------------------------------------
+//       Notes : Each job connects a partly charged pack to the open circuit
+//               output and starts the charger on it, CC at CHARGE_CURRENT_MA
+//               up to CHARGE_VOLTAGE_MV, then CV until the current tapers
+//               to CHARGE_TERMINATION_MA. The pack is scaled down so a charge
+//               takes seconds, its time constant in CV is ~R * C. Midway
+//               through CC the voltage setpoint is written, as from the UI,
+//               and the charge must carry on at its own setpoints. The
+//               current overshoot is measured on the meter average once in
+//               CC, the pack voltage overshoot over the whole charge.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#include "boost.h"
+#include "charger.h"
+#include "sim.h"
+#include <math.h>
+
+//------------------------------------------------------------------------------
+// Module constant defines
+//------------------------------------------------------------------------------
+#define CHARGE_VOLTAGE_MV     (12600)
+#define CHARGE_CURRENT_MA     (500)
+#define CHARGE_TERMINATION_MA (50)
+#define CHARGE_TIMEOUT_MIN    (1)
+#define CHARGE_RUN_MS         (8000)
+
+// A 3S pack, part charged, sized for a ~2s CC phase
+#define CHARGE_EMF         (11.5)
+#define CHARGE_RESISTANCE  (0.5)
+#define CHARGE_CAPACITANCE (1.0)
+
+// The setpoint written during CC, which must not reach the output
+#define CHARGE_USER_MV    (6000)
+#define CHARGE_USER_AT_MS (1000)
+
+// 10% of the CC current, 1% of the CV voltage
+#define CHARGE_MAX_CURRENT (CHARGE_CURRENT_MA / 1000.0 * 1.1)
+#define CHARGE_MAX_VOLTAGE (CHARGE_VOLTAGE_MV / 1000.0 * 1.01)
+
+// The pack ends within the termination current's drop of the CV voltage
+#define CHARGE_FULL_BAND (CHARGE_TERMINATION_MA / 1000.0 * CHARGE_RESISTANCE + 0.05)
+
+#define PARAM_CONTROLLER (0)
+
+#define METRIC_CC     (0)
+#define METRIC_CV     (1)
+#define METRIC_REASON (2)
+#define METRIC_PEAK_I (3)
+#define METRIC_PEAK_V (4)
+#define METRIC_EMF    (5)
+
+#define array_size(x) (sizeof(x) / sizeof(x[0]))
+
+//------------------------------------------------------------------------------
+// Module static variables
+//------------------------------------------------------------------------------
+static const BoostController_e s_controllers[] = {eBOOST_CONTROLLER_PID, eBOOST_CONTROLLER_CASCADE};
+static const char *const s_controllerNames[] = {"pid", "cascade"};
+
+static const SimJob_t *s_job = NULL;
+
+//------------------------------------------------------------------------------
+// Module static function prototypes
+//------------------------------------------------------------------------------
+static uint32_t Plan(SimJob_t *jobs, uint32_t max);
+static void Run(const SimJob_t *job);
+static bool Check(const SimJob_t *jobs, uint32_t count);
+static void Hook(uint64_t cycles);
+
+//------------------------------------------------------------------------------
+// Module exported variables
+//------------------------------------------------------------------------------
+const SimScenario_t g_simCharge = {
+    .name = "charge",
+    .metricNames = {"CC ms", "CV ms", "end", "peak A", "peak V", "emf V"},
+    .plan = Plan,
+    .run = Run,
+    .check = Check,
+};
+
+//------------------------------------------------------------------------------
+// Module static functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  A job per controller
+ */
+static uint32_t Plan(SimJob_t *jobs, uint32_t max)
+{
+    uint32_t count = 0;
+    for (size_t c = 0; c < array_size(s_controllers) && count < max; c++)
+    {
+        SimJob_t *job = &jobs[count++];
+        job->plant = (PlantConfig_t){.vin = 5.0, .load = 0};
+        job->param[PARAM_CONTROLLER] = s_controllers[c];
+        job->runMs = CHARGE_RUN_MS;
+        snprintf(job->label, sizeof(job->label), "%s", s_controllerNames[c]);
+    }
+    return count;
+}
+
+/**
+ * @brief  Boot from erased flash
+ */
+static void Run(const SimJob_t *job)
+{
+    s_job = job;
+    Sim_Boot(job, Hook, NULL);
+}
+
+/**
+ * @brief  Every charge must end on the taper current with the pack full,
+ *         without overshooting the CC current or the CV voltage
+ */
+static bool Check(const SimJob_t *jobs, uint32_t count)
+{
+    bool passed = true;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const SimResult_t *result = jobs[i].result;
+        if (!result->done)
+        {
+            continue;
+        }
+
+        if (result->metric[METRIC_REASON] != eCHARGER_END_TAPER)
+        {
+            printf("  %s: ended by %.0f, not the taper current\n", jobs[i].label, result->metric[METRIC_REASON]);
+            passed = false;
+        }
+        if (result->metric[METRIC_PEAK_I] > CHARGE_MAX_CURRENT)
+        {
+            printf("  %s: overshoots the charge current\n", jobs[i].label);
+            passed = false;
+        }
+        if (result->metric[METRIC_PEAK_V] > CHARGE_MAX_VOLTAGE)
+        {
+            printf("  %s: overshoots the charge voltage\n", jobs[i].label);
+            passed = false;
+        }
+        if (fabs(result->metric[METRIC_EMF] - CHARGE_VOLTAGE_MV / 1000.0) > CHARGE_FULL_BAND)
+        {
+            printf("  %s: pack not full\n", jobs[i].label);
+            passed = false;
+        }
+    }
+    return passed;
+}
+
+/**
+ * @brief  Connect the pack, charge it and time the phases
+ */
+static void Hook(uint64_t cycles)
+{
+    static bool started = false;
+    static bool written = false;
+    static uint64_t startAt = 0;
+    static uint64_t cvAt = 0;
+    static double average = 0;
+
+    // Once booted, main() reads the settings back after starting the loop
+    if (!BoostPWM_IsCalibrated())
+    {
+        return;
+    }
+
+    if (!started)
+    {
+        started = true;
+        const PlantBattery_t battery = {
+            .emf = CHARGE_EMF,
+            .resistance = CHARGE_RESISTANCE,
+            .capacitance = CHARGE_CAPACITANCE,
+        };
+        Plant_SetBattery(&battery);
+        Sim_Command(eSIM_CMD_SET_CONTROLLER, s_job->param[PARAM_CONTROLLER]);
+        Sim_Command(eSIM_CMD_SET_CHARGE_VOLTAGE, CHARGE_VOLTAGE_MV);
+        Sim_Command(eSIM_CMD_SET_CHARGE_CURRENT, CHARGE_CURRENT_MA);
+        Sim_Command(eSIM_CMD_SET_CHARGE_TERMINATION, CHARGE_TERMINATION_MA);
+        Sim_Command(eSIM_CMD_SET_CHARGE_TIMEOUT, CHARGE_TIMEOUT_MIN);
+        Sim_Command(eSIM_CMD_CHARGE, 1);
+        startAt = cycles;
+        return;
+    }
+
+    PlantState_t state;
+    Plant_GetState(&state);
+    SimResult_t *result = s_job->result;
+    ChargerStatus_t status;
+    Charger_GetStatus(&status);
+
+    average += (state.iLoad - average) * SIM_SETTLE_AVERAGE;
+    result->metric[METRIC_PEAK_V] = fmax(result->metric[METRIC_PEAK_V], state.vOut);
+
+    switch (status.state)
+    {
+        case eCHARGER_STATE_IDLE:
+            break;
+
+        case eCHARGER_STATE_CC:
+            result->metric[METRIC_PEAK_I] = fmax(result->metric[METRIC_PEAK_I], average);
+            if (!written && cycles - startAt >= (uint64_t)CHARGE_USER_AT_MS * SIM_CYCLES_PER_MS)
+            {
+                written = true;
+                Sim_Command(eSIM_CMD_SET_VOLTAGE, CHARGE_USER_MV);
+            }
+            break;
+
+        case eCHARGER_STATE_CV:
+            if (!cvAt)
+            {
+                cvAt = cycles;
+                result->metric[METRIC_CC] = Sim_Milliseconds(cvAt - startAt);
+            }
+            break;
+
+        default:
+            result->metric[METRIC_CV] = cvAt ? Sim_Milliseconds(cycles - cvAt) : 0;
+            result->metric[METRIC_REASON] = status.reason;
+            result->metric[METRIC_EMF] = state.vBattery;
+            Sim_Finish();
+            break;
+    }
+}
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
@@ -0,0 +1,285 @@
+//------------------------------------------------------------------------------
+//       Filename: ivcurve.c
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Takes the I-V curve of a diode string on the model
+//------------------------------------------------------------------------------
+//       Notes : Each job connects a string of three LEDs to the output and
+//               sweeps it with HID commands 14 and 15, as the web UI does,
+//               along one axis with the other as the compliance. The curve
+//               is checked against the string's own equation, see
+//               PlantDiode_t: at every point above IVCURVE_FIT_MA the
+//               voltage the string needs for the measured current, and the
+//               slope of ln(I) against the diodes' own voltage, which an
+//               offset in the voltage reading leaves alone. Every point must
+//               settle and the whole sweep must take under IVCURVE_MAX_MS.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#include "boost.h"
+#include "sim.h"
+#include "sweep.h"
+#include <math.h>
+
+//------------------------------------------------------------------------------
+// Module constant defines
+//------------------------------------------------------------------------------
+#define IVCURVE_RUN_MS (2000)
+#define IVCURVE_POINTS (17)
+#define IVCURVE_MAX_MS (1000)
+
+// White LEDs, 20mA at 2.9V each
+#define IVCURVE_DIODES     (3)
+#define IVCURVE_SATURATION (8.714e-27)
+#define IVCURVE_IDEALITY   (2.0)
+#define IVCURVE_RESISTANCE (1.0)
+#define IVCURVE_EMISSION   (IVCURVE_DIODES * IVCURVE_IDEALITY * 0.02585)
+
+// The points fitted, below this the reading is a few counts
+#define IVCURVE_FIT_MA (10)
+
+// Allowed, the voltage reading is good to ~0.5% on the nominal board
+#define IVCURVE_MAX_MV        (60)
+#define IVCURVE_MAX_SLOPE_PCT (5.0)
+#define IVCURVE_MIN_FITTED    (8)
+
+// The compliance, well clear of the curve
+#define IVCURVE_LIMIT_MA (1000)
+#define IVCURVE_LIMIT_MV (12000)
+
+#define PARAM_AXIS  (0)
+#define PARAM_START (1)
+#define PARAM_STOP  (2)
+
+#define METRIC_TOTAL     (0)
+#define METRIC_UNSETTLED (1)
+#define METRIC_FITTED    (2)
+#define METRIC_V_ERROR   (3)
+#define METRIC_SLOPE     (4)
+#define METRIC_STATE     (5)
+
+#define array_size(x) (sizeof(x) / sizeof(x[0]))
+
+//------------------------------------------------------------------------------
+// Module type definitions
+//------------------------------------------------------------------------------
+typedef struct
+{
+    SweepAxis_e axis;
+    uint16_t start;
+    uint16_t stop;
+    const char *name;
+} IvCurveSweep_t;
+
+//------------------------------------------------------------------------------
+// Module static variables
+//------------------------------------------------------------------------------
+static const IvCurveSweep_t s_sweeps[] = {
+    {eSWEEP_AXIS_VOLTAGE, 8000, 9600, "voltage"},
+    {eSWEEP_AXIS_CURRENT, 10, 330, "current"},
+};
+
+static const SimJob_t *s_job = NULL;
+
+//------------------------------------------------------------------------------
+// Module static function prototypes
+//------------------------------------------------------------------------------
+static uint32_t Plan(SimJob_t *jobs, uint32_t max);
+static void Run(const SimJob_t *job);
+static bool Check(const SimJob_t *jobs, uint32_t count);
+static void Hook(uint64_t cycles);
+static void Fit(const SweepReport_t *report, SimResult_t *result);
+
+//------------------------------------------------------------------------------
+// Module exported variables
+//------------------------------------------------------------------------------
+const SimScenario_t g_simIvCurve = {
+    .name = "ivcurve",
+    .metricNames = {"total ms", "unsettled", "fitted", "V error mV", "slope %", "state"},
+    .plan = Plan,
+    .run = Run,
+    .check = Check,
+};
+
+//------------------------------------------------------------------------------
+// Module static functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  A job per axis
+ */
+static uint32_t Plan(SimJob_t *jobs, uint32_t max)
+{
+    uint32_t count = 0;
+    for (size_t s = 0; s < array_size(s_sweeps) && count < max; s++)
+    {
+        SimJob_t *job = &jobs[count++];
+        job->plant = (PlantConfig_t){.vin = 5.0, .load = 0};
+        job->param[PARAM_AXIS] = s_sweeps[s].axis;
+        job->param[PARAM_START] = s_sweeps[s].start;
+        job->param[PARAM_STOP] = s_sweeps[s].stop;
+        job->runMs = IVCURVE_RUN_MS;
+        snprintf(job->label, sizeof(job->label), "%s %u-%u", s_sweeps[s].name, s_sweeps[s].start,
+                 s_sweeps[s].stop);
+    }
+    return count;
+}
+
+/**
+ * @brief  Boot from erased flash
+ */
+static void Run(const SimJob_t *job)
+{
+    s_job = job;
+    Sim_Boot(job, Hook, NULL);
+}
+
+/**
+ * @brief  Every sweep must finish settled within IVCURVE_MAX_MS and follow
+ *         the string's equation
+ */
+static bool Check(const SimJob_t *jobs, uint32_t count)
+{
+    bool passed = true;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const SimResult_t *result = jobs[i].result;
+        if (!result->done)
+        {
+            continue;
+        }
+
+        if (result->metric[METRIC_STATE] != eSWEEP_STATE_DONE)
+        {
+            printf("  %s: the sweep did not finish, state %.0f\n", jobs[i].label, result->metric[METRIC_STATE]);
+            passed = false;
+            continue;
+        }
+        if (result->metric[METRIC_TOTAL] > IVCURVE_MAX_MS)
+        {
+            printf("  %s: took %.0fms\n", jobs[i].label, result->metric[METRIC_TOTAL]);
+            passed = false;
+        }
+        if (result->metric[METRIC_UNSETTLED])
+        {
+            printf("  %s: %.0f points unsettled\n", jobs[i].label, result->metric[METRIC_UNSETTLED]);
+            passed = false;
+        }
+        if (result->metric[METRIC_FITTED] < IVCURVE_MIN_FITTED)
+        {
+            printf("  %s: only %.0f points on the curve\n", jobs[i].label, result->metric[METRIC_FITTED]);
+            passed = false;
+        }
+        if (result->metric[METRIC_V_ERROR] > IVCURVE_MAX_MV)
+        {
+            printf("  %s: off the curve by %.0fmV\n", jobs[i].label, result->metric[METRIC_V_ERROR]);
+            passed = false;
+        }
+        if (fabs(result->metric[METRIC_SLOPE]) > IVCURVE_MAX_SLOPE_PCT)
+        {
+            printf("  %s: slope off by %.1f%%\n", jobs[i].label, result->metric[METRIC_SLOPE]);
+            passed = false;
+        }
+    }
+    return passed;
+}
+
+/**
+ * @brief  Connect the string, sweep it and time the sweep
+ */
+static void Hook(uint64_t cycles)
+{
+    static bool started = false;
+    static uint64_t startAt = 0;
+
+    // Once booted, main() reads the settings back after starting the loop
+    if (!BoostPWM_IsCalibrated())
+    {
+        return;
+    }
+
+    const SweepAxis_e axis = s_job->param[PARAM_AXIS];
+    const uint32_t start = s_job->param[PARAM_START];
+    const uint32_t stop = s_job->param[PARAM_STOP];
+    if (!started)
+    {
+        started = true;
+        const PlantDiode_t diode = {
+            .count = IVCURVE_DIODES,
+            .saturation = IVCURVE_SATURATION,
+            .ideality = IVCURVE_IDEALITY,
+            .resistance = IVCURVE_RESISTANCE,
+        };
+        Plant_SetDiode(&diode);
+        Sim_Command(eSIM_CMD_SET_CURRENT, axis == eSWEEP_AXIS_VOLTAGE ? IVCURVE_LIMIT_MA : start);
+        Sim_Command(eSIM_CMD_SET_VOLTAGE, axis == eSWEEP_AXIS_VOLTAGE ? start : IVCURVE_LIMIT_MV);
+        Sim_Command(eSIM_CMD_SWEEP_RANGE, start | stop << 16);
+        Sim_Command(eSIM_CMD_SWEEP_START, IVCURVE_POINTS | axis << 8);
+        startAt = cycles;
+        return;
+    }
+
+    // Started by the main loop, running until done or aborted
+    const SweepReport_t *report = Sweep_GetReport();
+    if (report->state == eSWEEP_STATE_DONE || report->state == eSWEEP_STATE_ABORTED)
+    {
+        SimResult_t *result = s_job->result;
+        result->metric[METRIC_TOTAL] = Sim_Milliseconds(cycles - startAt);
+        result->metric[METRIC_UNSETTLED] = __builtin_popcount(report->unsettled);
+        result->metric[METRIC_STATE] = report->state;
+        Fit(report, result);
+        Sim_Finish();
+    }
+}
+
+/**
+ * @brief  Compare the curve with the string's equation
+ * @param  report - the finished sweep
+ * @param[out] result - the worst voltage error and the slope's error
+ * @return None
+ * @note   The slope is the least squares fit of ln(I) against V - I * R,
+ *         1 / (count * n * Vt) for the string.
+ */
+static void Fit(const SweepReport_t *report, SimResult_t *result)
+{
+    double n = 0;
+    double sx = 0;
+    double sy = 0;
+    double sxx = 0;
+    double sxy = 0;
+    for (uint32_t i = 0; i < report->count; i++)
+    {
+        const SweepPoint_t *point = &report->points[i];
+        if (point->milliamps < IVCURVE_FIT_MA)
+        {
+            continue;
+        }
+
+        const double current = point->milliamps / 1000.0;
+        const double volts = point->millivolts / 1000.0;
+        const double model = current * IVCURVE_RESISTANCE + IVCURVE_EMISSION * log(current / IVCURVE_SATURATION + 1);
+        result->metric[METRIC_V_ERROR] = fmax(result->metric[METRIC_V_ERROR], fabs(volts - model) * 1000);
+
+        const double x = volts - current * IVCURVE_RESISTANCE;
+        const double y = log(current);
+        n++;
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+    }
+
+    result->metric[METRIC_FITTED] = n;
+    if (n >= 2)
+    {
+        const double slope = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+        result->metric[METRIC_SLOPE] = (slope * IVCURVE_EMISSION - 1) * 100;
+    }
+}
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
@@ -0,0 +1,289 @@
+//------------------------------------------------------------------------------
+//       Filename: loadstep.c
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Compares the PID and cascade controllers on load steps
+//------------------------------------------------------------------------------
+//       Notes : Each job settles one controller at a setpoint on a light load,
+//               then steps the load three times:
+//                 - heavier, still below the current limit (CV load step)
+//                 - past the current limit, into CC (CV to CC transition)
+//                 - back to the light load, out of CC (CC to CV transition)
+//               and measures the deviation and the settling time of each.
+//               The steps settle on the averaged output, as a meter shows
+//               it, but the CV step's dip is shorter than the average, so its
+//               recovery is timed on the instantaneous output: from the step
+//               back into the band after the lowest point, 0 if it stays in.
+//               The inductor current peak on entering CC is the transient
+//               the cascade's inner loop should bound, the output current
+//               itself is held up by the output capacitor either way.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#include "boost.h"
+#include "sim.h"
+#include <math.h>
+
+//------------------------------------------------------------------------------
+// Module constant defines
+//------------------------------------------------------------------------------
+#define LOADSTEP_RUN_MS   (400)
+#define LOADSTEP_HOLD_MS  (2)
+#define LOADSTEP_LIMIT_MA (500)
+
+#define LOADSTEP_LIGHT_OHMS (220.0)
+// Half the current limit, and past it to hold 3/4 of the target in CC, which
+// stays above the input voltage for a boost to regulate
+#define LOADSTEP_HEAVY_OHMS(v) ((v) / (LOADSTEP_LIMIT_MA / 2000.0))
+#define LOADSTEP_CC_OHMS(v)    ((v) * 0.75 / (LOADSTEP_LIMIT_MA / 1000.0))
+
+// 1% (or 50mV) of the voltage, 5% of the current limit
+#define LOADSTEP_VOLTAGE_BAND(v) fmax((v) * 0.01, 0.05)
+#define LOADSTEP_CURRENT_BAND    (LOADSTEP_LIMIT_MA / 1000.0 * 0.05)
+
+// 10% of the target, in mV
+#define LOADSTEP_MAX_OVERSHOOT(mv) ((mv) * 0.1)
+
+#define PARAM_CONTROLLER (0)
+#define PARAM_TARGET     (1) // mV
+
+#define METRIC_DIP        (0)
+#define METRIC_RECOVER    (1)
+#define METRIC_PEAK_IL    (2)
+#define METRIC_CC_SETTLE  (3)
+#define METRIC_OVERSHOOT  (4)
+#define METRIC_CV_SETTLE  (5)
+
+#define array_size(x) (sizeof(x) / sizeof(x[0]))
+
+//------------------------------------------------------------------------------
+// Module type definitions
+//------------------------------------------------------------------------------
+typedef enum
+{
+    ePHASE_SETTLE = 0, // At the setpoint on the light load
+    ePHASE_CV_STEP,    // Heavier load, still regulating the voltage
+    ePHASE_CC_ENTER,   // Past the current limit
+    ePHASE_CC_EXIT,    // Back to the light load
+} Phase_e;
+
+//------------------------------------------------------------------------------
+// Module static variables
+//------------------------------------------------------------------------------
+static const BoostController_e s_controllers[] = {eBOOST_CONTROLLER_PID, eBOOST_CONTROLLER_CASCADE};
+static const uint32_t s_targets[] = {8000, 10000, 12000};
+
+static const SimJob_t *s_job = NULL;
+
+//------------------------------------------------------------------------------
+// Module static function prototypes
+//------------------------------------------------------------------------------
+static uint32_t Plan(SimJob_t *jobs, uint32_t max);
+static void Run(const SimJob_t *job);
+static bool Check(const SimJob_t *jobs, uint32_t count);
+static void Hook(uint64_t cycles);
+
+//------------------------------------------------------------------------------
+// Module exported variables
+//------------------------------------------------------------------------------
+const SimScenario_t g_simLoadStep = {
+    .name = "loadstep",
+    .metricNames = {"dip mV", "recover ms", "peak iL A", "CC ms", "overshoot mV", "CV ms"},
+    .plan = Plan,
+    .run = Run,
+    .check = Check,
+};
+
+//------------------------------------------------------------------------------
+// Module static functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  A job per target for each controller, the same targets in order
+ */
+static uint32_t Plan(SimJob_t *jobs, uint32_t max)
+{
+    uint32_t count = 0;
+    for (size_t t = 0; t < array_size(s_targets); t++)
+    {
+        for (size_t c = 0; c < array_size(s_controllers) && count < max; c++)
+        {
+            SimJob_t *job = &jobs[count++];
+            job->plant = (PlantConfig_t){.vin = 5.0, .load = LOADSTEP_LIGHT_OHMS};
+            job->param[PARAM_CONTROLLER] = s_controllers[c];
+            job->param[PARAM_TARGET] = s_targets[t];
+            job->runMs = LOADSTEP_RUN_MS;
+            snprintf(job->label, sizeof(job->label), "%umV %s", s_targets[t],
+                     s_controllers[c] == eBOOST_CONTROLLER_PID ? "PID" : "cascade");
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief  Boot from erased flash
+ */
+static void Run(const SimJob_t *job)
+{
+    s_job = job;
+    Sim_Boot(job, Hook, NULL);
+}
+
+/**
+ * @brief  Leaving CC must not overshoot by more than LOADSTEP_MAX_OVERSHOOT
+ *         and the cascade must bound the inductor current entering CC at
+ *         least as well as the PID. Every step settling was checked by the
+ *         runner, as the job finishes once the last one has.
+ */
+static bool Check(const SimJob_t *jobs, uint32_t count)
+{
+    bool passed = true;
+    double dip = 0;
+    double recover = 0;
+    double peak = 0;
+    double overshoot = 0;
+    uint32_t pairs = 0;
+    for (uint32_t i = 0; i + 1 < count; i += 2)
+    {
+        const SimResult_t *pid = jobs[i].result;
+        const SimResult_t *cascade = jobs[i + 1].result;
+        if (!pid->done || !cascade->done)
+        {
+            continue;
+        }
+
+        for (uint32_t j = i; j < i + 2; j++)
+        {
+            const double target = jobs[j].param[PARAM_TARGET];
+            if (jobs[j].result->metric[METRIC_OVERSHOOT] > LOADSTEP_MAX_OVERSHOOT(target))
+            {
+                printf("  %s: overshoots leaving CC\n", jobs[j].label);
+                passed = false;
+            }
+        }
+
+        if (cascade->metric[METRIC_PEAK_IL] > pid->metric[METRIC_PEAK_IL])
+        {
+            printf("  %s: inductor current peaks higher than PID\n", jobs[i + 1].label);
+            passed = false;
+        }
+
+        dip += cascade->metric[METRIC_DIP] - pid->metric[METRIC_DIP];
+        recover += cascade->metric[METRIC_RECOVER] - pid->metric[METRIC_RECOVER];
+        peak += cascade->metric[METRIC_PEAK_IL] - pid->metric[METRIC_PEAK_IL];
+        overshoot += cascade->metric[METRIC_OVERSHOOT] - pid->metric[METRIC_OVERSHOOT];
+        pairs++;
+    }
+
+    if (pairs)
+    {
+        printf("  cascade against PID on average: dip %+.0fmV, recovery %+.3fms, peak iL %+.2fA, CC exit overshoot "
+               "%+.0fmV\n",
+               dip / pairs, recover / pairs, peak / pairs, overshoot / pairs);
+    }
+    return passed;
+}
+
+/**
+ * @brief  Step the load once the output has settled after the previous step
+ */
+static void Hook(uint64_t cycles)
+{
+    static bool started = false;
+    static Phase_e phase = ePHASE_SETTLE;
+    static SimSettle_t settle;
+    static double extreme = 0;
+    static uint64_t recoveredAt = 0;
+
+    // Once booted, main() reads the controller back after starting the loop
+    if (!BoostPWM_IsCalibrated())
+    {
+        return;
+    }
+
+    if (!started)
+    {
+        started = true;
+        Sim_Command(eSIM_CMD_SET_CONTROLLER, s_job->param[PARAM_CONTROLLER]);
+        Sim_Command(eSIM_CMD_SET_CURRENT, LOADSTEP_LIMIT_MA);
+        Sim_Command(eSIM_CMD_SET_VOLTAGE, s_job->param[PARAM_TARGET]);
+        Sim_SettleStart(&settle, cycles);
+        return;
+    }
+
+    PlantState_t state;
+    Plant_GetState(&state);
+    const double target = s_job->param[PARAM_TARGET] / 1000.0;
+    const double limit = LOADSTEP_LIMIT_MA / 1000.0;
+    SimResult_t *result = s_job->result;
+
+    switch (phase)
+    {
+        case ePHASE_SETTLE:
+            if (Sim_Settled(&settle, cycles, state.vOut, target, LOADSTEP_VOLTAGE_BAND(target), LOADSTEP_HOLD_MS))
+            {
+                Plant_SetLoad(LOADSTEP_HEAVY_OHMS(target));
+                Sim_SettleStart(&settle, cycles);
+                extreme = state.vOut;
+                recoveredAt = 0;
+                phase = ePHASE_CV_STEP;
+            }
+            break;
+
+        case ePHASE_CV_STEP:
+            if (state.vOut < extreme)
+            {
+                extreme = state.vOut;
+                recoveredAt = 0;
+            }
+            else if (!recoveredAt && fabs(state.vOut - target) <= LOADSTEP_VOLTAGE_BAND(target))
+            {
+                recoveredAt = cycles;
+            }
+            if (Sim_Settled(&settle, cycles, state.vOut, target, LOADSTEP_VOLTAGE_BAND(target), LOADSTEP_HOLD_MS))
+            {
+                result->metric[METRIC_DIP] = (target - extreme) * 1000;
+                // Still outside when the average settles, it recovers no sooner
+                const bool dipped = target - extreme > LOADSTEP_VOLTAGE_BAND(target);
+                recoveredAt = recoveredAt ? recoveredAt : cycles;
+                result->metric[METRIC_RECOVER] = dipped ? Sim_Milliseconds(recoveredAt - settle.start) : 0;
+
+                Plant_SetLoad(LOADSTEP_CC_OHMS(target));
+                Sim_SettleStart(&settle, cycles);
+                extreme = state.iL;
+                phase = ePHASE_CC_ENTER;
+            }
+            break;
+
+        case ePHASE_CC_ENTER:
+            extreme = fmax(extreme, state.iL);
+            if (Sim_Settled(&settle, cycles, state.iLoad, limit, LOADSTEP_CURRENT_BAND, LOADSTEP_HOLD_MS))
+            {
+                result->metric[METRIC_PEAK_IL] = extreme;
+                result->metric[METRIC_CC_SETTLE] = Sim_SettleMs(&settle);
+
+                Plant_SetLoad(LOADSTEP_LIGHT_OHMS);
+                Sim_SettleStart(&settle, cycles);
+                extreme = state.vOut;
+                phase = ePHASE_CC_EXIT;
+            }
+            break;
+
+        case ePHASE_CC_EXIT:
+            extreme = fmax(extreme, state.vOut);
+            if (Sim_Settled(&settle, cycles, state.vOut, target, LOADSTEP_VOLTAGE_BAND(target), LOADSTEP_HOLD_MS))
+            {
+                result->metric[METRIC_OVERSHOOT] = fmax(extreme - target, 0) * 1000;
+                result->metric[METRIC_CV_SETTLE] = Sim_SettleMs(&settle);
+                Sim_Finish();
+            }
+            break;
+    }
+}
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
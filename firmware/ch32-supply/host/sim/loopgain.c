@@ -0,0 +1,314 @@
+//------------------------------------------------------------------------------
+//       Filename: loopgain.c
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Checks the loop gain analyser against the model
+//------------------------------------------------------------------------------
+//       Notes : Each job settles the PID at an operating point, runs a sweep
+//               with HID command 13, as the web UI does, and compares every
+//               point with the loop gain worked out from the model: the
+//               plant linearised about the operating point (see
+//               Plant_GetResponse()) times the PID's own z transform,
+//                 C(z) = 2^-kp + 2^-kd (1 - z^-1) + 2^-ki / (1 - z^-1)
+//               Points where the gain is far from 1 are dominated by one of
+//               the two signals the analyser correlates, and its Q6 gain is
+//               coarse below 1/4, so only those between LOOPGAIN_CHECK_MIN_DB
+//               and LOOPGAIN_CHECK_MAX_DB are checked. The phase lags the
+//               model a little more as the gain falls past the crossover,
+//               ~10deg at -10dB. The crossover and phase margin are
+//               interpolated from the sweep. The loads keep the inductor in
+//               continuous conduction through the perturbation, as the model
+//               assumes. On light loads the current touches 0 around the LC
+//               resonance, which damps it well below the linear model's peak.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#include "boost.h"
+#include "fra.h"
+#include "sim.h"
+#include <complex.h>
+#include <math.h>
+
+//------------------------------------------------------------------------------
+// Module constant defines
+//------------------------------------------------------------------------------
+#define LOOPGAIN_RUN_MS       (4000)
+#define LOOPGAIN_HOLD_MS      (5)
+#define LOOPGAIN_LIMIT_MA     (1000)
+#define LOOPGAIN_CHECK_MIN_DB (-12.0) // The gains checked
+#define LOOPGAIN_CHECK_MAX_DB (20.0)
+#define LOOPGAIN_MAX_DB       (1.0)  // Gain error allowed
+#define LOOPGAIN_MAX_DEG      (12.0) // Phase error allowed
+#define LOOPGAIN_MIN_CHECKED  (3)
+
+// 1% (or 50mV) of the target
+#define LOOPGAIN_BAND(v) fmax((v) * 0.01, 0.05)
+
+// The control loop rate, one sample per PWM period
+#define LOOPGAIN_SAMPLE_HZ ((double)FUNCONF_SYSTEM_CORE_CLOCK / ((TIM1->PSC + 1) * (TIM1->ATRLR + 1)))
+
+// FraPoint_t scaling
+#define FRA_GAIN_SCALE  (64.0)
+#define FRA_PHASE_SCALE (100.0)
+
+#define PARAM_POINT (0)
+
+#define METRIC_GAIN_ERROR  (0)
+#define METRIC_PHASE_ERROR (1)
+#define METRIC_CHECKED     (2)
+#define METRIC_CROSSOVER   (3)
+#define METRIC_MARGIN      (4)
+#define METRIC_MIN_IL      (5)
+
+#define array_size(x) (sizeof(x) / sizeof(x[0]))
+
+//------------------------------------------------------------------------------
+// Module type definitions
+//------------------------------------------------------------------------------
+typedef enum
+{
+    ePHASE_SETTLE = 0, // At the setpoint
+    ePHASE_SWEEP,      // Sweeping
+    ePHASE_RESETTLE,   // Back at the operating point, for the model
+} Phase_e;
+
+typedef struct
+{
+    uint32_t targetMv;
+    double load; // Ohms
+} LoopGainPoint_t;
+
+//------------------------------------------------------------------------------
+// Module static variables
+//------------------------------------------------------------------------------
+static const LoopGainPoint_t s_points[] = {
+    {6000, 10},
+    {9000, 20},
+    {12000, 30},
+};
+
+static const SimJob_t *s_job = NULL;
+
+//------------------------------------------------------------------------------
+// Module static function prototypes
+//------------------------------------------------------------------------------
+static uint32_t Plan(SimJob_t *jobs, uint32_t max);
+static void Run(const SimJob_t *job);
+static bool Check(const SimJob_t *jobs, uint32_t count);
+static void Hook(uint64_t cycles);
+static void Compare(const FraReport_t *report, SimResult_t *result);
+static double complex ModelGain(double frequency);
+
+//------------------------------------------------------------------------------
+// Module exported variables
+//------------------------------------------------------------------------------
+const SimScenario_t g_simLoopGain = {
+    .name = "loopgain",
+    .metricNames = {"gain dB", "phase deg", "checked", "crossover Hz", "margin deg", "min iL A"},
+    .plan = Plan,
+    .run = Run,
+    .check = Check,
+};
+
+//------------------------------------------------------------------------------
+// Module static functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  A job per operating point
+ */
+static uint32_t Plan(SimJob_t *jobs, uint32_t max)
+{
+    uint32_t count = 0;
+    for (size_t p = 0; p < array_size(s_points) && count < max; p++)
+    {
+        SimJob_t *job = &jobs[count++];
+        job->plant = (PlantConfig_t){.vin = 5.0, .load = s_points[p].load};
+        job->param[PARAM_POINT] = p;
+        job->runMs = LOOPGAIN_RUN_MS;
+        snprintf(job->label, sizeof(job->label), "%umV %gR", s_points[p].targetMv, s_points[p].load);
+    }
+    return count;
+}
+
+/**
+ * @brief  Boot from erased flash
+ */
+static void Run(const SimJob_t *job)
+{
+    s_job = job;
+    Sim_Boot(job, Hook, NULL);
+}
+
+/**
+ * @brief  Every checked point must be within LOOPGAIN_MAX_DB and
+ *         LOOPGAIN_MAX_DEG of the model, with at least LOOPGAIN_MIN_CHECKED
+ *         around the crossover
+ */
+static bool Check(const SimJob_t *jobs, uint32_t count)
+{
+    bool passed = true;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const SimResult_t *result = jobs[i].result;
+        if (!result->done)
+        {
+            continue;
+        }
+
+        if (result->metric[METRIC_MIN_IL] <= 0)
+        {
+            printf("  %s: the inductor current reached 0, the model does not apply\n", jobs[i].label);
+            passed = false;
+        }
+        if (result->metric[METRIC_CHECKED] < LOOPGAIN_MIN_CHECKED)
+        {
+            printf("  %s: only %.0f points checked\n", jobs[i].label, result->metric[METRIC_CHECKED]);
+            passed = false;
+        }
+        if (result->metric[METRIC_GAIN_ERROR] > LOOPGAIN_MAX_DB)
+        {
+            printf("  %s: gain off the model by %.2fdB\n", jobs[i].label, result->metric[METRIC_GAIN_ERROR]);
+            passed = false;
+        }
+        if (result->metric[METRIC_PHASE_ERROR] > LOOPGAIN_MAX_DEG)
+        {
+            printf("  %s: phase off the model by %.1fdeg\n", jobs[i].label, result->metric[METRIC_PHASE_ERROR]);
+            passed = false;
+        }
+    }
+    return passed;
+}
+
+/**
+ * @brief  Settle, sweep, then compare once back at the operating point
+ */
+static void Hook(uint64_t cycles)
+{
+    static bool started = false;
+    static Phase_e phase = ePHASE_SETTLE;
+    static SimSettle_t settle;
+
+    // Once booted, main() reads the settings back after starting the loop
+    if (!BoostPWM_IsCalibrated())
+    {
+        return;
+    }
+
+    const LoopGainPoint_t *point = &s_points[s_job->param[PARAM_POINT]];
+    if (!started)
+    {
+        started = true;
+        Sim_Command(eSIM_CMD_SET_CONTROLLER, eBOOST_CONTROLLER_PID);
+        Sim_Command(eSIM_CMD_SET_CURRENT, LOOPGAIN_LIMIT_MA);
+        Sim_Command(eSIM_CMD_SET_VOLTAGE, point->targetMv);
+        Sim_SettleStart(&settle, cycles);
+        return;
+    }
+
+    PlantState_t state;
+    Plant_GetState(&state);
+    const double target = point->targetMv / 1000.0;
+    const FraReport_t *report = FRA_GetReport();
+
+    switch (phase)
+    {
+        case ePHASE_SETTLE:
+            if (Sim_Settled(&settle, cycles, state.vOut, target, LOOPGAIN_BAND(target), LOOPGAIN_HOLD_MS))
+            {
+                Sim_Command(eSIM_CMD_FRA_START, FRA_DEFAULT_AMPLITUDE);
+                s_job->result->metric[METRIC_MIN_IL] = state.iL;
+                phase = ePHASE_SWEEP;
+            }
+            break;
+
+        case ePHASE_SWEEP:
+            s_job->result->metric[METRIC_MIN_IL] = fmin(s_job->result->metric[METRIC_MIN_IL], state.iL);
+
+            // Started by the main loop, running until done or aborted
+            if (report->state != eFRA_STATE_RUNNING && report->count)
+            {
+                Sim_SettleStart(&settle, cycles);
+                phase = ePHASE_RESETTLE;
+            }
+            break;
+
+        case ePHASE_RESETTLE:
+            if (Sim_Settled(&settle, cycles, state.vOut, target, LOOPGAIN_BAND(target), LOOPGAIN_HOLD_MS))
+            {
+                Compare(report, s_job->result);
+                Sim_Finish();
+            }
+            break;
+    }
+}
+
+/**
+ * @brief  Compare the sweep with the model
+ * @param  report - the finished sweep
+ * @param[out] result - the worst errors, the crossover and the margin
+ * @return None
+ */
+static void Compare(const FraReport_t *report, SimResult_t *result)
+{
+    double lastDb = 0;
+    double lastDeg = 0;
+    for (uint32_t i = 0; i < report->count; i++)
+    {
+        const FraPoint_t *point = &report->points[i];
+        const double measuredDb = 20 * log10(fmax(point->gain, 1) / FRA_GAIN_SCALE);
+        const double measuredDeg = point->phase / FRA_PHASE_SCALE;
+
+        const double complex model = ModelGain(point->frequency);
+        const double modelDb = 20 * log10(cabs(model));
+        const double modelDeg = carg(model) * 180 / M_PI;
+
+        if (modelDb >= LOOPGAIN_CHECK_MIN_DB && modelDb <= LOOPGAIN_CHECK_MAX_DB)
+        {
+            const double phaseError = fabs(remainder(measuredDeg - modelDeg, 360));
+            result->metric[METRIC_GAIN_ERROR] = fmax(result->metric[METRIC_GAIN_ERROR], fabs(measuredDb - modelDb));
+            result->metric[METRIC_PHASE_ERROR] = fmax(result->metric[METRIC_PHASE_ERROR], phaseError);
+            result->metric[METRIC_CHECKED]++;
+        }
+
+        // The first fall through 0dB, interpolated on a log frequency axis
+        if (i && lastDb > 0 && measuredDb <= 0 && !result->metric[METRIC_CROSSOVER])
+        {
+            const FraPoint_t *last = &report->points[i - 1];
+            const double t = lastDb / (lastDb - measuredDb);
+            const double deg = lastDeg + remainder(measuredDeg - lastDeg, 360) * t;
+            result->metric[METRIC_CROSSOVER] = last->frequency * pow((double)point->frequency / last->frequency, t);
+            const double wrapped = remainder(deg, 360);
+            result->metric[METRIC_MARGIN] = wrapped > 0 ? wrapped - 180 : wrapped + 180;
+        }
+        lastDb = measuredDb;
+        lastDeg = measuredDeg;
+    }
+}
+
+/**
+ * @brief  Work out the loop gain from the model and the gains in use
+ * @param  frequency - Hz
+ * @return T(jw), the controller's z transform times the plant's
+ */
+static double complex ModelGain(double frequency)
+{
+    double re;
+    double im;
+    Plant_GetResponse(frequency, &re, &im);
+
+    BoostPidGains_t gains;
+    BoostPWM_GetPidGains(&gains);
+    const double complex zInverse = cexp(-I * 2 * M_PI * frequency / LOOPGAIN_SAMPLE_HZ);
+    const double complex controller = ldexp(1, -gains.kpShift) + ldexp(1, -gains.kdShift) * (1 - zInverse) +
+                                      ldexp(1, -gains.kiShift) / (1 - zInverse);
+
+    return controller * (re + I * im);
+}
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
@@ -0,0 +1,298 @@
+//------------------------------------------------------------------------------
+//       Filename: modes.c
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Checks the CP and CR modes are stable at their boundaries
+//------------------------------------------------------------------------------
+//       Notes : Each job settles a mode on a light load, then steps to a load
+//               on one side of a mode boundary or right on it:
+//                 CP - CV below MODES_POWER, CP, CC past MODES_LIMIT_MA
+//                 CR - CR, CC past MODES_LIMIT_MA
+//               It waits for the output to settle on the operating point the
+//               mode should hold there and measures the peak to peak output
+//               voltage and current over MODES_WINDOW_MS. A boundary where the
+//               regulated quantity flips back and forth shows as an error or
+//               as a large peak to peak.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#include "boost.h"
+#include "sim.h"
+#include <math.h>
+
+//------------------------------------------------------------------------------
+// Module constant defines
+//------------------------------------------------------------------------------
+#define MODES_RUN_MS      (300)
+#define MODES_HOLD_MS     (2)
+#define MODES_WINDOW_MS   (10)
+#define MODES_TARGET_MV   (12000)
+#define MODES_LIMIT_MA    (600)
+#define MODES_POWER       (4000) // mW
+#define MODES_RESISTANCE  (2000) // mOhm
+#define MODES_LIGHT_OHMS  (100.0)
+
+// Settled within 2% of the operating point
+#define MODES_BAND(v) ((v) * 0.02)
+
+// Pass limits, the error of the settled average and the peak to peak, in %.
+// Hunting between modes never settles, the peak to peak limit catches an
+// outright oscillation. The PID's ripple in CC grows as the load falls, its
+// current loop gain is inversely proportional to the load, ~6% at 9R.
+#define MODES_MAX_ERROR (2.0)
+#define MODES_MAX_PP    (8.0)
+
+#define PARAM_MODE       (0)
+#define PARAM_CONTROLLER (1)
+#define PARAM_LOAD       (2) // mOhm
+
+#define METRIC_EXPECTED (0)
+#define METRIC_SETTLE   (1)
+#define METRIC_ERROR    (2)
+#define METRIC_PP_V     (3)
+#define METRIC_PP_I     (4)
+
+#define array_size(x) (sizeof(x) / sizeof(x[0]))
+
+//------------------------------------------------------------------------------
+// Module type definitions
+//------------------------------------------------------------------------------
+typedef enum
+{
+    ePHASE_LIGHT = 0, // Settling on the light load
+    ePHASE_STEP,      // Settling on the test load
+    ePHASE_WINDOW,    // Measuring
+} Phase_e;
+
+typedef struct
+{
+    BoostMode_e mode;
+    double loads[6]; // Ohms, 0 terminated
+} ModeLoads_t;
+
+//------------------------------------------------------------------------------
+// Module static variables
+//------------------------------------------------------------------------------
+// The boundaries are at 36R (CV/CP) and 11.1R (CP/CC) in CP, 18R (CR/CC) in CR
+static const ModeLoads_t s_modeLoads[] = {
+    {eBOOST_MODE_CP, {50, 36, 20, 11.1, 9}},
+    {eBOOST_MODE_CR, {40, 18, 16, 12}},
+};
+static const BoostController_e s_controllers[] = {eBOOST_CONTROLLER_PID, eBOOST_CONTROLLER_CASCADE};
+
+static const SimJob_t *s_job = NULL;
+
+//------------------------------------------------------------------------------
+// Module static function prototypes
+//------------------------------------------------------------------------------
+static uint32_t Plan(SimJob_t *jobs, uint32_t max);
+static void Run(const SimJob_t *job);
+static bool Check(const SimJob_t *jobs, uint32_t count);
+static void Hook(uint64_t cycles);
+static double OperatingPoint(BoostMode_e mode, double load);
+
+//------------------------------------------------------------------------------
+// Module exported variables
+//------------------------------------------------------------------------------
+const SimScenario_t g_simModes = {
+    .name = "modes",
+    .metricNames = {"expected V", "settle ms", "error %", "p-p V %", "p-p I %"},
+    .plan = Plan,
+    .run = Run,
+    .check = Check,
+};
+
+//------------------------------------------------------------------------------
+// Module static functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  A job per mode, load and controller
+ */
+static uint32_t Plan(SimJob_t *jobs, uint32_t max)
+{
+    uint32_t count = 0;
+    for (size_t m = 0; m < array_size(s_modeLoads); m++)
+    {
+        const ModeLoads_t *modeLoads = &s_modeLoads[m];
+        for (size_t l = 0; l < array_size(modeLoads->loads) && modeLoads->loads[l] > 0; l++)
+        {
+            for (size_t c = 0; c < array_size(s_controllers) && count < max; c++)
+            {
+                SimJob_t *job = &jobs[count++];
+                job->plant = (PlantConfig_t){.vin = 5.0, .load = 0};
+                job->param[PARAM_MODE] = modeLoads->mode;
+                job->param[PARAM_CONTROLLER] = s_controllers[c];
+                job->param[PARAM_LOAD] = lround(modeLoads->loads[l] * 1000);
+                job->runMs = MODES_RUN_MS;
+                snprintf(job->label, sizeof(job->label), "%s %gR %s",
+                         modeLoads->mode == eBOOST_MODE_CP ? "CP" : "CR", modeLoads->loads[l],
+                         s_controllers[c] == eBOOST_CONTROLLER_PID ? "PID" : "cascade");
+            }
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief  Boot from erased flash
+ */
+static void Run(const SimJob_t *job)
+{
+    s_job = job;
+    Sim_Boot(job, Hook, NULL);
+}
+
+/**
+ * @brief  Every job must hold its operating point within MODES_MAX_ERROR
+ *         and without oscillating past MODES_MAX_PP
+ */
+static bool Check(const SimJob_t *jobs, uint32_t count)
+{
+    bool passed = true;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const SimResult_t *result = jobs[i].result;
+        if (!result->done)
+        {
+            continue;
+        }
+
+        if (fabs(result->metric[METRIC_ERROR]) > MODES_MAX_ERROR)
+        {
+            printf("  %s: off the operating point\n", jobs[i].label);
+            passed = false;
+        }
+
+        if (result->metric[METRIC_PP_V] > MODES_MAX_PP || result->metric[METRIC_PP_I] > MODES_MAX_PP)
+        {
+            printf("  %s: oscillating\n", jobs[i].label);
+            passed = false;
+        }
+    }
+    return passed;
+}
+
+/**
+ * @brief  Set the mode up, step the load and measure once settled
+ */
+static void Hook(uint64_t cycles)
+{
+    static bool started = false;
+    static Phase_e phase = ePHASE_LIGHT;
+    static SimSettle_t settle;
+    static uint64_t windowEnd = 0;
+    static double vSum = 0;
+    static uint32_t samples = 0;
+    static double vMin, vMax, iMin, iMax;
+
+    // Once booted, main() reads the controller back after starting the loop,
+    // and the current offset is calibrated open circuit
+    if (!BoostPWM_IsCalibrated())
+    {
+        return;
+    }
+
+    const BoostMode_e mode = s_job->param[PARAM_MODE];
+    const double load = s_job->param[PARAM_LOAD] / 1000.0;
+    if (!started)
+    {
+        started = true;
+        Plant_SetLoad(MODES_LIGHT_OHMS);
+        Sim_Command(eSIM_CMD_SET_CONTROLLER, s_job->param[PARAM_CONTROLLER]);
+        Sim_Command(eSIM_CMD_SET_POWER, MODES_POWER);
+        Sim_Command(eSIM_CMD_SET_RESISTANCE, MODES_RESISTANCE);
+        Sim_Command(eSIM_CMD_SET_MODE, mode);
+        Sim_Command(eSIM_CMD_SET_CURRENT, MODES_LIMIT_MA);
+        Sim_Command(eSIM_CMD_SET_VOLTAGE, MODES_TARGET_MV);
+        Sim_SettleStart(&settle, cycles);
+        return;
+    }
+
+    PlantState_t state;
+    Plant_GetState(&state);
+    SimResult_t *result = s_job->result;
+
+    switch (phase)
+    {
+        case ePHASE_LIGHT:
+        {
+            const double expected = OperatingPoint(mode, MODES_LIGHT_OHMS);
+            if (Sim_Settled(&settle, cycles, state.vOut, expected, MODES_BAND(expected), MODES_HOLD_MS))
+            {
+                Plant_SetLoad(load);
+                Sim_SettleStart(&settle, cycles);
+                phase = ePHASE_STEP;
+            }
+            break;
+        }
+
+        case ePHASE_STEP:
+        {
+            const double expected = OperatingPoint(mode, load);
+            if (Sim_Settled(&settle, cycles, state.vOut, expected, MODES_BAND(expected), MODES_HOLD_MS))
+            {
+                result->metric[METRIC_EXPECTED] = expected;
+                result->metric[METRIC_SETTLE] = Sim_SettleMs(&settle);
+                windowEnd = cycles + MODES_WINDOW_MS * SIM_CYCLES_PER_MS;
+                vMin = vMax = state.vOut;
+                iMin = iMax = state.iLoad;
+                phase = ePHASE_WINDOW;
+            }
+            break;
+        }
+
+        case ePHASE_WINDOW:
+        {
+            vSum += state.vOut;
+            samples++;
+            vMin = fmin(vMin, state.vOut);
+            vMax = fmax(vMax, state.vOut);
+            iMin = fmin(iMin, state.iLoad);
+            iMax = fmax(iMax, state.iLoad);
+            if (cycles < windowEnd)
+            {
+                break;
+            }
+
+            const double expected = result->metric[METRIC_EXPECTED];
+            const double average = vSum / samples;
+            result->metric[METRIC_ERROR] = (average / expected - 1) * 100;
+            result->metric[METRIC_PP_V] = (vMax - vMin) / average * 100;
+            result->metric[METRIC_PP_I] = (iMax - iMin) / (average / load) * 100;
+            Sim_Finish();
+            break;
+        }
+    }
+}
+
+/**
+ * @brief  The output voltage a mode should hold on a load
+ * @param  mode - CP or CR
+ * @param  load - Ohms
+ * @return Volts, whichever of the voltage, power or resistance and current
+ *         limits is the lowest
+ */
+static double OperatingPoint(BoostMode_e mode, double load)
+{
+    const double target = MODES_TARGET_MV / 1000.0;
+    const double cc = MODES_LIMIT_MA / 1000.0 * load;
+
+    double v = target;
+    if (mode == eBOOST_MODE_CP)
+    {
+        v = fmin(v, sqrt(MODES_POWER / 1000.0 * load));
+    }
+    else if (mode == eBOOST_MODE_CR)
+    {
+        v = target * load / (load + MODES_RESISTANCE / 1000.0);
+    }
+    return fmin(v, cc);
+}
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
@@ -0,0 +1,351 @@
+//------------------------------------------------------------------------------
+//       Filename: replay.c
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Checks that a device trace replays bit for bit
+//------------------------------------------------------------------------------
+//       Notes : Each job first runs the firmware on the model as the device,
+//               settles it, arms a capture with HID command 26, as the web
+//               UI does, and steps the load so the records hold a transient.
+//               It writes the capture as the web UI saves it, the controller
+//               state and the records, along with the duty each interrupt
+//               left. The job then boots the firmware on the trace alone,
+//               see HOST_ADC_REPLAY in host/host.c, and compares the duties.
+//               The last job clears the integrators in the state it saves,
+//               it must differ, which shows the comparison would catch a
+//               replay that drifts.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#include "boost.h"
+#include "sim.h"
+#include "trace.h"
+#include <math.h>
+#include <stdlib.h>
+
+//------------------------------------------------------------------------------
+// Module constant defines
+//------------------------------------------------------------------------------
+#define REPLAY_RUN_MS   (300)
+#define REPLAY_HOLD_MS  (5)
+#define REPLAY_LIMIT_MA (1000)
+#define REPLAY_POWER_MW (5000)
+
+// 1% (or 50mV) of the target
+#define REPLAY_BAND(v) fmax((v) * 0.01, 0.05)
+
+#define PARAM_POINT  (0)
+#define PARAM_INTACT (1) // The state saved as captured
+
+#define METRIC_RECORDS    (0)
+#define METRIC_MISMATCHES (1)
+#define METRIC_FIRST      (2) // The first record that differs, -1 if none
+
+#define array_size(x) (sizeof(x) / sizeof(x[0]))
+
+//------------------------------------------------------------------------------
+// Module type definitions
+//------------------------------------------------------------------------------
+typedef struct
+{
+    BoostController_e controller;
+    BoostMode_e mode;
+    uint32_t targetMv;
+    double load;     // Ohms, settled on
+    double stepLoad; // Ohms, from the arm
+    const char *name;
+} ReplayPoint_t;
+
+//------------------------------------------------------------------------------
+// Module static variables
+//------------------------------------------------------------------------------
+static const ReplayPoint_t s_points[] = {
+    {eBOOST_CONTROLLER_PID, eBOOST_MODE_CV, 9000, 30, 15, "PID CV"},
+    {eBOOST_CONTROLLER_CASCADE, eBOOST_MODE_CV, 9000, 30, 15, "cascade CV"},
+    {eBOOST_CONTROLLER_PID, eBOOST_MODE_CP, 12000, 20, 30, "PID CP"},
+};
+
+static char s_traceFile[256];
+static char s_dutyFile[256];
+static uint16_t s_duties[TRACE_SAMPLES];
+static const SimJob_t *s_job = NULL;
+
+//------------------------------------------------------------------------------
+// Module static function prototypes
+//------------------------------------------------------------------------------
+static uint32_t Plan(SimJob_t *jobs, uint32_t max);
+static void Run(const SimJob_t *job);
+static bool Check(const SimJob_t *jobs, uint32_t count);
+static void Capture(const SimJob_t *job);
+static void CaptureHook(uint64_t cycles);
+static void ReplayHook(uint64_t cycles);
+static void WriteTrace(const TraceReport_t *report, bool seeded);
+static void WriteWord(FILE *file, uint32_t word);
+
+//------------------------------------------------------------------------------
+// Module exported variables
+//------------------------------------------------------------------------------
+const SimScenario_t g_simReplay = {
+    .name = "replay",
+    .metricNames = {"records", "mismatches", "first"},
+    .plan = Plan,
+    .run = Run,
+    .check = Check,
+};
+
+//------------------------------------------------------------------------------
+// Module static functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  A job per operating point, and the first with its integrators
+ *         cleared
+ */
+static uint32_t Plan(SimJob_t *jobs, uint32_t max)
+{
+    uint32_t count = 0;
+    for (size_t p = 0; p <= array_size(s_points) && count < max; p++)
+    {
+        const bool intact = p < array_size(s_points);
+        const ReplayPoint_t *point = &s_points[intact ? p : 0];
+        SimJob_t *job = &jobs[count++];
+        job->plant = (PlantConfig_t){.vin = 5.0, .load = 0};
+        job->param[PARAM_POINT] = intact ? p : 0;
+        job->param[PARAM_INTACT] = intact;
+        job->runMs = REPLAY_RUN_MS;
+        snprintf(job->label, sizeof(job->label), "%s %gR to %gR%s", point->name, point->load, point->stepLoad,
+                 intact ? "" : " I cleared");
+    }
+    return count;
+}
+
+/**
+ * @brief  Capture on the model, then boot on the capture
+ */
+static void Run(const SimJob_t *job)
+{
+    s_job = job;
+    Sim_TempFile(s_traceFile, sizeof(s_traceFile), "trace");
+    Sim_TempFile(s_dutyFile, sizeof(s_dutyFile), "duty");
+
+    // Not finishing leaves the job's result unfinished, which fails it
+    if (!Sim_Spawn(job, Capture))
+    {
+        return;
+    }
+
+    FILE *file = fopen(s_dutyFile, "rb");
+    const bool read = file && fread(s_duties, sizeof(s_duties), 1, file) == 1;
+    if (file)
+    {
+        fclose(file);
+    }
+    if (!read)
+    {
+        return;
+    }
+
+    setenv("HOST_ADC_REPLAY", s_traceFile, 1);
+    s_job->result->metric[METRIC_FIRST] = -1;
+    Sim_Boot(job, ReplayHook, NULL);
+}
+
+/**
+ * @brief  Every replay must match the device's duties, but for the one
+ *         without its integrators
+ */
+static bool Check(const SimJob_t *jobs, uint32_t count)
+{
+    bool passed = true;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const SimResult_t *result = jobs[i].result;
+        if (!result->done)
+        {
+            continue;
+        }
+
+        if (jobs[i].param[PARAM_INTACT] && result->metric[METRIC_MISMATCHES])
+        {
+            printf("  %s: %.0f duties differ, the first at record %.0f\n", jobs[i].label,
+                   result->metric[METRIC_MISMATCHES], result->metric[METRIC_FIRST]);
+            passed = false;
+        }
+        if (!jobs[i].param[PARAM_INTACT] && !result->metric[METRIC_MISMATCHES])
+        {
+            printf("  %s: matches without the integrators\n", jobs[i].label);
+            passed = false;
+        }
+    }
+    return passed;
+}
+
+/**
+ * @brief  Boot from erased flash on the model, as the device
+ */
+static void Capture(const SimJob_t *job)
+{
+    Sim_Boot(job, CaptureHook, NULL);
+}
+
+/**
+ * @brief  Settle, arm and step the load, then save the capture and the
+ *         duties it led to
+ */
+static void CaptureHook(uint64_t cycles)
+{
+    static bool started = false;
+    static bool armed = false;
+    static SimSettle_t settle;
+
+    // Once booted, main() reads the settings back after starting the loop.
+    // The load goes on after the offset calibration, which would take the
+    // current it draws through the diode for the offset.
+    if (!BoostPWM_IsCalibrated())
+    {
+        return;
+    }
+
+    const ReplayPoint_t *point = &s_points[s_job->param[PARAM_POINT]];
+    if (!started)
+    {
+        started = true;
+        Plant_SetLoad(point->load);
+        Sim_Command(eSIM_CMD_SET_CONTROLLER, point->controller);
+        Sim_Command(eSIM_CMD_SET_CURRENT, REPLAY_LIMIT_MA);
+        Sim_Command(eSIM_CMD_SET_POWER, REPLAY_POWER_MW);
+        Sim_Command(eSIM_CMD_SET_MODE, point->mode);
+        Sim_Command(eSIM_CMD_SET_VOLTAGE, point->targetMv);
+        Sim_SettleStart(&settle, cycles);
+        return;
+    }
+
+    if (!armed)
+    {
+        // The operating point, not the target, in CP
+        PlantState_t state;
+        Plant_GetState(&state);
+        const double target = point->mode == eBOOST_MODE_CP ? sqrt(REPLAY_POWER_MW / 1000.0 * point->load)
+                                                            : point->targetMv / 1000.0;
+        if (Sim_Settled(&settle, cycles, state.vOut, target, REPLAY_BAND(target), REPLAY_HOLD_MS))
+        {
+            Sim_Command(eSIM_CMD_TRACE_ARM, 0);
+            Plant_SetLoad(point->stepLoad);
+            armed = true;
+        }
+        return;
+    }
+
+    // The hook runs after each interrupt, so each record's duty is here
+    const TraceReport_t *report = Trace_GetReport();
+    if (report->count)
+    {
+        s_duties[report->count - 1] = TIM1->CH3CVR;
+    }
+
+    if (report->state == eTRACE_STATE_DONE)
+    {
+        WriteTrace(report, s_job->param[PARAM_INTACT]);
+        FILE *file = fopen(s_dutyFile, "wb");
+        if (file)
+        {
+            fwrite(s_duties, sizeof(s_duties), 1, file);
+            fclose(file);
+            Sim_Finish();
+        }
+    }
+}
+
+/**
+ * @brief  Compare each replayed record's duty with the device's
+ */
+static void ReplayHook(uint64_t cycles)
+{
+    static uint32_t compared = 0;
+
+    // Ends with the trace, the next interrupt has no record
+    const uint32_t count = Host_GetReplayCount();
+    if (count == compared)
+    {
+        return;
+    }
+    compared = count;
+
+    SimResult_t *result = s_job->result;
+    result->metric[METRIC_RECORDS] = count;
+    if (TIM1->CH3CVR != s_duties[count - 1])
+    {
+        if (!result->metric[METRIC_MISMATCHES])
+        {
+            result->metric[METRIC_FIRST] = count - 1;
+        }
+        result->metric[METRIC_MISMATCHES]++;
+    }
+
+    if (count == TRACE_SAMPLES)
+    {
+        Sim_Finish();
+    }
+}
+
+/**
+ * @brief  Write a capture as the web UI saves it, see trace.h
+ * @param  report - the finished capture
+ * @param  intact - false to clear the integrators
+ * @return None
+ */
+static void WriteTrace(const TraceReport_t *report, bool intact)
+{
+    FILE *file = fopen(s_traceFile, "wb");
+    if (!file)
+    {
+        return;
+    }
+
+    TraceSeed_t seed = report->seed;
+    if (!intact)
+    {
+        seed.integrator = 0;
+        seed.outerIntegrator = 0;
+        seed.innerIntegrator = 0;
+    }
+
+    WriteWord(file, TRACE_FILE_MAGIC);
+    WriteWord(file, TRACE_FILE_VERSION);
+    WriteWord(file, sizeof(seed));
+    const uint8_t *bytes = (const uint8_t *)&seed;
+    for (uint32_t offset = 0; offset < sizeof(seed); offset += 4)
+    {
+        uint32_t word = 0;
+        for (uint32_t i = 0; i < 4 && offset + i < sizeof(seed); i++)
+        {
+            word |= (uint32_t)bytes[offset + i] << (i * 8);
+        }
+        WriteWord(file, word);
+    }
+
+    for (uint32_t i = 0; i < report->count; i++)
+    {
+        WriteWord(file, report->records[i]);
+    }
+    fclose(file);
+}
+
+/**
+ * @brief  Write a little endian word
+ * @param  file - the trace
+ * @param  word - the word
+ * @return None
+ */
+static void WriteWord(FILE *file, uint32_t word)
+{
+    const uint8_t bytes[4] = {word, word >> 8, word >> 16, word >> 24};
+    fwrite(bytes, sizeof(bytes), 1, file);
+}
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
@@ -0,0 +1,225 @@
+//------------------------------------------------------------------------------
+//       Filename: short.c
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Measures the dissipation in a sustained short for each
+//                 short circuit response
+//------------------------------------------------------------------------------
+//       Notes : Each job regulates SHORT_TARGET_MV open circuit, then loads
+//               the output past the current limit for SHORT_RUN_MS, and
+//               averages the power drawn from the input and dissipated in the
+//               converter over the last SHORT_WINDOW_MS of it. The load holds
+//               the output between the input voltage and a knee set above it.
+//               A boost has no switch in series with the input, with the
+//               duty at 0 a hard short still draws (Vin - Vdiode) / R through
+//               the inductor and the diode, 0.1R holds ~1.8V at 93W in. That
+//               is above the default knee and no response can change it, so
+//               it is not run. The check expects foldback and hiccup to draw
+//               and dissipate less than no response.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#include "boost.h"
+#include "sim.h"
+#include <math.h>
+
+//------------------------------------------------------------------------------
+// Module constant defines
+//------------------------------------------------------------------------------
+#define SHORT_TARGET_MV   (12000)
+#define SHORT_LIMIT_MA    (1000)
+#define SHORT_SETTLE_MS   (20)
+#define SHORT_RUN_MS      (1200)
+#define SHORT_WINDOW_MS   (1000)
+#define SHORT_OHMS        (7.0)
+#define SHORT_KNEE        (9000) // mV
+#define SHORT_FLOOR_MA    (100)
+#define SHORT_RETRY_MS    (100)
+
+// 1% (or 50mV) of the target
+#define SHORT_BAND(v) fmax((v) * 0.01, 0.05)
+
+#define PARAM_FAULT_MODE (0)
+
+#define METRIC_INPUT  (0)
+#define METRIC_LOSS   (1)
+#define METRIC_OUTPUT (2)
+#define METRIC_TRIPS  (3)
+
+#define array_size(x) (sizeof(x) / sizeof(x[0]))
+
+//------------------------------------------------------------------------------
+// Module type definitions
+//------------------------------------------------------------------------------
+typedef enum
+{
+    ePHASE_REGULATE = 0, // Settling open circuit
+    ePHASE_SHORT,        // Shorted, waiting for the window
+    ePHASE_WINDOW,       // Averaging
+} Phase_e;
+
+//------------------------------------------------------------------------------
+// Module static variables
+//------------------------------------------------------------------------------
+static const BoostFaultMode_e s_faultModes[] = {eBOOST_FAULT_NONE, eBOOST_FAULT_FOLDBACK, eBOOST_FAULT_HICCUP};
+static const char *const s_faultNames[] = {"none", "foldback", "hiccup"};
+
+static const SimJob_t *s_job = NULL;
+
+//------------------------------------------------------------------------------
+// Module static function prototypes
+//------------------------------------------------------------------------------
+static uint32_t Plan(SimJob_t *jobs, uint32_t max);
+static void Run(const SimJob_t *job);
+static bool Check(const SimJob_t *jobs, uint32_t count);
+static void Hook(uint64_t cycles);
+
+//------------------------------------------------------------------------------
+// Module exported variables
+//------------------------------------------------------------------------------
+const SimScenario_t g_simShort = {
+    .name = "short",
+    .metricNames = {"input W", "loss W", "output W", "trips"},
+    .plan = Plan,
+    .run = Run,
+    .check = Check,
+};
+
+//------------------------------------------------------------------------------
+// Module static functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  A job per response, no response first
+ */
+static uint32_t Plan(SimJob_t *jobs, uint32_t max)
+{
+    uint32_t count = 0;
+    for (size_t f = 0; f < array_size(s_faultModes) && count < max; f++)
+    {
+        SimJob_t *job = &jobs[count++];
+        job->plant = (PlantConfig_t){.vin = 5.0, .load = 0};
+        job->param[PARAM_FAULT_MODE] = s_faultModes[f];
+        job->runMs = SHORT_RUN_MS + SHORT_SETTLE_MS + 100;
+        snprintf(job->label, sizeof(job->label), "overload %s", s_faultNames[f]);
+    }
+    return count;
+}
+
+/**
+ * @brief  Boot from erased flash
+ */
+static void Run(const SimJob_t *job)
+{
+    s_job = job;
+    Sim_Boot(job, Hook, NULL);
+}
+
+/**
+ * @brief  Foldback and hiccup must cut the input power and the dissipation
+ */
+static bool Check(const SimJob_t *jobs, uint32_t count)
+{
+    bool passed = true;
+    const SimResult_t *none = jobs[0].result;
+    for (uint32_t i = 1; i < count; i++)
+    {
+        const SimResult_t *result = jobs[i].result;
+        if (!none->done || !result->done)
+        {
+            continue;
+        }
+
+        if (result->metric[METRIC_INPUT] >= none->metric[METRIC_INPUT] ||
+            result->metric[METRIC_LOSS] >= none->metric[METRIC_LOSS])
+        {
+            printf("  %s: dissipates no less than no response\n", jobs[i].label);
+            passed = false;
+        }
+    }
+    return passed;
+}
+
+/**
+ * @brief  Regulate, short the output and average the power
+ */
+static void Hook(uint64_t cycles)
+{
+    static bool started = false;
+    static Phase_e phase = ePHASE_REGULATE;
+    static SimSettle_t settle;
+    static uint64_t windowAt = 0;
+    static uint16_t trips = 0;
+    static PlantState_t start;
+
+    // Once booted, main() reads the settings back after starting the loop
+    if (!BoostPWM_IsCalibrated())
+    {
+        return;
+    }
+
+    if (!started)
+    {
+        started = true;
+        Sim_Command(eSIM_CMD_SET_FAULT_KNEE, SHORT_KNEE);
+        Sim_Command(eSIM_CMD_SET_FAULT_FLOOR, SHORT_FLOOR_MA);
+        Sim_Command(eSIM_CMD_SET_FAULT_RETRY, SHORT_RETRY_MS);
+        Sim_Command(eSIM_CMD_SET_FAULT_MODE, s_job->param[PARAM_FAULT_MODE]);
+        Sim_Command(eSIM_CMD_SET_CURRENT, SHORT_LIMIT_MA);
+        Sim_Command(eSIM_CMD_SET_VOLTAGE, SHORT_TARGET_MV);
+        Sim_SettleStart(&settle, cycles);
+        return;
+    }
+
+    PlantState_t state;
+    Plant_GetState(&state);
+    SimResult_t *result = s_job->result;
+    const double target = SHORT_TARGET_MV / 1000.0;
+
+    switch (phase)
+    {
+        case ePHASE_REGULATE:
+            if (Sim_Settled(&settle, cycles, state.vOut, target, SHORT_BAND(target), SHORT_SETTLE_MS))
+            {
+                Plant_SetLoad(SHORT_OHMS);
+                windowAt = cycles + (uint64_t)(SHORT_RUN_MS - SHORT_WINDOW_MS) * SIM_CYCLES_PER_MS;
+                phase = ePHASE_SHORT;
+            }
+            break;
+
+        case ePHASE_SHORT:
+            if (cycles >= windowAt)
+            {
+                start = state;
+                trips = BoostPWM_GetFaultCount();
+                phase = ePHASE_WINDOW;
+            }
+            break;
+
+        case ePHASE_WINDOW:
+        {
+            const double seconds = Sim_Milliseconds(cycles - windowAt) / 1000;
+            if (seconds < SHORT_WINDOW_MS / 1000.0)
+            {
+                break;
+            }
+
+            // Over a second the output capacitor's energy is negligible
+            const double input = (state.energyIn - start.energyIn) / seconds;
+            const double loss = (state.energyLoss - start.energyLoss) / seconds;
+            result->metric[METRIC_INPUT] = input;
+            result->metric[METRIC_LOSS] = loss;
+            result->metric[METRIC_OUTPUT] = input - loss;
+            result->metric[METRIC_TRIPS] = (uint16_t)(BoostPWM_GetFaultCount() - trips);
+            Sim_Finish();
+            break;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
@@ -0,0 +1,616 @@
+//------------------------------------------------------------------------------
+//       Filename: sim.c
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Runs the simulation scenarios on the model, in parallel
+//------------------------------------------------------------------------------
+//       Notes : Usage: main_sim [-j jobs] [-l] [scenario...]
+//               Runs every scenario, or the ones named, and prints a table
+//               of each one's jobs. The exit status is 1 if a job did not
+//               finish or a scenario's check failed. Scenarios marked
+//               onRequest only run when named.
+//               The firmware keeps its state in globals, so every job is a
+//               process of its own. -j workers (the number of cores by
+//               default) each start with an even share of the jobs and run
+//               them one after another, a worker that runs out steals from
+//               the end of the share with the most left. Jobs next to each
+//               other in a plan tend to take as long, so the shares start
+//               even and the stealing only evens out the tail.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#include "sim.h"
+#include "usb_config.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+//------------------------------------------------------------------------------
+// Module constant defines
+//------------------------------------------------------------------------------
+#define SIM_MAX_JOBS       (8192)
+#define SIM_MAX_LISTED     (64) // Past this only the unfinished jobs are listed
+#define SIM_MAX_TEMP_FILES (4)
+#define SIM_MAX_PATH       (256)
+#define SIM_MAX_WORKERS    (256)
+
+// Job process exit codes
+#define SIM_EXIT_FINISHED (0)
+#define SIM_EXIT_TIMEOUT  (3)
+#define SIM_EXIT_RETURNED (4)
+
+#define array_size(x) (sizeof(x) / sizeof(x[0]))
+
+//------------------------------------------------------------------------------
+// External variables
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// External functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module type definitions
+//------------------------------------------------------------------------------
+
+// The jobs a worker has left, in the memory the workers share. The first and
+// the end of the range are packed in one word, so the owner taking the first
+// and a thief taking the last update it with one compare and swap.
+typedef struct
+{
+    uint64_t range; // First job << 32 | end
+} SimQueue_t;
+
+typedef struct
+{
+    SimQueue_t queue[SIM_MAX_WORKERS];
+    uint32_t finished; // Jobs finished by every worker, for the progress
+} SimPool_t;
+
+//------------------------------------------------------------------------------
+// Module static variables
+//------------------------------------------------------------------------------
+static const SimScenario_t *const s_scenarios[] = {
+    &g_simStartup,
+    &g_simLoadStep,
+    &g_simModes,
+    &g_simShort,
+    &g_simCharge,
+    &g_simTune,
+    &g_simTolerance,
+    &g_simLoopGain,
+    &g_simIvCurve,
+    &g_simReplay,
+};
+
+// The job this process runs, and its scenario's hook
+static const SimJob_t *s_job = NULL;
+static HostHook_t s_hook = NULL;
+static uint64_t s_deadline = 0;
+
+// Scratch files, removed when the job ends, but not by a step it spawned
+static char s_tempFiles[SIM_MAX_TEMP_FILES][SIM_MAX_PATH];
+static uint32_t s_tempFileCount = 0;
+static bool s_spawned = false;
+
+//------------------------------------------------------------------------------
+// Module static function prototypes
+//------------------------------------------------------------------------------
+static void Hook(uint64_t cycles);
+static void Exit(int status);
+static bool Selected(const SimScenario_t *scenario, int argc, char **argv);
+static void RunJobs(SimJob_t *jobs, uint32_t count, uint32_t workers);
+static void Work(SimPool_t *pool, SimJob_t *jobs, uint32_t worker, uint32_t workers);
+static bool Take(SimQueue_t *queue, bool last, uint32_t *index);
+static bool Steal(SimPool_t *pool, uint32_t worker, uint32_t workers, uint32_t *index);
+static bool Report(const SimScenario_t *scenario, const SimJob_t *jobs, uint32_t count);
+
+//------------------------------------------------------------------------------
+// Module externally exported functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  Run the scenarios
+ * @param  argc - argument count
+ * @param  argv - see the notes at the top
+ * @return 0 if every scenario passed
+ */
+int main(int argc, char **argv)
+{
+    long workers = sysconf(_SC_NPROCESSORS_ONLN);
+
+    int option;
+    while ((option = getopt(argc, argv, "j:l")) != -1)
+    {
+        switch (option)
+        {
+            case 'j':
+                workers = atol(optarg);
+                break;
+            case 'l':
+                for (size_t i = 0; i < array_size(s_scenarios); i++)
+                {
+                    printf("%s\n", s_scenarios[i]->name);
+                }
+                return 0;
+            default:
+                fprintf(stderr, "usage: %s [-j jobs] [-l] [scenario...]\n", argv[0]);
+                return 2;
+        }
+    }
+    workers = workers > 0 ? workers : 1;
+    workers = workers < SIM_MAX_WORKERS ? workers : SIM_MAX_WORKERS;
+
+    SimJob_t *jobs = calloc(SIM_MAX_JOBS, sizeof(SimJob_t));
+    SimResult_t *results = mmap(NULL, SIM_MAX_JOBS * sizeof(SimResult_t), PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (!jobs || results == MAP_FAILED)
+    {
+        perror("main_sim");
+        return 2;
+    }
+
+    // Plan every selected scenario up front, one pool runs all their jobs
+    uint32_t first[array_size(s_scenarios)];
+    uint32_t count[array_size(s_scenarios)];
+    uint32_t total = 0;
+    for (size_t i = 0; i < array_size(s_scenarios); i++)
+    {
+        first[i] = total;
+        count[i] = 0;
+        if (!Selected(s_scenarios[i], argc - optind, argv + optind))
+        {
+            continue;
+        }
+
+        count[i] = s_scenarios[i]->plan(&jobs[total], SIM_MAX_JOBS - total);
+        for (uint32_t j = total; j < total + count[i]; j++)
+        {
+            jobs[j].scenario = s_scenarios[i];
+            jobs[j].result = &results[j];
+        }
+        total += count[i];
+    }
+
+    // The firmware must not see the runner's stdin, and no log output
+    if (!freopen("/dev/null", "r", stdin))
+    {
+        perror("/dev/null");
+        return 2;
+    }
+    setenv("HOST_DEBUGGER", "0", 1);
+    fflush(stdout);
+
+    RunJobs(jobs, total, workers);
+
+    bool passed = true;
+    for (size_t i = 0; i < array_size(s_scenarios); i++)
+    {
+        if (count[i])
+        {
+            passed &= Report(s_scenarios[i], &jobs[first[i]], count[i]);
+        }
+    }
+
+    return passed ? 0 : 1;
+}
+
+/**
+ * @brief  Boot the firmware on the model for a job
+ * @param  job - the job, its plant configuration and time limit
+ * @param  hook - the scenario's hook, called after every ADC interrupt
+ * @param  nvsFile - the settings page to boot with and save to, NULL for
+ *                   erased flash
+ * @return None, the process exits in Sim_Finish() or at the time limit
+ */
+void Sim_Boot(const SimJob_t *job, HostHook_t hook, const char *nvsFile)
+{
+    s_job = job;
+    s_hook = hook;
+    s_deadline = (uint64_t)job->runMs * SIM_CYCLES_PER_MS;
+
+    if (nvsFile)
+    {
+        setenv("HOST_NVS_FILE", nvsFile, 1);
+    }
+    else
+    {
+        unsetenv("HOST_NVS_FILE");
+    }
+
+    Plant_Configure(&job->plant);
+    Host_SetHook(Hook);
+    Firmware_Main();
+    _exit(SIM_EXIT_RETURNED);
+}
+
+/**
+ * @brief  End the job, its metrics are in its result
+ * @param  None
+ * @return None, exits the process
+ */
+void Sim_Finish(void)
+{
+    s_job->result->done = true;
+    Exit(SIM_EXIT_FINISHED);
+}
+
+/**
+ * @brief  Run a step of a job in a process of its own and wait for it, for
+ *         the runs that set up the state a job boots with
+ * @param  job - the job
+ * @param  run - boots the firmware, see Sim_Boot()
+ * @return true if the step finished
+ * @note   The step's metrics are discarded.
+ */
+bool Sim_Spawn(const SimJob_t *job, void (*run)(const SimJob_t *job))
+{
+    fflush(stdout);
+    const pid_t pid = fork();
+    if (pid == 0)
+    {
+        s_spawned = true;
+        run(job);
+        _exit(SIM_EXIT_RETURNED);
+    }
+
+    int status = 0;
+    const bool finished = pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+                          WEXITSTATUS(status) == SIM_EXIT_FINISHED;
+    *job->result = (SimResult_t){0};
+    return finished;
+}
+
+/**
+ * @brief  Write a command to the state report, as the web UI does
+ * @param  command - the command ID, see CommandId_e in main.c
+ * @param  value - its argument
+ * @return None
+ */
+void Sim_Command(uint8_t command, uint32_t value)
+{
+    const uint8_t report[BOOST_REPORT_SIZE] = {
+        BOOST_REPORT_ID_STATE, command, value, value >> 8, value >> 16, value >> 24,
+    };
+    Host_HidWrite(report, sizeof(report));
+}
+
+/**
+ * @brief  Convert simulated time
+ * @param  cycles - core cycles
+ * @return milliseconds
+ */
+double Sim_Milliseconds(uint64_t cycles)
+{
+    return (double)cycles / SIM_CYCLES_PER_MS;
+}
+
+/**
+ * @brief  Name a scratch file for this job, removed when the job ends
+ * @param[out] path - the path
+ * @param  size - the size of path
+ * @param  suffix - tells a job's files apart
+ * @return None
+ */
+void Sim_TempFile(char *path, uint32_t size, const char *suffix)
+{
+    const char *dir = getenv("TMPDIR");
+    snprintf(path, size, "%s/main_sim-%d-%s", dir ? dir : "/tmp", (int)getpid(), suffix);
+
+    if (s_tempFileCount < SIM_MAX_TEMP_FILES)
+    {
+        snprintf(s_tempFiles[s_tempFileCount++], SIM_MAX_PATH, "%s", path);
+    }
+}
+
+/**
+ * @brief  Start timing a disturbance
+ * @param[out] settle - the tracker
+ * @param  cycles - the simulated time of the disturbance
+ * @return None
+ */
+void Sim_SettleStart(SimSettle_t *settle, uint64_t cycles)
+{
+    *settle = (SimSettle_t){.start = cycles};
+}
+
+/**
+ * @brief  Track a value after a disturbance
+ * @param  settle - the tracker, see Sim_SettleStart()
+ * @param  cycles - the simulated time
+ * @param  value - the value, once per control cycle
+ * @param  target - where it should settle
+ * @param  band - how close its average must stay
+ * @param  holdMs - for how long
+ * @return true once the average has stayed within the band for holdMs
+ */
+bool Sim_Settled(SimSettle_t *settle, uint64_t cycles, double value, double target, double band, uint32_t holdMs)
+{
+    settle->average += settle->primed ? (value - settle->average) * SIM_SETTLE_AVERAGE : value;
+    settle->primed = true;
+
+    if (fabs(settle->average - target) > band)
+    {
+        settle->inBandAt = 0;
+        return false;
+    }
+
+    if (!settle->inBandAt)
+    {
+        settle->inBandAt = cycles;
+    }
+    return cycles - settle->inBandAt >= (uint64_t)holdMs * SIM_CYCLES_PER_MS;
+}
+
+/**
+ * @brief  Get the settling time
+ * @param  settle - the tracker, once Sim_Settled() returned true
+ * @return milliseconds from the disturbance into the band
+ */
+double Sim_SettleMs(const SimSettle_t *settle)
+{
+    return Sim_Milliseconds(settle->inBandAt - settle->start);
+}
+
+//------------------------------------------------------------------------------
+// Module static functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  Run the scenario's hook, and end the job at its time limit
+ * @param  cycles - the simulated time
+ * @return None
+ */
+static void Hook(uint64_t cycles)
+{
+    if (cycles >= s_deadline)
+    {
+        Exit(SIM_EXIT_TIMEOUT);
+    }
+    s_hook(cycles);
+}
+
+/**
+ * @brief  End the job's process, removing its scratch files
+ * @param  status - the exit status
+ * @return None
+ */
+static void Exit(int status)
+{
+    for (uint32_t i = 0; i < s_tempFileCount && !s_spawned; i++)
+    {
+        unlink(s_tempFiles[i]);
+    }
+    fflush(stdout);
+    _exit(status);
+}
+
+/**
+ * @brief  Check if a scenario was asked for
+ * @param  scenario - the scenario
+ * @param  count - the number of names given
+ * @param  names - the names, none runs all but the onRequest ones
+ * @return true to run it
+ */
+static bool Selected(const SimScenario_t *scenario, int count, char **names)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (strcmp(names[i], scenario->name) == 0)
+        {
+            return true;
+        }
+    }
+    return count == 0 && !scenario->onRequest;
+}
+
+/**
+ * @brief  Run jobs on worker processes, sharing them out evenly
+ * @param  jobs - the jobs
+ * @param  count - the number of jobs
+ * @param  workers - the number of workers
+ * @return None
+ */
+static void RunJobs(SimJob_t *jobs, uint32_t count, uint32_t workers)
+{
+    const bool progress = isatty(STDERR_FILENO);
+    workers = workers < count ? workers : count;
+    if (workers == 0)
+    {
+        return;
+    }
+
+    SimPool_t *pool = mmap(NULL, sizeof(SimPool_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (pool == MAP_FAILED)
+    {
+        perror("main_sim");
+        return;
+    }
+
+    for (uint32_t w = 0; w < workers; w++)
+    {
+        const uint64_t first = (uint64_t)count * w / workers;
+        const uint64_t end = (uint64_t)count * (w + 1) / workers;
+        pool->queue[w].range = first << 32 | end;
+    }
+
+    uint32_t running = 0;
+    for (uint32_t w = 0; w < workers; w++)
+    {
+        const pid_t pid = fork();
+        if (pid == 0)
+        {
+            Work(pool, jobs, w, workers);
+            _exit(0);
+        }
+        running += pid > 0;
+    }
+
+    // Another worker takes the share of one that could not start
+    while (running)
+    {
+        int status;
+        const pid_t pid = waitpid(-1, &status, progress ? WNOHANG : 0);
+        if (pid > 0)
+        {
+            running--;
+        }
+        else if (pid < 0)
+        {
+            break;
+        }
+        else
+        {
+            fprintf(stderr, "\r%u/%u jobs", __atomic_load_n(&pool->finished, __ATOMIC_RELAXED), count);
+            usleep(100 * 1000);
+        }
+    }
+
+    if (progress)
+    {
+        fprintf(stderr, "\r%*s\r", 24, "");
+    }
+    munmap(pool, sizeof(SimPool_t));
+}
+
+/**
+ * @brief  Run a worker's jobs, then steal until none are left
+ * @param  pool - the workers' queues
+ * @param  jobs - the jobs
+ * @param  worker - this worker
+ * @param  workers - the number of workers
+ * @return None
+ */
+static void Work(SimPool_t *pool, SimJob_t *jobs, uint32_t worker, uint32_t workers)
+{
+    uint32_t index;
+    while (Take(&pool->queue[worker], false, &index) || Steal(pool, worker, workers, &index))
+    {
+        const SimJob_t *job = &jobs[index];
+        const pid_t pid = fork();
+        if (pid == 0)
+        {
+            job->scenario->run(job);
+            Exit(SIM_EXIT_RETURNED);
+        }
+
+        // A job that crashed or timed out never set done, that is its failure
+        int status;
+        if (pid > 0)
+        {
+            waitpid(pid, &status, 0);
+        }
+        __atomic_add_fetch(&pool->finished, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief  Take a job from a queue
+ * @param  queue - the queue
+ * @param  last - take the last job, as a thief does, or the first
+ * @param[out] index - the job taken
+ * @return false if the queue was empty
+ */
+static bool Take(SimQueue_t *queue, bool last, uint32_t *index)
+{
+    uint64_t range = __atomic_load_n(&queue->range, __ATOMIC_ACQUIRE);
+    uint64_t taken;
+    do
+    {
+        const uint32_t first = range >> 32;
+        const uint32_t end = (uint32_t)range;
+        if (first >= end)
+        {
+            return false;
+        }
+        *index = last ? end - 1 : first;
+        taken = last ? range - 1 : range + ((uint64_t)1 << 32);
+    } while (!__atomic_compare_exchange_n(&queue->range, &range, taken, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+    return true;
+}
+
+/**
+ * @brief  Steal a job from the worker with the most left
+ * @param  pool - the workers' queues
+ * @param  worker - the thief
+ * @param  workers - the number of workers
+ * @param[out] index - the job stolen
+ * @return false once every queue is empty
+ */
+static bool Steal(SimPool_t *pool, uint32_t worker, uint32_t workers, uint32_t *index)
+{
+    for (;;)
+    {
+        uint32_t victim = worker;
+        uint32_t most = 0;
+        for (uint32_t w = 0; w < workers; w++)
+        {
+            const uint64_t range = __atomic_load_n(&pool->queue[w].range, __ATOMIC_ACQUIRE);
+            const uint32_t left = (uint32_t)range > (range >> 32) ? (uint32_t)range - (range >> 32) : 0;
+            if (left > most)
+            {
+                most = left;
+                victim = w;
+            }
+        }
+
+        if (most == 0)
+        {
+            return false;
+        }
+
+        // Lost a race for the last job of that queue, look again
+        if (Take(&pool->queue[victim], true, index))
+        {
+            return true;
+        }
+    }
+}
+
+/**
+ * @brief  Print a scenario's jobs and check them
+ * @param  scenario - the scenario
+ * @param  jobs - its jobs
+ * @param  count - the number of jobs
+ * @return true if every job finished and the check passed
+ */
+static bool Report(const SimScenario_t *scenario, const SimJob_t *jobs, uint32_t count)
+{
+    printf("%s\n%-*s", scenario->name, SIM_MAX_LABEL / 2, "");
+    for (int m = 0; m < SIM_MAX_METRICS && scenario->metricNames[m]; m++)
+    {
+        printf(" %12s", scenario->metricNames[m]);
+    }
+    printf("\n");
+
+    bool finished = true;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (count > SIM_MAX_LISTED && jobs[i].result->done)
+        {
+            continue;
+        }
+
+        printf("%-*s", SIM_MAX_LABEL / 2, jobs[i].label);
+        for (int m = 0; m < SIM_MAX_METRICS && scenario->metricNames[m]; m++)
+        {
+            printf(" %12.3f", jobs[i].result->metric[m]);
+        }
+        printf("%s\n", jobs[i].result->done ? "" : "  DID NOT FINISH");
+        finished &= jobs[i].result->done;
+    }
+
+    const bool passed = finished && scenario->check(jobs, count);
+    printf("%s: %s\n\n", scenario->name, passed ? "ok" : "FAILED");
+    return passed;
+}
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
@@ -0,0 +1,148 @@
+//------------------------------------------------------------------------------
+//       Filename: sim.h
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Defines the simulation scenarios and the runner they use
+//------------------------------------------------------------------------------
+//       Notes : A scenario plans a set of jobs, each job boots the whole
+//               firmware on the model in a process of its own, drives it
+//               through Host_SetHook() and leaves its metrics in memory the
+//               runner shares with it. Once every job is done the scenario
+//               checks the results as a set, e.g. warm against cold start.
+//------------------------------------------------------------------------------
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#include "host.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+//------------------------------------------------------------------------------
+// Module exported defines
+//------------------------------------------------------------------------------
+#define SIM_MAX_METRICS (6)
+#define SIM_MAX_PARAMS  (4)
+#define SIM_MAX_LABEL   (48)
+
+#define SIM_CYCLES_PER_MS (FUNCONF_SYSTEM_CORE_CLOCK / 1000)
+
+// Settling is judged on a moving average over ~0.5ms, the switching ripple
+// and small fast oscillations average out as they do on a meter
+#define SIM_SETTLE_AVERAGE (1.0 / 45)
+
+//------------------------------------------------------------------------------
+// Module exported type definitions
+//------------------------------------------------------------------------------
+typedef struct SimScenario SimScenario_t;
+
+// The commands the scenarios write, checked against CommandId_e in main.c
+typedef enum
+{
+    eSIM_CMD_SET_VOLTAGE = 1,
+    eSIM_CMD_SET_CURRENT = 2,
+    eSIM_CMD_SAVE = 3,
+    eSIM_CMD_SET_CONTROLLER = 5,
+    eSIM_CMD_SET_MODE = 6,
+    eSIM_CMD_SET_POWER = 7,
+    eSIM_CMD_SET_RESISTANCE = 8,
+    eSIM_CMD_SET_FAULT_MODE = 9,
+    eSIM_CMD_SET_FAULT_KNEE = 10,
+    eSIM_CMD_SET_FAULT_FLOOR = 11,
+    eSIM_CMD_SET_FAULT_RETRY = 12,
+    eSIM_CMD_FRA_START = 13,
+    eSIM_CMD_SWEEP_RANGE = 14,
+    eSIM_CMD_SWEEP_START = 15,
+    eSIM_CMD_CHARGE = 16,
+    eSIM_CMD_SET_CHARGE_VOLTAGE = 17,
+    eSIM_CMD_SET_CHARGE_CURRENT = 18,
+    eSIM_CMD_SET_CHARGE_TERMINATION = 19,
+    eSIM_CMD_SET_CHARGE_TIMEOUT = 20,
+    eSIM_CMD_SET_PID_GAINS = 23,
+    eSIM_CMD_TRACE_ARM = 26,
+} SimCommand_e;
+
+typedef struct
+{
+    double metric[SIM_MAX_METRICS]; // As named by the scenario
+    bool done;                      // The job reached its end, see Sim_Finish()
+} SimResult_t;
+
+typedef struct
+{
+    const SimScenario_t *scenario;
+    char label[SIM_MAX_LABEL];      // The parameters, shown with the results
+    PlantConfig_t plant;
+    int32_t param[SIM_MAX_PARAMS];  // Scenario specific
+    uint32_t runMs;                 // Simulated time limit, the job fails past it
+    SimResult_t *result;            // Shared with the runner
+} SimJob_t;
+
+// Tracks a value into a band around its target, see Sim_Settled()
+typedef struct
+{
+    uint64_t start;    // When the value was disturbed, in core cycles
+    uint64_t inBandAt; // When it last entered the band, 0 while outside
+    double average;    // The value as a meter shows it, see SIM_SETTLE_AVERAGE
+    bool primed;       // average holds a value
+} SimSettle_t;
+
+struct SimScenario
+{
+    const char *name;
+    bool onRequest; // Only run when named, e.g. too long for every make sim
+    const char *metricNames[SIM_MAX_METRICS]; // NULL terminated if fewer
+
+    // Fill in up to max jobs, return how many
+    uint32_t (*plan)(SimJob_t *jobs, uint32_t max);
+
+    // Runs in the job's process, boots the firmware and never returns
+    void (*run)(const SimJob_t *job);
+
+    // Check the finished jobs, print why any failed and return false
+    bool (*check)(const SimJob_t *jobs, uint32_t count);
+};
+
+//------------------------------------------------------------------------------
+// Module exported functions
+//------------------------------------------------------------------------------
+void Sim_Boot(const SimJob_t *job, HostHook_t hook, const char *nvsFile);
+void Sim_Finish(void);
+bool Sim_Spawn(const SimJob_t *job, void (*run)(const SimJob_t *job));
+void Sim_Command(uint8_t command, uint32_t value);
+double Sim_Milliseconds(uint64_t cycles);
+void Sim_TempFile(char *path, uint32_t size, const char *suffix);
+void Sim_SettleStart(SimSettle_t *settle, uint64_t cycles);
+bool Sim_Settled(SimSettle_t *settle, uint64_t cycles, double value, double target, double band, uint32_t holdMs);
+double Sim_SettleMs(const SimSettle_t *settle);
+
+// The firmware's main(), renamed by sim_main.c
+int Firmware_Main(void);
+
+//------------------------------------------------------------------------------
+// Module exported variables
+//------------------------------------------------------------------------------
+extern const SimScenario_t g_simStartup;
+extern const SimScenario_t g_simLoadStep;
+extern const SimScenario_t g_simModes;
+extern const SimScenario_t g_simShort;
+extern const SimScenario_t g_simCharge;
+extern const SimScenario_t g_simTune;
+extern const SimScenario_t g_simTolerance;
+extern const SimScenario_t g_simLoopGain;
+extern const SimScenario_t g_simIvCurve;
+extern const SimScenario_t g_simReplay;
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,45 @@
+//------------------------------------------------------------------------------
+//       Filename: sim_main.c
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Builds main.c into the simulations, which boot it per job
+//------------------------------------------------------------------------------
+//       Notes : The runner brings its own main(), the firmware's is renamed
+//               and called from Sim_Boot().
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#define main Firmware_Main
+#include "main.c"
+#undef main
+
+#include "sim.h"
+
+static_assert((int)eSIM_CMD_SET_VOLTAGE == (int)CMD_SET_VOLTAGE, "SimCommand_e must match CommandId_e");
+static_assert((int)eSIM_CMD_SET_CURRENT == (int)CMD_SET_CURRENT, "SimCommand_e must match CommandId_e");
+static_assert((int)eSIM_CMD_SAVE == (int)CMD_SAVE, "SimCommand_e must match CommandId_e");
+static_assert((int)eSIM_CMD_SET_CONTROLLER == (int)CMD_SET_CONTROLLER, "SimCommand_e must match CommandId_e");
+static_assert((int)eSIM_CMD_SET_MODE == (int)CMD_SET_MODE, "SimCommand_e must match CommandId_e");
+static_assert((int)eSIM_CMD_SET_POWER == (int)CMD_SET_POWER, "SimCommand_e must match CommandId_e");
+static_assert((int)eSIM_CMD_SET_RESISTANCE == (int)CMD_SET_RESISTANCE, "SimCommand_e must match CommandId_e");
+static_assert((int)eSIM_CMD_SET_FAULT_MODE == (int)CMD_SET_FAULT_MODE, "SimCommand_e must match CommandId_e");
+static_assert((int)eSIM_CMD_SET_FAULT_KNEE == (int)CMD_SET_FAULT_KNEE, "SimCommand_e must match CommandId_e");
+static_assert((int)eSIM_CMD_SET_FAULT_FLOOR == (int)CMD_SET_FAULT_FLOOR, "SimCommand_e must match CommandId_e");
+static_assert((int)eSIM_CMD_SET_FAULT_RETRY == (int)CMD_SET_FAULT_RETRY, "SimCommand_e must match CommandId_e");
+static_assert((int)eSIM_CMD_FRA_START == (int)CMD_FRA_START, "SimCommand_e must match CommandId_e");
+static_assert((int)eSIM_CMD_SWEEP_RANGE == (int)CMD_SWEEP_RANGE, "SimCommand_e must match CommandId_e");
+static_assert((int)eSIM_CMD_SWEEP_START == (int)CMD_SWEEP_START, "SimCommand_e must match CommandId_e");
+static_assert((int)eSIM_CMD_CHARGE == (int)CMD_CHARGE, "SimCommand_e must match CommandId_e");
+static_assert((int)eSIM_CMD_SET_CHARGE_VOLTAGE == (int)CMD_SET_CHARGE_VOLTAGE, "SimCommand_e must match CommandId_e");
+static_assert((int)eSIM_CMD_SET_CHARGE_CURRENT == (int)CMD_SET_CHARGE_CURRENT, "SimCommand_e must match CommandId_e");
+static_assert((int)eSIM_CMD_SET_CHARGE_TERMINATION == (int)CMD_SET_CHARGE_TERMINATION, "SimCommand_e must match CommandId_e");
+static_assert((int)eSIM_CMD_SET_CHARGE_TIMEOUT == (int)CMD_SET_CHARGE_TIMEOUT, "SimCommand_e must match CommandId_e");
+static_assert((int)eSIM_CMD_SET_PID_GAINS == (int)CMD_SET_PID_GAINS, "SimCommand_e must match CommandId_e");
+static_assert((int)eSIM_CMD_TRACE_ARM == (int)CMD_TRACE_ARM, "SimCommand_e must match CommandId_e");
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
@@ -0,0 +1,252 @@
+//------------------------------------------------------------------------------
+//       Filename: startup.c
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Compares the warm start from saved settings to a soft start
+//------------------------------------------------------------------------------
+//       Notes : Each job first runs the firmware to save its settings, then
+//               boots it again from them and times the output from the end
+//               of the offset calibration to within STARTUP_BAND of the
+//               target. A warm save is taken once the step response has
+//               settled, so it carries the operating point. A cold save is
+//               written with the setpoint, before the loop could settle,
+//               so the same setpoint boots with a soft start.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#include "boost.h"
+#include "sim.h"
+#include <math.h>
+#include <unistd.h>
+
+//------------------------------------------------------------------------------
+// Module constant defines
+//------------------------------------------------------------------------------
+#define STARTUP_RUN_MS  (300)
+#define STARTUP_SAVE_MS (5)
+#define STARTUP_HOLD_MS (2)
+
+// Regulating once within 1% (or 50mV) of the target for STARTUP_HOLD_MS
+#define STARTUP_BAND(v) fmax((v) * 0.01, 0.05)
+
+#define PARAM_TARGET (0) // mV
+#define PARAM_WARM   (1) // Save once settled
+
+#define METRIC_TURN_ON   (0)
+#define METRIC_OVERSHOOT (1)
+#define METRIC_WARM      (2)
+
+#define array_size(x) (sizeof(x) / sizeof(x[0]))
+
+//------------------------------------------------------------------------------
+// Module static variables
+//------------------------------------------------------------------------------
+static const uint32_t s_targets[] = {6000, 9000, 12000};
+static const double s_loads[] = {0, 220, 100};
+
+static char s_nvsFile[256];
+static const SimJob_t *s_job = NULL;
+
+//------------------------------------------------------------------------------
+// Module static function prototypes
+//------------------------------------------------------------------------------
+static uint32_t Plan(SimJob_t *jobs, uint32_t max);
+static void Run(const SimJob_t *job);
+static bool Check(const SimJob_t *jobs, uint32_t count);
+static void Save(const SimJob_t *job);
+static void SaveHook(uint64_t cycles);
+static void StartHook(uint64_t cycles);
+
+//------------------------------------------------------------------------------
+// Module exported variables
+//------------------------------------------------------------------------------
+const SimScenario_t g_simStartup = {
+    .name = "startup",
+    .metricNames = {"turn-on ms", "overshoot mV", "warm"},
+    .plan = Plan,
+    .run = Run,
+    .check = Check,
+};
+
+//------------------------------------------------------------------------------
+// Module static functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  A warm and a cold job for every target and load
+ */
+static uint32_t Plan(SimJob_t *jobs, uint32_t max)
+{
+    uint32_t count = 0;
+    for (size_t t = 0; t < array_size(s_targets); t++)
+    {
+        for (size_t l = 0; l < array_size(s_loads); l++)
+        {
+            for (int warm = 1; warm >= 0 && count < max; warm--)
+            {
+                SimJob_t *job = &jobs[count++];
+                job->plant = (PlantConfig_t){.vin = 5.0, .load = s_loads[l]};
+                job->param[PARAM_TARGET] = s_targets[t];
+                job->param[PARAM_WARM] = warm;
+                job->runMs = STARTUP_RUN_MS;
+                snprintf(job->label, sizeof(job->label), "%umV %gR %s", s_targets[t], s_loads[l],
+                         warm ? "warm" : "cold");
+            }
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief  Save the settings, then boot from them
+ */
+static void Run(const SimJob_t *job)
+{
+    s_job = job;
+    Sim_TempFile(s_nvsFile, sizeof(s_nvsFile), "nvs");
+    unlink(s_nvsFile);
+
+    // Not finishing leaves the job's result unfinished, which fails it
+    if (Sim_Spawn(job, Save))
+    {
+        Sim_Boot(job, StartHook, s_nvsFile);
+    }
+}
+
+/**
+ * @brief  Each warm start must be used, and beat its cold start without
+ *         overshooting more
+ */
+static bool Check(const SimJob_t *jobs, uint32_t count)
+{
+    bool passed = true;
+    double speedup = 0;
+    uint32_t pairs = 0;
+    for (uint32_t i = 0; i + 1 < count; i += 2)
+    {
+        const SimResult_t *warm = jobs[i].result;
+        const SimResult_t *cold = jobs[i + 1].result;
+
+        if (warm->metric[METRIC_WARM] != 1 || cold->metric[METRIC_WARM] != 0)
+        {
+            printf("  %s: warm start %s\n", jobs[i].label, warm->metric[METRIC_WARM] ? "used cold" : "not used");
+            passed = false;
+            continue;
+        }
+
+        if (warm->metric[METRIC_TURN_ON] >= cold->metric[METRIC_TURN_ON])
+        {
+            printf("  %s: no faster than cold\n", jobs[i].label);
+            passed = false;
+        }
+
+        // One ADC count of margin, ~16mV
+        if (warm->metric[METRIC_OVERSHOOT] > cold->metric[METRIC_OVERSHOOT] + 16)
+        {
+            printf("  %s: overshoots more than cold\n", jobs[i].label);
+            passed = false;
+        }
+
+        speedup += cold->metric[METRIC_TURN_ON] / warm->metric[METRIC_TURN_ON];
+        pairs++;
+    }
+
+    if (pairs)
+    {
+        printf("  warm start is %.1fx faster on average\n", speedup / pairs);
+    }
+    return passed;
+}
+
+/**
+ * @brief  Boot from erased flash to save the settings
+ */
+static void Save(const SimJob_t *job)
+{
+    Sim_Boot(job, SaveHook, s_nvsFile);
+}
+
+/**
+ * @brief  Set the target, and save it once settled, or straight away for a
+ *         cold start
+ */
+static void SaveHook(uint64_t cycles)
+{
+    static bool targetSet = false;
+    static uint64_t savedAt = 0;
+
+    if (!targetSet)
+    {
+        targetSet = true;
+        Sim_Command(eSIM_CMD_SET_VOLTAGE, s_job->param[PARAM_TARGET]);
+        if (!s_job->param[PARAM_WARM])
+        {
+            Sim_Command(eSIM_CMD_SAVE, 0);
+            savedAt = cycles;
+        }
+        return;
+    }
+
+    BoostStepResponse_t step;
+    BoostPWM_GetStepResponse(&step);
+    if (!savedAt && step.complete)
+    {
+        Sim_Command(eSIM_CMD_SAVE, 0);
+        savedAt = cycles;
+    }
+
+    if (savedAt && cycles - savedAt >= STARTUP_SAVE_MS * SIM_CYCLES_PER_MS)
+    {
+        Sim_Finish();
+    }
+}
+
+/**
+ * @brief  Time the output from the end of the calibration into the band
+ */
+static void StartHook(uint64_t cycles)
+{
+    static uint64_t calibratedAt = 0;
+    static uint64_t inBandAt = 0;
+    static double peak = 0;
+
+    if (!BoostPWM_IsCalibrated())
+    {
+        return;
+    }
+    if (!calibratedAt)
+    {
+        calibratedAt = cycles;
+    }
+
+    PlantState_t state;
+    Plant_GetState(&state);
+    const double target = s_job->param[PARAM_TARGET] / 1000.0;
+    peak = fmax(peak, state.vOut);
+
+    if (fabs(state.vOut - target) > STARTUP_BAND(target))
+    {
+        inBandAt = 0;
+        return;
+    }
+
+    if (!inBandAt)
+    {
+        inBandAt = cycles;
+    }
+    else if (cycles - inBandAt >= STARTUP_HOLD_MS * SIM_CYCLES_PER_MS)
+    {
+        SimResult_t *result = s_job->result;
+        result->metric[METRIC_TURN_ON] = Sim_Milliseconds(inBandAt - calibratedAt);
+        result->metric[METRIC_OVERSHOOT] = fmax(peak - target, 0) * 1000;
+        result->metric[METRIC_WARM] = BoostPWM_IsWarmStarted();
+        Sim_Finish();
+    }
+}
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
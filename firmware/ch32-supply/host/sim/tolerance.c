@@ -0,0 +1,373 @@
+//------------------------------------------------------------------------------
+//       Filename: tolerance.c
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Monte Carlo analysis of the output and current reading
+//                 errors from component tolerances
+//------------------------------------------------------------------------------
+//       Notes : Each job builds the board with component values drawn from
+//               their tolerances, boots it untrimmed, regulates a 100R load
+//               at each of s_setpoints and measures:
+//                 V error - the output against the setpoint, the one
+//                           furthest out
+//                 I error - the reported current against the load's, at
+//                           the last setpoint
+//               A group of jobs varies one source and one varies them all,
+//               so the spread of each shows what its calibration step is
+//               worth. Each value is normal with the tolerance at 3 sigma,
+//               cut off at the tolerance. The draws come from a fixed seed,
+//               so runs repeat exactly. The check fails if the nominal
+//               board is off by more than the ADC resolution, or the
+//               divider alone is off by more than the README promises.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#include "boost.h"
+#include "sim.h"
+#include <math.h>
+#include <stdlib.h>
+
+//------------------------------------------------------------------------------
+// Module constant defines
+//------------------------------------------------------------------------------
+#define TOLERANCE_SAMPLES  (64) // Jobs per group
+#define TOLERANCE_RUN_MS   (300)
+#define TOLERANCE_LOAD     (100.0)
+#define TOLERANCE_LIMIT_MA (1000)
+#define TOLERANCE_HOLD_MS  (2)
+#define TOLERANCE_WINDOW_MS (10) // Averaged once settled
+
+// The components, 3 sigma
+#define TOLERANCE_RESISTOR  (0.01) // 1% parts
+#define TOLERANCE_VREF      (0.025) // 1.17V to 1.23V, the datasheet range
+#define TOLERANCE_OFFSET_MV (5.0)
+
+// The settling band, wide enough for any board to enter
+#define TOLERANCE_BAND(v) ((v) * 0.05)
+
+// Nominal within 2 counts of the feedback ADC, the divider within the
+// README's 1.6% plus that
+#define TOLERANCE_NOMINAL_MAX (0.5) // %
+#define TOLERANCE_DIVIDER_MAX (1.6 + TOLERANCE_NOMINAL_MAX)
+
+#define PARAM_GROUP (0)
+
+#define METRIC_V_ERROR (0) // %
+#define METRIC_I_ERROR (1) // mA
+#define METRIC_RF      (2) // %
+#define METRIC_RIN     (3) // %
+#define METRIC_VREF    (4) // %
+#define METRIC_OFFSET  (5) // mV
+
+#define array_size(x) (sizeof(x) / sizeof(x[0]))
+
+//------------------------------------------------------------------------------
+// Module type definitions
+//------------------------------------------------------------------------------
+typedef enum
+{
+    eGROUP_NOMINAL = 0,
+    eGROUP_DIVIDER,
+    eGROUP_VREF,
+    eGROUP_OFFSET,
+    eGROUP_ALL,
+    eGROUP_COUNT,
+} Group_e;
+
+typedef enum
+{
+    ePHASE_SETTLE = 0, // Into the band around the setpoint
+    ePHASE_WINDOW,     // Averaging
+} Phase_e;
+
+//------------------------------------------------------------------------------
+// Module static variables
+//------------------------------------------------------------------------------
+static const char *const s_groupNames[] = {"nominal", "divider", "vref", "offset", "all"};
+static const uint32_t s_setpoints[] = {6000, 9000, 12000};
+
+static const SimJob_t *s_job = NULL;
+static uint64_t s_random = 0x9E3779B97F4A7C15;
+
+//------------------------------------------------------------------------------
+// Module static function prototypes
+//------------------------------------------------------------------------------
+static uint32_t Plan(SimJob_t *jobs, uint32_t max);
+static void Run(const SimJob_t *job);
+static bool Check(const SimJob_t *jobs, uint32_t count);
+static void Hook(uint64_t cycles);
+static double Draw(double tolerance);
+static int CompareDouble(const void *a, const void *b);
+static void PrintDistribution(const char *group, const char *unit, double *values, uint32_t count);
+
+//------------------------------------------------------------------------------
+// Module exported variables
+//------------------------------------------------------------------------------
+const SimScenario_t g_simTolerance = {
+    .name = "tolerance",
+    .metricNames = {"V error %", "I error mA", "Rf %", "Rin %", "VREF %", "offset mV"},
+    .plan = Plan,
+    .run = Run,
+    .check = Check,
+};
+
+//------------------------------------------------------------------------------
+// Module static functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  The nominal board, then TOLERANCE_SAMPLES boards per group
+ */
+static uint32_t Plan(SimJob_t *jobs, uint32_t max)
+{
+    uint32_t count = 0;
+    for (int group = 0; group < eGROUP_COUNT; group++)
+    {
+        const uint32_t samples = group == eGROUP_NOMINAL ? 1 : TOLERANCE_SAMPLES;
+        for (uint32_t i = 0; i < samples && count < max; i++)
+        {
+            const bool divider = group == eGROUP_DIVIDER || group == eGROUP_ALL;
+            const bool vref = group == eGROUP_VREF || group == eGROUP_ALL;
+            const bool offset = group == eGROUP_OFFSET || group == eGROUP_ALL;
+
+            SimJob_t *job = &jobs[count++];
+            job->plant = (PlantConfig_t){
+                .vin = 5.0,
+                .load = 0,
+                .rfError = divider ? Draw(TOLERANCE_RESISTOR) : 0,
+                .rinError = divider ? Draw(TOLERANCE_RESISTOR) : 0,
+                .vrefError = vref ? Draw(TOLERANCE_VREF) : 0,
+                .offsetMv = offset ? Draw(TOLERANCE_OFFSET_MV) : 0,
+            };
+            job->param[PARAM_GROUP] = group;
+            job->runMs = TOLERANCE_RUN_MS;
+            snprintf(job->label, sizeof(job->label), "%s %u", s_groupNames[group], i);
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief  Boot from erased flash
+ */
+static void Run(const SimJob_t *job)
+{
+    s_job = job;
+    Sim_Boot(job, Hook, NULL);
+}
+
+/**
+ * @brief  Print the spread of each group, and check the nominal board and
+ *         the divider against their bounds
+ */
+static bool Check(const SimJob_t *jobs, uint32_t count)
+{
+    double *voltage = calloc(count, sizeof(double));
+    double *current = calloc(count, sizeof(double));
+    if (!voltage || !current)
+    {
+        free(voltage);
+        free(current);
+        return false;
+    }
+
+    bool passed = true;
+    printf("  %-10s %-4s %8s %8s %8s %8s %8s\n", "", "", "mean", "sigma", "1%", "99%", "worst");
+    for (int group = 0; group < eGROUP_COUNT; group++)
+    {
+        uint32_t n = 0;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            if (jobs[i].param[PARAM_GROUP] == group && jobs[i].result->done)
+            {
+                voltage[n] = jobs[i].result->metric[METRIC_V_ERROR];
+                current[n] = jobs[i].result->metric[METRIC_I_ERROR];
+                n++;
+            }
+        }
+
+        if (n == 0)
+        {
+            continue;
+        }
+
+        PrintDistribution(s_groupNames[group], "V %", voltage, n);
+        PrintDistribution("", "I mA", current, n);
+
+        // Sorted by PrintDistribution(), the worst is at one end
+        const double worst = fmax(-voltage[0], voltage[n - 1]);
+        if (group == eGROUP_NOMINAL && worst > TOLERANCE_NOMINAL_MAX)
+        {
+            printf("  nominal: %.2f%% off with no component errors\n", worst);
+            passed = false;
+        }
+        if (group == eGROUP_DIVIDER && worst > TOLERANCE_DIVIDER_MAX)
+        {
+            printf("  divider: %.2f%% off, past the %.1f%% of 1%% parts\n", worst, TOLERANCE_DIVIDER_MAX);
+            passed = false;
+        }
+    }
+
+    free(voltage);
+    free(current);
+    return passed;
+}
+
+/**
+ * @brief  Regulate each setpoint in turn and average the output once settled
+ */
+static void Hook(uint64_t cycles)
+{
+    static bool started = false;
+    static Phase_e phase = ePHASE_SETTLE;
+    static SimSettle_t settle;
+    static uint32_t setpoint = 0;
+    static uint64_t windowAt = 0;
+    static uint32_t samples = 0;
+    static double vSum = 0;
+    static double iSum = 0;
+    static double iReported = 0;
+
+    // Once booted, main() reads the settings back after starting the loop
+    if (!BoostPWM_IsCalibrated())
+    {
+        return;
+    }
+
+    if (!started)
+    {
+        started = true;
+        Plant_SetLoad(TOLERANCE_LOAD);
+        Sim_Command(eSIM_CMD_SET_CURRENT, TOLERANCE_LIMIT_MA);
+        Sim_Command(eSIM_CMD_SET_VOLTAGE, s_setpoints[0]);
+        Sim_SettleStart(&settle, cycles);
+        return;
+    }
+
+    PlantState_t state;
+    Plant_GetState(&state);
+    SimResult_t *result = s_job->result;
+    const double target = s_setpoints[setpoint] / 1000.0;
+
+    switch (phase)
+    {
+        case ePHASE_SETTLE:
+            if (Sim_Settled(&settle, cycles, state.vOut, target, TOLERANCE_BAND(target), TOLERANCE_HOLD_MS))
+            {
+                windowAt = cycles;
+                samples = 0;
+                vSum = 0;
+                iSum = 0;
+                iReported = 0;
+                phase = ePHASE_WINDOW;
+            }
+            break;
+
+        case ePHASE_WINDOW:
+        {
+            BoostState_t reported;
+            BoostPWM_GetState(&reported);
+            vSum += state.vOut;
+            iSum += state.iLoad;
+            iReported += reported.current + reported.currentFraction / 256.0;
+            samples++;
+            if (cycles - windowAt < (uint64_t)TOLERANCE_WINDOW_MS * SIM_CYCLES_PER_MS)
+            {
+                break;
+            }
+
+            const double error = (vSum / samples / target - 1) * 100;
+            if (fabs(error) > fabs(result->metric[METRIC_V_ERROR]))
+            {
+                result->metric[METRIC_V_ERROR] = error;
+            }
+
+            if (++setpoint < array_size(s_setpoints))
+            {
+                Sim_Command(eSIM_CMD_SET_VOLTAGE, s_setpoints[setpoint]);
+                Sim_SettleStart(&settle, cycles);
+                phase = ePHASE_SETTLE;
+                break;
+            }
+
+            result->metric[METRIC_I_ERROR] = (iReported - iSum * 1000) / samples;
+            result->metric[METRIC_RF] = s_job->plant.rfError * 100;
+            result->metric[METRIC_RIN] = s_job->plant.rinError * 100;
+            result->metric[METRIC_VREF] = s_job->plant.vrefError * 100;
+            result->metric[METRIC_OFFSET] = s_job->plant.offsetMv;
+            Sim_Finish();
+            break;
+        }
+    }
+}
+
+/**
+ * @brief  Draw a component error, normal with the tolerance at 3 sigma and
+ *         cut off at the tolerance
+ * @param  tolerance - the largest error
+ * @return the error
+ */
+static double Draw(double tolerance)
+{
+    for (;;)
+    {
+        // Box-Muller on two xorshift draws in (0, 1]
+        double u[2];
+        for (int i = 0; i < 2; i++)
+        {
+            s_random ^= s_random << 13;
+            s_random ^= s_random >> 7;
+            s_random ^= s_random << 17;
+            u[i] = ((s_random >> 11) + 1.0) / 9007199254740992.0;
+        }
+
+        const double value = sqrt(-2 * log(u[0])) * cos(2 * M_PI * u[1]) * tolerance / 3;
+        if (fabs(value) <= tolerance)
+        {
+            return value;
+        }
+    }
+}
+
+/**
+ * @brief  qsort() order, ascending
+ */
+static int CompareDouble(const void *a, const void *b)
+{
+    const double x = *(const double *)a;
+    const double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief  Print the spread of a metric over a group
+ * @param  group - the group's name, or empty for its next metric
+ * @param  unit - the metric
+ * @param  values - its values, sorted on return
+ * @param  count - the number of values
+ * @return None
+ */
+static void PrintDistribution(const char *group, const char *unit, double *values, uint32_t count)
+{
+    qsort(values, count, sizeof(double), CompareDouble);
+
+    double sum = 0;
+    double squares = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        sum += values[i];
+        squares += values[i] * values[i];
+    }
+    const double mean = sum / count;
+    const double sigma = sqrt(fmax(squares / count - mean * mean, 0));
+
+    printf("  %-10s %-4s %8.3f %8.3f %8.3f %8.3f %8.3f\n", group, unit, mean, sigma, values[count / 100],
+           values[count - 1 - count / 100], fmax(-values[0], values[count - 1]));
+}
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
@@ -0,0 +1,393 @@
+//------------------------------------------------------------------------------
+//       Filename: tune.c
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Sweeps the PID gains and prints the Pareto front of the
+//                 settling time, overshoot and ripple
+//------------------------------------------------------------------------------
+//       Notes : Run by name, main_sim tune, it is too long for every make sim.
+//               Each job sets one set of shifts, settles the PID at an
+//               operating point and steps the voltage target up, then
+//               measures on the model's output:
+//                 settle    - from the step into TUNE_BAND, held TUNE_HOLD_MS
+//                 overshoot - the peak past the new target
+//                 ripple    - peak to peak over TUNE_RIPPLE_MS once settled
+//               A set is judged on its worst operating point. One that does
+//               not settle everywhere is unstable and left out, the rest are
+//               ranked and the ones no other set beats on all three are the
+//               front. The check fails if any set does not settle, being off
+//               the front is reported.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#include "boost.h"
+#include "sim.h"
+#include <math.h>
+#include <stdlib.h>
+
+//------------------------------------------------------------------------------
+// Module constant defines
+//------------------------------------------------------------------------------
+#define TUNE_RUN_MS     (400)
+#define TUNE_TIMEOUT_MS (100) // Unsettled past this, before and after the step
+#define TUNE_HOLD_MS    (2)
+#define TUNE_RIPPLE_MS  (5)
+#define TUNE_LIMIT_MA   (1000) // The most main.c accepts
+
+// 1% (or 50mV) of the target
+#define TUNE_BAND(v) fmax((v) * 0.01, 0.05)
+
+// The shifts swept, every combination BoostPWM_SetPidGains() accepts. Widen
+// the BOOST_PID_* range in boost.h to look further.
+#define TUNE_KP_MIN (0)
+#define TUNE_KP_MAX (BOOST_PID_KP_SHIFT_MAX)
+#define TUNE_KD_MIN (0)
+#define TUNE_KD_MAX (BOOST_PID_KD_SHIFT_MAX)
+#define TUNE_KI_MIN (BOOST_PID_KI_SHIFT_MIN)
+#define TUNE_KI_MAX (BOOST_PID_KI_SHIFT_MAX)
+
+#define GAINS(kp, kd, ki) ((kp) | (kd) << 8 | (ki) << 16)
+
+#define PARAM_GAINS (0) // As written by CMD_SET_PID_GAINS
+#define PARAM_POINT (1)
+
+#define METRIC_SETTLE    (0)
+#define METRIC_OVERSHOOT (1)
+#define METRIC_RIPPLE    (2)
+#define METRIC_COUNT     (3)
+
+#define array_size(x) (sizeof(x) / sizeof(x[0]))
+
+//------------------------------------------------------------------------------
+// Module type definitions
+//------------------------------------------------------------------------------
+typedef enum
+{
+    ePHASE_SETTLE = 0, // At the first target
+    ePHASE_STEP,       // Stepped to the second
+    ePHASE_RIPPLE,     // Settled, measuring the ripple
+} Phase_e;
+
+typedef struct
+{
+    double vin;      // V
+    uint32_t fromMv; // Settled here first
+    uint32_t toMv;   // Then stepped here
+    double load;     // Ohms
+} TunePoint_t;
+
+// A set of gains judged on its worst operating point
+typedef struct
+{
+    int32_t gains;
+    double metric[METRIC_COUNT];
+} TuneRank_t;
+
+//------------------------------------------------------------------------------
+// Module static variables
+//------------------------------------------------------------------------------
+static const TunePoint_t s_points[] = {
+    {5.0, 7000, 10000, 100},
+    {5.0, 9000, 12000, 30},
+    {4.5, 6000, 9000, 220},
+};
+
+static const SimJob_t *s_job = NULL;
+
+//------------------------------------------------------------------------------
+// Module static function prototypes
+//------------------------------------------------------------------------------
+static uint32_t Plan(SimJob_t *jobs, uint32_t max);
+static void Run(const SimJob_t *job);
+static bool Check(const SimJob_t *jobs, uint32_t count);
+static void Hook(uint64_t cycles);
+static bool Dominates(const TuneRank_t *a, const TuneRank_t *b);
+static int CompareSettle(const void *a, const void *b);
+static void PrintRank(const char *prefix, const TuneRank_t *rank);
+
+//------------------------------------------------------------------------------
+// Module exported variables
+//------------------------------------------------------------------------------
+const SimScenario_t g_simTune = {
+    .name = "tune",
+    .onRequest = true,
+    .metricNames = {"settle ms", "overshoot mV", "p-p mV"},
+    .plan = Plan,
+    .run = Run,
+    .check = Check,
+};
+
+//------------------------------------------------------------------------------
+// Module static functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  A job per set of gains and operating point, the points of a set
+ *         next to each other
+ */
+static uint32_t Plan(SimJob_t *jobs, uint32_t max)
+{
+    uint32_t count = 0;
+    for (int kp = TUNE_KP_MIN; kp <= TUNE_KP_MAX; kp++)
+    {
+        for (int kd = TUNE_KD_MIN; kd <= TUNE_KD_MAX; kd++)
+        {
+            for (int ki = TUNE_KI_MIN; ki <= TUNE_KI_MAX; ki++)
+            {
+                if (count + array_size(s_points) > max)
+                {
+                    return count;
+                }
+
+                for (size_t p = 0; p < array_size(s_points); p++)
+                {
+                    const TunePoint_t *point = &s_points[p];
+                    SimJob_t *job = &jobs[count++];
+                    job->plant = (PlantConfig_t){.vin = point->vin, .load = 0};
+                    job->param[PARAM_GAINS] = GAINS(kp, kd, ki);
+                    job->param[PARAM_POINT] = p;
+                    job->runMs = TUNE_RUN_MS;
+                    snprintf(job->label, sizeof(job->label), "kp %d kd %d ki %d %.1fV %gR", kp, kd, ki,
+                             point->toMv / 1000.0, point->load);
+                }
+            }
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief  Boot from erased flash
+ */
+static void Run(const SimJob_t *job)
+{
+    s_job = job;
+    Sim_Boot(job, Hook, NULL);
+}
+
+/**
+ * @brief  Rank the sets on their worst point and print the front
+ */
+static bool Check(const SimJob_t *jobs, uint32_t count)
+{
+    const uint32_t points = array_size(s_points);
+    TuneRank_t *ranks = calloc(count / points + 1, sizeof(TuneRank_t));
+    if (!ranks)
+    {
+        return false;
+    }
+
+    BoostPidGains_t defaults;
+    BoostPWM_GetPidGains(&defaults);
+    const int32_t defaultGains = GAINS(defaults.kpShift, defaults.kdShift, defaults.kiShift);
+    const TuneRank_t *defaultRank = NULL;
+
+    uint32_t stable = 0;
+    uint32_t unstable = 0;
+    for (uint32_t i = 0; i + points <= count; i += points)
+    {
+        TuneRank_t rank = {.gains = jobs[i].param[PARAM_GAINS]};
+        bool settled = true;
+        for (uint32_t p = i; p < i + points; p++)
+        {
+            const SimResult_t *result = jobs[p].result;
+            settled &= result->done && result->metric[METRIC_SETTLE] < TUNE_TIMEOUT_MS;
+            for (int m = 0; m < METRIC_COUNT; m++)
+            {
+                rank.metric[m] = fmax(rank.metric[m], result->metric[m]);
+            }
+        }
+
+        if (!settled)
+        {
+            PrintRank("  unstable: ", &rank);
+            unstable++;
+            continue;
+        }
+
+        ranks[stable] = rank;
+        if (rank.gains == defaultGains)
+        {
+            defaultRank = &ranks[stable];
+        }
+        stable++;
+    }
+
+    // Move the front to the start, the sets no other set dominates
+    uint32_t front = 0;
+    for (uint32_t i = 0; i < stable; i++)
+    {
+        bool dominated = false;
+        for (uint32_t j = 0; j < stable && !dominated; j++)
+        {
+            dominated = Dominates(&ranks[j], &ranks[i]);
+        }
+
+        if (!dominated)
+        {
+            const TuneRank_t swap = ranks[front];
+            ranks[front] = ranks[i];
+            ranks[i] = swap;
+            defaultRank = defaultRank == &ranks[i] ? &ranks[front] : defaultRank == &ranks[front] ? &ranks[i] : defaultRank;
+            front++;
+        }
+    }
+
+    printf("  %u sets settle at every point, %u do not, the front on the worst point:\n", stable, unstable);
+    printf("  %-20s %12s %12s %12s\n", "shifts", "settle ms", "overshoot mV", "p-p mV");
+
+    const int32_t defaultKept = defaultRank ? defaultRank->gains : -1;
+    qsort(ranks, front, sizeof(TuneRank_t), CompareSettle);
+    bool onFront = false;
+    for (uint32_t i = 0; i < front; i++)
+    {
+        onFront |= ranks[i].gains == defaultKept;
+        PrintRank(ranks[i].gains == defaultKept ? "* " : "  ", &ranks[i]);
+    }
+
+    if (!onFront && defaultRank)
+    {
+        for (uint32_t i = front; i < stable; i++)
+        {
+            if (ranks[i].gains == defaultKept)
+            {
+                printf("  the default gains are off the front:\n");
+                PrintRank("  ", &ranks[i]);
+            }
+        }
+    }
+
+    free(ranks);
+    return unstable == 0;
+}
+
+/**
+ * @brief  Step the target once settled, then measure the response
+ */
+static void Hook(uint64_t cycles)
+{
+    static bool started = false;
+    static Phase_e phase = ePHASE_SETTLE;
+    static SimSettle_t settle;
+    static uint64_t rippleAt = 0;
+    static double low = 0;
+    static double high = 0;
+
+    // Once booted, main() reads the settings back after starting the loop
+    if (!BoostPWM_IsCalibrated())
+    {
+        return;
+    }
+
+    const TunePoint_t *point = &s_points[s_job->param[PARAM_POINT]];
+    SimResult_t *result = s_job->result;
+    if (!started)
+    {
+        started = true;
+        Plant_SetLoad(point->load);
+        Sim_Command(eSIM_CMD_SET_CONTROLLER, eBOOST_CONTROLLER_PID);
+        Sim_Command(eSIM_CMD_SET_PID_GAINS, s_job->param[PARAM_GAINS]);
+        Sim_Command(eSIM_CMD_SET_CURRENT, TUNE_LIMIT_MA);
+        Sim_Command(eSIM_CMD_SET_VOLTAGE, point->fromMv);
+        Sim_SettleStart(&settle, cycles);
+        return;
+    }
+
+    PlantState_t state;
+    Plant_GetState(&state);
+    const double from = point->fromMv / 1000.0;
+    const double to = point->toMv / 1000.0;
+
+    // Unstable gains never settle, they rank last rather than fail the job
+    if (phase != ePHASE_RIPPLE && cycles - settle.start >= (uint64_t)TUNE_TIMEOUT_MS * SIM_CYCLES_PER_MS)
+    {
+        result->metric[METRIC_SETTLE] = TUNE_TIMEOUT_MS;
+        Sim_Finish();
+    }
+
+    switch (phase)
+    {
+        case ePHASE_SETTLE:
+            if (Sim_Settled(&settle, cycles, state.vOut, from, TUNE_BAND(from), TUNE_HOLD_MS))
+            {
+                Sim_Command(eSIM_CMD_SET_VOLTAGE, point->toMv);
+                Sim_SettleStart(&settle, cycles);
+                phase = ePHASE_STEP;
+            }
+            break;
+
+        case ePHASE_STEP:
+            result->metric[METRIC_OVERSHOOT] = fmax(result->metric[METRIC_OVERSHOOT], (state.vOut - to) * 1000);
+            if (Sim_Settled(&settle, cycles, state.vOut, to, TUNE_BAND(to), TUNE_HOLD_MS))
+            {
+                result->metric[METRIC_SETTLE] = Sim_SettleMs(&settle);
+                rippleAt = cycles;
+                low = state.vOut;
+                high = state.vOut;
+                phase = ePHASE_RIPPLE;
+            }
+            break;
+
+        case ePHASE_RIPPLE:
+            low = fmin(low, state.vOut);
+            high = fmax(high, state.vOut);
+            if (cycles - rippleAt >= (uint64_t)TUNE_RIPPLE_MS * SIM_CYCLES_PER_MS)
+            {
+                result->metric[METRIC_RIPPLE] = (high - low) * 1000;
+                Sim_Finish();
+            }
+            break;
+    }
+}
+
+/**
+ * @brief  Check if a set is at least as good on every metric and better on one
+ * @param  a - the set
+ * @param  b - the set it is compared with
+ * @return true if a dominates b
+ */
+static bool Dominates(const TuneRank_t *a, const TuneRank_t *b)
+{
+    bool better = false;
+    for (int m = 0; m < METRIC_COUNT; m++)
+    {
+        if (a->metric[m] > b->metric[m])
+        {
+            return false;
+        }
+        better |= a->metric[m] < b->metric[m];
+    }
+    return better;
+}
+
+/**
+ * @brief  qsort() order, fastest settling first
+ */
+static int CompareSettle(const void *a, const void *b)
+{
+    const double settleA = ((const TuneRank_t *)a)->metric[METRIC_SETTLE];
+    const double settleB = ((const TuneRank_t *)b)->metric[METRIC_SETTLE];
+    return (settleA > settleB) - (settleA < settleB);
+}
+
+/**
+ * @brief  Print a ranked set
+ * @param  prefix - marks the default gains
+ * @param  rank - the set
+ * @return None
+ */
+static void PrintRank(const char *prefix, const TuneRank_t *rank)
+{
+    char shifts[24];
+    snprintf(shifts, sizeof(shifts), "kp %d kd %d ki %d", rank->gains & 0xFF, (rank->gains >> 8) & 0xFF,
+             (rank->gains >> 16) & 0xFF);
+    printf("%s%-20s %12.3f %12.1f %12.1f\n", prefix, shifts, rank->metric[METRIC_SETTLE],
+           rank->metric[METRIC_OVERSHOOT], rank->metric[METRIC_RIPPLE]);
+}
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
@@ -0,0 +1,151 @@
+//------------------------------------------------------------------------------
+//       Filename: wasm_main.c
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Builds the host firmware for the web UI's simulated supply
+//------------------------------------------------------------------------------
+//       Notes : Compiled with emscripten into a module that runs in the UI's
+//               worker, see software/webui/sim.js. The firmware boots on the
+//               model as in main_host, with its own main(). The hook paces
+//               simulated time to the wall clock, sleeping once it is ahead,
+//               which hands the worker back its event loop, and the feature
+//               report requests queued meanwhile are served from the hook,
+//               where the USB interrupt would run on the MCU.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#define main Firmware_Main
+#include "main.c"
+#undef main
+
+#include <emscripten.h>
+#include <string.h>
+
+//------------------------------------------------------------------------------
+// Module constant defines
+//------------------------------------------------------------------------------
+#define WASM_CYCLES_PER_MS (FUNCONF_SYSTEM_CORE_CLOCK / 1000)
+
+// Simulated time between looks at the wall clock and the request queue
+#define WASM_SLICE_CYCLES (WASM_CYCLES_PER_MS)
+
+// Further behind than this and the lag is dropped, so a stalled tab catches
+// up slowly instead of running flat out
+#define WASM_MAX_LAG_MS (50)
+
+#define WASM_REPORT_SIZE (64)
+
+//------------------------------------------------------------------------------
+// Module static variables
+//------------------------------------------------------------------------------
+static uint8_t s_report[WASM_REPORT_SIZE];
+static uint64_t s_nextSlice = 0;
+static double s_startMs = 0;
+static uint64_t s_startCycles = 0;
+
+//------------------------------------------------------------------------------
+// Module static function prototypes
+//------------------------------------------------------------------------------
+static void Hook(uint64_t cycles);
+
+// Serves the requests the worker queued, with the exported functions below
+EM_JS(void, WasmJs_Service, (void), { Module['service'](); });
+
+//------------------------------------------------------------------------------
+// Module externally exported functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  Boot the firmware, it never returns
+ */
+int main(void)
+{
+    s_startMs = emscripten_get_now();
+    Host_SetHook(Hook);
+    return Firmware_Main();
+}
+
+/**
+ * @brief  Get the buffer the reports are passed through
+ * @param  None
+ * @return WASM_REPORT_SIZE bytes
+ */
+EMSCRIPTEN_KEEPALIVE uint8_t *Wasm_Report(void)
+{
+    return s_report;
+}
+
+/**
+ * @brief  Write the report in the buffer, as a set report request
+ * @param  length - the report length, starting with its ID
+ * @return None
+ */
+EMSCRIPTEN_KEEPALIVE void Wasm_SetReport(uint32_t length)
+{
+    Host_HidWrite(s_report, length < sizeof(s_report) ? length : sizeof(s_report));
+}
+
+/**
+ * @brief  Read a report into the buffer, as a get report request
+ * @param  reportId - the report ID
+ * @return the report length, 0 for an unknown ID
+ */
+EMSCRIPTEN_KEEPALIVE uint32_t Wasm_GetReport(uint8_t reportId)
+{
+    struct usb_endpoint endpoint = {0};
+    usb_handle_hid_get_report_start(&endpoint, sizeof(s_report), reportId);
+    if (endpoint.max_len)
+    {
+        memcpy(s_report, endpoint.opaque, endpoint.max_len);
+    }
+    return endpoint.max_len;
+}
+
+/**
+ * @brief  Change the model's load
+ * @param  ohms - the new load, 0 for open circuit
+ * @return None
+ */
+EMSCRIPTEN_KEEPALIVE void Wasm_SetLoad(double ohms)
+{
+    Plant_SetLoad(ohms);
+}
+
+//------------------------------------------------------------------------------
+// Module static functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  Keep to the wall clock and serve the queued requests
+ */
+static void Hook(uint64_t cycles)
+{
+    if (cycles < s_nextSlice)
+    {
+        return;
+    }
+    s_nextSlice = cycles + WASM_SLICE_CYCLES;
+
+    const double simulatedMs = (double)(cycles - s_startCycles) / WASM_CYCLES_PER_MS;
+    const double elapsedMs = emscripten_get_now() - s_startMs;
+    if (elapsedMs - simulatedMs > WASM_MAX_LAG_MS)
+    {
+        // Still let the worker take its messages
+        emscripten_sleep(0);
+        s_startMs = emscripten_get_now();
+        s_startCycles = cycles;
+    }
+    else if (simulatedMs > elapsedMs)
+    {
+        emscripten_sleep((unsigned)(simulatedMs - elapsedMs) + 1);
+    }
+
+    WasmJs_Service();
+}
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
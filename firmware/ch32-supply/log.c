@@ -12,6 +12,7 @@
 // Module includes
 //------------------------------------------------------------------------------
 #include "log.h"
+#include <inttypes.h>
 
 //------------------------------------------------------------------------------
 // Module constant defines
@@ -38,7 +39,7 @@
 // Module static variables
 //------------------------------------------------------------------------------
 static LogLevel_e s_maxLogLevel = eLOG_LEVEL_DEBUG;
-static const uint32_t *s_systick = NULL;
+static LogClock_t s_clock = NULL;
 
 //------------------------------------------------------------------------------
 // Module static function prototypes
@@ -50,13 +51,13 @@ static const uint32_t *s_systick = NULL;
 /*
  * @brief       Initialize  UART Logging library.
  * @param[in]   level - logging level
- * @param[in]   systick - pointer to systick counter
+ * @param[in]   clock - gives the timestamps, in microseconds
  * @return      None
  */
-void LOG_Init(const LogLevel_e level, const uint32_t *const systick)
+void LOG_Init(const LogLevel_e level, LogClock_t clock)
 {
     s_maxLogLevel = level;
-    s_systick = systick;
+    s_clock = clock;
 
     if (level != eLOG_LEVEL_NONE)
     {
@@ -105,7 +106,8 @@ void LOG(const LogLevel_e level, const char *tag, char *format, ...)
             break;
     }
     printf(colour);
-    printf("%lu %c %s: ", *s_systick, indicator, tag);
+    const uint32_t micros = s_clock();
+    printf("%" PRIu32 ".%03" PRIu32 " %c %s: ", micros / 1000, micros % 1000, indicator, tag);
     va_list args;
     va_start(args, format);
     vprintf(format, args);
@@ -51,10 +51,13 @@ typedef enum
     eLOG_LEVEL_NONE
 } LogLevel_e;
 
+// Timestamp source, in microseconds
+typedef uint32_t (*LogClock_t)(void);
+
 //------------------------------------------------------------------------------
 // Module exported functions
 //------------------------------------------------------------------------------
-void LOG_Init(const LogLevel_e level, const uint32_t *const systick);
+void LOG_Init(const LogLevel_e level, LogClock_t clock);
 
 //------------------------------------------------------------------------------
 // Module exported variables
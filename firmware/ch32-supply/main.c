@@ -15,10 +15,18 @@
 #include <stdbool.h>
 
 #include "boost.h"
-#include "ch32v003fun.h"
+#include "charger.h"
+#include "console.h"
+#include "fra.h"
+#include "hal.h"
+#include "history.h"
 #include "log.h"
 #include "nvs.h"
+#include "profile.h"
 #include "rv003usb.h"
+#include "sweep.h"
+#include "timebase.h"
+#include "trace.h"
 
 //------------------------------------------------------------------------------
 // Module constant defines
@@ -26,17 +34,62 @@
 
 #define TAG "main"
 
-#ifndef CONFIG_CURRENT_LIMIT
-#define CONFIG_CURRENT_LIMIT 1000
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+
+// Short circuit response defaults. A boost can not pull its output below the
+// input minus the diode's drop, a 0.1R short holds ~1.8V from 5V, above the
+// default knee, and with nothing in series with the input no response can
+// limit it. The responses act on overloads that hold the output below the
+// knee while the loop still regulates.
+#ifndef CONFIG_FAULT_KNEE
+#define CONFIG_FAULT_KNEE 1000
+#endif
+
+#ifndef CONFIG_FAULT_FLOOR
+#define CONFIG_FAULT_FLOOR 100
+#endif
+
+#ifndef CONFIG_FAULT_RETRY
+#define CONFIG_FAULT_RETRY 100
+#endif
+
+// Charge profile defaults, a single Li-ion cell
+#ifndef CONFIG_CHARGER_VOLTAGE
+#define CONFIG_CHARGER_VOLTAGE 4200
 #endif
 
-#ifndef CONFIG_VOLTAGE_LIMIT
-#define CONFIG_VOLTAGE_LIMIT 15000
+#ifndef CONFIG_CHARGER_CURRENT
+#define CONFIG_CHARGER_CURRENT 500
 #endif
 
-#define NVS_MAGIC 0xbee5
+#ifndef CONFIG_CHARGER_TERMINATION
+#define CONFIG_CHARGER_TERMINATION 50
+#endif
+
+#ifndef CONFIG_CHARGER_TIMEOUT
+#define CONFIG_CHARGER_TIMEOUT 240
+#endif
+
+static_assert(CONFIG_CHARGER_VOLTAGE <= CONFIG_VOLTAGE_LIMIT, "CONFIG_CHARGER_VOLTAGE past the output limit");
+static_assert(CONFIG_CHARGER_CURRENT <= CONFIG_CURRENT_LIMIT, "CONFIG_CHARGER_CURRENT past the output limit");
+
+#define NVS_MAGIC 0xbeeb
+
+// The feature report IDs run on from this one
+#define REPORT_ID_FIRST BOOST_REPORT_ID_STATE
 
 #define array_size(x) (sizeof(x) / sizeof(x[0]))
+
+// The lines logged in a burst, when the debugger attaches (~375 bytes) or on
+// 'b' and 'P', would not fit the console at once. They are flagged and one
+// goes out per loop once there is room for the longest, timestamp and colour
+// codes included.
+#define LOG_LINE_SIZE    (96)
+#define LOG_LINE_ATTACH  (0) // The setpoints and the calibration
+#define LOG_LINE_BOOT    (3) // The boot phase timestamps
+#define LOG_LINE_PROFILE (LOG_LINE_BOOT + eBOOT_PHASE_COUNT)
+#define LOG_LINE_END     (LOG_LINE_PROFILE + ePROFILE_COUNT)
+#define LOG_LINES(first_, end_) ((1u << (end_)) - (1u << (first_)))
 //------------------------------------------------------------------------------
 // External variables
 //------------------------------------------------------------------------------
@@ -55,6 +108,14 @@ typedef struct
     uint32_t current;
     uint16_t magic;
     bool save;
+    BoostWarmStart_t warmStart;
+    uint32_t power;
+    uint32_t resistance;
+    uint8_t mode;
+    BoostFaultConfig_t fault;
+    ChargerConfig_t charger;
+    BoostPidGains_t gains;
+    BoostTrim_t trim;
 } Settings_t;
 
 typedef enum
@@ -62,31 +123,176 @@ typedef enum
     CMD_SET_VOLTAGE = 1,
     CMD_SET_CURRENT = 2,
     CMD_SAVE = 3,
+    CMD_OUTPUT_ENABLE = 4,
+    CMD_SET_CONTROLLER = 5,
+    CMD_SET_MODE = 6,
+    CMD_SET_POWER = 7,
+    CMD_SET_RESISTANCE = 8,
+    CMD_SET_FAULT_MODE = 9,
+    CMD_SET_FAULT_KNEE = 10,
+    CMD_SET_FAULT_FLOOR = 11,
+    CMD_SET_FAULT_RETRY = 12,
+    CMD_FRA_START = 13,
+    CMD_SWEEP_RANGE = 14,
+    CMD_SWEEP_START = 15,
+    CMD_CHARGE = 16,
+    CMD_SET_CHARGE_VOLTAGE = 17,
+    CMD_SET_CHARGE_CURRENT = 18,
+    CMD_SET_CHARGE_TERMINATION = 19,
+    CMD_SET_CHARGE_TIMEOUT = 20,
+    CMD_SET_CHARGE_DELTA_V = 21,
+    CMD_PROFILE_RESET = 22,
+    CMD_SET_PID_GAINS = 23,
+    CMD_SET_VOLTAGE_TRIM = 24,
+    CMD_SET_CURRENT_TRIM = 25,
+    CMD_TRACE_ARM = 26,
+    CMD_FRA_STOP = 27,
 } CommandId_e;
 
+typedef enum
+{
+    eBOOT_PHASE_USB = 0,
+    eBOOT_PHASE_NVS,
+    eBOOT_PHASE_BOOST,
+    eBOOT_PHASE_REGULATING,
+    eBOOT_PHASE_DEBUGGER,
+    eBOOT_PHASE_COUNT,
+} BootPhase_e;
+
+// Setpoints in use, the 0xB3 report, set through the commands
+typedef struct
+{
+    uint16_t voltage;    // mV
+    uint16_t current;    // mA
+    uint16_t power;      // mW
+    uint16_t resistance; // mOhm
+    uint8_t mode;        // BoostMode_e
+    uint8_t controller;  // BoostController_e
+    uint8_t outputEnabled;
+    uint8_t reserved;
+    BoostFaultConfig_t fault;
+    BoostPidGains_t gains;
+    BoostTrim_t trim;
+} ConfigReport_t;
+
+static_assert(sizeof(ConfigReport_t) == 28, "ConfigReport_t must match the 0xB3 report in usb_config.h");
+static_assert(CONFIG_RESISTANCE_LIMIT <= UINT16_MAX, "ConfigReport_t.resistance is 16 bits");
+static_assert(LOG_LINE_END <= 32, "The pending log lines are bits of a word");
+static_assert(LOG_LINE_SIZE <= CONFIG_CONSOLE_TX_SIZE, "A burst line must fit in the console");
+
+// Counters, the 0xB4 report
+typedef struct
+{
+    uint32_t uptimeMs;
+    uint32_t commands;  // Command reports received
+    uint32_t loopRate;  // Main loop iterations in the last second
+    uint16_t faults;    // Short circuit trips
+    uint16_t bootMs;    // From reset to regulating, 0 until then
+} StatsReport_t;
+
+static_assert(sizeof(StatsReport_t) == 16, "StatsReport_t must match the 0xB4 report in usb_config.h");
+
+typedef const void *(*ReportGet_t)(void);
+typedef void (*ReportSet_t)(struct usb_endpoint *e, const uint8_t *data, int len);
+
+typedef struct
+{
+    uint16_t size;             // Bytes returned, 0 for an unused ID
+    const volatile void *data; // Returned as is, unless get is set
+    ReportGet_t get;           // For reports that move, e.g. double buffered ones
+    ReportSet_t set;           // Called for every packet written, NULL if read only
+} HidReport_t;
+
 //------------------------------------------------------------------------------
 // Module static variables
 //------------------------------------------------------------------------------
-static volatile uint32_t s_systickCount = 0;
+// Core cycles at each boot phase, measured from Timebase_Init()
+static uint32_t s_bootTimes[eBOOT_PHASE_COUNT] = {0};
+static const char *const s_bootPhaseNames[eBOOT_PHASE_COUNT] = {
+    [eBOOT_PHASE_USB] = "usb",
+    [eBOOT_PHASE_NVS] = "nvs",
+    [eBOOT_PHASE_BOOST] = "boost",
+    [eBOOT_PHASE_REGULATING] = "regulating",
+    [eBOOT_PHASE_DEBUGGER] = "debugger",
+};
 
 static volatile size_t s_bytesReceived = 0;
 static volatile Settings_t s_settings = {
     .voltage = 0,
     .current = CONFIG_CURRENT_LIMIT,
 };
+static volatile bool s_outputEnabled = true;
+static volatile BoostCalibration_t s_calibration = {0};
+static volatile BoostController_e s_controller = eBOOST_CONTROLLER_PID;
+static volatile uint8_t s_fraAmplitude = 0;
+static volatile bool s_fraStart = false;
+static volatile bool s_fraStop = false;
+static volatile SweepConfig_t s_sweepConfig = {0};
+static volatile bool s_sweepStart = false;
+static volatile int8_t s_charge = -1;
+static volatile ChargerStatus_t s_chargerStatus = {0};
+static volatile BoostStepResponse_t s_stepResponse = {0};
+#if CONFIG_ENABLE_PROFILE
+static volatile ProfileReport_t s_profile = {0};
+static volatile bool s_profileReset = false;
+#endif
 static volatile BoostState_t s_state = {
     .voltage = 0,
     .current = CONFIG_CURRENT_LIMIT,
     .duty = 0,
     .ccMode = false,
 };
+static volatile ConfigReport_t s_config = {0};
+static volatile StatsReport_t s_stats = {0};
 
 //------------------------------------------------------------------------------
 // Module static function prototypes
 //------------------------------------------------------------------------------
-static void SysTick_Init(void);
-static void WDT_Init(uint16_t reload_val, uint8_t prescaler);
-static void WDT_Pet(void);
+static void Boot_MarkPhase(BootPhase_e phase);
+static void Log_Line(uint32_t line);
+static void Report_GetConfig(ConfigReport_t *report);
+static const HidReport_t *Report_Find(uint32_t lValueLSBIndexMSB);
+static void Report_SetState(struct usb_endpoint *e, const uint8_t *data, int len);
+#if CONFIG_ENABLE_FRA
+static const void *Report_GetFra(void);
+#endif
+#if CONFIG_ENABLE_SWEEP
+static const void *Report_GetSweep(void);
+#endif
+#if CONFIG_ENABLE_TRACE
+static const void *Report_GetTrace(void);
+#endif
+#if CONFIG_ENABLE_HISTORY
+static const void *Report_GetHistory(void);
+#endif
+
+// Feature reports, indexed by ID from REPORT_ID_FIRST, so the USB interrupt
+// finds one without a search
+static const HidReport_t s_reports[] = {
+    [BOOST_REPORT_ID_STATE - REPORT_ID_FIRST] = {sizeof(s_state), &s_state, NULL, Report_SetState},
+#if CONFIG_ENABLE_HISTORY
+    [BOOST_REPORT_ID_HISTORY - REPORT_ID_FIRST] = {sizeof(HistoryReport_t), NULL, Report_GetHistory, NULL},
+#endif
+    [BOOST_REPORT_ID_CALIBRATION - REPORT_ID_FIRST] = {sizeof(s_calibration), &s_calibration, NULL, NULL},
+#if CONFIG_ENABLE_FRA
+    [BOOST_REPORT_ID_FRA - REPORT_ID_FIRST] = {sizeof(FraReport_t), NULL, Report_GetFra, NULL},
+#endif
+#if CONFIG_ENABLE_SWEEP
+    [BOOST_REPORT_ID_SWEEP - REPORT_ID_FIRST] = {sizeof(SweepReport_t), NULL, Report_GetSweep, NULL},
+#endif
+#if CONFIG_ENABLE_CHARGER
+    [BOOST_REPORT_ID_CHARGER - REPORT_ID_FIRST] = {sizeof(s_chargerStatus), &s_chargerStatus, NULL, NULL},
+#endif
+#if CONFIG_ENABLE_PROFILE
+    [BOOST_REPORT_ID_PROFILE - REPORT_ID_FIRST] = {sizeof(s_profile), &s_profile, NULL, NULL},
+#endif
+    [BOOST_REPORT_ID_STEP - REPORT_ID_FIRST] = {sizeof(s_stepResponse), &s_stepResponse, NULL, NULL},
+#if CONFIG_ENABLE_TRACE
+    [BOOST_REPORT_ID_TRACE - REPORT_ID_FIRST] = {sizeof(TraceReport_t), NULL, Report_GetTrace, NULL},
+#endif
+    [BOOST_REPORT_ID_CONFIG - REPORT_ID_FIRST] = {sizeof(s_config), &s_config, NULL, NULL},
+    [BOOST_REPORT_ID_STATS - REPORT_ID_FIRST] = {sizeof(s_stats), &s_stats, NULL, NULL},
+};
 
 //------------------------------------------------------------------------------
 // Module externally exported functions
@@ -101,25 +307,23 @@ int main(void)
 {
     SystemInit();
 
-    SysTick_Init();
+    Timebase_Init();
 
-    const bool debuggerAttached = !WaitForDebuggerToAttach(1000);
-    if (debuggerAttached)
-    {
-        LOG_Init(eLOG_LEVEL_INFO, (uint32_t *)&s_systickCount);
-    }
-    else
-    {
-        LOG_Init(eLOG_LEVEL_NONE, (uint32_t *)&s_systickCount);
-    }
+    // Logging is enabled lazily from the main loop once a debugger attaches,
+    // waiting for one here would keep the output dead on every power-up.
+    bool debuggerAttached = false;
+    uint32_t logPending = 0;
+    LOG_Init(eLOG_LEVEL_NONE, Timebase_Micros);
 
 #ifdef CONFIG_USE_USB
     usb_setup();
 #endif
+    Boot_MarkPhase(eBOOT_PHASE_USB);
 
     NVS_Init();
 
     NVS_Load((uint8_t *)&s_settings, 0, sizeof(s_settings));
+    Boot_MarkPhase(eBOOT_PHASE_NVS);
 
     if (s_settings.magic != NVS_MAGIC)
     {
@@ -128,14 +332,45 @@ int main(void)
         s_settings.current = CONFIG_CURRENT_LIMIT;
         s_settings.magic = NVS_MAGIC;
         s_settings.save = false;
+        s_settings.warmStart.valid = false;
+        s_settings.power = 0;
+        s_settings.resistance = 0;
+        s_settings.mode = eBOOST_MODE_CV;
+        s_settings.fault = (BoostFaultConfig_t){
+            .kneeMillivolts = CONFIG_FAULT_KNEE,
+            .floorMilliamps = CONFIG_FAULT_FLOOR,
+            .retryMs = CONFIG_FAULT_RETRY,
+            .mode = eBOOST_FAULT_NONE,
+        };
+        s_settings.charger = (ChargerConfig_t){
+            .voltageMillivolts = CONFIG_CHARGER_VOLTAGE,
+            .currentMilliamps = CONFIG_CHARGER_CURRENT,
+            .terminationMilliamps = CONFIG_CHARGER_TERMINATION,
+            .timeoutMinutes = CONFIG_CHARGER_TIMEOUT,
+            .deltaMillivolts = 0,
+        };
+        BoostPWM_GetPidGains((BoostPidGains_t *)&s_settings.gains);
+        s_settings.trim = (BoostTrim_t){0};
     }
 
-    LOGI(TAG, "Voltage: %dmV, Current: %dmA", s_settings.voltage, s_settings.current);
-
     BoostPWM_Init();
 
+    BoostPWM_SetTrim((BoostTrim_t *)&s_settings.trim);
     BoostPWM_SetVoltageTarget(s_settings.voltage);
     BoostPWM_SetCurrentLimit(s_settings.current);
+    BoostPWM_SetPowerTarget(s_settings.power);
+    BoostPWM_SetSourceResistance(s_settings.resistance);
+    BoostPWM_SetMode(s_settings.mode);
+    BoostPWM_SetFaultConfig((BoostFaultConfig_t *)&s_settings.fault);
+    // Settings saved before the gains were bounded come back clamped
+    BoostPWM_SetPidGains((BoostPidGains_t *)&s_settings.gains);
+    BoostPWM_GetPidGains((BoostPidGains_t *)&s_settings.gains);
+    BoostPWM_SetWarmStart((BoostWarmStart_t *)&s_settings.warmStart);
+    s_controller = BoostPWM_GetController();
+#if CONFIG_ENABLE_CHARGER
+    Charger_SetConfig((ChargerConfig_t *)&s_settings.charger);
+#endif
+    Boot_MarkPhase(eBOOT_PHASE_BOOST);
 
 #if 0
 
@@ -147,16 +382,60 @@ int main(void)
     }
 #endif
 
-    WDT_Init(0x0FFF, IWDG_Prescaler_128);
+    HAL_WDT_Init(0x0FFF, IWDG_Prescaler_128);
 
     static uint32_t power = 0;
 
     static size_t s_lastBytesReceived = 0;
     static uint32_t lastTime = 0;
+    static uint32_t loops = 0;
+
+#if CONFIG_ENABLE_PROFILE
+    uint32_t loopStart = Profile_Now();
+#endif
 
     while (1)
     {
-        WDT_Pet();
+#if CONFIG_ENABLE_PROFILE
+        // Measured start to start, so iterations cut short by `continue` count too
+        Profile_Record(ePROFILE_MAIN_LOOP, loopStart);
+        loopStart = Profile_Now();
+
+        if (s_profileReset)
+        {
+            s_profileReset = false;
+            Profile_Reset();
+        }
+        Profile_GetReport((ProfileReport_t *)&s_profile);
+#endif
+
+        HAL_WDT_Feed();
+        HAL_Yield();
+        loops++;
+
+        if (!s_bootTimes[eBOOT_PHASE_REGULATING] && BoostPWM_IsCalibrated())
+        {
+            Boot_MarkPhase(eBOOT_PHASE_REGULATING);
+        }
+
+        if (!debuggerAttached && DidDebuggerAttach())
+        {
+            debuggerAttached = true;
+            Boot_MarkPhase(eBOOT_PHASE_DEBUGGER);
+            LOG_Init(eLOG_LEVEL_INFO, Timebase_Micros);
+            logPending |= LOG_LINES(LOG_LINE_ATTACH, LOG_LINE_PROFILE);
+        }
+
+        if (logPending && Console_TxFree() >= LOG_LINE_SIZE)
+        {
+            uint32_t line = 0;
+            while (!(logPending & (1u << line)))
+            {
+                line++;
+            }
+            logPending &= ~(1u << line);
+            Log_Line(line);
+        }
 
         if (s_bytesReceived != s_lastBytesReceived)
         {
@@ -170,34 +449,148 @@ int main(void)
 
             if (s_settings.current > CONFIG_CURRENT_LIMIT)
             {
-                s_settings.voltage = CONFIG_CURRENT_LIMIT;
+                s_settings.current = CONFIG_CURRENT_LIMIT;
             }
 
-            BoostPWM_SetVoltageTarget(s_settings.voltage);
-            BoostPWM_SetCurrentLimit(s_settings.current);
+            if (s_settings.power > CONFIG_POWER_LIMIT)
+            {
+                s_settings.power = CONFIG_POWER_LIMIT;
+            }
+
+            if (s_settings.resistance > CONFIG_RESISTANCE_LIMIT)
+            {
+                s_settings.resistance = CONFIG_RESISTANCE_LIMIT;
+            }
+
+            BoostPWM_SetTrim((BoostTrim_t *)&s_settings.trim);
+
+            // A running sweep or charge owns the setpoints, Sweep_Task() and
+            // Charger_Task() put the user's back, with any change received
+            // meanwhile, once it ends
+            bool setpointsOwned = false;
+#if CONFIG_ENABLE_SWEEP
+            setpointsOwned |= Sweep_IsRunning();
+#endif
+#if CONFIG_ENABLE_CHARGER
+            setpointsOwned |= Charger_IsRunning();
+#endif
+            if (!setpointsOwned)
+            {
+                BoostPWM_SetVoltageTarget(s_settings.voltage);
+                BoostPWM_SetCurrentLimit(s_settings.current);
+                BoostPWM_SetMode(s_settings.mode);
+            }
+            BoostPWM_SetPowerTarget(s_settings.power);
+            BoostPWM_SetSourceResistance(s_settings.resistance);
+            BoostPWM_SetFaultConfig((BoostFaultConfig_t *)&s_settings.fault);
+            BoostPWM_SetOutputEnabled(s_outputEnabled);
+            BoostPWM_SetController(s_controller);
+            BoostPWM_SetPidGains((BoostPidGains_t *)&s_settings.gains);
+            BoostPWM_GetPidGains((BoostPidGains_t *)&s_settings.gains);
+#if CONFIG_ENABLE_CHARGER
+            Charger_SetConfig((ChargerConfig_t *)&s_settings.charger);
+#endif
             s_lastBytesReceived = s_bytesReceived;
         }
 
         if (s_settings.save)
         {
             s_settings.save = false;
-            LOGI(TAG, "Saving settings: Voltage: %dmV, Current: %dmA",
-                 s_settings.voltage, s_settings.current);
+            // The operating point is only kept if the loop has settled on the saved setpoint
+            const bool settled = BoostPWM_GetWarmStart((BoostWarmStart_t *)&s_settings.warmStart);
+            LOGI(TAG, "Saving settings: Voltage: %dmV, Current: %dmA, Duty: %d, Settled: %d",
+                 s_settings.voltage, s_settings.current, s_settings.warmStart.duty, settled);
             NVS_Save((uint8_t *)&s_settings, sizeof(s_settings));
             LOGI(TAG, "Settings saved");
+        }
+
+#if CONFIG_ENABLE_FRA
+        if (s_fraStart)
+        {
+            s_fraStart = false;
+            FRA_Start(s_fraAmplitude);
+        }
+
+        if (s_fraStop)
+        {
+            s_fraStop = false;
+            FRA_Stop();
+        }
+
+        // The perturbation is only applied while regulating
+        if (FRA_IsRunning() && !BoostPWM_IsOutputEnabled())
+        {
+            FRA_Stop();
+        }
+        FRA_Task();
+#endif
+
+#if CONFIG_ENABLE_SWEEP
+        if (s_sweepStart)
+        {
+            s_sweepStart = false;
+            Sweep_Start((SweepConfig_t *)&s_sweepConfig);
+        }
+
+        // Put the user's setpoints back once the curve is taken
+        if (Sweep_Task())
+        {
+            BoostPWM_SetMode(s_settings.mode);
+            BoostPWM_SetVoltageTarget(s_settings.voltage);
+            BoostPWM_SetCurrentLimit(s_settings.current);
+        }
+#endif
+
+#if CONFIG_ENABLE_CHARGER
+        if (s_charge >= 0)
+        {
+            if (s_charge && Charger_Start())
+            {
+                s_outputEnabled = true;
+            }
+            else if (!s_charge)
+            {
+                Charger_Stop();
+            }
+            s_charge = -1;
+        }
 
-            // NOTE: no idea why, but systick skips an interrupt after this
-            SysTick_Init();
-            LOGI(TAG, "SysTick restarted");
+        // Back to the user's setpoints, the output stays off
+        if (Charger_Task())
+        {
+            s_outputEnabled = false;
+            BoostPWM_SetOutputEnabled(false);
+            BoostPWM_SetMode(s_settings.mode);
+            BoostPWM_SetVoltageTarget(s_settings.voltage);
+            BoostPWM_SetCurrentLimit(s_settings.current);
         }
+        Charger_GetStatus((ChargerStatus_t *)&s_chargerStatus);
+#endif
 
+        BoostPWM_Task();
+
+        PROFILE_START(getStateStart);
         BoostPWM_GetState((BoostState_t *)&s_state);
+        PROFILE_STOP(ePROFILE_GET_STATE, getStateStart);
+#if CONFIG_ENABLE_HISTORY
+        History_Task((BoostState_t *)&s_state);
+#endif
+        BoostPWM_GetCalibration((BoostCalibration_t *)&s_calibration);
+        BoostPWM_GetStepResponse((BoostStepResponse_t *)&s_stepResponse);
+        Report_GetConfig((ConfigReport_t *)&s_config);
         power = (s_state.voltage * s_state.current) / 1000;
 
-        if (s_systickCount - lastTime > 1000)
+        const uint32_t now = Timebase_Millis();
+        s_stats.uptimeMs = now;
+        s_stats.faults = BoostPWM_GetFaultCount();
+        if (now - lastTime > 1000)
         {
-            lastTime = s_systickCount;
-            LOGI(TAG, "CC: %d, Voltage: %5dmV, Current: %4dmA, Power: %5dmW, Duty: %3d",
+            lastTime = now;
+            s_stats.loopRate = loops;
+            s_stats.bootMs = s_bootTimes[eBOOT_PHASE_REGULATING] / TIMEBASE_CYCLES_PER_US / 1000;
+            loops = 0;
+            LOGI(TAG, "On: %d, CC: %d, Voltage: %5dmV, Current: %4dmA, Power: %5dmW, Duty: %3d",
+                 BoostPWM_IsOutputEnabled(),
                  s_state.ccMode,
                  s_state.voltage,
                  s_state.current,
@@ -205,17 +598,61 @@ int main(void)
                  s_state.duty);
         }
 
-        if (!debuggerAttached) continue;
+        // Runs with or without a debugger, so attaching one costs no time
+        Console_Task();
 
-        int c = getchar();
+        int c = Console_Read();
 
         switch (c)
         {
             case '0':
-                BoostPWM_SetVoltageTarget(0);
-                BoostPWM_SetCurrentLimit(CONFIG_CURRENT_LIMIT);
-                s_settings.voltage = 0;
-                s_settings.current = CONFIG_CURRENT_LIMIT;
+                s_outputEnabled = false;
+                BoostPWM_SetOutputEnabled(false);
+                break;
+            case 'o':
+                s_outputEnabled = true;
+                BoostPWM_SetOutputEnabled(true);
+                break;
+            case 'O':
+                // Cold turn-on, as a reference for the warm turn-on time
+                BoostPWM_SetOutputEnabled(false);
+                BoostPWM_ResetController();
+                s_outputEnabled = true;
+                BoostPWM_SetOutputEnabled(true);
+                break;
+            case 'm':
+                s_settings.mode = (s_settings.mode + 1) % eBOOST_MODE_COUNT;
+                BoostPWM_SetMode(s_settings.mode);
+                LOGI(TAG, "Mode: %d, Power: %dmW, Resistance: %dmOhm",
+                     s_settings.mode, s_settings.power, s_settings.resistance);
+                break;
+            case 'f':
+                s_settings.fault.mode = (s_settings.fault.mode + 1) % eBOOST_FAULT_COUNT;
+                BoostPWM_SetFaultConfig((BoostFaultConfig_t *)&s_settings.fault);
+                LOGI(TAG, "Fault mode: %d, Knee: %dmV, Floor: %dmA, Retry: %dms, Trips: %d",
+                     s_settings.fault.mode, s_settings.fault.kneeMillivolts,
+                     s_settings.fault.floorMilliamps, s_settings.fault.retryMs,
+                     BoostPWM_GetFaultCount());
+                break;
+            case 'p':
+                s_controller = (s_controller + 1) % eBOOST_CONTROLLER_COUNT;
+                BoostPWM_SetController(s_controller);
+                LOGI(TAG, "Controller: %s", s_controller == eBOOST_CONTROLLER_CASCADE ? "cascade" : "pid");
+                break;
+            case 'r':
+                LOGI(TAG, "Current offset: %d, Drift: %d, Recalibrations: %d",
+                     s_calibration.currentOffset, s_calibration.offsetDrift, s_calibration.recalibrations);
+                LOGI(TAG, "Trim: Voltage: %d, Current: %d", s_settings.trim.voltage, s_settings.trim.current);
+                break;
+            case 't':
+                LOGI(TAG, "Turn-on: %dus", BoostPWM_GetTurnOnTime() / TIMEBASE_CYCLES_PER_US);
+                break;
+            case 'k':
+                LOGI(TAG, "Gains: Kp >> %d, Kd >> %d, Ki >> %d", s_settings.gains.kpShift,
+                     s_settings.gains.kdShift, s_settings.gains.kiShift);
+                LOGI(TAG, "Last step: Settling: %dus, Overshoot: %dmV, Ripple: %dmV%s", s_stepResponse.settlingUs,
+                     s_stepResponse.overshootMillivolts, s_stepResponse.rippleMillivolts,
+                     s_stepResponse.complete ? "" : " (in progress)");
                 break;
             case '+':
             case '=':
@@ -253,6 +690,42 @@ int main(void)
             case 's':
                 s_settings.save = true;
                 break;
+            case 'b':
+                logPending |= LOG_LINES(LOG_LINE_BOOT, LOG_LINE_PROFILE);
+                break;
+#if CONFIG_ENABLE_PROFILE
+            case 'P':
+                logPending |= LOG_LINES(LOG_LINE_PROFILE, LOG_LINE_END);
+                break;
+#endif
+#if CONFIG_ENABLE_CHARGER
+            case 'g':
+                s_charge = !Charger_IsRunning();
+                break;
+#endif
+#if CONFIG_ENABLE_SWEEP
+            case 'i':
+                // LED style curve, stepping the current up to the limit
+                s_sweepConfig = (SweepConfig_t){
+                    .start = s_settings.current / SWEEP_MAX_POINTS,
+                    .stop = s_settings.current,
+                    .points = SWEEP_MAX_POINTS,
+                    .axis = eSWEEP_AXIS_CURRENT,
+                };
+                s_sweepStart = true;
+                break;
+#endif
+#if CONFIG_ENABLE_FRA
+            case 'a':
+                if (FRA_IsRunning())
+                {
+                    s_fraStop = true;
+                    break;
+                }
+                s_fraAmplitude = 0;
+                s_fraStart = true;
+                break;
+#endif
             default:
                 if (c <= '0' || c > '9') break;
                 if (s_state.ccMode)
@@ -267,7 +740,6 @@ int main(void)
                 }
                 break;
         }
-        Delay_Ms(100);
     }
 }
 
@@ -276,74 +748,254 @@ int main(void)
 //------------------------------------------------------------------------------
 
 /**
- * @brief  Enable the SysTick module
- * @param  None
+ * @brief  Record the time a boot phase completed
+ * @param  phase - the boot phase
  * @return None
  */
-static void SysTick_Init(void)
+static void Boot_MarkPhase(BootPhase_e phase)
 {
-    // Disable default SysTick behavior
-    SysTick->CTLR = 0;
-
-    // Enable the SysTick IRQ
-    NVIC_EnableIRQ(SysTicK_IRQn);
+    s_bootTimes[phase] = HAL_GetTicks();
+}
 
-    // Set the tick interval to 1ms for normal op
-    SysTick->CMP = (FUNCONF_SYSTEM_CORE_CLOCK / 1000) - 1;
+/**
+ * @brief  Log one line of a burst, see LOG_LINE_SIZE
+ * @param  line - which, from LOG_LINE_ATTACH to LOG_LINE_END
+ * @return None
+ */
+static void Log_Line(uint32_t line)
+{
+    switch (line)
+    {
+        case LOG_LINE_ATTACH:
+            LOGI(TAG, "Voltage: %dmV, Current: %dmA", s_settings.voltage, s_settings.current);
+            break;
+        case LOG_LINE_ATTACH + 1:
+            LOGI(TAG, "Current offset: %d", BoostPWM_GetCurrentOffset());
+            break;
+        case LOG_LINE_ATTACH + 2:
+            LOGI(TAG, "Warm start: %s", BoostPWM_IsWarmStarted() ? "yes" : "no");
+            break;
+        default:
+            if (line < LOG_LINE_PROFILE)
+            {
+                const uint32_t phase = line - LOG_LINE_BOOT;
+                LOGI(TAG, "Boot %s: %dus", s_bootPhaseNames[phase], s_bootTimes[phase] / TIMEBASE_CYCLES_PER_US);
+            }
+#if CONFIG_ENABLE_PROFILE
+            else
+            {
+                Profile_Log(line - LOG_LINE_PROFILE);
+                // Start the next window once the last section is out
+                if (line == LOG_LINE_END - 1)
+                {
+                    s_profileReset = true;
+                }
+            }
+#endif
+            break;
+    }
+}
 
-    // Start at zero
-    SysTick->CNT = 0;
-    s_systickCount = 0;
+/**
+ * @brief  Take a copy of the setpoints for the config report
+ * @param[out] report - the report
+ * @return None
+ */
+static void Report_GetConfig(ConfigReport_t *report)
+{
+    report->voltage = s_settings.voltage;
+    report->current = s_settings.current;
+    report->power = s_settings.power;
+    report->resistance = s_settings.resistance;
+    report->mode = s_settings.mode;
+    report->controller = s_controller;
+    report->outputEnabled = s_outputEnabled;
+    report->fault = s_settings.fault;
+    report->gains = s_settings.gains;
+    report->trim = s_settings.trim;
+}
 
-    // Enable SysTick counter, IRQ, HCLK/1
-    SysTick->CTLR = SYSTICK_CTLR_STE | SYSTICK_CTLR_STIE | SYSTICK_CTLR_STCLK;
+/**
+ * @brief  Look up a feature report
+ * @param  lValueLSBIndexMSB - the request value, the report ID in the low byte
+ * @return the report, or NULL if there is none with that ID
+ */
+static const HidReport_t *Report_Find(uint32_t lValueLSBIndexMSB)
+{
+    // IDs below the first wrap around to large indices
+    const uint8_t index = (uint8_t)lValueLSBIndexMSB - REPORT_ID_FIRST;
+    if (index >= array_size(s_reports) || !s_reports[index].size)
+    {
+        return NULL;
+    }
+    return &s_reports[index];
 }
 
 /**
- * @brief  Initialize the watchdog timer
- * @param reload_val - the value to reload the counter with
- * @param prescaler - the prescaler to use
+ * @brief  Handle a command written to the state report
+ * @param  e - the endpoint
+ * @param[in]  data - the packet, starting with the report ID
+ * @param  len - the length
  * @return None
+ * @note   Runs in the USB interrupt, the main loop applies the settings
  */
-static void WDT_Init(uint16_t reload_val, uint8_t prescaler)
+static void Report_SetState(struct usb_endpoint *e, const uint8_t *data, int len)
 {
-    IWDG->CTLR = 0x5555;
-    IWDG->PSCR = prescaler;
+    if (len < 6 || BOOST_REPORT_ID_STATE != data[0])
+    {
+        return;
+    }
 
-    IWDG->CTLR = 0x5555;
-    IWDG->RLDR = reload_val & 0xfff;
+    const uint8_t cmd = data[1];
+    switch (cmd)
+    {
+        case CMD_SET_VOLTAGE:
+            s_settings.voltage = *(uint32_t *)(data + 2);
+            break;
+        case CMD_SET_CURRENT:
+            s_settings.current = *(uint32_t *)(data + 2);
+            break;
+        case CMD_SAVE:
+            s_settings.save = true;
+            break;
+        case CMD_OUTPUT_ENABLE:
+            s_outputEnabled = *(uint32_t *)(data + 2) != 0;
+            break;
+        case CMD_SET_CONTROLLER:
+            s_controller = *(uint32_t *)(data + 2);
+            break;
+        case CMD_SET_MODE:
+            s_settings.mode = *(uint32_t *)(data + 2);
+            break;
+        case CMD_SET_POWER:
+            s_settings.power = *(uint32_t *)(data + 2);
+            break;
+        case CMD_SET_RESISTANCE:
+            s_settings.resistance = *(uint32_t *)(data + 2);
+            break;
+        case CMD_SET_FAULT_MODE:
+            s_settings.fault.mode = *(uint32_t *)(data + 2);
+            break;
+        case CMD_SET_FAULT_KNEE:
+            s_settings.fault.kneeMillivolts = *(uint32_t *)(data + 2);
+            break;
+        case CMD_SET_FAULT_FLOOR:
+            s_settings.fault.floorMilliamps = *(uint32_t *)(data + 2);
+            break;
+        case CMD_SET_FAULT_RETRY:
+            s_settings.fault.retryMs = *(uint32_t *)(data + 2);
+            break;
+        case CMD_FRA_START:
+            s_fraAmplitude = *(uint32_t *)(data + 2);
+            s_fraStart = true;
+            break;
+        case CMD_FRA_STOP:
+            s_fraStop = true;
+            break;
+        case CMD_SWEEP_RANGE:
+            s_sweepConfig.start = *(uint16_t *)(data + 2);
+            s_sweepConfig.stop = *(uint16_t *)(data + 4);
+            break;
+        case CMD_SWEEP_START:
+            s_sweepConfig.points = data[2];
+            s_sweepConfig.axis = data[3];
+            s_sweepStart = true;
+            break;
+        case CMD_CHARGE:
+            s_charge = *(uint32_t *)(data + 2) != 0;
+            break;
+        // The charger drives the targets itself, so it is held to the output
+        // limits here, before the 16 bit setting can wrap
+        case CMD_SET_CHARGE_VOLTAGE:
+            s_settings.charger.voltageMillivolts = min(*(uint32_t *)(data + 2), CONFIG_VOLTAGE_LIMIT);
+            break;
+        case CMD_SET_CHARGE_CURRENT:
+            s_settings.charger.currentMilliamps = min(*(uint32_t *)(data + 2), CONFIG_CURRENT_LIMIT);
+            break;
+        case CMD_SET_CHARGE_TERMINATION:
+            s_settings.charger.terminationMilliamps = *(uint32_t *)(data + 2);
+            break;
+        case CMD_SET_CHARGE_TIMEOUT:
+            s_settings.charger.timeoutMinutes = *(uint32_t *)(data + 2);
+            break;
+        case CMD_SET_CHARGE_DELTA_V:
+            s_settings.charger.deltaMillivolts = *(uint32_t *)(data + 2);
+            break;
+        case CMD_SET_VOLTAGE_TRIM:
+            s_settings.trim.voltage = *(int32_t *)(data + 2);
+            break;
+        case CMD_SET_CURRENT_TRIM:
+            s_settings.trim.current = *(int32_t *)(data + 2);
+            break;
+        case CMD_SET_PID_GAINS:
+            s_settings.gains.kpShift = data[2];
+            s_settings.gains.kdShift = data[3];
+            s_settings.gains.kiShift = data[4];
+            break;
+#if CONFIG_ENABLE_PROFILE
+        case CMD_PROFILE_RESET:
+            s_profileReset = true;
+            break;
+#endif
+#if CONFIG_ENABLE_TRACE
+        case CMD_TRACE_ARM:
+            Trace_Arm();
+            break;
+#endif
+    }
 
-    IWDG->CTLR = 0xCCCC;
+    e->count++;
+    s_bytesReceived += len;
+    s_stats.commands++;
 }
 
+#if CONFIG_ENABLE_FRA
 /**
- * @brief  Pet the watchdog timer
+ * @brief  Get the FRA report
  * @param  None
- * @return None
+ * @return the report
  */
-static void WDT_Pet(void)
+static const void *Report_GetFra(void)
 {
-    IWDG->CTLR = 0xAAAA;
+    return FRA_GetReport();
 }
+#endif
 
+#if CONFIG_ENABLE_SWEEP
 /**
- * @brief  SysTick interrupt handler
+ * @brief  Get the sweep report
  * @param  None
- * @return None
- * @note   __attribute__((interrupt)) syntax is crucial!
+ * @return the report
  */
-void SysTick_Handler(void) __attribute__((interrupt));
-void SysTick_Handler(void)
+static const void *Report_GetSweep(void)
 {
-    // Set the next interrupt to be in 1/1000th of a second
-    SysTick->CMP += (FUNCONF_SYSTEM_CORE_CLOCK / 1000);
+    return Sweep_GetReport();
+}
+#endif
 
-    // Clear IRQ
-    SysTick->SR = 0;
+#if CONFIG_ENABLE_TRACE
+/**
+ * @brief  Get the trace report
+ * @param  None
+ * @return the report
+ */
+static const void *Report_GetTrace(void)
+{
+    return Trace_GetReport();
+}
+#endif
 
-    // Update counter
-    s_systickCount++;
+#if CONFIG_ENABLE_HISTORY
+/**
+ * @brief  Get the history report
+ * @param  None
+ * @return the report last published, it alternates between two buffers
+ */
+static const void *Report_GetHistory(void)
+{
+    return History_GetReport();
 }
+#endif
 
 /**
  * @brief  Handle USB user in requests
@@ -373,7 +1025,7 @@ void usb_handle_user_in_request(struct usb_endpoint *e, uint8_t *scratchpad, int
  */
 void usb_handle_other_control_message(struct usb_endpoint *e, struct usb_urb *s, struct rv003usb_internal *ist)
 {
-    LogUEvent(SysTick->CNT, s->wRequestTypeLSBRequestMSB, s->lValueLSBIndexMSB, s->wLength);
+    LogUEvent(HAL_GetTicks(), s->wRequestTypeLSBRequestMSB, s->lValueLSBIndexMSB, s->wLength);
     // e->opaque = (uint8_t *)1;
 }
 
@@ -388,108 +1040,39 @@ void usb_handle_other_control_message(struct usb_endpoint *e, struct usb_urb *s,
  */
 void usb_handle_user_data(struct usb_endpoint *e, int current_endpoint, uint8_t *data, int len, struct rv003usb_internal *ist)
 {
-#if 0
-    int offset = e->count << 3;
-    int torx = e->max_len - offset;
-    if (torx > len) torx = len;
-	if( torx > 0 )
-	{
-		memcpy( scratch + offset, data, torx );
-		e->count++;
-
-      s_bytesReceived += torx;
-	}
-#else
-    if (len >= 6 && 0xAA == data[0])
+    // Set by usb_handle_hid_set_report_start() for reports that take writes
+    const HidReport_t *report = (const HidReport_t *)e->opaque;
+    if (report)
     {
-        const uint8_t cmd = data[1];
-        switch (cmd)
-        {
-            case CMD_SET_VOLTAGE:
-                s_settings.voltage = *(uint32_t *)(data + 2);
-                break;
-            case CMD_SET_CURRENT:
-                s_settings.current = *(uint32_t *)(data + 2);
-                break;
-            case CMD_SAVE:
-                s_settings.save = true;
-                break;
-        }
-
-        e->count++;
-        s_bytesReceived += len;
+        report->set(e, data, len);
     }
-#endif
 }
 
 void usb_handle_hid_get_report_start(struct usb_endpoint *e, int reqLen, uint32_t lValueLSBIndexMSB)
 {
-
-    // You can check the lValueLSBIndexMSB word to decide what you want to do here
-    // But, whatever you point this at will be returned back to the host PC where
-    // it calls hid_get_feature_report.
-    //
     // Please note, that on some systems, for this to work, your return length must
     // match the length defined in HID_REPORT_COUNT, in your HID report, in usb_config.h
+    const HidReport_t *report = Report_Find(lValueLSBIndexMSB);
+    if (!report)
+    {
+        // Nothing but the status stage
+        return;
+    }
 
-    // if (reqLen > sizeof(s_state)) reqLen = sizeof(s_state);
-    e->opaque = (void *)&s_state;
-    e->max_len = sizeof(s_state);
+    e->opaque = (void *)(report->get ? report->get() : report->data);
+    e->max_len = report->size < reqLen ? report->size : reqLen;
 }
 
 void usb_handle_hid_set_report_start(struct usb_endpoint *e, int reqLen, uint32_t lValueLSBIndexMSB)
 {
-    // Here is where you get an alert when the host PC calls hid_send_feature_report.
-    //
-    // You can handle the appropriate message here.  Please note that in this
-    // example, the data is chunked into groups-of-8-bytes.
-    //
-    // Note that you may need to make this match HID_REPORT_COUNT, in your HID
-    // report, in usb_config.h
-
-    // if (reqLen > sizeof(s_state)) reqLen = sizeof(s_state);
-    e->max_len = sizeof(s_state);
-}
-
-static uint8_t newByte = 0;
-static uint32_t count = 0;
-static uint32_t countLast = 0;
-
-/**
- * @brief  Debugger input handler
- * @param  numbytes - the number of bytes received
- * @param  data - the data (8 bytes)
- * @return None
- */
-void handle_debug_input(int numbytes, uint8_t *data)
-{
-    newByte = data[0];
-    count += numbytes;
-}
-
-/**
- * @brief  Get the next character from the debugger
- * @param  None
- * @return the next character or -1 if no character is available
- * @note   This function will block for up to 100ms waiting for a character
- */
-int getchar(void)
-{
-    const uint32_t timeout = 100;
-    const uint32_t end = s_systickCount + timeout;
-    while (count == countLast && (s_systickCount < end))
-    {
-        poll_input();
-        putchar(0);
-    }
-
-    if (count == countLast)
+    // The data arrives in packets of 8 bytes, each passed on to the report's
+    // handler by usb_handle_user_data(). Reports without one drop them.
+    const HidReport_t *report = Report_Find(lValueLSBIndexMSB);
+    if (report && report->set)
     {
-        return -1;
+        e->opaque = (void *)report;
+        e->max_len = report->size;
     }
-
-    countLast = count;
-    return newByte;
 }
 
 //------------------------------------------------------------------------------
@@ -12,7 +12,7 @@
 // Module includes
 //------------------------------------------------------------------------------
 #include "nvs.h"
-#include "ch32v003_flash.h"
+#include "hal.h"
 #include "log.h"
 
 //------------------------------------------------------------------------------
@@ -48,8 +48,8 @@ static uint32_t nvs_page_start = 0;
 
 void NVS_Init(void)
 {
-    flash_set_latency();
-    nvs_page_start = flash_calculate_runtime_address(0);
+    HAL_Flash_Init();
+    nvs_page_start = HAL_Flash_Address(0);
     LOGD(TAG, "NVS page start: 0x%08X", nvs_page_start);
 }
 
@@ -60,22 +60,22 @@ void NVS_Save(uint8_t *data, size_t size)
         LOGE(TAG, "Cannot save data, size %d is too big", size);
         return;
     }
-    flash_unlock();
+    HAL_Flash_Unlock();
     LOGD(TAG, "Memory unlocked");
 
     LOGD(TAG, "Erasing 64b page");
-    flash_erase_page(nvs_page_start);
+    HAL_Flash_ErasePage(nvs_page_start);
     LOGD(TAG, "Memory erased");
 
     LOGW(TAG, "Writing %d bytes", size);
     for (size_t i = 0; i < size; i += 2)
     {
         const uint16_t value = data[i] | (data[i + 1] << 8);
-        flash_program_16(nvs_page_start + i, value);
+        HAL_Flash_Program16(nvs_page_start + i, value);
     }
     LOGD(TAG, "Memory written");
 
-    flash_lock();
+    HAL_Flash_Lock();
     LOGD(TAG, "Memory locked");
 }
 
@@ -89,7 +89,7 @@ void NVS_Load(uint8_t *data, size_t offset, size_t size)
 
     for (size_t i = 0; i < size; i++)
     {
-        data[i] = flash_read_8_bits(nvs_page_start + offset + i);
+        data[i] = HAL_Flash_Read8(nvs_page_start + offset + i);
     }
 }
 
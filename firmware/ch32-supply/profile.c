@@ -0,0 +1,154 @@
+//------------------------------------------------------------------------------
+//       Filename: profile.c
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Implements the cycle count profiling API
+//------------------------------------------------------------------------------
+//       Notes : None
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#include "profile.h"
+#include "hal.h"
+#include "log.h"
+
+#if CONFIG_ENABLE_PROFILE
+
+//------------------------------------------------------------------------------
+// Module constant defines
+//------------------------------------------------------------------------------
+#define TAG "profile"
+
+// Totals are halved together with the count to stay within 32 bits
+#define PROFILE_MAX_COUNT (1 << 12)
+
+//------------------------------------------------------------------------------
+// External variables
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// External functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module type definitions
+//------------------------------------------------------------------------------
+typedef struct
+{
+    uint32_t min;
+    uint32_t max;
+    uint32_t total;
+    uint32_t count;
+} ProfileCounter_t;
+
+//------------------------------------------------------------------------------
+// Module static variables
+//------------------------------------------------------------------------------
+static volatile ProfileCounter_t s_counters[ePROFILE_COUNT] = {0};
+
+static const char *const s_names[ePROFILE_COUNT] = {
+    [ePROFILE_ADC_ISR] = "adc isr",
+    [ePROFILE_CONTROLLER] = "controller",
+    [ePROFILE_GET_STATE] = "get state",
+    [ePROFILE_MAIN_LOOP] = "main loop",
+};
+
+//------------------------------------------------------------------------------
+// Module static function prototypes
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module externally exported functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  Get the current cycle count
+ * @param  None
+ * @return the SysTick counter
+ */
+uint32_t Profile_Now(void)
+{
+    return HAL_GetTicks();
+}
+
+/**
+ * @brief  Record the cycles spent since a start count
+ * @param  id - the profiled scope
+ * @param  start - the count from Profile_Now() at the start of the scope
+ * @return None
+ */
+void Profile_Record(ProfileId_e id, uint32_t start)
+{
+    const uint32_t cycles = HAL_GetTicks() - start;
+    volatile ProfileCounter_t *counter = &s_counters[id];
+
+    if (counter->count == 0 || cycles < counter->min)
+    {
+        counter->min = cycles;
+    }
+    if (cycles > counter->max)
+    {
+        counter->max = cycles;
+    }
+
+    counter->total += cycles;
+    if (++counter->count >= PROFILE_MAX_COUNT)
+    {
+        counter->total >>= 1;
+        counter->count >>= 1;
+    }
+}
+
+/**
+ * @brief  Get the min, max and average cycles of every scope
+ * @param[out] report - the profiling results
+ * @return None
+ */
+void Profile_GetReport(ProfileReport_t *report)
+{
+    for (int i = 0; i < ePROFILE_COUNT; i++)
+    {
+        const ProfileCounter_t counter = s_counters[i];
+        report->stats[i] = (ProfileStats_t){
+            .min = counter.min,
+            .max = counter.max,
+            .average = counter.count ? counter.total / counter.count : 0,
+        };
+    }
+}
+
+/**
+ * @brief  Clear all the counters
+ * @param  None
+ * @return None
+ */
+void Profile_Reset(void)
+{
+    for (int i = 0; i < ePROFILE_COUNT; i++)
+    {
+        s_counters[i] = (ProfileCounter_t){0};
+    }
+}
+
+/**
+ * @brief  Log the profiling results of one section
+ * @param  id - the section
+ * @return None
+ * @note   A line per call, the four do not fit the console at once
+ */
+void Profile_Log(ProfileId_e id)
+{
+    ProfileReport_t report;
+    Profile_GetReport(&report);
+    LOGI(TAG, "%-10s min: %6d, max: %6d, avg: %6d cycles", s_names[id], report.stats[id].min,
+         report.stats[id].max, report.stats[id].average);
+}
+
+#endif // CONFIG_ENABLE_PROFILE
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
@@ -0,0 +1,82 @@
+//------------------------------------------------------------------------------
+//       Filename: profile.h
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Defines the cycle count profiling API
+//------------------------------------------------------------------------------
+//       Notes : SysTick runs from HCLK, so its counter gives the core cycles
+//               spent in a scope, flash wait states and interrupt entry
+//               included. The scopes compile out when profiling is off.
+//------------------------------------------------------------------------------
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#include "funconfig.h"
+#include <stdint.h>
+
+//------------------------------------------------------------------------------
+// Module exported defines
+//------------------------------------------------------------------------------
+#ifndef CONFIG_ENABLE_PROFILE
+#define CONFIG_ENABLE_PROFILE (0)
+#endif
+
+#if CONFIG_ENABLE_PROFILE
+#define PROFILE_START(start_)   const uint32_t start_ = Profile_Now()
+#define PROFILE_STOP(id_, start_) Profile_Record((id_), (start_))
+#else
+#define PROFILE_START(start_)
+#define PROFILE_STOP(id_, start_)
+#endif
+
+//------------------------------------------------------------------------------
+// Module exported type definitions
+//------------------------------------------------------------------------------
+typedef enum
+{
+    ePROFILE_ADC_ISR = 0, // Whole control loop interrupt
+    ePROFILE_CONTROLLER,  // PID or cascade step
+    ePROFILE_GET_STATE,   // BoostPWM_GetState()
+    ePROFILE_MAIN_LOOP,   // One main loop iteration
+    ePROFILE_COUNT,
+} ProfileId_e;
+
+typedef struct __attribute__((packed))
+{
+    uint32_t min;
+    uint32_t max;
+    uint32_t average;
+} ProfileStats_t;
+
+typedef struct __attribute__((packed))
+{
+    ProfileStats_t stats[ePROFILE_COUNT];
+} ProfileReport_t;
+
+//------------------------------------------------------------------------------
+// Module exported functions
+//------------------------------------------------------------------------------
+uint32_t Profile_Now(void);
+void Profile_Record(ProfileId_e id, uint32_t start);
+void Profile_GetReport(ProfileReport_t *report);
+void Profile_Reset(void);
+void Profile_Log(ProfileId_e id);
+
+//------------------------------------------------------------------------------
+// Module exported variables
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+#ifdef __cplusplus
+}
+#endif
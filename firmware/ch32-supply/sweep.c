@@ -0,0 +1,217 @@
+//------------------------------------------------------------------------------
+//       Filename: sweep.c
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Implements the I-V curve sweep API
+//------------------------------------------------------------------------------
+//       Notes : Each point steps the target, then waits for an averaged
+//               measurement from the control loop. The loop only starts
+//               averaging once it has settled, so the time per point
+//               follows the step response instead of a fixed delay.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#include "sweep.h"
+#include "boost.h"
+#include "hal.h"
+#include "log.h"
+
+#if CONFIG_ENABLE_SWEEP
+
+//------------------------------------------------------------------------------
+// Module constant defines
+//------------------------------------------------------------------------------
+#define TAG "sweep"
+
+#define SYSTICKS_PER_MS (FUNCONF_SYSTEM_CORE_CLOCK / 1000)
+
+//------------------------------------------------------------------------------
+// External variables
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// External functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module type definitions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module static variables
+//------------------------------------------------------------------------------
+static SweepConfig_t s_config = {0};
+static SweepReport_t s_report = {0};
+static bool s_measuring = false;
+static uint32_t s_startTime = 0;
+
+//------------------------------------------------------------------------------
+// Module static function prototypes
+//------------------------------------------------------------------------------
+static void SetPoint(uint8_t index);
+
+//------------------------------------------------------------------------------
+// Module externally exported functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  Start a sweep, the output must be on
+ * @param  config - the sweep range, number of points and axis
+ * @return true if the sweep was started, false if the range is outside the
+ *         output limits or the config is otherwise invalid
+ * @note   The caller is expected to restore its setpoints once Sweep_Task()
+ *         reports the end of the sweep.
+ */
+bool Sweep_Start(const SweepConfig_t *config)
+{
+    // A zero target switches the output off, so it would never be measured
+    if (config->points < 2 || config->points > SWEEP_MAX_POINTS || config->axis >= eSWEEP_AXIS_COUNT ||
+        config->start == 0 || config->stop == 0 || !BoostPWM_IsOutputEnabled())
+    {
+        LOGE(TAG, "Invalid sweep: %d points, axis %d", config->points, config->axis);
+        return false;
+    }
+
+    const uint16_t limit = config->axis == eSWEEP_AXIS_VOLTAGE ? CONFIG_VOLTAGE_LIMIT : CONFIG_CURRENT_LIMIT;
+    if (config->start > limit || config->stop > limit)
+    {
+        LOGE(TAG, "Sweep past the %d limit: %d to %d", limit, config->start, config->stop);
+        return false;
+    }
+
+    s_config = *config;
+    s_report.state = eSWEEP_STATE_RUNNING;
+    s_report.count = 0;
+    s_report.unsettled = 0;
+    s_measuring = false;
+    s_startTime = HAL_GetTicks();
+
+    LOGI(TAG, "Sweeping %s from %d to %d in %d points",
+         config->axis == eSWEEP_AXIS_VOLTAGE ? "voltage" : "current",
+         config->start, config->stop, config->points);
+    return true;
+}
+
+/**
+ * @brief  Abort a running sweep, the points measured so far are kept
+ * @param  None
+ * @return None
+ */
+void Sweep_Stop(void)
+{
+    if (s_report.state == eSWEEP_STATE_RUNNING)
+    {
+        s_report.state = eSWEEP_STATE_ABORTED;
+    }
+}
+
+/**
+ * @brief  Advance the sweep, called from the main loop
+ * @param  None
+ * @return true if the sweep ended during this call
+ */
+bool Sweep_Task(void)
+{
+    if (s_report.state != eSWEEP_STATE_RUNNING)
+    {
+        return false;
+    }
+
+    // Measurements only progress while regulating
+    if (!BoostPWM_IsOutputEnabled())
+    {
+        s_report.state = eSWEEP_STATE_ABORTED;
+        LOGW(TAG, "Sweep aborted after %d points", s_report.count);
+        return true;
+    }
+
+    if (s_measuring)
+    {
+        BoostMeasurement_t measurement;
+        if (!BoostPWM_GetMeasurement(&measurement))
+        {
+            return false;
+        }
+
+        s_measuring = false;
+        s_report.points[s_report.count] = (SweepPoint_t){
+            .millivolts = measurement.millivolts,
+            .milliamps = measurement.milliamps,
+        };
+        if (!measurement.settled)
+        {
+            s_report.unsettled |= 1UL << s_report.count;
+        }
+        s_report.count++;
+    }
+
+    if (s_report.count >= s_config.points)
+    {
+        s_report.state = eSWEEP_STATE_DONE;
+        LOGI(TAG, "Sweep done in %dms", (HAL_GetTicks() - s_startTime) / SYSTICKS_PER_MS);
+        for (uint8_t i = 0; i < s_report.count; i++)
+        {
+            LOGI(TAG, "%2d: %5dmV %4dmA%s", i, s_report.points[i].millivolts, s_report.points[i].milliamps,
+                 (s_report.unsettled & (1UL << i)) ? " (unsettled)" : "");
+        }
+        return true;
+    }
+
+    SetPoint(s_report.count);
+    BoostPWM_StartMeasurement();
+    s_measuring = true;
+    return false;
+}
+
+/**
+ * @brief  Check if a sweep is in progress
+ * @param  None
+ * @return true if running
+ */
+bool Sweep_IsRunning(void)
+{
+    return s_report.state == eSWEEP_STATE_RUNNING;
+}
+
+/**
+ * @brief  Get the measured curve
+ * @param  None
+ * @return pointer to the report
+ */
+const SweepReport_t *Sweep_GetReport(void)
+{
+    return &s_report;
+}
+
+//------------------------------------------------------------------------------
+// Module static functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  Step the swept target to a point
+ * @param  index - the point index
+ * @return None
+ */
+static void SetPoint(uint8_t index)
+{
+    const int32_t span = (int32_t)s_config.stop - s_config.start;
+    const uint32_t value = s_config.start + (span * index) / (s_config.points - 1);
+
+    if (s_config.axis == eSWEEP_AXIS_VOLTAGE)
+    {
+        BoostPWM_SetVoltageTarget(value);
+    }
+    else
+    {
+        BoostPWM_SetCurrentLimit(value);
+    }
+}
+
+#endif // CONFIG_ENABLE_SWEEP
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
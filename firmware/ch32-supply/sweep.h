@@ -0,0 +1,88 @@
+//------------------------------------------------------------------------------
+//       Filename: sweep.h
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Defines the I-V curve sweep API
+//------------------------------------------------------------------------------
+//       Notes : None
+//------------------------------------------------------------------------------
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#include "funconfig.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+//------------------------------------------------------------------------------
+// Module exported defines
+//------------------------------------------------------------------------------
+
+#define SWEEP_MAX_POINTS (32)
+
+//------------------------------------------------------------------------------
+// Module exported type definitions
+//------------------------------------------------------------------------------
+typedef enum
+{
+    eSWEEP_AXIS_VOLTAGE = 0, // Step the voltage target, current limit is the compliance
+    eSWEEP_AXIS_CURRENT,     // Step the current limit, voltage target is the compliance
+    eSWEEP_AXIS_COUNT,
+} SweepAxis_e;
+
+typedef enum
+{
+    eSWEEP_STATE_IDLE = 0,
+    eSWEEP_STATE_RUNNING,
+    eSWEEP_STATE_DONE,
+    eSWEEP_STATE_ABORTED,
+} SweepState_e;
+
+typedef struct
+{
+    uint16_t start; // mV or mA, depending on the axis
+    uint16_t stop;
+    uint8_t points;
+    uint8_t axis;
+} SweepConfig_t;
+
+typedef struct __attribute__((packed))
+{
+    uint16_t millivolts;
+    uint16_t milliamps;
+} SweepPoint_t;
+
+typedef struct __attribute__((packed))
+{
+    uint8_t state;
+    uint8_t count;
+    uint32_t unsettled; // Bit per point that timed out before settling
+    SweepPoint_t points[SWEEP_MAX_POINTS];
+} SweepReport_t;
+
+//------------------------------------------------------------------------------
+// Module exported functions
+//------------------------------------------------------------------------------
+bool Sweep_Start(const SweepConfig_t *config);
+void Sweep_Stop(void);
+bool Sweep_Task(void);
+bool Sweep_IsRunning(void);
+const SweepReport_t *Sweep_GetReport(void);
+
+//------------------------------------------------------------------------------
+// Module exported variables
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,281 @@
+//------------------------------------------------------------------------------
+//       Filename: telemetry.c
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Implements the telemetry sample packing API
+//------------------------------------------------------------------------------
+//       Notes : The decoder is the reference for host tools, the firmware
+//               only encodes and the linker drops the rest.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#include "telemetry.h"
+#include <stdbool.h>
+
+//------------------------------------------------------------------------------
+// Module constant defines
+//------------------------------------------------------------------------------
+
+// A zig-zag mapped 16 bit difference takes up to 17 bits
+#define VARINT_MAX_SIZE (3)
+
+//------------------------------------------------------------------------------
+// External variables
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// External functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module type definitions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module static variables
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module static function prototypes
+//------------------------------------------------------------------------------
+static void Differences(const TelemetrySample_t *previous, const TelemetrySample_t *sample, uint8_t periodMs,
+                        uint32_t *fields);
+static uint8_t VarintSize(uint32_t value);
+static uint8_t PutVarint(uint8_t *buffer, uint32_t value);
+static bool GetVarint(const uint8_t *buffer, uint8_t size, uint8_t *offset, uint32_t *value);
+
+//------------------------------------------------------------------------------
+// Module externally exported functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  Pack as many of the newest samples as fit
+ * @param  samples - the samples, oldest first
+ * @param  count - the number of samples
+ * @param  periodMs - the nominal time between samples
+ * @param[out] buffer - the block
+ * @param  capacity - the size of the buffer
+ * @param[out] size - the bytes used
+ * @return the number of samples packed, the last ones of samples
+ */
+uint8_t Telemetry_Encode(const TelemetrySample_t *samples, uint8_t count, uint8_t periodMs, uint8_t *buffer,
+                         uint8_t capacity, uint8_t *size)
+{
+    *size = 0;
+    if (!count || capacity < TELEMETRY_KEYFRAME_SIZE)
+    {
+        return 0;
+    }
+
+    // Walk back from the newest sample while its difference and its half of
+    // a mask byte still fit behind the keyframe
+    uint32_t fields[TELEMETRY_FIELDS];
+    uint32_t used = TELEMETRY_KEYFRAME_SIZE;
+    uint8_t first = count - 1;
+    while (first > 0)
+    {
+        Differences(&samples[first - 1], &samples[first], periodMs, fields);
+        uint32_t cost = (count - first) & 1; // Every other sample opens a mask byte
+        for (int i = 0; i < TELEMETRY_FIELDS; i++)
+        {
+            cost += fields[i] ? VarintSize(fields[i]) : 0;
+        }
+        if (used + cost > capacity)
+        {
+            break;
+        }
+        used += cost;
+        first--;
+    }
+
+    const TelemetrySample_t *key = &samples[first];
+    buffer[0] = key->voltage;
+    buffer[1] = key->voltage >> 8;
+    buffer[2] = key->current;
+    buffer[3] = key->current >> 8;
+    buffer[4] = key->duty;
+
+    uint8_t offset = TELEMETRY_KEYFRAME_SIZE;
+    uint8_t mask = 0;
+    for (uint8_t n = first + 1; n < count; n++)
+    {
+        const bool high = (n - first - 1) & 1;
+        if (!high)
+        {
+            mask = offset++;
+            buffer[mask] = 0;
+        }
+
+        Differences(&samples[n - 1], &samples[n], periodMs, fields);
+        for (int i = 0; i < TELEMETRY_FIELDS; i++)
+        {
+            if (fields[i])
+            {
+                buffer[mask] |= 1 << (i + (high ? 4 : 0));
+                offset += PutVarint(&buffer[offset], fields[i]);
+            }
+        }
+    }
+
+    *size = offset;
+    return count - first;
+}
+
+/**
+ * @brief  Unpack a block
+ * @param  buffer - the block
+ * @param  size - the bytes in the block
+ * @param  count - the number of samples packed
+ * @param  periodMs - the nominal time between samples
+ * @param[out] samples - the samples, oldest first, the first has no elapsed time
+ * @return the number of samples, or -1 if the block is malformed
+ */
+int Telemetry_Decode(const uint8_t *buffer, uint8_t size, uint8_t count, uint8_t periodMs,
+                     TelemetrySample_t *samples)
+{
+    if (!count)
+    {
+        return 0;
+    }
+    if (size < TELEMETRY_KEYFRAME_SIZE)
+    {
+        return -1;
+    }
+
+    samples[0] = (TelemetrySample_t){
+        .elapsedMs = 0,
+        .voltage = buffer[0] | buffer[1] << 8,
+        .current = buffer[2] | buffer[3] << 8,
+        .duty = buffer[4],
+    };
+
+    uint8_t offset = TELEMETRY_KEYFRAME_SIZE;
+    uint8_t mask = 0;
+    for (uint8_t n = 1; n < count; n++)
+    {
+        if ((n - 1) & 1)
+        {
+            mask >>= 4;
+        }
+        else if (offset < size)
+        {
+            mask = buffer[offset++];
+        }
+        else
+        {
+            return -1;
+        }
+
+        int32_t fields[TELEMETRY_FIELDS] = {0};
+        for (int i = 0; i < TELEMETRY_FIELDS; i++)
+        {
+            uint32_t value = 0;
+            if ((mask & (1 << i)) && !GetVarint(buffer, size, &offset, &value))
+            {
+                return -1;
+            }
+            fields[i] = (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+        }
+
+        const TelemetrySample_t *previous = &samples[n - 1];
+        samples[n] = (TelemetrySample_t){
+            .elapsedMs = periodMs + fields[0],
+            .voltage = previous->voltage + fields[1],
+            .current = previous->current + fields[2],
+            .duty = previous->duty + fields[3],
+        };
+    }
+
+    return offset == size ? count : -1;
+}
+
+//------------------------------------------------------------------------------
+// Module static functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  Zig-zag mapped differences between two samples
+ * @param  previous - the earlier sample
+ * @param  sample - the later sample
+ * @param  periodMs - the nominal time between samples
+ * @param[out] fields - the differences, in field order
+ * @return None
+ */
+static void Differences(const TelemetrySample_t *previous, const TelemetrySample_t *sample, uint8_t periodMs,
+                        uint32_t *fields)
+{
+    const int32_t differences[TELEMETRY_FIELDS] = {
+        (int32_t)sample->elapsedMs - periodMs,
+        (int16_t)(sample->voltage - previous->voltage),
+        (int16_t)(sample->current - previous->current),
+        (int8_t)(sample->duty - previous->duty),
+    };
+
+    for (int i = 0; i < TELEMETRY_FIELDS; i++)
+    {
+        fields[i] = ((uint32_t)differences[i] << 1) ^ (uint32_t)(differences[i] >> 31);
+    }
+}
+
+/**
+ * @brief  Get the size of a varint
+ * @param  value - the value
+ * @return bytes
+ */
+static uint8_t VarintSize(uint32_t value)
+{
+    uint8_t size = 1;
+    while (value >>= 7)
+    {
+        size++;
+    }
+    return size;
+}
+
+/**
+ * @brief  Write a varint
+ * @param[out] buffer - where to write it
+ * @param  value - the value
+ * @return bytes written
+ */
+static uint8_t PutVarint(uint8_t *buffer, uint32_t value)
+{
+    uint8_t size = 0;
+    while (value >= 0x80)
+    {
+        buffer[size++] = value | 0x80;
+        value >>= 7;
+    }
+    buffer[size++] = value;
+    return size;
+}
+
+/**
+ * @brief  Read a varint
+ * @param  buffer - the block
+ * @param  size - the bytes in the block
+ * @param[in,out] offset - where to read, advanced past the varint
+ * @param[out] value - the value
+ * @return false if it runs past the block or is too long
+ */
+static bool GetVarint(const uint8_t *buffer, uint8_t size, uint8_t *offset, uint32_t *value)
+{
+    *value = 0;
+    for (int i = 0; i < VARINT_MAX_SIZE && *offset < size; i++)
+    {
+        const uint8_t byte = buffer[(*offset)++];
+        *value |= (uint32_t)(byte & 0x7f) << (7 * i);
+        if (!(byte & 0x80))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
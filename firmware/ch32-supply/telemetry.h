@@ -0,0 +1,74 @@
+//------------------------------------------------------------------------------
+//       Filename: telemetry.h
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Defines the telemetry sample packing API
+//------------------------------------------------------------------------------
+//       Notes : A block starts with a keyframe, the oldest sample in full:
+//                 voltage (u16), current (u16), duty (u8), little endian
+//               Every later sample is the difference to the one before it,
+//               field by field, in this order:
+//                 0 - elapsed ms minus the sample period
+//                 1 - voltage, mV
+//                 2 - current, mA, wrapping at 16 bits
+//                 3 - duty, wrapping at 8 bits
+//               Each difference is zig-zag mapped to unsigned and written as
+//               a varint, 7 bits per byte, low first, the top bit set on all
+//               but the last byte. Zero differences are left out. A mask
+//               byte in front of every pair of samples says which fields are
+//               present, bit N for field N, the low nibble for the first
+//               sample of the pair and the high nibble for the second.
+//               A steady output mostly changes by a few counts per sample,
+//               which is one byte per changed field plus half a mask byte.
+//------------------------------------------------------------------------------
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#include <stdint.h>
+
+//------------------------------------------------------------------------------
+// Module exported defines
+//------------------------------------------------------------------------------
+#define TELEMETRY_KEYFRAME_SIZE (5)
+#define TELEMETRY_FIELDS        (4)
+
+// Set in TelemetrySample_t.current while in constant current
+#define TELEMETRY_CC_MODE (0x8000)
+
+//------------------------------------------------------------------------------
+// Module exported type definitions
+//------------------------------------------------------------------------------
+typedef struct
+{
+    uint16_t voltage;  // mV
+    uint16_t current;  // mA, TELEMETRY_CC_MODE in constant current
+    uint8_t elapsedMs; // Since the sample before, saturates at 255
+    uint8_t duty;
+} TelemetrySample_t;
+
+//------------------------------------------------------------------------------
+// Module exported functions
+//------------------------------------------------------------------------------
+uint8_t Telemetry_Encode(const TelemetrySample_t *samples, uint8_t count, uint8_t periodMs, uint8_t *buffer,
+                         uint8_t capacity, uint8_t *size);
+int Telemetry_Decode(const uint8_t *buffer, uint8_t size, uint8_t count, uint8_t periodMs,
+                     TelemetrySample_t *samples);
+
+//------------------------------------------------------------------------------
+// Module exported variables
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,131 @@
+//------------------------------------------------------------------------------
+//       Filename: timebase.c
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Implements the monotonic timebase API
+//------------------------------------------------------------------------------
+//       Notes : The microsecond and millisecond counts are accumulated from
+//               the same deltas with their remainders carried, so there is no
+//               64 bit division (a libgcc call on RV32EC) on any read.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#include "timebase.h"
+#include "hal.h"
+
+//------------------------------------------------------------------------------
+// Module constant defines
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// External variables
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// External functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module type definitions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module static variables
+//------------------------------------------------------------------------------
+static uint32_t s_lastTicks = 0;
+static uint64_t s_cycles = 0;
+static uint32_t s_micros = 0;
+static uint32_t s_microsRemainder = 0;
+static uint32_t s_millis = 0;
+static uint32_t s_millisRemainder = 0;
+
+//------------------------------------------------------------------------------
+// Module static function prototypes
+//------------------------------------------------------------------------------
+static void Update(void);
+
+//------------------------------------------------------------------------------
+// Module externally exported functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  Start the free running counter, time starts at zero
+ * @param  None
+ * @return None
+ */
+void Timebase_Init(void)
+{
+    HAL_SysTick_Start();
+    s_lastTicks = HAL_GetTicks();
+    s_cycles = 0;
+    s_micros = s_microsRemainder = 0;
+    s_millis = s_millisRemainder = 0;
+}
+
+/**
+ * @brief  Get the time since Timebase_Init()
+ * @param  None
+ * @return core cycles
+ */
+uint64_t Timebase_Now(void)
+{
+    Update();
+    return s_cycles;
+}
+
+/**
+ * @brief  Get the time since Timebase_Init()
+ * @param  None
+ * @return microseconds, wraps after ~71 minutes
+ */
+uint32_t Timebase_Micros(void)
+{
+    Update();
+    return s_micros;
+}
+
+/**
+ * @brief  Get the time since Timebase_Init()
+ * @param  None
+ * @return milliseconds, wraps after ~49 days
+ */
+uint32_t Timebase_Millis(void)
+{
+    Update();
+    return s_millis;
+}
+
+//------------------------------------------------------------------------------
+// Module static functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  Fold the cycles since the last read into the counts
+ * @param  None
+ * @return None
+ */
+static void Update(void)
+{
+    const uint32_t ticks = HAL_GetTicks();
+    const uint32_t delta = ticks - s_lastTicks;
+    s_lastTicks = ticks;
+
+    s_cycles += delta;
+
+    // The remainders stay below a period, so the sums fit 32 bits as long as
+    // reads come more than a millisecond inside the wrap
+    const uint32_t micros = (s_microsRemainder + delta) / TIMEBASE_CYCLES_PER_US;
+    s_microsRemainder = (s_microsRemainder + delta) - micros * TIMEBASE_CYCLES_PER_US;
+    s_micros += micros;
+
+    const uint32_t millis = (s_millisRemainder + delta) / TIMEBASE_CYCLES_PER_MS;
+    s_millisRemainder = (s_millisRemainder + delta) - millis * TIMEBASE_CYCLES_PER_MS;
+    s_millis += millis;
+}
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
@@ -0,0 +1,57 @@
+//------------------------------------------------------------------------------
+//       Filename: timebase.h
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Defines the monotonic timebase API
+//------------------------------------------------------------------------------
+//       Notes : SysTick free runs from HCLK with no interrupt. Its 32 bit
+//               counter wraps every ~89s at 48MHz, reads extend it to 64 bits
+//               by adding the cycles elapsed since the previous read, so it
+//               must be read at least once per wrap, which the main loop does.
+//               Not reentrant, read it from the main loop only. Interrupts
+//               time intervals with HAL_GetTicks() differences instead.
+//------------------------------------------------------------------------------
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#include "funconfig.h"
+#include <stdint.h>
+
+//------------------------------------------------------------------------------
+// Module exported defines
+//------------------------------------------------------------------------------
+#define TIMEBASE_CYCLES_PER_US (FUNCONF_SYSTEM_CORE_CLOCK / 1000000)
+#define TIMEBASE_CYCLES_PER_MS (FUNCONF_SYSTEM_CORE_CLOCK / 1000)
+
+#define TIMEBASE_MS(ms) ((uint64_t)(ms) * TIMEBASE_CYCLES_PER_MS)
+
+//------------------------------------------------------------------------------
+// Module exported type definitions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module exported functions
+//------------------------------------------------------------------------------
+void Timebase_Init(void);
+uint64_t Timebase_Now(void);
+uint32_t Timebase_Micros(void);
+uint32_t Timebase_Millis(void);
+
+//------------------------------------------------------------------------------
+// Module exported variables
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+#ifdef __cplusplus
+}
+#endif
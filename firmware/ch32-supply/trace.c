@@ -0,0 +1,113 @@
+//------------------------------------------------------------------------------
+//       Filename: trace.c
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Implements the on-device ADC trace capture
+//------------------------------------------------------------------------------
+//       Notes : A one shot capture of the next TRACE_SAMPLES interrupts after
+//               Trace_Arm(). Idle, the interrupt only pays for the state check.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#include "trace.h"
+#include <stddef.h>
+
+#if CONFIG_ENABLE_TRACE
+
+//------------------------------------------------------------------------------
+// Module constant defines
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// External variables
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// External functions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module type definitions
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module static variables
+//------------------------------------------------------------------------------
+static volatile TraceReport_t s_report = {0};
+
+//------------------------------------------------------------------------------
+// Module static function prototypes
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module externally exported functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  Start a capture, replacing the previous one
+ * @param  None
+ * @return None
+ */
+void Trace_Arm(void)
+{
+    s_report.state = eTRACE_STATE_IDLE;
+    s_report.count = 0;
+    s_report.state = eTRACE_STATE_ARMED;
+}
+
+/**
+ * @brief  Get the state to fill in before the first record
+ * @param  None
+ * @return the report's seed if armed and nothing is captured yet, else NULL
+ * @note   Called from the ADC interrupt, before Trace_Record()
+ */
+TraceSeed_t *Trace_GetSeed(void)
+{
+    if (s_report.state != eTRACE_STATE_ARMED || s_report.count)
+    {
+        return NULL;
+    }
+    return (TraceSeed_t *)&s_report.seed;
+}
+
+/**
+ * @brief  Capture one interrupt's readings, if armed
+ * @param  vRaw - the voltage feedback
+ * @param  iRaw - the current feedback
+ * @param  vref - the VRef reading
+ * @param  vrefSampled - whether VRef was part of this conversion
+ * @return None
+ * @note   Called from the ADC interrupt
+ */
+void Trace_Record(uint16_t vRaw, uint16_t iRaw, uint16_t vref, bool vrefSampled)
+{
+    if (s_report.state != eTRACE_STATE_ARMED)
+    {
+        return;
+    }
+
+    s_report.records[s_report.count] = Trace_Pack(vRaw, iRaw, vref, vrefSampled);
+    if (++s_report.count >= TRACE_SAMPLES)
+    {
+        s_report.state = eTRACE_STATE_DONE;
+    }
+}
+
+/**
+ * @brief  Get the capture, for the HID report
+ * @param  None
+ * @return the capture state and records
+ */
+const TraceReport_t *Trace_GetReport(void)
+{
+    return (const TraceReport_t *)&s_report;
+}
+
+#endif // CONFIG_ENABLE_TRACE
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
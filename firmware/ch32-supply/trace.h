@@ -0,0 +1,185 @@
+//------------------------------------------------------------------------------
+//       Filename: trace.h
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Defines the ADC trace format and the on-device capture API
+//------------------------------------------------------------------------------
+//       Notes : A trace is the raw feedback the control loop read, one record
+//               per ADC interrupt. Feeding the same records to the interrupt
+//               in the same order reproduces the duty sequence bit for bit,
+//               which is what the host replay does (host/host.c).
+//               Trace files are TRACE_FILE_MAGIC, TRACE_FILE_VERSION and then
+//               the records, all little endian 32 bit words. From version 2
+//               the host also writes the inputs the firmware took between
+//               two interrupts, console bytes and HID reports, as event
+//               records in their place, so a replay needs nothing but the
+//               trace. An event record is TRACE_EVENT with its type and
+//               length, then its bytes packed 4 to a word, low byte first.
+//               A device trace has no events. From version 3 the version is
+//               followed by the length of the controller's state in bytes,
+//               packed the same way. A device trace starts mid run, the
+//               replay takes the controller's state from it as it was
+//               before the first record, see TraceSeed_t. A host trace
+//               starts at boot and writes a length of 0.
+//------------------------------------------------------------------------------
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//------------------------------------------------------------------------------
+// Module includes
+//------------------------------------------------------------------------------
+#include "funconfig.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+//------------------------------------------------------------------------------
+// Module exported defines
+//------------------------------------------------------------------------------
+#ifndef CONFIG_ENABLE_TRACE
+#define CONFIG_ENABLE_TRACE (0)
+#endif
+
+// Interrupts captured per trigger, the report grows by 4 bytes per sample
+#define TRACE_SAMPLES (32)
+
+#define TRACE_FILE_MAGIC   (0x54434441) // "ADCT"
+#define TRACE_FILE_VERSION (3)
+
+// Record layout, 10 bit readings
+#define TRACE_VOLTAGE_SHIFT (0)
+#define TRACE_CURRENT_SHIFT (10)
+#define TRACE_VREF_SHIFT    (20)
+#define TRACE_VREF_SAMPLED  (1u << 30)
+#define TRACE_READING_MASK  (0x3ff)
+
+// Event record layout, version 2
+#define TRACE_EVENT             (1u << 31)
+#define TRACE_EVENT_TYPE_SHIFT  (24)
+#define TRACE_EVENT_TYPE_MASK   (0x7f)
+#define TRACE_EVENT_LENGTH_MASK (0xff)
+
+#if CONFIG_ENABLE_TRACE
+#define TRACE_RECORD(vRaw_, iRaw_, vref_, vrefSampled_) Trace_Record((vRaw_), (iRaw_), (vref_), (vrefSampled_))
+#else
+#define TRACE_RECORD(vRaw_, iRaw_, vref_, vrefSampled_)
+#endif
+
+//------------------------------------------------------------------------------
+// Module exported type definitions
+//------------------------------------------------------------------------------
+typedef enum
+{
+    eTRACE_STATE_IDLE = 0,
+    eTRACE_STATE_ARMED,
+    eTRACE_STATE_DONE,
+} TraceState_e;
+
+typedef enum
+{
+    eTRACE_EVENT_CONSOLE = 0, // Bytes passed to handle_debug_input()
+    eTRACE_EVENT_HID,         // A feature report written, starting with its ID
+} TraceEvent_e;
+
+// The control loop's state before the first record, everything the duty
+// depends on besides the readings. Taken with the output on and no loop gain
+// sweep running, either makes the replay differ.
+typedef struct __attribute__((packed))
+{
+    int32_t integrator;      // PID
+    int32_t lastError;       // PID, for the derivative
+    int32_t outerIntegrator; // Cascade
+    int32_t innerIntegrator; // Cascade
+    uint32_t targetPRaw;
+    uint32_t resistanceRaw;
+    uint32_t foldbackSlope;
+    uint32_t hiccupRetry;
+    uint32_t hiccupTimer;
+    uint32_t hiccupBackoff;
+    uint32_t hiccupHealthy;
+    uint32_t vrefFiltered; // The VRef filter, for the conversions
+    uint32_t vrefPublished;
+    uint16_t targetVRaw;
+    uint16_t targetIRaw;
+    uint16_t softStartVRaw;
+    uint16_t faultKneeRaw;
+    uint16_t foldbackFloorRaw;
+    uint16_t shortCount;
+    int16_t currentOffset;
+    uint16_t vref; // The last VRef reading, also boots the replay
+    uint8_t duty; // Left by the interrupt before the first record
+    uint8_t controller;
+    uint8_t mode;
+    uint8_t faultMode;
+    uint8_t vrefCount; // The VRef schedule
+    uint8_t vrefSampled;
+    uint8_t kpShift;
+    uint8_t kdShift;
+    uint8_t kiShift;
+    uint8_t reserved;
+} TraceSeed_t;
+
+// TRACE_SEED_SIZE in the web UI's script.js
+static_assert(sizeof(TraceSeed_t) == 78, "TraceSeed_t changed, update TRACE_SEED_SIZE");
+
+typedef struct __attribute__((packed))
+{
+    uint8_t state;
+    uint8_t count;
+    TraceSeed_t seed;
+    uint32_t records[TRACE_SAMPLES];
+} TraceReport_t;
+
+// The 0xB2 descriptor entry takes the size in a single byte
+static_assert(sizeof(TraceReport_t) <= 0xff, "TraceReport_t too big for its report");
+
+//------------------------------------------------------------------------------
+// Module exported functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  Pack one interrupt's readings into a trace record
+ * @param  vRaw - the voltage feedback
+ * @param  iRaw - the current feedback, on whichever range was selected
+ * @param  vref - the VRef reading, only meaningful if vrefSampled
+ * @param  vrefSampled - whether VRef was part of this conversion
+ * @return the record
+ */
+static inline uint32_t Trace_Pack(uint16_t vRaw, uint16_t iRaw, uint16_t vref, bool vrefSampled)
+{
+    return ((uint32_t)(vRaw & TRACE_READING_MASK) << TRACE_VOLTAGE_SHIFT) |
+           ((uint32_t)(iRaw & TRACE_READING_MASK) << TRACE_CURRENT_SHIFT) |
+           (vrefSampled ? ((uint32_t)(vref & TRACE_READING_MASK) << TRACE_VREF_SHIFT) | TRACE_VREF_SAMPLED : 0);
+}
+
+/**
+ * @brief  Make the record that starts an event
+ * @param  type - the event type
+ * @param  length - the bytes that follow
+ * @return the record
+ */
+static inline uint32_t Trace_PackEvent(TraceEvent_e type, uint8_t length)
+{
+    return TRACE_EVENT | ((uint32_t)(type & TRACE_EVENT_TYPE_MASK) << TRACE_EVENT_TYPE_SHIFT) | length;
+}
+
+void Trace_Arm(void);
+TraceSeed_t *Trace_GetSeed(void);
+void Trace_Record(uint16_t vRaw, uint16_t iRaw, uint16_t vref, bool vrefSampled);
+const TraceReport_t *Trace_GetReport(void);
+
+//------------------------------------------------------------------------------
+// Module exported variables
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+#ifdef __cplusplus
+}
+#endif
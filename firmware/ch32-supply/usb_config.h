@@ -4,11 +4,13 @@
 // Defines the number of endpoints for this device. (Always add one for EP0). For two EPs, this should be 3.
 #define ENDPOINTS 2
 
-#define USB_PORT   C // [A,C,D] GPIO Port to use with D+, D- and DPU
-#define USB_PIN_DP 4 // [0-4] GPIO Number for USB D+ Pin
-#define USB_PIN_DM 3 // [0-4] GPIO Number for USB D- Pin
+#include "board.h"
+
+#define USB_PORT   BOARD_USB_PORT   // [A,C,D] GPIO Port to use with D+, D- and DPU
+#define USB_PIN_DP BOARD_USB_PIN_DP // [0-4] GPIO Number for USB D+ Pin
+#define USB_PIN_DM BOARD_USB_PIN_DM // [0-4] GPIO Number for USB D- Pin
 // #define USB_PORT_DPU A  // [A,C,D] Override GPIO Port for DPU
-#define USB_PIN_DPU 2 // [0-7] GPIO for feeding the 1.5k Pull-Up on USB D- Pin; Comment out if not used / tied to 3V3!
+#define USB_PIN_DPU BOARD_USB_PIN_DPU // [0-7] GPIO for feeding the 1.5k Pull-Up on USB D- Pin; Comment out if not used / tied to 3V3!
 
 #define RV003USB_DEBUG_TIMING      0
 #define RV003USB_OPTIMIZE_FLASH    1
@@ -22,6 +24,21 @@
 
 #include "funconfig.h"
 #include <tinyusb_hid.h>
+#if CONFIG_ENABLE_FRA
+#include "fra.h"
+#endif
+#if CONFIG_ENABLE_SWEEP
+#include "sweep.h"
+#endif
+#if CONFIG_ENABLE_CHARGER
+#include "charger.h"
+#endif
+#if CONFIG_ENABLE_PROFILE
+#include "profile.h"
+#endif
+#if CONFIG_ENABLE_TRACE
+#include "trace.h"
+#endif
 
 #ifdef INSTANCE_DESCRIPTORS
 
@@ -48,12 +65,58 @@ static const uint8_t special_hid_desc[] = {
     HID_USAGE(0x00),
     HID_REPORT_SIZE(8),
     HID_COLLECTION(HID_COLLECTION_LOGICAL),
-    HID_REPORT_COUNT(BOOST_REPORT_SIZE - 1),
-    HID_REPORT_ID(0xaa)
+    HID_REPORT_COUNT(BOOST_REPORT_SIZE - 1), // BoostState_t, and commands are written to it
+    HID_REPORT_ID(BOOST_REPORT_ID_STATE)
+        HID_USAGE(0x01),
+    HID_FEATURE(HID_DATA | HID_VARIABLE | HID_ABSOLUTE),
+    HID_REPORT_COUNT(6), // BoostCalibration_t
+    HID_REPORT_ID(BOOST_REPORT_ID_CALIBRATION)
+        HID_USAGE(0x01),
+    HID_FEATURE(HID_DATA | HID_VARIABLE | HID_ABSOLUTE),
+#if CONFIG_ENABLE_FRA
+    HID_REPORT_COUNT(sizeof(FraReport_t)),
+    HID_REPORT_ID(BOOST_REPORT_ID_FRA)
+        HID_USAGE(0x01),
+    HID_FEATURE(HID_DATA | HID_VARIABLE | HID_ABSOLUTE),
+#endif
+#if CONFIG_ENABLE_SWEEP
+    HID_REPORT_COUNT(sizeof(SweepReport_t)),
+    HID_REPORT_ID(BOOST_REPORT_ID_SWEEP)
+        HID_USAGE(0x01),
+    HID_FEATURE(HID_DATA | HID_VARIABLE | HID_ABSOLUTE),
+#endif
+#if CONFIG_ENABLE_CHARGER
+    HID_REPORT_COUNT(sizeof(ChargerStatus_t)),
+    HID_REPORT_ID(BOOST_REPORT_ID_CHARGER)
+        HID_USAGE(0x01),
+    HID_FEATURE(HID_DATA | HID_VARIABLE | HID_ABSOLUTE),
+#endif
+    HID_REPORT_COUNT(7), // BoostStepResponse_t
+    HID_REPORT_ID(BOOST_REPORT_ID_STEP)
+        HID_USAGE(0x01),
+    HID_FEATURE(HID_DATA | HID_VARIABLE | HID_ABSOLUTE),
+#if CONFIG_ENABLE_PROFILE
+    HID_REPORT_COUNT(sizeof(ProfileReport_t)),
+    HID_REPORT_ID(BOOST_REPORT_ID_PROFILE)
+        HID_USAGE(0x01),
+    HID_FEATURE(HID_DATA | HID_VARIABLE | HID_ABSOLUTE),
+#endif
+#if CONFIG_ENABLE_TRACE
+    HID_REPORT_COUNT(sizeof(TraceReport_t)),
+    HID_REPORT_ID(BOOST_REPORT_ID_TRACE)
+        HID_USAGE(0x01),
+    HID_FEATURE(HID_DATA | HID_VARIABLE | HID_ABSOLUTE),
+#endif
+    HID_REPORT_COUNT(63), // HistoryReport_t, `hidapitester --vidpid 1209/D003 --open --read-feature 171`
+    HID_REPORT_ID(BOOST_REPORT_ID_HISTORY)
+        HID_USAGE(0x01),
+    HID_FEATURE(HID_DATA | HID_VARIABLE | HID_ABSOLUTE),
+    HID_REPORT_COUNT(28), // ConfigReport_t
+    HID_REPORT_ID(BOOST_REPORT_ID_CONFIG)
         HID_USAGE(0x01),
     HID_FEATURE(HID_DATA | HID_VARIABLE | HID_ABSOLUTE),
-    HID_REPORT_COUNT(63), // For use with `hidapitester --vidpid 1209/D003 --open --read-feature 171`
-    HID_REPORT_ID(0xab)
+    HID_REPORT_COUNT(16), // StatsReport_t
+    HID_REPORT_ID(BOOST_REPORT_ID_STATS)
         HID_USAGE(0x01),
     HID_FEATURE(HID_DATA | HID_VARIABLE | HID_ABSOLUTE),
     HID_COLLECTION_END,
@@ -14,9 +14,24 @@
 const expectedProductName = "CCCCPPPS";
 const filter = { vendorId: 0x1209, productId: 0xd003 };
 
-// Enable mock data for testing
+// Talk to the simulator in sim.js instead of a device, for testing
 var MOCK = false;
 const BOOST_REPORT_SIZE = 8 * 1;
+const REPORT_ID_STATE = 0xAA;
+const REPORT_ID_HISTORY = 0xAB;
+const REPORT_ID_CALIBRATION = 0xAC;
+const REPORT_ID_STEP = 0xB1;
+const REPORT_ID_TRACE = 0xB2;
+// See trace.h in the firmware
+const TRACE_FILE_MAGIC = 0x54434441;
+const TRACE_FILE_VERSION = 3;
+const TRACE_SEED_SIZE = 78; // TraceSeed_t, the controller state before the first record
+const TRACE_STATE_DONE = 2;
+// See telemetry.h in the firmware
+const TELEMETRY_KEYFRAME_SIZE = 5;
+const TELEMETRY_CC_MODE = 0x8000;
+// The plot reads 0xAB this often, a block holds 40ms of samples at the least
+const HISTORY_POLL_MS = 50;
 var STATS = true;
 
 //------------------------------------------------------------------------------
@@ -27,6 +42,47 @@ class CommandID {
     static VOLTAGE = 1;
     static CURRENT = 2;
     static SAVE = 3;
+    static OUTPUT = 4;
+    static CONTROLLER = 5;
+    static MODE = 6;
+    static POWER = 7;
+    static RESISTANCE = 8;
+    static FAULT_MODE = 9;
+    static FAULT_KNEE = 10;
+    static FAULT_FLOOR = 11;
+    static FAULT_RETRY = 12;
+    static FRA_START = 13;
+    static SWEEP_RANGE = 14;
+    static SWEEP_START = 15;
+    static CHARGE = 16;
+    static CHARGE_VOLTAGE = 17;
+    static CHARGE_CURRENT = 18;
+    static CHARGE_TERMINATION = 19;
+    static CHARGE_TIMEOUT = 20;
+    static CHARGE_DELTA_V = 21;
+    static PROFILE_RESET = 22;
+    static PID_GAINS = 23;
+    static VOLTAGE_TRIM = 24;
+    static CURRENT_TRIM = 25;
+    static TRACE_ARM = 26;
+    static FRA_STOP = 27;
+}
+
+class FaultMode {
+    static NONE = 0;
+    static FOLDBACK = 1;
+    static HICCUP = 2;
+}
+
+class OutputMode {
+    static CV = 0;
+    static CP = 1;
+    static CR = 2;
+}
+
+class Controller {
+    static PID = 0;
+    static CASCADE = 1;
 }
 
 class PowerSupplyState {
@@ -36,12 +92,13 @@ class PowerSupplyState {
                 console.log(`Invalid data length: ${data.length}`);
             }
             this.voltage = readU16LE(data, 0);
-            this.current = readU16LE(data, 2);
+            // The fraction below 1mA follows the state, older firmware sends 6 bytes
+            this.current = readU16LE(data, 2) + (data.length > 6 ? data[6] / 256 : 0);
             if (this.voltage == 0 || this.current == 0) {
                 this.power = 0;
             }
             else {
-                this.power = this.voltage * this.current / 1000;
+                this.power = Math.round(this.voltage * this.current / 1000);
             }
             this.duty = data[4];
             this.ccMode = data[5] == 1;
@@ -57,6 +114,69 @@ class PowerSupplyState {
     }
 }
 
+class CalibrationState {
+    constructor(data) {
+        this.currentOffset = readI16LE(data, 0);
+        this.offsetDrift = readI16LE(data, 2);
+        this.recalibrations = readU16LE(data, 4);
+    }
+}
+
+class StepResponse {
+    constructor(data) {
+        this.settlingUs = readU16LE(data, 0);
+        this.overshoot = readU16LE(data, 2);
+        this.ripple = readU16LE(data, 4);
+        this.complete = data[6] == 1;
+    }
+}
+
+/**
+ * @brief  Stand-in for a HIDDevice, backed by the simulator worker
+ */
+class MockDevice {
+    constructor() {
+        this.productName = expectedProductName;
+        this.nextId = 0;
+        this.pending = new Map();
+        this.worker = new Worker("sim.js");
+        this.worker.onmessage = (event) => {
+            if (event.data.type == 'notice') {
+                setStatus(event.data.message, "orange");
+                console.warn(event.data.message);
+                return;
+            }
+            const resolve = this.pending.get(event.data.id);
+            this.pending.delete(event.data.id);
+            resolve(new DataView(event.data.data));
+        };
+    }
+
+    request(msg) {
+        return new Promise((resolve) => {
+            msg.id = this.nextId++;
+            this.pending.set(msg.id, resolve);
+            this.worker.postMessage(msg);
+        });
+    }
+
+    async sendFeatureReport(reportId, data) {
+        await this.request({ type: 'send', reportId, data: Array.from(data) });
+    }
+
+    async receiveFeatureReport(reportId) {
+        return this.request({ type: 'receive', reportId });
+    }
+
+    setLoad(ohms) {
+        this.worker.postMessage({ type: 'load', ohms });
+    }
+
+    close() {
+        this.worker.terminate();
+    }
+}
+
 //------------------------------------------------------------------------------
 // Module global variables
 //------------------------------------------------------------------------------
@@ -67,6 +187,8 @@ var interval;
 var samplerate = 5;
 var samplewindow = 5;
 var samplecount = samplewindow;
+var lastSequence = null;
+var historyStart = 0;
 
 var stats = {
     good: 0,
@@ -131,7 +253,11 @@ function onLoad() {
     Plotly.newPlot('canvas', traces, layout, config);
 
 
-    if (!navigator.hid) {
+    if (MOCK) {
+        dev = new MockDevice();
+        setStatus("Simulated");
+    }
+    else if (!navigator.hid) {
         setStatusError("Browser does not support HID.");
         document.getElementById("connectButton").hidden = true;
     }
@@ -150,10 +276,18 @@ function onLoad() {
     }
 
     setSampleRate();
+    setInterval(requestHistory, HISTORY_POLL_MS);
 
     if (STATS) {
         setInterval(() => {
             document.getElementById("StatusPerf").innerHTML = `Good: ${stats.good} Bad: ${stats.bad} Total: ${stats.total} Disconnected: ${stats.disconnected}`
+            if (dev) {
+                readCalibration(dev)
+                    .then((cal) => {
+                        document.getElementById("StatusCalibration").innerHTML = `Current offset: ${cal.currentOffset} Drift: ${cal.offsetDrift} Recalibrations: ${cal.recalibrations}`
+                    })
+                    .catch(() => { });
+            }
         }, 1000);
     }
 
@@ -279,6 +413,17 @@ function readU16LE(data, offset) {
     return data[offset] + (data[offset + 1] << 8);
 }
 
+/**
+ * @brief  Read a 16-bit signed integer in little-endian format
+ * @param {Uint8Array} data: Data buffer
+ * @param {number} offset: Offset in the buffer
+ * @return {number} The 16-bit signed integer
+ */
+function readI16LE(data, offset) {
+    const value = readU16LE(data, offset);
+    return value >= 0x8000 ? value - 0x10000 : value;
+}
+
 /**
  * @brief  Write a 16-bit unsigned integer in little-endian format
  * @param {Uint8Array} data: Data buffer
@@ -297,7 +442,7 @@ function writeU16LE(data, offset, value) {
  * @return {PowerSupplyState} The power supply state
  */
 async function readStatus(dev) {
-    const report = await dev.receiveFeatureReport(0xAA);
+    const report = await dev.receiveFeatureReport(REPORT_ID_STATE);
     if (!report || !report.buffer || !report.buffer.byteLength) {
         throw "Error reading status";
     }
@@ -307,6 +452,133 @@ async function readStatus(dev) {
     return status;
 }
 
+/**
+ * @brief  Read the current sensor calibration of the power supply
+ * @param {object} dev: Device object
+ * @return {CalibrationState} The calibration state
+ */
+async function readCalibration(dev) {
+    const report = await dev.receiveFeatureReport(REPORT_ID_CALIBRATION);
+    if (!report || !report.buffer || !report.buffer.byteLength) {
+        throw "Error reading calibration";
+    }
+
+    return new CalibrationState(new Uint8Array(report.buffer));
+}
+
+/**
+ * @brief  Read the response to the last voltage step
+ * @param {object} dev: Device object
+ * @return {StepResponse} Settling time, overshoot and ripple
+ */
+async function readStepResponse(dev) {
+    const report = await dev.receiveFeatureReport(REPORT_ID_STEP);
+    if (!report || !report.buffer || !report.buffer.byteLength) {
+        throw "Error reading step response";
+    }
+
+    return new StepResponse(new Uint8Array(report.buffer));
+}
+
+/**
+ * @brief  Read the recent samples kept by the power supply
+ * @param {object} dev: Device object
+ * @return {object} {sequence, millis, samples}, the sequence number and time
+ *         of the newest sample and the samples, oldest first, each with its own
+ * @note   Samples already seen have a sequence number at or below the last one
+ */
+async function readHistory(dev) {
+    const report = await dev.receiveFeatureReport(REPORT_ID_HISTORY);
+    if (!report || !report.buffer || report.buffer.byteLength < 9) {
+        throw "Error reading history";
+    }
+
+    const data = new Uint8Array(report.buffer);
+    const sequence = readU16LE(data, 0);
+    const count = data[2];
+    const millis = readU32LE(data, 3) >>> 0;
+    const periodMs = data[7];
+    const size = data[8];
+    const samples = decodeTelemetry(data.subarray(9, 9 + size), count, periodMs);
+
+    // Walk the timestamps back from the newest sample
+    let time = millis;
+    for (let i = samples.length - 1; i >= 0; i--) {
+        samples[i].sequence = (sequence - (samples.length - 1 - i)) & 0xFFFF;
+        samples[i].millis = time;
+        time -= samples[i].elapsedMs;
+    }
+    return { sequence, millis, samples };
+}
+
+/**
+ * @brief  Unpack a block of telemetry samples, see telemetry.h in the firmware
+ * @param {Uint8Array} data: The block
+ * @param {number} count: The number of samples in it
+ * @param {number} periodMs: The nominal time between samples
+ * @return {Array} {voltage, current, ccMode, duty, elapsedMs} per sample, oldest first
+ */
+function decodeTelemetry(data, count, periodMs) {
+    if (count == 0) {
+        return [];
+    }
+    if (data.length < TELEMETRY_KEYFRAME_SIZE) {
+        throw "Telemetry block too short";
+    }
+
+    let offset = TELEMETRY_KEYFRAME_SIZE;
+    const readVarint = () => {
+        let value = 0;
+        for (let i = 0; i < 3 && offset < data.length; i++) {
+            const byte = data[offset++];
+            value |= (byte & 0x7F) << (7 * i);
+            if (!(byte & 0x80)) {
+                return (value >>> 1) ^ -(value & 1);
+            }
+        }
+        throw "Telemetry varint malformed";
+    };
+
+    let voltage = readU16LE(data, 0);
+    let current = readU16LE(data, 2);
+    let duty = data[4];
+    let elapsedMs = 0;
+    let mask = 0;
+    const samples = [];
+    for (let n = 0; n < count; n++) {
+        if (n > 0) {
+            if ((n - 1) & 1) {
+                mask >>= 4;
+            }
+            else if (offset < data.length) {
+                mask = data[offset++];
+            }
+            else {
+                throw "Telemetry block too short";
+            }
+
+            const fields = [0, 0, 0, 0].map((_, i) => (mask & (1 << i)) ? readVarint() : 0);
+            elapsedMs = (periodMs + fields[0]) & 0xFF;
+            voltage = (voltage + fields[1]) & 0xFFFF;
+            current = (current + fields[2]) & 0xFFFF;
+            duty = (duty + fields[3]) & 0xFF;
+        }
+
+        samples.push({
+            voltage,
+            current: current & ~TELEMETRY_CC_MODE,
+            ccMode: (current & TELEMETRY_CC_MODE) != 0,
+            duty,
+            elapsedMs,
+        });
+    }
+
+    if (offset != data.length) {
+        throw "Telemetry block has trailing bytes";
+    }
+    return samples;
+}
+
 /**
  * @brief  Send a command to the power supply
  * @param {object} dev: Device object
@@ -317,7 +589,7 @@ async function sendCommand(dev, command) {
     if (command.length > BOOST_REPORT_SIZE) {
         throw "Command too long";
     }
-    const report = await dev.sendFeatureReport(0xAA, command);
+    const report = await dev.sendFeatureReport(REPORT_ID_STATE, command);
     if (!report) {
         throw "Error sending command";
     }
@@ -333,7 +605,7 @@ async function setVoltage(voltage) {
         const command = new Uint8Array(BOOST_REPORT_SIZE - 1);
         command[0] = CommandID.VOLTAGE;
         writeU32LE(command, 1, voltage);
-        await dev.sendFeatureReport(0xAA, command);
+        await dev.sendFeatureReport(REPORT_ID_STATE, command);
     }
 }
 
@@ -347,8 +619,165 @@ async function setCurrent(current) {
         const command = new Uint8Array(BOOST_REPORT_SIZE - 1);
         command[0] = CommandID.CURRENT;
         writeU32LE(command, 1, current);
-        await dev.sendFeatureReport(0xAA, command);
+        await dev.sendFeatureReport(REPORT_ID_STATE, command);
+    }
+}
+
+/**
+ * @brief  Enable or disable the output of the power supply
+ * @param {boolean} enabled: True to turn the output on
+ * @return None
+ */
+async function setOutput(enabled) {
+    if (dev) {
+        const command = new Uint8Array(BOOST_REPORT_SIZE - 1);
+        command[0] = CommandID.OUTPUT;
+        writeU32LE(command, 1, enabled ? 1 : 0);
+        await dev.sendFeatureReport(REPORT_ID_STATE, command);
+    }
+}
+
+/**
+ * @brief  Select the control algorithm of the power supply
+ * @param {number} controller: One of Controller
+ * @return None
+ */
+async function setController(controller) {
+    if (dev) {
+        const command = new Uint8Array(BOOST_REPORT_SIZE - 1);
+        command[0] = CommandID.CONTROLLER;
+        writeU32LE(command, 1, controller);
+        await dev.sendFeatureReport(REPORT_ID_STATE, command);
+    }
+}
+
+/**
+ * @brief  Send a command with a 32-bit argument to the power supply
+ * @param {number} id: One of CommandID
+ * @param {number} value: The argument
+ * @return None
+ */
+async function sendValue(id, value) {
+    if (dev) {
+        const command = new Uint8Array(BOOST_REPORT_SIZE - 1);
+        command[0] = id;
+        writeU32LE(command, 1, value);
+        await dev.sendFeatureReport(REPORT_ID_STATE, command);
+    }
+}
+
+/**
+ * @brief  Set the output mode of the power supply
+ * @param {number} mode: One of OutputMode
+ * @return None
+ */
+async function setMode(mode) {
+    await sendValue(CommandID.MODE, mode);
+}
+
+/**
+ * @brief  Set the target power for constant power mode
+ * @param {number} power: The power in mW
+ * @return None
+ */
+async function setPower(power) {
+    await sendValue(CommandID.POWER, power);
+}
+
+/**
+ * @brief  Set the source resistance for constant resistance mode
+ * @param {number} resistance: The resistance in mOhm
+ * @return None
+ */
+async function setResistance(resistance) {
+    await sendValue(CommandID.RESISTANCE, resistance);
+}
+
+/**
+ * @brief  Configure the short circuit response of the power supply
+ * @param {number} mode: One of FaultMode
+ * @param {number} knee: Output voltage in mV below which the output is shorted
+ * @param {number} floor: Foldback current limit at 0V in mA
+ * @param {number} retry: Initial hiccup off time in ms
+ * @return None
+ */
+async function setFaultResponse(mode, knee, floor, retry) {
+    await sendValue(CommandID.FAULT_KNEE, knee);
+    await sendValue(CommandID.FAULT_FLOOR, floor);
+    await sendValue(CommandID.FAULT_RETRY, retry);
+    await sendValue(CommandID.FAULT_MODE, mode);
+}
+
+/**
+ * @brief  Set the PID gains, each term is its error shifted right by the gain
+ * @param {number} kp: Proportional shift
+ * @param {number} kd: Derivative shift
+ * @param {number} ki: Integral shift
+ * @return None
+ * @note   The firmware clamps each shift to the range main_sim tune checks
+ */
+async function setPidGains(kp, kd, ki) {
+    await sendValue(CommandID.PID_GAINS, kp | (kd << 8) | (ki << 16));
+}
+
+/**
+ * @brief  Set the per unit gain trims, measured against a reference meter
+ * @param {number} voltage: Voltage trim, (actual / reported - 1) * 65536
+ * @param {number} current: Current trim, (actual / reported - 1) * 65536
+ * @return None
+ */
+async function setTrim(voltage, current) {
+    await sendValue(CommandID.VOLTAGE_TRIM, voltage);
+    await sendValue(CommandID.CURRENT_TRIM, current);
+}
+
+/**
+ * @brief  Capture the next ADC interrupts and save them as a trace file, for
+ *         replay with the host build
+ * @param  None
+ * @return None
+ */
+async function captureTrace() {
+    if (!dev) {
+        return;
     }
+    await sendValue(CommandID.TRACE_ARM, 0);
+    await sleep(10);
+
+    const report = await dev.receiveFeatureReport(REPORT_ID_TRACE);
+    if (!report || !report.buffer || !report.buffer.byteLength) {
+        throw "Error reading trace, is CONFIG_ENABLE_TRACE set?";
+    }
+    const data = new Uint8Array(report.buffer);
+    if (data[0] != TRACE_STATE_DONE) {
+        throw "Trace capture did not finish";
+    }
+
+    // The state is packed 4 bytes to a word, as the records are
+    const count = data[1];
+    const seedWords = Math.ceil(TRACE_SEED_SIZE / 4);
+    const records = 2 + TRACE_SEED_SIZE;
+    const file = new Uint8Array(12 + 4 * (seedWords + count));
+    writeU32LE(file, 0, TRACE_FILE_MAGIC);
+    writeU32LE(file, 4, TRACE_FILE_VERSION);
+    writeU32LE(file, 8, TRACE_SEED_SIZE);
+    file.set(data.subarray(2, records), 12);
+    file.set(data.subarray(records, records + 4 * count), 12 + 4 * seedWords);
+
+    const link = document.createElement("a");
+    link.href = URL.createObjectURL(new Blob([file]));
+    link.download = "adc.trace";
+    link.click();
+    URL.revokeObjectURL(link.href);
+}
+
+/**
+ * @brief  Wait for a while
+ * @param {number} ms: The time to wait in ms
+ * @return None
+ */
+function sleep(ms) {
+    return new Promise((resolve) => setTimeout(resolve, ms));
 }
 
 /**
@@ -359,7 +788,7 @@ async function saveSettings() {
     if (dev) {
         const command = new Uint8Array(BOOST_REPORT_SIZE - 1);
         command[0] = CommandID.SAVE;
-        await dev.sendFeatureReport(0xAA, command);
+        await dev.sendFeatureReport(REPORT_ID_STATE, command);
     }
 }
 
@@ -385,6 +814,36 @@ async function requestStatus() {
     }
 }
 
+/**
+ * @brief  Read the samples taken since the last read and plot them
+ * @param  None
+ * @return None
+ * @note   The plot is in device time, samples missed show as a straight line
+ */
+async function requestHistory() {
+    if (!dev) {
+        return;
+    }
+
+    const history = await readHistory(dev).catch(() => null);
+    if (!history || !history.samples.length) {
+        return;
+    }
+
+    // Sequence numbers wrap at 16 bits, ahead means less than half way round
+    const isNew = (sample) => {
+        const ahead = (sample.sequence - lastSequence) & 0xFFFF;
+        return lastSequence === null || (ahead != 0 && ahead < 0x8000);
+    };
+    const samples = history.samples.filter(isNew);
+    if (lastSequence === null) {
+        historyStart = history.samples[0].millis;
+    }
+    lastSequence = history.sequence;
+
+    addSamples(samples);
+}
+
 /**
  * @brief  Resize event handler
  * @param  None
@@ -430,20 +889,23 @@ function updateLayout() {
 }
 
 /**
- * @brief  Add data to the plot
- * @param {PowerSupplyState} status: The power supply status
+ * @brief  Add samples from the history report to the plot
+ * @param {Array} samples: {voltage, current, millis} per sample, oldest first
  * @return None
  */
-function addData(status) {
-    if (update == false) return;
-    samplecount += 1 / samplerate;
-
-    traces[0].x.push(samplecount);
-    traces[0].y.push(status.voltage);
-    traces[1].x.push(samplecount);
-    traces[1].y.push(status.current);
-    traces[2].x.push(samplecount);
-    traces[2].y.push(status.power);
+function addSamples(samples) {
+    if (update == false || !samples.length) return;
+
+    for (const sample of samples) {
+        samplecount = samplewindow + ((sample.millis - historyStart) >>> 0) / 1000;
+
+        traces[0].x.push(samplecount);
+        traces[0].y.push(sample.voltage);
+        traces[1].x.push(samplecount);
+        traces[1].y.push(sample.current);
+        traces[2].x.push(samplecount);
+        traces[2].y.push(Math.round(sample.voltage * sample.current / 1000));
+    }
 
     updateLayout();
 }
@@ -499,17 +961,7 @@ function liveUpdate() {
 function setSampleRate() {
     clearInterval(interval);
     samplerate = document.getElementById("samplerate").value;
-    if (MOCK) {
-        interval = setInterval(function() {
-            const voltage = Math.random() * 1000;
-            const current = Math.random() * 100;
-            const power = voltage * current / 1000;
-            addData(new PowerSupplyState({ voltage, current, power }));
-        }, 1000 / samplerate);
-    }
-    else {
-        interval = setInterval(requestStatus, 1000 / samplerate);
-    }
+    interval = setInterval(requestStatus, 1000 / samplerate);
 
     samplewindow = document.getElementById("samplewindow").value;
     console.log(`Setting sample rate to ${samplerate}Hz and sample window to ${samplewindow}s`);
@@ -535,16 +987,16 @@ function setLineShape(smooth) {
  * @return None
  */
 function updateReadings(status) {
+    // Resolve low currents below 1mA, the last digits are noise above that
+    const current = status.current < 100 ? status.current.toFixed(2) : Math.round(status.current);
     document.getElementById("VoltageInfo").innerHTML = "Voltage: " + status.voltage + "mV";
-    document.getElementById("CurrentInfo").innerHTML = "Current: " + status.current + 'mA';
+    document.getElementById("CurrentInfo").innerHTML = "Current: " + current + 'mA';
     document.getElementById("PowerInfo").innerHTML = "Power: " + status.power + "mW";
 
     document.getElementById("VoltageBig").innerHTML = status.voltage;
-    document.getElementById("CurrentBig").innerHTML = status.current;
+    document.getElementById("CurrentBig").innerHTML = current;
     document.getElementById("PowerBig").innerHTML = status.power;
     document.getElementById("CC").className = status.ccMode ? "indicator on" : "indicator off";
-
-    addData(status);
 }
 
 /**
@@ -569,4 +1021,52 @@ function sendCurrent() {
     setCurrent(parseInt(c));
 }
 
+/**
+ * @brief  Send the power to the power supply
+ * @param  None
+ * @return None
+ */
+function sendPower() {
+    const p = document.getElementById("SetPower").value;
+    console.log(`Setting power to ${p}`);
+    setPower(parseInt(p));
+}
+
+/**
+ * @brief  Send the source resistance to the power supply
+ * @param  None
+ * @return None
+ */
+function sendResistance() {
+    const r = document.getElementById("SetResistance").value;
+    console.log(`Setting resistance to ${r}`);
+    setResistance(parseInt(r));
+}
+
+/**
+ * @brief  Show the response to the last voltage step, to judge the gains
+ * @param  None
+ * @return None
+ */
+async function showStepResponse() {
+    if (!dev) {
+        return;
+    }
+    const r = await readStepResponse(dev);
+    const settling = r.settlingUs == 0xffff ? "did not settle" : `${r.settlingUs}us`;
+    document.getElementById("TuneResults").innerHTML =
+        `${settling}, ${r.overshoot}mV overshoot, ${r.ripple}mV ripple${r.complete ? "" : " (in progress)"}`;
+}
 
+/**
+ * @brief  Send the PID gains from the page
+ * @param  None
+ * @return None
+ */
+function sendGains() {
+    const kp = parseInt(document.getElementById("GainKp").value);
+    const kd = parseInt(document.getElementById("GainKd").value);
+    const ki = parseInt(document.getElementById("GainKi").value);
+    console.log(`Setting gains to Kp>>${kp} Kd>>${kd} Ki>>${ki}`);
+    setPidGains(kp, kd, ki);
+}
@@ -0,0 +1,113 @@
+//------------------------------------------------------------------------------
+//       Filename: sim.js
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Power Supply Simulator
+//------------------------------------------------------------------------------
+//       Notes : Runs in a Web Worker. The firmware itself, built for the host
+//               with emscripten into firmware.js (make -C firmware/ch32-supply/host
+//               wasm), runs on the model of the boost converter in host/plant.c,
+//               so the UI sees the same controller, commands and reports as
+//               on the real supply. The requests are queued here and served
+//               by the firmware, see host/wasm/wasm_main.c.
+//               firmware.js is a build output and is not committed. Without
+//               it the worker tells the UI and runs the JavaScript port of the
+//               controller in sim_model.js instead.
+//------------------------------------------------------------------------------
+
+try {
+    importScripts("firmware.js");
+}
+catch (error) {
+    postMessage({
+        type: 'notice',
+        message: "firmware.js not found, build it with make -C firmware/ch32-supply/host wasm. " +
+            "Simulating with the JavaScript model, only the PID controller is ported.",
+    });
+    importScripts("sim_model.js");
+}
+
+//------------------------------------------------------------------------------
+// Module constant defines
+//------------------------------------------------------------------------------
+
+const HOST_LOAD_OHMS = 100;
+
+//------------------------------------------------------------------------------
+// Module global variables
+//------------------------------------------------------------------------------
+
+var requests = [];
+var firmware = null;
+
+if (self.Firmware) {
+    onmessage = queue;
+    Firmware({
+        preRun: [(module) => {
+            firmware = module;
+            module.ENV.HOST_LOAD_OHMS = String(HOST_LOAD_OHMS);
+            // No console input in a worker
+            module.ENV.HOST_DEBUGGER = "0";
+        }],
+        stdin: () => null,
+        service: service,
+    });
+}
+
+//------------------------------------------------------------------------------
+// Module static functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  Message handler, mirrors the HID feature reports
+ * @param {MessageEvent} event: {id, type, reportId, data} or {type: 'load', ohms}
+ * @return None
+ */
+function queue(event) {
+    requests.push(event.data);
+}
+
+/**
+ * @brief  Serve the queued requests, called by the firmware from its hook
+ * @param  None
+ * @return None
+ */
+function service() {
+    while (requests.length) {
+        serve(firmware, requests.shift());
+    }
+}
+
+/**
+ * @brief  Pass one request to the firmware and post the reply
+ * @param {object} module: The firmware module
+ * @param {object} msg: The request
+ * @return None
+ */
+function serve(module, msg) {
+    if (msg.type == 'load') {
+        module._Wasm_SetLoad(Math.max(msg.ohms, 0));
+        return;
+    }
+
+    const buffer = module._Wasm_Report();
+    let reply = new Uint8Array(0);
+    if (msg.type == 'send') {
+        // WebHID leaves the ID out, the firmware expects it first
+        const data = Uint8Array.from(msg.data);
+        module.HEAPU8[buffer] = msg.reportId;
+        module.HEAPU8.set(data, buffer + 1);
+        module._Wasm_SetReport(data.length + 1);
+    }
+    else if (msg.type == 'receive') {
+        const length = module._Wasm_GetReport(msg.reportId);
+        reply = module.HEAPU8.slice(buffer, buffer + length);
+    }
+
+    postMessage({ id: msg.id, data: reply.buffer }, [reply.buffer]);
+}
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
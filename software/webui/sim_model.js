@@ -0,0 +1,413 @@
+//------------------------------------------------------------------------------
+//       Filename: sim_model.js
+//------------------------------------------------------------------------------
+//       Bogdan Ionescu (c) 2024
+//------------------------------------------------------------------------------
+//       Purpose : Power Supply Simulator, without the firmware
+//------------------------------------------------------------------------------
+//       Notes : sim.js loads this when firmware.js has not been built. The
+//               firmware PID controller is ported with the same integer maths
+//               and runs at the control loop rate against an averaged boost
+//               converter model, so the readings, the step response and the
+//               gain tuning behave like the real supply. It answers 0xAA,
+//               0xAB and 0xB1 in the firmware layout, the other reports and
+//               commands (modes, faults, sweeps, charging, traces) are not
+//               ported and read back as zeros.
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// Module constant defines
+//------------------------------------------------------------------------------
+
+const REPORT_ID_STATE = 0xAA;
+const REPORT_ID_HISTORY = 0xAB;
+const REPORT_ID_STEP = 0xB1;
+
+const CMD_VOLTAGE = 1;
+const CMD_CURRENT = 2;
+const CMD_OUTPUT = 4;
+const CMD_MODE = 6;
+const CMD_PID_GAINS = 23;
+
+// Same as the firmware
+const CORE_CLOCK = 48000000;
+const PWM_PRESCALER = 2;
+const PWM_PERIOD = 255 + 10 + 1;
+const CONTROL_LOOP_HZ = Math.floor(CORE_CLOCK / (PWM_PRESCALER * PWM_PERIOD));
+const MIN_DUTY = 0;
+const MAX_DUTY = 250;
+const ADC_MAX = 1 << 10;
+const Rf = 390;
+const Rin = 100;
+const Rt = Rf + Rin;
+const VDD_MILLIVOLTS = 3300;
+// BOOST_PID_* in boost.h
+const PID_KP_SHIFT_MAX = 4;
+const PID_KD_SHIFT_MAX = 3;
+const PID_KI_SHIFT_MIN = 6;
+const PID_KI_SHIFT_MAX = 9;
+
+const MS_TO_SAMPLES = (ms) => ms * Math.floor(CONTROL_LOOP_HZ / 1000);
+const SAMPLES_TO_US = (n) => Math.floor(n * 1000 / Math.floor(CONTROL_LOOP_HZ / 1000));
+const STEP_TOLERANCE = 4;
+const STEP_HOLD = MS_TO_SAMPLES(1);
+const STEP_TIMEOUT = MS_TO_SAMPLES(50);
+const STEP_RIPPLE = MS_TO_SAMPLES(2);
+const STEP_UNSETTLED = 0xffff;
+
+// Plant, a non-synchronous boost from USB into a resistive load
+const VIN = 5.0;
+const INDUCTANCE = 22e-6;
+const CAPACITANCE = 100e-6;
+const DCR = 0.15;
+const DIODE_DROP = 0.35;
+const LOAD_OHMS = 100;
+const SUBSTEPS = 4;
+const NOISE_COUNTS = 1;
+
+// See history.h and telemetry.h
+const HISTORY_PERIOD_MS = 10;
+const HISTORY_KEYFRAME_SIZE = 5;
+
+// Simulated time is advanced in chunks, capped so a stalled tab catches up slowly
+const TICK_MS = 10;
+const MAX_CHUNK = MS_TO_SAMPLES(50);
+
+//------------------------------------------------------------------------------
+// Module global variables
+//------------------------------------------------------------------------------
+
+var sim = {
+    // Controller
+    targetVRaw: 0,
+    targetIRaw: 0,
+    outputEnabled: false,
+    mode: 0,
+    kpShift: 0,
+    kdShift: 3,
+    kiShift: 6,
+    lastEP: 0,
+    eI: 0,
+    duty: 0,
+    ccMode: 0,
+    vRaw: 0,
+    current: 0,
+    samples: 0,
+    sequence: 0,
+
+    // Plant
+    iL: 0,
+    vOut: VIN - DIODE_DROP,
+    load: LOAD_OHMS,
+
+    // Step response
+    step: {
+        active: false,
+        complete: false,
+        rising: false,
+        samples: 0,
+        inBand: 0,
+        settledAt: 0,
+        overshoot: 0,
+        rippleStart: 0,
+        rippleMin: 0,
+        rippleMax: 0,
+    },
+};
+
+var lastTime = performance.now();
+
+//------------------------------------------------------------------------------
+// Module externally exported functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  Message handler, mirrors the HID feature reports
+ * @param {MessageEvent} event: {id, type, reportId, data} or {type: 'load', ohms}
+ * @return None
+ */
+onmessage = function(event) {
+    const msg = event.data;
+
+    if (msg.type == 'load') {
+        sim.load = Math.max(msg.ohms, 0.1);
+        return;
+    }
+
+    let reply = new Uint8Array(0);
+    if (msg.type == 'send') {
+        if (msg.reportId == REPORT_ID_STATE) {
+            handleCommand(new Uint8Array(msg.data));
+        }
+    }
+    else if (msg.type == 'receive') {
+        reply = getReport(msg.reportId);
+    }
+
+    postMessage({ id: msg.id, data: reply.buffer }, [reply.buffer]);
+}
+
+setInterval(run, TICK_MS);
+
+//------------------------------------------------------------------------------
+// Module static functions
+//------------------------------------------------------------------------------
+
+/**
+ * @brief  Advance the simulation to the current time
+ * @param  None
+ * @return None
+ */
+function run() {
+    const now = performance.now();
+    let samples = Math.floor((now - lastTime) * CONTROL_LOOP_HZ / 1000);
+    if (samples <= 0) {
+        return;
+    }
+    lastTime += samples * 1000 / CONTROL_LOOP_HZ;
+    samples = Math.min(samples, MAX_CHUNK);
+    sim.samples += samples;
+
+    for (let i = 0; i < samples; i++) {
+        sample();
+        control();
+        plant();
+    }
+}
+
+/**
+ * @brief  Sample the output like the ADC, the current is in 1mA counts
+ * @param  None
+ * @return None
+ */
+function sample() {
+    const noise = () => Math.round((Math.random() * 2 - 1) * NOISE_COUNTS);
+    const vRaw = Math.round(sim.vOut * 1000 * ADC_MAX * Rin / (Rt * VDD_MILLIVOLTS)) + noise();
+    sim.vRaw = Math.min(Math.max(vRaw, 0), ADC_MAX - 1);
+    sim.current = Math.max(Math.round(sim.vOut / sim.load * 1000) + noise(), 0);
+}
+
+/**
+ * @brief  Port of BoostControl() with the PID controller
+ * @param  None
+ * @return None
+ */
+function control() {
+    if (!sim.outputEnabled) {
+        sim.duty = 0;
+        return;
+    }
+
+    if (sim.targetVRaw == 0 || sim.targetIRaw == 0) {
+        sim.lastEP = 0;
+        sim.eI = 0;
+        sim.duty = 0;
+        return;
+    }
+
+    // Integer maths as in BoostControllerPID(), s_lastEP is only ever reset
+    const ePv = sim.targetVRaw - sim.vRaw;
+    const ePi = sim.targetIRaw - sim.current;
+    sim.ccMode = (ePv < ePi) ? 0 : 1;
+
+    const eP = Math.min(ePv, ePi);
+    const eD = eP - sim.lastEP;
+    sim.eI = (sim.eI + eP) | 0;
+
+    let duty = (eP >> sim.kpShift) + (eD >> sim.kdShift) + (sim.eI >> sim.kiShift);
+    duty = Math.max(duty, MIN_DUTY);
+    duty = Math.min(duty, MAX_DUTY);
+    sim.duty = duty;
+
+    stepSample();
+}
+
+/**
+ * @brief  Advance the averaged boost model by one control period
+ * @param  None
+ * @return None
+ * @note   The diode stops the inductor current going negative, which is a
+ *         rough stand-in for discontinuous conduction at light load.
+ */
+function plant() {
+    const d = sim.duty / PWM_PERIOD;
+    const dt = 1 / (CONTROL_LOOP_HZ * SUBSTEPS);
+
+    for (let i = 0; i < SUBSTEPS; i++) {
+        const vSwitch = (1 - d) * (sim.vOut + DIODE_DROP);
+        sim.iL += (VIN - sim.iL * DCR - vSwitch) / INDUCTANCE * dt;
+        sim.iL = Math.max(sim.iL, 0);
+        sim.vOut += ((1 - d) * sim.iL - sim.vOut / sim.load) / CAPACITANCE * dt;
+        sim.vOut = Math.max(sim.vOut, 0);
+    }
+}
+
+/**
+ * @brief  Port of StepSample()
+ * @param  None
+ * @return None
+ */
+function stepSample() {
+    const step = sim.step;
+    if (!step.active) {
+        return;
+    }
+
+    const error = sim.vRaw - sim.targetVRaw;
+    step.samples++;
+
+    if (step.settledAt == 0) {
+        const overshoot = step.rising ? error : -error;
+        step.overshoot = Math.max(step.overshoot, overshoot);
+
+        if (error <= STEP_TOLERANCE && error >= -STEP_TOLERANCE) {
+            if (step.inBand == 0) {
+                step.inBand = step.samples;
+            }
+        }
+        else {
+            step.inBand = 0;
+        }
+
+        const settled = step.inBand && (step.samples - step.inBand) >= STEP_HOLD;
+        if (settled || step.samples >= STEP_TIMEOUT) {
+            step.settledAt = settled ? step.inBand : STEP_TIMEOUT;
+            step.rippleStart = step.samples;
+            step.rippleMin = sim.vRaw;
+            step.rippleMax = sim.vRaw;
+        }
+        return;
+    }
+
+    step.rippleMin = Math.min(step.rippleMin, sim.vRaw);
+    step.rippleMax = Math.max(step.rippleMax, sim.vRaw);
+    if (step.samples - step.rippleStart >= STEP_RIPPLE) {
+        step.active = false;
+        step.complete = true;
+    }
+}
+
+/**
+ * @brief  Apply a command from the state report
+ * @param {Uint8Array} data: [cmd, u32 LE]
+ * @return None
+ */
+function handleCommand(data) {
+    const value = data[1] | (data[2] << 8) | (data[3] << 16) | (data[4] << 24);
+
+    switch (data[0]) {
+        case CMD_VOLTAGE:
+            setVoltageTarget(value);
+            break;
+        case CMD_CURRENT:
+            sim.targetIRaw = value;
+            break;
+        case CMD_OUTPUT:
+            if (value && !sim.outputEnabled) {
+                sim.lastEP = 0;
+            }
+            sim.outputEnabled = value != 0;
+            break;
+        case CMD_MODE:
+            sim.mode = value;
+            break;
+        case CMD_PID_GAINS:
+            sim.kpShift = Math.min(data[1], PID_KP_SHIFT_MAX);
+            sim.kdShift = Math.min(data[2], PID_KD_SHIFT_MAX);
+            sim.kiShift = Math.min(Math.max(data[3], PID_KI_SHIFT_MIN), PID_KI_SHIFT_MAX);
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * @brief  Port of BoostPWM_SetVoltageTarget()
+ * @param {number} millivolts: The target voltage in mV
+ * @return None
+ */
+function setVoltageTarget(millivolts) {
+    const target = millivoltsToRaw(millivolts);
+    if (target == sim.targetVRaw) {
+        return;
+    }
+
+    sim.step = {
+        active: true,
+        complete: false,
+        rising: target > sim.targetVRaw,
+        samples: 0,
+        inBand: 0,
+        settledAt: 0,
+        overshoot: 0,
+        rippleStart: 0,
+        rippleMin: 0,
+        rippleMax: 0,
+    };
+    sim.targetVRaw = target;
+}
+
+/**
+ * @brief  Build a feature report in the firmware layout
+ * @param {number} reportId: The report ID
+ * @return {Uint8Array} The report
+ */
+function getReport(reportId) {
+    const view = new DataView(new ArrayBuffer(7));
+
+    switch (reportId) {
+        case REPORT_ID_STATE:
+            view.setUint16(0, rawToMillivolts(sim.vRaw), true);
+            view.setUint16(2, sim.current, true);
+            view.setUint8(4, sim.duty);
+            view.setUint8(5, sim.ccMode);
+            return new Uint8Array(view.buffer.slice(0, 6));
+        case REPORT_ID_HISTORY: {
+            // A block of one sample, the keyframe, per read
+            const history = new DataView(new ArrayBuffer(9 + HISTORY_KEYFRAME_SIZE));
+            sim.sequence = (sim.sequence + 1) & 0xFFFF;
+            history.setUint16(0, sim.sequence, true);
+            history.setUint8(2, 1);
+            history.setUint32(3, Math.floor(sim.samples * 1000 / CONTROL_LOOP_HZ), true);
+            history.setUint8(7, HISTORY_PERIOD_MS);
+            history.setUint8(8, HISTORY_KEYFRAME_SIZE);
+            history.setUint16(9, rawToMillivolts(sim.vRaw), true);
+            history.setUint16(11, sim.current, true);
+            history.setUint8(13, sim.duty);
+            return new Uint8Array(history.buffer);
+        }
+        case REPORT_ID_STEP: {
+            const step = sim.step;
+            const settled = step.settledAt && step.settledAt < STEP_TIMEOUT;
+            view.setUint16(0, settled ? SAMPLES_TO_US(step.settledAt) : STEP_UNSETTLED, true);
+            view.setUint16(2, rawToMillivolts(step.overshoot), true);
+            view.setUint16(4, rawToMillivolts(step.rippleMax - step.rippleMin), true);
+            view.setUint8(6, step.complete ? 1 : 0);
+            return new Uint8Array(view.buffer);
+        }
+        default:
+            return new Uint8Array(view.buffer);
+    }
+}
+
+/**
+ * @brief  Convert millivolts to feedback counts
+ * @param {number} millivolts: The voltage in mV
+ * @return {number} ADC counts
+ */
+function millivoltsToRaw(millivolts) {
+    return Math.floor(millivolts * ADC_MAX * Rin / (Rt * VDD_MILLIVOLTS));
+}
+
+/**
+ * @brief  Convert feedback counts to millivolts
+ * @param {number} raw: ADC counts
+ * @return {number} The voltage in mV
+ */
+function rawToMillivolts(raw) {
+    return Math.floor(raw * Rt * VDD_MILLIVOLTS / (ADC_MAX * Rin));
+}
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------